@@ -111,7 +111,12 @@ typedef struct {
 #define STB_GLOBAL  (1)
 
 #define STT_NOTYPE   (0)
+#define STT_OBJECT   (1)
+#define STT_FUNC     (2)
 #define STT_SECTION  (3)
+#define STT_FILE     (4)
+
+#define SHN_UNDEF    (0)
 
 #define ELF64_ST_BIND(info)          ((info)>> 4)
 #define ELF64_ST_TYPE(info)          ((info) & 0xf)
@@ -129,6 +134,7 @@ typedef struct {
 #define R_X86_64_64     (1)        /* Direct 64 bit  */
 #define R_X86_64_PC32   (2)        /* PC relative 32 bit signed */
 #define R_X86_64_PLT32  (4)        /* 32 bit PLT address */
+#define R_X86_64_32     (10)       /* Direct 32 bit zero extended */
 
 #define ELF64_R_SYM(info)            ((info) >> 32)
 #define ELF64_R_TYPE(info)           ((unsigned char)(info))
@@ -38,6 +38,23 @@ typedef __gnuc_va_list va_list;
     ? (char*)(ap)->reg_save_area + ((ap)->fp_offset += 8) - 8 \
     : __va_arg_mem(ap, sz, align))
 
+// Struct in registers is gathered into `buf`: `sr` is `__builtin_struct_regs(ty)`.
+#define __va_arg_struct(ap, buf, sr, sz, align) ({ \
+  int __n = (sr) & 3, __nf = (((sr) >> 2) & 1) + (((sr) >> 3) & 1); \
+  char *__q; \
+  if (__n > 0 && (ap)->gp_offset + (__n - __nf) * 8 <= 6 * 8 && \
+      (ap)->fp_offset + __nf * 8 <= (6 + 8) * 8) { \
+    for (int __i = 0; __i < __n; ++__i) { \
+      unsigned int *__o = (sr) & (4 << __i) ? &(ap)->fp_offset : &(ap)->gp_offset; \
+      (buf)[__i] = *(long*)((char*)(ap)->reg_save_area + *__o); \
+      *__o += 8; \
+    } \
+    __q = (char*)(buf); \
+  } else { \
+    __q = __va_arg_mem(ap, sz, align); \
+  } \
+  __q; })
+
 #ifndef __NO_FLONUM
 #define __builtin_va_arg_fp_case(ap, ty) \
   case /*flonum*/ 6: \
@@ -48,10 +65,13 @@ typedef __gnuc_va_list va_list;
 
 #define __builtin_va_arg(ap, ty) ({ \
   char *p; \
+  long __buf[2]; \
   switch (__builtin_type_kind(ty)) { \
   __builtin_va_arg_fp_case(ap, ty) \
   case /*fixnum*/ 1: case /*ptr*/ 2: \
     p = __va_arg_gp(ap, sizeof(ty), _Alignof(ty)); break; \
+  case /*struct*/ 5: \
+    p = __va_arg_struct(ap, __buf, __builtin_struct_regs(ty), sizeof(ty), _Alignof(ty)); break; \
   default: \
     p = __va_arg_mem(ap, sizeof(ty), _Alignof(ty)); break; \
   } \
@@ -9,6 +9,7 @@ void *realloc(void* ptr, size_t size);
 void *calloc(size_t size, size_t n);
 
 void exit(int code);
+int atexit(void (*func)(void));
 
 long strtol(const char *p, char **pp, int base);
 unsigned long strtoul(const char *p, char **pp, int base);
@@ -0,0 +1,99 @@
+// Runtime for `-fprofile-generate`: block counters are added into the profile at exit.
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+// Emitted by the compiler for each instrumented function.
+typedef struct ProfileRecord {
+  struct ProfileRecord *next;  // NULL until registered.
+  const char *name;
+  const char *path;
+  long count;
+  long *counters;
+} ProfileRecord;
+
+static ProfileRecord sentinel;
+static ProfileRecord *records;  // Terminated with `sentinel`.
+
+static ProfileRecord *find_record(const char *path, const char *name, size_t len, long count) {
+  for (ProfileRecord *r = records; r != &sentinel; r = r->next) {
+    if (r->count == count && strncmp(r->name, name, len) == 0 && r->name[len] == '\0' &&
+        strcmp(r->path, path) == 0)
+      return r;
+  }
+  return NULL;
+}
+
+static long read_number(char **pp) {
+  char *p = *pp;
+  while (*p == ' ')
+    ++p;
+  return strtol(p, pp, 10);
+}
+
+// Accumulate the counts of previous runs.
+static void merge_profile(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+    return;
+  char *line = NULL;
+  size_t capa = 0;
+  while (getline(&line, &capa, fp) > 0) {
+    char *p = strchr(line, ' ');
+    if (p == NULL)
+      continue;
+    size_t len = p - line;
+    long count = read_number(&p);
+    ProfileRecord *r = find_record(path, line, len, count);
+    if (r == NULL)
+      continue;
+    for (long i = 0; i < count; ++i)
+      r->counters[i] += read_number(&p);
+  }
+  free(line);
+  fclose(fp);
+}
+
+static void write_profile(const char *path) {
+  merge_profile(path);
+
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot write profile: %s\n", path);
+    return;
+  }
+  for (ProfileRecord *r = records; r != &sentinel; r = r->next) {
+    if (strcmp(r->path, path) != 0)
+      continue;
+    fprintf(fp, "%s %ld", r->name, r->count);
+    for (long i = 0; i < r->count; ++i)
+      fprintf(fp, " %ld", r->counters[i]);
+    fputc('\n', fp);
+  }
+  fclose(fp);
+}
+
+static void dump_profile(void) {
+  for (ProfileRecord *r = records; r != &sentinel; r = r->next) {
+    // Each file is written once, with its first record.
+    ProfileRecord *p;
+    for (p = records; p != r; p = p->next) {
+      if (strcmp(p->path, r->path) == 0)
+        break;
+    }
+    if (p == r)
+      write_profile(r->path);
+  }
+}
+
+void __xcc_profile_register(ProfileRecord *record) {
+  if (record->next != NULL)
+    return;
+  if (records == NULL) {
+    records = &sentinel;
+    atexit(dump_profile);
+  }
+  record->next = records;
+  records = record;
+}
@@ -1,20 +1,51 @@
 #include "stdlib.h"
 
+#if !defined(__APPLE__)
+
+#define ATEXIT_MAX  (32)
+
+static void (*atexit_funcs[ATEXIT_MAX])(void);
+static int atexit_count;
+
+int atexit(void (*func)(void)) {
+  if (atexit_count >= ATEXIT_MAX)
+    return 1;
+  atexit_funcs[atexit_count++] = func;
+  return 0;
+}
+
+static void call_atexit_funcs(void) {
+  // Called in the reverse order of their registration.
+  while (atexit_count > 0)
+    (*atexit_funcs[--atexit_count])();
+}
+#endif
+
 #if defined(__XV6)
-void exit(int code) {
+static void exit_process(int code) {
   __asm("mov $2, %eax\n"  // SYS_exit
         "int $64");
 }
 
+void exit(int code) {
+  call_atexit_funcs();
+  exit_process(code);
+}
+
 #elif defined(__WASM)
 
 #elif defined(__linux__)
 
-void exit(int code) {
+static void exit_process(int code) {
   __asm("mov $60, %eax\n"  // __NR_exit
         "syscall");
 }
 
+void exit(int code) {
+  call_atexit_funcs();
+  exit_process(code);
+}
+
 #elif defined(__APPLE__)
 
 // Use libc.
@@ -32,6 +32,22 @@ static void dump_vreg(FILE *fp, VReg *vreg, int size) {
   }
 }
 
+static void dump_mem(FILE *fp, IR *ir, VReg *base, VReg *index) {
+  if (ir->mem.label != NULL)
+    fprintf(fp, "%.*s", ir->mem.label->bytes, ir->mem.label->chars);
+  else if (ir->mem.frame != NULL)
+    fprintf(fp, "rbp%+d", ir->mem.frame->offset);
+  else
+    dump_vreg(fp, base, WORD_SIZE);
+  if (index != NULL) {
+    fprintf(fp, " + ");
+    dump_vreg(fp, index, WORD_SIZE);
+    fprintf(fp, " * %d", ir->mem.scale);
+  }
+  if (ir->value != 0)
+    fprintf(fp, " %c %" PRIdPTR, ir->value > 0 ? '+' : '-', ir->value > 0 ? ir->value : -ir->value);
+}
+
 static void dump_ir(FILE *fp, IR *ir) {
   static char *kCond[] = {"__", "MP", "EQ", "NE", "LT", "LE", "GE", "GT", "ULT", "ULE", "UGE", "UGT"};
 
@@ -39,8 +55,9 @@ static void dump_ir(FILE *fp, IR *ir) {
   case IR_BOFS:   fprintf(fp, "\tBOFS\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = &[rbp %c %d]\n", ir->opr1->offset >= 0 ? '+' : '-', ir->opr1->offset > 0 ? ir->opr1->offset : -ir->opr1->offset); break;
   case IR_IOFS:   fprintf(fp, "\tIOFS\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = &%.*s\n", ir->iofs.label->bytes, ir->iofs.label->chars); break;
   case IR_SOFS:   fprintf(fp, "\tSOFS\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = &[rsp %c %ld]\n", ir->opr1->fixnum >= 0 ? '+' : '-', ir->opr1->fixnum > 0 ? ir->opr1->fixnum : -ir->opr1->fixnum); break;
-  case IR_LOAD:   fprintf(fp, "\tLOAD\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = ["); dump_vreg(fp, ir->opr1, WORD_SIZE); fprintf(fp, "]\n"); break;
-  case IR_STORE:  fprintf(fp, "\tSTORE\t["); dump_vreg(fp, ir->opr2, WORD_SIZE); fprintf(fp, "] = "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
+  case IR_LOAD:   fprintf(fp, "\tLOAD\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = ["); dump_mem(fp, ir, ir->opr1, ir->opr2); fprintf(fp, "]\n"); break;
+  case IR_STORE:  fprintf(fp, "\tSTORE\t["); dump_mem(fp, ir, ir->opr2, NULL); fprintf(fp, "] = "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
+  case IR_LEA:    fprintf(fp, "\tLEA\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = &["); dump_mem(fp, ir, ir->opr1, ir->opr2); fprintf(fp, "]\n"); break;
   case IR_ADD:    fprintf(fp, "\tADD\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, " + "); dump_vreg(fp, ir->opr2, ir->size); fprintf(fp, "\n"); break;
   case IR_SUB:    fprintf(fp, "\tSUB\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, " - "); dump_vreg(fp, ir->opr2, ir->size); fprintf(fp, "\n"); break;
   case IR_MUL:    fprintf(fp, "\tMUL\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, " * "); dump_vreg(fp, ir->opr2, ir->size); fprintf(fp, "\n"); break;
@@ -55,6 +72,7 @@ static void dump_ir(FILE *fp, IR *ir) {
   case IR_NEG:    fprintf(fp, "\tNEG\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = -"); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
   case IR_BITNOT: fprintf(fp, "\tBITNOT\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = ~"); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
   case IR_COND:   fprintf(fp, "\tCOND\t"); dump_vreg(fp, ir->dst, 4); fprintf(fp, " = %s\n", kCond[ir->cond.kind]); break;
+  case IR_CMOV:   fprintf(fp, "\tCMOV\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = %s ? ", kCond[ir->cond.kind]); dump_vreg(fp, ir->opr2, ir->size); fprintf(fp, " : "); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
   case IR_JMP:    fprintf(fp, "\tJ%s\t%.*s\n", kCond[ir->jmp.cond], ir->jmp.bb->label->bytes, ir->jmp.bb->label->chars); break;
   case IR_TJMP:
     fprintf(fp, "\tTJMP\t");
@@ -63,9 +81,17 @@ static void dump_ir(FILE *fp, IR *ir) {
     fprintf(fp, "]\n");
     break;
   case IR_PRECALL: fprintf(fp, "\tPRECALL\n"); break;
-  case IR_PUSHARG: fprintf(fp, "\tPUSHARG\t"); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
+  case IR_PUSHARG: fprintf(fp, "\tPUSHARG\t#%d, ", ir->pusharg.index); dump_vreg(fp, ir->opr1, ir->size); fprintf(fp, "\n"); break;
   case IR_CALL:
-    if (ir->call.label != NULL) {
+    if (ir->call.tail) {
+      fprintf(fp, "\tTAILCALL\t");
+      if (ir->call.label != NULL) {
+        fprintf(fp, "%.*s", ir->call.label->bytes, ir->call.label->chars);
+      } else {
+        fprintf(fp, "*"); dump_vreg(fp, ir->opr1, WORD_SIZE);
+      }
+      fprintf(fp, "(args=#%d)\n", ir->call.reg_arg_count);
+    } else if (ir->call.label != NULL) {
       fprintf(fp, "\tCALL\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = call %.*s(args=#%d)\n", ir->call.label->bytes, ir->call.label->chars, ir->call.reg_arg_count);
     } else {
       fprintf(fp, "\tCALL\t"); dump_vreg(fp, ir->dst, ir->size); fprintf(fp, " = *"); dump_vreg(fp, ir->opr1, WORD_SIZE); fprintf(fp, "(args=#%d)\n", ir->call.reg_arg_count);
@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include "asm_x86.h"
+#include "dwarf.h"
 #include "elfutil.h"
 #include "gen_section.h"
 #include "ir_asm.h"
@@ -39,19 +40,65 @@
 #define LOAD_ADDRESS    START_ADDRESS
 #define DATA_ALIGN      (0x1000)
 
-static void parse_file(FILE *fp, const char *filename, Vector **section_irs, Table *label_table) {
+// Input is read in large blocks, and lines are parsed in place.
+// Blocks are never freed, because labels refer to the names in them.
+
+#define INPUT_BLOCK_SIZE  (256 * 1024)
+
+typedef struct {
+  int fd;
+  char *buf;
+  size_t pos, size;
+  bool eof;
+} LineReader;
+
+static char *read_line(LineReader *reader) {
+  for (;;) {
+    char *start = reader->buf + reader->pos;
+    size_t left = reader->size - reader->pos;
+    char *nl = memchr(start, '\n', left);
+    if (nl != NULL) {
+      *nl = '\0';
+      reader->pos = nl + 1 - reader->buf;
+      return start;
+    }
+    if (reader->eof) {
+      if (left == 0)
+        return NULL;
+      start[left] = '\0';  // Last line without newline: space is reserved.
+      reader->pos = reader->size;
+      return start;
+    }
+
+    // Move the incomplete line to the top of a new block.
+    size_t capa = INPUT_BLOCK_SIZE;
+    while (capa < left * 2 + 1)
+      capa *= 2;
+    char *buf = malloc(capa);
+    memcpy(buf, start, left);
+    ssize_t n = read(reader->fd, buf + left, capa - left - 1);
+    if (n <= 0) {
+      reader->eof = true;
+      n = 0;
+    }
+    reader->buf = buf;
+    reader->pos = 0;
+    reader->size = left + n;
+  }
+}
+
+static void parse_file(FILE *fp, const char *filename, Vector *section_irs, Table *label_table) {
+  LineReader reader = {.fd = fileno(fp), .buf = NULL, .pos = 0, .size = 0, .eof = false};
   ParseInfo info;
   info.filename = filename;
   info.lineno = 1;
   for (;; ++info.lineno) {
-    char *rawline = NULL;
-    size_t capa = 0;
-    ssize_t len = getline_chomp(&rawline, &capa, fp);
-    if (len == -1)
+    char *rawline = read_line(&reader);
+    if (rawline == NULL)
       break;
     info.rawline = rawline;
 
-    Vector *irs = section_irs[current_section];
+    Vector *irs = section_irs->data[current_section];
     Line *line = parse_line(&info);
     if (line == NULL)
       continue;
@@ -101,14 +148,31 @@ static void putnum(FILE *fp, unsigned long num, int bytes) {
   }
 }
 
-static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
-  size_t codesz, rodatasz, datasz, bsssz;
-  get_section_size(SEC_CODE, &codesz, NULL);
-  get_section_size(SEC_RODATA, &rodatasz, NULL);
-  get_section_size(SEC_DATA, &datasz, NULL);
-  get_section_size(SEC_BSS, &bsssz, NULL);
+// Section header layout: sections, relocations for them, debug sections (with their
+// relocations), and tables.
+static int output_obj(const char *ofn, Table *label_table, Vector *unresolved,
+                      DebugSection *debug_sections) {
+  int nsec = section_count();
+
+  // Relocations for each section.
+  int *rela_counts = calloc(nsec, sizeof(*rela_counts));
+  for (int i = 0; i < unresolved->len; ++i) {
+    UnresolvedInfo *u = unresolved->data[i];
+    assert(u->src_section >= 0 && u->src_section < nsec);
+    ++rela_counts[u->src_section];
+  }
+  int rela_shnum = 0;
+  for (int i = 0; i < nsec; ++i) {
+    if (rela_counts[i] > 0)
+      ++rela_shnum;
+  }
+  const int debug_shndx_start = 1 + nsec + rela_shnum;
 
   // Construct symtab and strtab.
+  int debug_shnum = 0;
+  int debug_shndxs[DEBUG_SECTION_COUNT];  // Section index.
+  int debug_symbols[DEBUG_SECTION_COUNT];  // Symbol index for the section.
+  int local_symbol_count = 0;
   Symtab symtab;
   symtab_init(&symtab);
   {
@@ -116,23 +180,43 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
     Elf64_Sym *sym;
     sym = symtab_add(&symtab, alloc_name("", NULL, false));
     sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
-    // SECTION
-    for (int i = 0; i < 4; ++i) {
+    // SECTION: symbol index is section number + 1.
+    for (int i = 0; i < nsec; ++i) {
       sym = symtab_add(&symtab, alloc_name("", NULL, false));
       sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
       sym->st_shndx = i + 1;  // Section index.
     }
+    if (debug_sections != NULL) {
+      int shndx = debug_shndx_start;
+      for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+        debug_shndxs[i] = shndx;
+        shndx += debug_sections[i].relas->len > 0 ? 2 : 1;
+        sym = symtab_add(&symtab, alloc_name("", NULL, false));
+        sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        sym->st_shndx = debug_shndxs[i];
+        debug_symbols[i] = sym - symtab.buf;
+      }
+      debug_shnum = shndx - debug_shndx_start;
+    }
 
-    // Label symbols
-    const Name *name;
-    LabelInfo *info;
-    for (int it = 0; (it = table_iterate(label_table, it, &name, (void**)&info)) != -1; ) {
-      if (!(info->flag & LF_GLOBAL) || !(info->flag & LF_DEFINED))
-        continue;
-      sym = symtab_add(&symtab, name);
-      sym->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
-      sym->st_value = info->address - section_start_addresses[info->section];
-      sym->st_shndx = info->section + 1;  // Symbol index for Local section.
+    // Label symbols: local ones first, `.L' labels are not output.
+    for (int global = 0; global < 2; ++global) {
+      const Name *name;
+      LabelInfo *info;
+      for (int it = 0; (it = table_iterate(label_table, it, &name, (void**)&info)) != -1; ) {
+        if (!(info->flag & LF_DEFINED) || (info->flag & LF_GLOBAL ? 1 : 0) != global)
+          continue;
+        if (!global && name->bytes >= 2 && strncmp(name->chars, ".L", 2) == 0)
+          continue;
+        int type = info->flag & LF_FUNC ? STT_FUNC : info->flag & LF_OBJECT ? STT_OBJECT : STT_NOTYPE;
+        sym = symtab_add(&symtab, name);
+        sym->st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+        sym->st_value = info->address - get_section(info->section)->start_address;
+        sym->st_size = calc_label_size(label_table, info);
+        sym->st_shndx = info->section + 1;  // Symbol index for Local section.
+      }
+      if (!global)
+        local_symbol_count = symtab.count;
     }
   }
 
@@ -151,47 +235,32 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
 
   uintptr_t entry = 0;
   int phnum = 0;
-  int shnum = 11;
+  int shnum = debug_shndx_start + debug_shnum + 3;
+  int strtab_index = debug_shndx_start + debug_shnum, symtab_index = strtab_index + 1;
   out_elf_header(ofp, entry, phnum, shnum);
 
   uintptr_t addr = sizeof(Elf64_Ehdr);
-  uintptr_t code_ofs = addr;
-  output_section(ofp, SEC_CODE);
-  uintptr_t rodata_ofs = addr += codesz;
-  if (rodatasz > 0) {
-    rodata_ofs = ALIGN(rodata_ofs, 0x10);
-    put_padding(ofp, rodata_ofs);
-    output_section(ofp, SEC_RODATA);
-    addr = rodata_ofs + rodatasz;
-  }
-  uintptr_t data_ofs = addr;
-  if (datasz > 0) {
-    data_ofs = ALIGN(data_ofs, 0x10);
-    put_padding(ofp, data_ofs);
-    output_section(ofp, SEC_DATA);
-    addr = data_ofs + datasz;
-  }
-  uintptr_t bss_ofs = addr;
-  if (bsssz > 0) {
-    bss_ofs = ALIGN(bss_ofs, 0x10);
-    put_padding(ofp, bss_ofs);
-    addr = bss_ofs;
-  }
-
-  int rela_counts[SECTION_COUNT];
-  memset(rela_counts, 0x00, sizeof(rela_counts));
-  for (int i = 0; i < unresolved->len; ++i) {
-    UnresolvedInfo *u = unresolved->data[i];
-    assert(u->src_section >= 0 && u->src_section < SECTION_COUNT);
-    ++rela_counts[u->src_section];
+  uintptr_t *section_ofss = malloc(sizeof(*section_ofss) * nsec);
+  for (int i = 0; i < nsec; ++i) {
+    Section *section = get_section(i);
+    size_t size;
+    get_section_size(i, &size, NULL);
+    if (size > 0)
+      addr = ALIGN(addr, MAX(section->align, 0x10));
+    section_ofss[i] = addr;
+    if (section->type != SHT_NOBITS && size > 0) {
+      put_padding(ofp, addr);
+      output_section(ofp, i);
+      addr += size;
+    }
   }
 
-  Elf64_Rela *rela_bufs[SECTION_COUNT];
-  for (int i = 0; i < SECTION_COUNT; ++i) {
+  Elf64_Rela **rela_bufs = malloc(sizeof(*rela_bufs) * nsec);
+  for (int i = 0; i < nsec; ++i) {
     int count = rela_counts[i];
     rela_bufs[i] = count <= 0 ? NULL : calloc(count, sizeof(*rela_bufs[0]));
   }
-  memset(rela_counts, 0x00, sizeof(rela_counts));  // Reset count.
+  memset(rela_counts, 0x00, sizeof(*rela_counts) * nsec);  // Reset count.
 
   for (int i = 0; i < unresolved->len; ++i) {
     UnresolvedInfo *u = unresolved->data[i];
@@ -213,9 +282,9 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
       {
         LabelInfo *label = table_get(label_table, u->label);
         assert(label != NULL);
-        int rodata_index = label->section + 1;  // Symtab index for .rodata section = section number + 1
+        int section_index = label->section + 1;  // Symtab index for the section = section number + 1
         rela->r_offset = u->offset;
-        rela->r_info = ELF64_R_INFO(rodata_index, R_X86_64_PC32);
+        rela->r_info = ELF64_R_INFO(section_index, R_X86_64_PC32);
         rela->r_addend = u->add;
       }
       break;
@@ -233,7 +302,7 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
         } else {
           rela->r_offset = u->offset;
           rela->r_info = ELF64_R_INFO(label->section + 1, R_X86_64_64);
-          rela->r_addend = u->add + (label->address - section_start_addresses[label->section]);
+          rela->r_addend = u->add + (label->address - get_section(label->section)->start_address);
         }
       }
       break;
@@ -241,17 +310,46 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
     }
   }
 
-  uintptr_t rela_ofss[SECTION_COUNT];
-  for (int i = 0; i < SEC_BSS; ++i) {
+  uintptr_t *rela_ofss = malloc(sizeof(*rela_ofss) * nsec);
+  for (int i = 0; i < nsec; ++i) {
+    if (rela_counts[i] <= 0)
+      continue;
     rela_ofss[i] = addr = ALIGN(addr, 0x10);
     put_padding(ofp, addr);
-    if (rela_counts[i] > 0) {
-      fwrite(rela_bufs[i], sizeof(*rela_bufs[i]), rela_counts[i], ofp);
-      addr += sizeof(*rela_bufs[i]) * rela_counts[i];
+    fwrite(rela_bufs[i], sizeof(*rela_bufs[i]), rela_counts[i], ofp);
+    addr += sizeof(*rela_bufs[i]) * rela_counts[i];
+  }
+
+  uintptr_t debug_ofss[DEBUG_SECTION_COUNT], debug_rela_ofss[DEBUG_SECTION_COUNT];
+  if (debug_sections != NULL) {
+    const int kTargetSymbols[] = {
+      [DR_ABBREV] = debug_symbols[DS_ABBREV],
+      [DR_LINE] = debug_symbols[DS_LINE],
+    };
+    for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+      DebugSection *section = &debug_sections[i];
+      put_padding(ofp, addr);
+      debug_ofss[i] = addr;
+      fwrite(section->buf.data, section->buf.size, 1, ofp);
+      addr += section->buf.size;
+
+      debug_rela_ofss[i] = addr = ALIGN(addr, 8);
+      put_padding(ofp, addr);
+      for (int j = 0; j < section->relas->len; ++j) {
+        const DebugRela *r = section->relas->data[j];
+        int symbol = r->target == DR_SECTION ? r->section + 1 : kTargetSymbols[r->target];
+        Elf64_Rela rela = {
+          .r_offset = r->offset,
+          .r_info = ELF64_R_INFO(symbol, r->size == 8 ? R_X86_64_64 : R_X86_64_32),
+          .r_addend = r->addend,
+        };
+        fwrite(&rela, sizeof(rela), 1, ofp);
+      }
+      addr += sizeof(Elf64_Rela) * section->relas->len;
     }
   }
 
-  uintptr_t symtab_ofs = addr + unresolved->len * sizeof(Elf64_Rela);
+  uintptr_t symtab_ofs = addr;
   put_padding(ofp, symtab_ofs);
   fwrite(symtab.buf, sizeof(*symtab.buf), symtab.count, ofp);
 
@@ -264,130 +362,96 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
 
   // Output section headers.
   {
-    Elf64_Shdr nulsec = {
+    Elf64_Shdr *shdrs = calloc(shnum, sizeof(*shdrs));
+    shdrs[0] = (Elf64_Shdr){
       .sh_name = strtab_add(&shstrtab, alloc_name("", NULL, false)),
       .sh_type = SHT_NULL,
       .sh_addralign = 1,
     };
-    Elf64_Shdr textsec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".text", NULL, false)),
-      .sh_type = SHT_PROGBITS,
-      .sh_flags = SHF_EXECINSTR | SHF_ALLOC,
-      .sh_addr = 0,
-      .sh_offset = code_ofs,
-      .sh_size = codesz,
-      .sh_link = 0,
-      .sh_info = 0,
-      .sh_addralign = MAX(section_aligns[SEC_CODE], 1),
-      .sh_entsize = 0,
-    };
-    Elf64_Shdr rodatasec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".rodata", NULL, false)),
-      .sh_type = SHT_PROGBITS,
-      .sh_flags = SHF_ALLOC,
-      .sh_addr = 0,
-      .sh_offset = rodata_ofs,
-      .sh_size = rodatasz,
-      .sh_link = 0,
-      .sh_info = 0,
-      .sh_addralign = MAX(section_aligns[SEC_RODATA], 1),
-      .sh_entsize = 0,
-    };
-    Elf64_Shdr datasec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".data", NULL, false)),
-      .sh_type = SHT_PROGBITS,
-      .sh_flags = SHF_WRITE | SHF_ALLOC,
-      .sh_addr = 0,
-      .sh_offset = data_ofs,
-      .sh_size = datasz,
-      .sh_link = 0,
-      .sh_info = 0,
-      .sh_addralign = MAX(section_aligns[SEC_DATA], 1),
-      .sh_entsize = 0,
-    };
-    Elf64_Shdr bsssec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".bss", NULL, false)),
-      .sh_type = SHT_NOBITS,
-      .sh_flags = SHF_WRITE | SHF_ALLOC,
-      .sh_addr = 0,
-      .sh_offset = bss_ofs,
-      .sh_size = bsssz,
-      .sh_link = 0,
-      .sh_info = 0,
-      .sh_addralign = MAX(section_aligns[SEC_BSS], 1),
-      .sh_entsize = 0,
-    };
-    Elf64_Shdr relatextsec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".rela.text", NULL, false)),
-      .sh_type = SHT_RELA,
-      .sh_flags = SHF_INFO_LINK,
-      .sh_addr = 0,
-      .sh_offset = rela_ofss[SEC_CODE],
-      .sh_size = sizeof(Elf64_Rela) * rela_counts[SEC_CODE],
-      .sh_link = 9,  // Index of symtab
-      .sh_info = 1,  // Index of text
-      .sh_addralign = 8,
-      .sh_entsize = sizeof(Elf64_Rela),
-    };
-    Elf64_Shdr relarodatasec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".rela.rodata", NULL, false)),
-      .sh_type = SHT_RELA,
-      .sh_flags = SHF_INFO_LINK,
-      .sh_addr = 0,
-      .sh_offset = rela_ofss[SEC_RODATA],
-      .sh_size = sizeof(Elf64_Rela) * rela_counts[SEC_RODATA],
-      .sh_link = 9,  // Index of symtab
-      .sh_info = 2,  // Index of rodata
-      .sh_addralign = 8,
-      .sh_entsize = sizeof(Elf64_Rela),
-    };
-    Elf64_Shdr reladatasec = {
-      .sh_name = strtab_add(&shstrtab, alloc_name(".rela.data", NULL, false)),
-      .sh_type = SHT_RELA,
-      .sh_flags = SHF_INFO_LINK,
-      .sh_addr = 0,
-      .sh_offset = rela_ofss[SEC_DATA],
-      .sh_size = sizeof(Elf64_Rela) * rela_counts[SEC_DATA],
-      .sh_link = 9,  // Index of symtab
-      .sh_info = 3,  // Index of data
-      .sh_addralign = 8,
-      .sh_entsize = sizeof(Elf64_Rela),
-    };
-    Elf64_Shdr strtabsec = {
+    for (int i = 0; i < nsec; ++i) {
+      Section *section = get_section(i);
+      size_t size;
+      get_section_size(i, &size, NULL);
+      shdrs[i + 1] = (Elf64_Shdr){
+        .sh_name = strtab_add(&shstrtab, section->name),
+        .sh_type = section->type,
+        .sh_flags = section->flag,
+        .sh_offset = section_ofss[i],
+        .sh_size = size,
+        .sh_addralign = MAX(section->align, 1),
+      };
+    }
+    int n = 1 + nsec;
+    for (int i = 0; i < nsec; ++i) {
+      if (rela_counts[i] <= 0)
+        continue;
+      const Name *name = get_section(i)->name;
+      char *rela_name = malloc(5 + name->bytes + 1);
+      snprintf(rela_name, 5 + name->bytes + 1, ".rela%.*s", name->bytes, name->chars);
+      shdrs[n++] = (Elf64_Shdr){
+        .sh_name = strtab_add(&shstrtab, alloc_name(rela_name, NULL, false)),
+        .sh_type = SHT_RELA,
+        .sh_flags = SHF_INFO_LINK,
+        .sh_offset = rela_ofss[i],
+        .sh_size = sizeof(Elf64_Rela) * rela_counts[i],
+        .sh_link = symtab_index,
+        .sh_info = i + 1,  // Index of the section
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Rela),
+      };
+    }
+    assert(n == debug_shndx_start);
+    if (debug_sections != NULL) {
+      for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+        DebugSection *section = &debug_sections[i];
+        const char *name = kDebugSectionNames[i];
+        shdrs[n++] = (Elf64_Shdr){
+          .sh_name = strtab_add(&shstrtab, alloc_name(name, NULL, false)),
+          .sh_type = SHT_PROGBITS,
+          .sh_offset = debug_ofss[i],
+          .sh_size = section->buf.size,
+          .sh_addralign = 1,
+        };
+        if (section->relas->len > 0) {
+          char rela_name[32];
+          snprintf(rela_name, sizeof(rela_name), ".rela%s", name);
+          shdrs[n++] = (Elf64_Shdr){
+            .sh_name = strtab_add(&shstrtab, alloc_name(rela_name, NULL, true)),
+            .sh_type = SHT_RELA,
+            .sh_flags = SHF_INFO_LINK,
+            .sh_offset = debug_rela_ofss[i],
+            .sh_size = sizeof(Elf64_Rela) * section->relas->len,
+            .sh_link = symtab_index,
+            .sh_info = debug_shndxs[i],
+            .sh_addralign = 8,
+            .sh_entsize = sizeof(Elf64_Rela),
+          };
+        }
+      }
+    }
+    assert(n == strtab_index);
+    shdrs[strtab_index] = (Elf64_Shdr){
       .sh_name = strtab_add(&shstrtab, alloc_name(".strtab", NULL, false)),
       .sh_type = SHT_STRTAB,
-      .sh_flags = 0,
-      .sh_addr = 0,
       .sh_offset = strtab_ofs,
       .sh_size = symtab.strtab.size,
-      .sh_link = 0,
-      .sh_info = 0,
       .sh_addralign = 1,
-      .sh_entsize = 0,
     };
-    Elf64_Shdr symtabsec = {
+    shdrs[symtab_index] = (Elf64_Shdr){
       .sh_name = strtab_add(&shstrtab, alloc_name(".symtab", NULL, false)),
       .sh_type = SHT_SYMTAB,
-      .sh_flags = 0,
-      .sh_addr = 0,
       .sh_offset = symtab_ofs,
       .sh_size = sizeof(*symtab.buf) * symtab.count,
-      .sh_link = 8,  // Index of strtab
-      .sh_info = 5,  // Number of local symbols
+      .sh_link = strtab_index,
+      .sh_info = local_symbol_count,  // Number of local symbols
       .sh_addralign = 8,
       .sh_entsize = sizeof(Elf64_Sym),
     };
-    Elf64_Shdr shstrtabsec = {
+    Elf64_Shdr *shstrtabsec = &shdrs[symtab_index + 1];
+    *shstrtabsec = (Elf64_Shdr){
       .sh_name = strtab_add(&shstrtab, alloc_name(".shstrtab", NULL, false)),
       .sh_type = SHT_STRTAB,
-      .sh_flags = 0,
-      .sh_addr = 0,
-      .sh_offset = 0,  // Dummy
-      .sh_size = 0,    // Dummy
-      .sh_link = 0,
-      .sh_info = 0,
       .sh_addralign = 1,
-      .sh_entsize = 0,
     };
 
     long shstrtab_ofs;
@@ -399,24 +463,13 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
       put_padding(ofp, shstrtab_ofs);
       fwrite(buf, shstrtab.size, 1, ofp);
     }
-    shstrtabsec.sh_offset = shstrtab_ofs;
-    shstrtabsec.sh_size = shstrtab.size;
+    shstrtabsec->sh_offset = shstrtab_ofs;
+    shstrtabsec->sh_size = shstrtab.size;
 
     long cur = ftell(ofp);
     long sh_ofs = ALIGN(cur, 0x10);
     put_padding(ofp, sh_ofs);
-
-    fwrite(&nulsec, sizeof(nulsec), 1, ofp);
-    fwrite(&textsec, sizeof(textsec), 1, ofp);
-    fwrite(&rodatasec, sizeof(rodatasec), 1, ofp);
-    fwrite(&datasec, sizeof(datasec), 1, ofp);
-    fwrite(&bsssec, sizeof(bsssec), 1, ofp);
-    fwrite(&relatextsec, sizeof(relatextsec), 1, ofp);
-    fwrite(&relarodatasec, sizeof(relarodatasec), 1, ofp);
-    fwrite(&reladatasec, sizeof(reladatasec), 1, ofp);
-    fwrite(&strtabsec, sizeof(strtabsec), 1, ofp);
-    fwrite(&symtabsec, sizeof(symtabsec), 1, ofp);
-    fwrite(&shstrtabsec, sizeof(shstrtabsec), 1, ofp);
+    fwrite(shdrs, sizeof(*shdrs), shnum, ofp);
 
     // Write section table offset.
     fseek(ofp, 0x28, SEEK_SET);
@@ -430,11 +483,14 @@ static int output_obj(const char *ofn, Table *label_table, Vector *unresolved) {
 
 int main(int argc, char *argv[]) {
   const char *ofn = NULL;
+  bool show_stats = false;
   enum LongOpt {
     OPT_LOCAL_LABEL_PREFIX = 256,
+    OPT_STATS,
   };
   struct option longopts[] = {
     {"version", no_argument, NULL, 'V'},
+    {"stats", no_argument, NULL, OPT_STATS},
     {0},
   };
   const char shortopts[] = "Vo:";
@@ -448,6 +504,9 @@ int main(int argc, char *argv[]) {
     case 'o':
       ofn = optarg;
       break;
+    case OPT_STATS:
+      show_stats = true;
+      break;
     }
   }
   int iarg = optind;
@@ -455,11 +514,12 @@ int main(int argc, char *argv[]) {
   // ================================================
   // Run own assembler
 
-  Vector *section_irs[SECTION_COUNT];
+  init_sections();
+  Vector *section_irs = new_vector();  // Grows when a section is added.
   Table label_table;
   table_init(&label_table);
-  for (int i = 0; i < SECTION_COUNT; ++i)
-    section_irs[i] = new_vector();
+  for (int i = 0; i < section_count(); ++i)
+    vec_push(section_irs, new_vector());
 
   if (iarg < argc) {
     for (int i = iarg; i < argc; ++i) {
@@ -479,15 +539,24 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  int grown = relax_branches(LOAD_ADDRESS, section_irs, &label_table);
+
+  // Alignments might still move labels after the relaxation, so iterate until settled.
   Vector *unresolved = new_vector();
   bool settle1, settle2;
+  int pass = 0;
   do {
+    ++pass;
     settle1 = calc_label_address(LOAD_ADDRESS, section_irs, &label_table);
     settle2 = resolve_relative_address(section_irs, &label_table, unresolved);
   } while (!(settle1 && settle2));
   emit_irs(section_irs);
 
-  fix_section_size(LOAD_ADDRESS);
+  if (show_stats)
+    fprintf(stderr, "long jumps: %d, address passes: %d\n", grown, pass);
+
+  DebugSection debug_sections[DEBUG_SECTION_COUNT];
+  bool debug = gen_debug_sections(section_irs, debug_sections);
 
-  return output_obj(ofn, &label_table, unresolved);
+  return output_obj(ofn, &label_table, unresolved, debug ? debug_sections : NULL);
 }
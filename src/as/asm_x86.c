@@ -17,15 +17,6 @@
 
 static const int kPow2Table[] = {-1, 0, 1, -1, 2, -1, -1, -1, 3};
 
-static unsigned char *put_code_filtered(unsigned char *p, const short *buf, size_t count) {
-  for (size_t i = 0; i < count; ++i) {
-    short c = *buf++;
-    if (c >= 0)
-      *p++ = c;
-  }
-  return p;
-}
-
 void make_code(Inst *inst, Code *code, unsigned char *buf, int len) {
   assert(len <= (int)sizeof(code->buf));
   code->inst = inst;
@@ -37,393 +28,272 @@ static char opr_regno(const Reg *reg) {
   return reg->no | (reg->x << 3);
 }
 
-static bool opr_reg8(const Reg *reg) {
-  assert(reg->size == REG8);
-  return opr_regno(reg) < 4;
-}
-
 static bool assemble_error(const ParseInfo *info, const char *message) {
   parse_error(info, message);
   return false;
 }
 
-static unsigned char *put_rex0(unsigned char *p, enum RegSize size, int sno, int dno,
-                               unsigned char opcode) {
-  if (size == REG16)
-    *p++ = 0x66;
-  if (sno >= 8 || dno >= 8 ||
-      (size == REG8 && (sno >= 4 || dno >= 4)) ||
-      size == REG64)
-    *p++ = 0x40 | ((dno & 8) >> 3) | ((sno & 8) >> 1) | (size != REG64 ? 0 : 8);
-  *p++ = opcode;
-  return p;
-}
-
-static unsigned char *put_rex1(unsigned char *p, enum RegSize size, int rex_prefix, int dno,
-                               unsigned char opcode) {
-  p = put_rex0(p, size, 0, dno, opcode);
-  *p++ = rex_prefix | (dno & 7);
-  return p;
-}
-
-static unsigned char *put_rex2(unsigned char *p, enum RegSize size, int sno, int dno,
-                               unsigned char opcode) {
-  p = put_rex0(p, size, sno, dno, opcode);
-  *p++ = 0xc0 | ((sno & 7) << 3) | (dno & 7);
-  return p;
-}
-
-static unsigned char *put_rex_indirect(
-    unsigned char *p, enum RegSize size, int reg, int indirect_reg,
-    unsigned char opcode, unsigned char op2, long offset)
-{
-  p = put_rex0(p, size, reg, indirect_reg,
-               size == REG8 ? opcode : (unsigned char)(opcode + 1));
-  int d = reg & 7;
-  int s = indirect_reg & 7;
-  unsigned char code = (offset == 0 && s != RBP - RAX) ? op2 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-  *p++ = code | s | (d << 3);
-  if (s == RSP - RAX)
-    *p++ = 0x24;
-
-  if (offset == 0 && s != RBP - RAX) {
-    ;
-  } else if (is_im8(offset)) {
-    *p++ = IM8(offset);
-  } else if (is_im32(offset)) {
-    PUT_CODE(p, IM32(offset));
-    p += 4;
-  }
-  return p;
-}
-
-static unsigned char *put_rex_indirect_with_index(
-    unsigned char *p, int base_reg, int index_reg, int dst_reg,
-    unsigned char opcode, unsigned char op2, long offset, int scale)
-{
-  *p++ = 0x48 | ((base_reg & 8) >> 3) | ((index_reg & 8) >> 2) | ((dst_reg & 8) >> 1);
-  *p++ = opcode | 1;
-
-  int b = base_reg & 7;
-  int i = index_reg & 7;
-  int d = dst_reg & 7;
-
-  char scale_bit = kPow2Table[scale];
-
-  unsigned char code = (offset == 0 && b != RBP - RAX) ? op2 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-  *p++ = code | (d << 3) | 0x04;
-  *p++ = b | (i << 3) | (scale_bit << 6);
-  //if (b == RSP - RAX)
-  //  *p++ = 0x24;
-
-  if (offset == 0 && b != RBP - RAX) {
-    ;
-  } else if (is_im8(offset)) {
-    *p++ = IM8(offset);
-  } else if (is_im32(offset)) {
-    PUT_CODE(p, IM32(offset));
-    p += 4;
-  }
-  return p;
-}
-
-static bool assemble_mov(Inst *inst, const ParseInfo *info, Code *code) {
-  unsigned char *p = code->buf;
-
-  if (inst->src.type == REG && inst->dst.type == REG) {
-    if (inst->dst.reg.size != inst->src.reg.size)
-      return assemble_error(info, "Different source and destination register size");
-
-    enum RegSize size = inst->src.reg.size;
-    p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                 size == REG8 ? 0x88 : 0x89);
-  } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-    enum RegSize size = inst->dst.reg.size;
-    if (size == REG64 && is_im32(inst->src.immediate)) {
-      int d = inst->dst.reg.no;
-      int pre = !inst->dst.reg.x ? 0x48 : 0x49;
-      MAKE_CODE(inst, code, pre, 0xc7, 0xc0 | d, IM32(inst->src.immediate));
-      return true;
-    }
-
-    p = put_rex0(p, size, 0, opr_regno(&inst->dst.reg),
-                 0xb0 | (size == REG8 ? 0 : 8) | inst->dst.reg.no);
-    switch (size) {
-    case REG8:  PUT_CODE(p, IM8(inst->src.immediate)); break;
-    case REG16: PUT_CODE(p, IM16(inst->src.immediate)); break;
-    case REG32: PUT_CODE(p, IM32(inst->src.immediate)); break;
-    case REG64: PUT_CODE(p, IM64(inst->src.immediate)); break;
-    default: assert(false); break;
-    }
-    p += 1 << size;
-  } else if (inst->src.type == INDIRECT && inst->dst.type == REG) {
-    if (inst->src.indirect.offset->kind == EX_FIXNUM) {
-      long offset = inst->src.indirect.offset->fixnum;
-      enum RegSize size = inst->dst.reg.size;
-      if (inst->src.indirect.reg.no == NOREG) {
-        int dno = opr_regno(&inst->dst.reg);
-        short prefix = size == REG16 ? 0x66 : size == REG64 ? 0x48 : -1;
-        short buf[] = {
-          prefix,
-          size == REG8 ? 0x8a : 0x8b,
-          ((dno & 7) << 3) | 0x04,
-          0x25,
-        };
-        p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-
-        if (is_im32(offset)) {
-          PUT_CODE(p, IM32(offset));
-          p += 4;
-        }
-      } else if (inst->src.indirect.reg.no != RIP) {
-        enum RegSize size = inst->dst.reg.size;
-        p = put_rex_indirect(
-            p, size,
-            opr_regno(&inst->dst.reg),
-            opr_regno(&inst->src.indirect.reg),
-            0x8a, 0x00, offset);
-      }
-    }
-  } else if (inst->src.type == REG && inst->dst.type == INDIRECT) {
-    if (inst->dst.indirect.offset->kind == EX_FIXNUM) {
-      long offset = inst->dst.indirect.offset->fixnum;
-      enum RegSize size = inst->src.reg.size;
-      if (inst->dst.indirect.reg.no == NOREG) {
-        int sno = opr_regno(&inst->src.reg);
-        short prefix = size == REG16 ? 0x66 : size == REG64 ? 0x48 : -1;
-        short buf[] = {
-          prefix,
-          size == REG8 ? 0x88 : 0x89,
-          ((sno & 7) << 3) | 0x04,
-          0x25,
-        };
-        p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-
-        if (is_im32(offset)) {
-          PUT_CODE(p, IM32(offset));
-          p += 4;
-        }
-      } else if (inst->dst.indirect.reg.no != RIP) {
-        p = put_rex_indirect(
-            p, size,
-            opr_regno(&inst->src.reg),
-            opr_regno(&inst->dst.indirect.reg),
-            0x88, 0x00, offset);
-      }
-    }
-  } else if (inst->src.type == INDIRECT_WITH_INDEX && inst->dst.type == REG) {
-    if (inst->src.indirect_with_index.offset->kind == EX_FIXNUM) {
-      long offset = inst->src.indirect_with_index.offset->fixnum;
-      assert(is_im32(offset));
-      short offset_bit = offset == 0 ? 0x04 : is_im8(offset) ? 0x44 : 0x84;
-      enum RegSize size = inst->dst.reg.size;
-      assert(inst->src.indirect_with_index.base_reg.no != RIP);
-      int bno = opr_regno(&inst->src.indirect_with_index.base_reg);
-      int ino = opr_regno(&inst->src.indirect_with_index.index_reg);
-      int dno = opr_regno(&inst->dst.reg);
-      Expr *scale_expr = inst->src.indirect_with_index.scale;
-      char scale_bit = scale_expr != NULL ? kPow2Table[scale_expr->fixnum] : 0;
-      short x = ((bno & 8) >> 3) | ((ino & 8) >> 2) | ((dno & 8) >> 1);
-      short prefix = size == REG16 ? 0x66 : size == REG64 || x != 0 ? 0x48 | x : -1;
-      short buf[] = {
-        prefix,
-        size == REG8 ? 0x8a : 0x8b,
-        ((dno & 7) << 3) | offset_bit,
-        (scale_bit << 6) | ((ino & 7) << 3) | (bno & 7),
-      };
-      p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-
-      if (offset != 0) {
-        if (is_im8(offset)) {
-          *p++ = IM8(offset);
-        } else {
-          PUT_CODE(p, IM32(offset));
-          p += 4;
-        }
-      }
-    }
-  }
-
-  if (p > code->buf) {
-    code->inst = inst;
-    code->len = p - code->buf;
-    assert((size_t)code->len <= sizeof(code->buf));
-    return true;
-  }
-
-  return assemble_error(info, "Illegal operand");
-}
+// Instructions are encoded from a table: a row gives the operand kinds it accepts, how the
+// operand size is decided, and the opcode with its ModRM/REX/VEX rules:
+//   [rep] [66] [prefix] [REX] [0f [38]] opcode [ModRM [SIB] [disp]] [imm]
+// or with a VEX prefix in place of 66, the mandatory prefix, REX and the opcode map.
+// Among the rows matching the operands, the shortest encoding is chosen (the first one on a tie).
+
+// Operand kinds
+#define K_NONE   (1 << 0)   // No operand.
+#define K_R8     (1 << 1)   // General register: K_R8 << RegSize
+#define K_R16    (1 << 2)
+#define K_R32    (1 << 3)
+#define K_R64    (1 << 4)
+#define K_MEM    (1 << 5)
+#define K_DREG   (1 << 6)   // *%reg
+#define K_DMEM   (1 << 7)   // *mem
+#define K_XMM    (1 << 8)
+#define K_YMM    (1 << 9)
+#define K_ACC    (1 << 10)  // %al, %ax, %eax or %rax, implied by the opcode.
+#define K_CL     (1 << 11)  // %cl, implied by the opcode.
+#define K_ONE    (1 << 12)  // $1, implied by the opcode.
+#define K_IMM8   (1 << 13)  // Immediate sign-extended from 8 bits to the operand size.
+#define K_UIMM8  (1 << 14)  // 8-bit immediate regardless of the operand size.
+#define K_IMM    (1 << 15)  // Immediate of the operand size, 32 bits sign-extended for 64.
+#define K_IMM64  (1 << 16)  // Immediate of the operand size, 64 bits for 64.
+
+#define K_R   (K_R16 | K_R32 | K_R64)
+#define K_RM  (K_R | K_MEM)
+#define K_RM8 (K_R8 | K_MEM)
+#define K_XM  (K_XMM | K_MEM)
+#define K_V   (K_XMM | K_YMM)
+#define K_VM  (K_V | K_MEM)
+
+// Operand size
+enum SizeRule {
+  SZ_NONE,  // No operand size: neither 66 prefix nor REX.W.
+  SZ_SRC,   // From the source register, or from the mnemonic suffix for memory.
+  SZ_DST,   // From the destination, likewise.
+  SZ_8,     // Fixed.
+  SZ_16,
+  SZ_32,
+  SZ_64,
+};
+
+enum OpcodeMap {
+  MAP_NONE,
+  MAP_0F,
+  MAP_0F38,
+};
+
+#define ENC_BYTE   (1 << 0)  // 8-bit operation: the operand size must be 8 bits, and vice versa.
+#define ENC_STORE  (1 << 1)  // Source in ModRM.reg and destination in ModRM.rm, otherwise reversed.
+#define ENC_DIGIT  (1 << 2)  // ModRM.reg is the opcode extension, the operand is in ModRM.rm.
+#define ENC_OPREG  (1 << 3)  // Register number is added to the opcode, without ModRM.
+#define ENC_DUP    (1 << 4)  // Destination is in both ModRM.reg and ModRM.rm.
+#define ENC_MIXED  (1 << 5)  // Source register size differs from the operand size.
+#define ENC_NO_W   (1 << 6)  // 64-bit in default, without REX.W.
+#define ENC_VEX    (1 << 7)
+
+typedef struct {
+  enum Opcode op;
+  unsigned int src, dst;  // Operand kinds
+  unsigned char size;  // SizeRule
+  unsigned char map;  // OpcodeMap
+  unsigned char prefix;  // Mandatory prefix: 0x66, 0xf2, 0xf3, or 0.
+  unsigned char opcode;
+  unsigned char flag;
+  unsigned char digit;  // For ENC_DIGIT.
+} Encoding;
+
+#define ALU_ENCODINGS(op, base, digit) \
+  {op, K_R8, K_RM8, SZ_SRC, MAP_NONE, 0, base, ENC_STORE | ENC_BYTE, 0}, \
+  {op, K_R, K_RM, SZ_SRC, MAP_NONE, 0, base + 1, ENC_STORE, 0}, \
+  {op, K_MEM, K_R8, SZ_DST, MAP_NONE, 0, base + 2, ENC_BYTE, 0}, \
+  {op, K_MEM, K_R, SZ_DST, MAP_NONE, 0, base + 3, 0, 0}, \
+  {op, K_IMM8, K_RM, SZ_DST, MAP_NONE, 0, 0x83, ENC_DIGIT, digit}, \
+  {op, K_IMM, K_ACC, SZ_DST, MAP_NONE, 0, base + 4, ENC_BYTE, 0}, \
+  {op, K_IMM, K_ACC, SZ_DST, MAP_NONE, 0, base + 5, 0, 0}, \
+  {op, K_IMM, K_RM8, SZ_DST, MAP_NONE, 0, 0x80, ENC_DIGIT | ENC_BYTE, digit}, \
+  {op, K_IMM, K_RM, SZ_DST, MAP_NONE, 0, 0x81, ENC_DIGIT, digit}
+
+#define UNARY_ENCODINGS(op, base, digit) \
+  {op, K_RM8, K_NONE, SZ_SRC, MAP_NONE, 0, base, ENC_DIGIT | ENC_BYTE, digit}, \
+  {op, K_RM, K_NONE, SZ_SRC, MAP_NONE, 0, base + 1, ENC_DIGIT, digit}
+
+#define SHIFT_ENCODINGS(op, digit) \
+  {op, K_ONE, K_RM8, SZ_DST, MAP_NONE, 0, 0xd0, ENC_DIGIT | ENC_BYTE, digit}, \
+  {op, K_ONE, K_RM, SZ_DST, MAP_NONE, 0, 0xd1, ENC_DIGIT, digit}, \
+  {op, K_CL, K_RM8, SZ_DST, MAP_NONE, 0, 0xd2, ENC_DIGIT | ENC_BYTE, digit}, \
+  {op, K_CL, K_RM, SZ_DST, MAP_NONE, 0, 0xd3, ENC_DIGIT, digit}, \
+  {op, K_UIMM8, K_RM8, SZ_DST, MAP_NONE, 0, 0xc0, ENC_DIGIT | ENC_BYTE, digit}, \
+  {op, K_UIMM8, K_RM, SZ_DST, MAP_NONE, 0, 0xc1, ENC_DIGIT, digit}
+
+// Rows for the same opcode must be consecutive.
+static const Encoding kEncodings[] = {
+  {MOV, K_R8, K_RM8, SZ_SRC, MAP_NONE, 0, 0x88, ENC_STORE | ENC_BYTE, 0},
+  {MOV, K_R, K_RM, SZ_SRC, MAP_NONE, 0, 0x89, ENC_STORE, 0},
+  {MOV, K_MEM, K_R8, SZ_DST, MAP_NONE, 0, 0x8a, ENC_BYTE, 0},
+  {MOV, K_MEM, K_R, SZ_DST, MAP_NONE, 0, 0x8b, 0, 0},
+  {MOV, K_IMM, K_R8, SZ_DST, MAP_NONE, 0, 0xb0, ENC_OPREG | ENC_BYTE, 0},
+  {MOV, K_IMM64, K_R, SZ_DST, MAP_NONE, 0, 0xb8, ENC_OPREG, 0},
+  {MOV, K_IMM, K_RM8, SZ_DST, MAP_NONE, 0, 0xc6, ENC_DIGIT | ENC_BYTE, 0},
+  {MOV, K_IMM, K_RM, SZ_DST, MAP_NONE, 0, 0xc7, ENC_DIGIT, 0},
+  {MOVSX, K_R8, K_R, SZ_DST, MAP_0F, 0, 0xbe, ENC_MIXED, 0},
+  {MOVSX, K_R16, K_R32 | K_R64, SZ_DST, MAP_0F, 0, 0xbf, ENC_MIXED, 0},
+  {MOVSX, K_R32, K_R64, SZ_DST, MAP_NONE, 0, 0x63, ENC_MIXED, 0},
+  {MOVZX, K_R8, K_R, SZ_DST, MAP_0F, 0, 0xb6, ENC_MIXED, 0},
+  {MOVZX, K_R16, K_R32 | K_R64, SZ_DST, MAP_0F, 0, 0xb7, ENC_MIXED, 0},
+  {LEA, K_MEM, K_R, SZ_DST, MAP_NONE, 0, 0x8d, 0, 0},
+
+  ALU_ENCODINGS(ADD, 0x00, 0),
+  ALU_ENCODINGS(SUB, 0x28, 5),
+  UNARY_ENCODINGS(MUL, 0xf6, 4),
+  UNARY_ENCODINGS(DIV, 0xf6, 6),
+  UNARY_ENCODINGS(IDIV, 0xf6, 7),
+  UNARY_ENCODINGS(IMUL, 0xf6, 5),
+  {IMUL, K_RM, K_R, SZ_DST, MAP_0F, 0, 0xaf, 0, 0},
+  {IMUL, K_IMM8, K_R, SZ_DST, MAP_NONE, 0, 0x6b, ENC_DUP, 0},
+  {IMUL, K_IMM, K_R, SZ_DST, MAP_NONE, 0, 0x69, ENC_DUP, 0},
+  UNARY_ENCODINGS(NEG, 0xf6, 3),
+  UNARY_ENCODINGS(NOT, 0xf6, 2),
+  UNARY_ENCODINGS(INC, 0xfe, 0),
+  UNARY_ENCODINGS(DEC, 0xfe, 1),
+  ALU_ENCODINGS(AND, 0x20, 4),
+  ALU_ENCODINGS(OR, 0x08, 1),
+  ALU_ENCODINGS(XOR, 0x30, 6),
+  SHIFT_ENCODINGS(SHL, 4),
+  SHIFT_ENCODINGS(SHR, 5),
+  SHIFT_ENCODINGS(SAR, 7),
+  ALU_ENCODINGS(CMP, 0x38, 7),
+  {TEST, K_R8, K_RM8, SZ_SRC, MAP_NONE, 0, 0x84, ENC_STORE | ENC_BYTE, 0},
+  {TEST, K_R, K_RM, SZ_SRC, MAP_NONE, 0, 0x85, ENC_STORE, 0},
+  {TEST, K_MEM, K_R8, SZ_DST, MAP_NONE, 0, 0x84, ENC_BYTE, 0},
+  {TEST, K_MEM, K_R, SZ_DST, MAP_NONE, 0, 0x85, 0, 0},
+  {TEST, K_IMM, K_ACC, SZ_DST, MAP_NONE, 0, 0xa8, ENC_BYTE, 0},
+  {TEST, K_IMM, K_ACC, SZ_DST, MAP_NONE, 0, 0xa9, 0, 0},
+  {TEST, K_IMM, K_RM8, SZ_DST, MAP_NONE, 0, 0xf6, ENC_DIGIT | ENC_BYTE, 0},
+  {TEST, K_IMM, K_RM, SZ_DST, MAP_NONE, 0, 0xf7, ENC_DIGIT, 0},
+  {CWTL, K_NONE, K_NONE, SZ_32, MAP_NONE, 0, 0x98, 0, 0},
+  {CLTD, K_NONE, K_NONE, SZ_32, MAP_NONE, 0, 0x99, 0, 0},
+  {CQTO, K_NONE, K_NONE, SZ_64, MAP_NONE, 0, 0x99, 0, 0},
+
+  // Condition code is added to the opcode for setcc and cmovcc.
+  {SETO, K_RM8, K_NONE, SZ_8, MAP_0F, 0, 0x90, ENC_DIGIT | ENC_BYTE, 0},
+  {CMOVO, K_RM, K_R, SZ_DST, MAP_0F, 0, 0x40, 0, 0},
+
+  // Direct jumps and calls are not in the table: they are relaxed afterward.
+  {JMP, K_DREG | K_DMEM, K_NONE, SZ_64, MAP_NONE, 0, 0xff, ENC_DIGIT | ENC_NO_W, 4},
+  {CALL, K_DREG | K_DMEM, K_NONE, SZ_64, MAP_NONE, 0, 0xff, ENC_DIGIT | ENC_NO_W, 2},
+  {RET, K_NONE, K_NONE, SZ_NONE, MAP_NONE, 0, 0xc3, 0, 0},
+  {PUSH, K_R64, K_NONE, SZ_64, MAP_NONE, 0, 0x50, ENC_OPREG | ENC_NO_W, 0},
+  {PUSH, K_MEM, K_NONE, SZ_64, MAP_NONE, 0, 0xff, ENC_DIGIT | ENC_NO_W, 6},
+  {PUSH, K_IMM8, K_NONE, SZ_64, MAP_NONE, 0, 0x6a, ENC_NO_W, 0},
+  {PUSH, K_IMM, K_NONE, SZ_64, MAP_NONE, 0, 0x68, ENC_NO_W, 0},
+  {POP, K_R64, K_NONE, SZ_64, MAP_NONE, 0, 0x58, ENC_OPREG | ENC_NO_W, 0},
+  {POP, K_MEM, K_NONE, SZ_64, MAP_NONE, 0, 0x8f, ENC_DIGIT | ENC_NO_W, 0},
+
+  {INT, K_UIMM8, K_NONE, SZ_NONE, MAP_NONE, 0, 0xcd, 0, 0},
+  {SYSCALL, K_NONE, K_NONE, SZ_NONE, MAP_0F, 0, 0x05, 0, 0},
+  {REP, K_NONE, K_NONE, SZ_NONE, MAP_NONE, 0, 0xf3, 0, 0},
+  {MOVSB, K_NONE, K_NONE, SZ_NONE, MAP_NONE, 0, 0xa4, 0, 0},
+  {STOSB, K_NONE, K_NONE, SZ_NONE, MAP_NONE, 0, 0xaa, 0, 0},
+  {POPCNT, K_RM, K_R, SZ_DST, MAP_0F, 0xf3, 0xb8, 0, 0},
+  {TZCNT, K_RM, K_R, SZ_DST, MAP_0F, 0xf3, 0xbc, 0, 0},
+  {BSF, K_RM, K_R, SZ_DST, MAP_0F, 0, 0xbc, 0, 0},
+  {PREFETCHT0, K_MEM, K_NONE, SZ_NONE, MAP_0F, 0, 0x18, ENC_DIGIT, 1},
+  {PREFETCHT1, K_MEM, K_NONE, SZ_NONE, MAP_0F, 0, 0x18, ENC_DIGIT, 2},
+  {PREFETCHT2, K_MEM, K_NONE, SZ_NONE, MAP_0F, 0, 0x18, ENC_DIGIT, 3},
+  {PREFETCHNTA, K_MEM, K_NONE, SZ_NONE, MAP_0F, 0, 0x18, ENC_DIGIT, 0},
 
 #ifndef __NO_FLONUM
-static unsigned char *assemble_movsd(Inst *inst, Code *code, bool single) {
-  unsigned char *p = code->buf;
-  unsigned char prefix = single ? 0xf3 : 0xf2;
-  if (inst->src.type == REG_XMM && inst->dst.type == REG_XMM) {
-    unsigned char sno = inst->src.regxmm - XMM0;
-    unsigned char dno = inst->dst.regxmm - XMM0;
-    short buf[] = {
-      prefix,
-      sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-      0x0f,
-      0x10,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-  } else if (inst->src.type == INDIRECT && inst->dst.type == REG_XMM) {
-    if (inst->src.indirect.offset->kind == EX_FIXNUM) {
-      if (inst->src.indirect.reg.no != NOREG && inst->src.indirect.reg.no != RIP) {
-        long offset = inst->src.indirect.offset->fixnum;
-        unsigned char sno = opr_regno(&inst->src.indirect.reg);
-        unsigned char dno = inst->dst.regxmm - XMM0;
-        int d = dno & 7;
-        int s = sno & 7;
-        unsigned char code = (offset == 0 && s != RBP - RAX) ? (unsigned char)0x00 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-
-        short buf[] = {
-          prefix,
-          sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-          0x0f,
-          0x10,
-          code | s | (d << 3),
-          s == RSP - RAX ? 0x24 : -1,
-        };
-        p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-
-        if (offset == 0 && s != RBP - RAX) {
-          ;
-        } else if (is_im8(offset)) {
-          *p++ = IM8(offset);
-        } else if (is_im32(offset)) {
-          PUT_CODE(p, IM32(offset));
-          p += 4;
-        }
-      }
-    }
-  } else if (inst->src.type == REG_XMM && inst->dst.type == INDIRECT) {
-    if (inst->dst.indirect.offset->kind == EX_FIXNUM) {
-      if (inst->dst.indirect.reg.no != NOREG && inst->dst.indirect.reg.no != RIP) {
-        long offset = inst->dst.indirect.offset->fixnum;
-        unsigned char sno = inst->src.regxmm - XMM0;
-        unsigned char dno = opr_regno(&inst->dst.indirect.reg);
-        int d = dno & 7;
-        int s = sno & 7;
-        unsigned char code = (offset == 0 && d != RBP - RAX) ? (unsigned char)0x00 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-
-        short buf[] = {
-          prefix,
-          sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((dno & 8) >> 3) | ((sno & 8) >> 1) : -1,
-          0x0f,
-          0x11,
-          code | d | (s << 3),
-          d == RSP - RAX ? 0x24 : -1,
-        };
-        p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-
-        if (offset == 0 && d != RBP - RAX) {
-          ;
-        } else if (is_im8(offset)) {
-          *p++ = IM8(offset);
-        } else if (is_im32(offset)) {
-          PUT_CODE(p, IM32(offset));
-          p += 4;
-        }
-      }
-    }
-  }
-
-  return p;
-}
-
-static unsigned char *assemble_bop_sd(Inst *inst, Code *code, bool single, unsigned char op) {
-  unsigned char *p = code->buf;
-  unsigned char prefix = single ? 0xf3 : 0xf2;
-  if (inst->src.type == REG_XMM && inst->dst.type == REG_XMM) {
-    unsigned char sno = inst->src.regxmm - XMM0;
-    unsigned char dno = inst->dst.regxmm - XMM0;
-    short buf[] = {
-      prefix,
-      sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-      0x0f,
-      op,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-  }
-
-  return p;
-}
-
-static unsigned char *assemble_ucomisd(Inst *inst, Code *code, bool single) {
-  unsigned char *p = code->buf;
-  if (inst->src.type == REG_XMM && inst->dst.type == REG_XMM) {
-    unsigned char sno = inst->src.regxmm - XMM0;
-    unsigned char dno = inst->dst.regxmm - XMM0;
-    short buf[] = {
-      single ? -1 : 0x66,
-      sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-      0x0f,
-      0x2e,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-  }
-  return p;
-}
-
-static unsigned char *assemble_cvtsi2sd(Inst *inst, Code *code, bool single) {
-  unsigned char *p = code->buf;
-  unsigned char prefix = single ? 0xf3 : 0xf2;
-  if (inst->src.type == REG && inst->dst.type == REG_XMM) {
-    unsigned char sno = opr_regno(&inst->src.reg);
-    unsigned char dno = inst->dst.regxmm - XMM0;
-    short buf[] = {
-      prefix,
-      sno >= 8 || dno >= 8 || inst->src.reg.size == REG64 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) | (inst->src.reg.size == REG64 ? 8 : 0) : -1,
-      0x0f,
-      0x2a,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-  }
-  return p;
-}
-
-static unsigned char *assemble_cvttsd2si(Inst *inst, Code *code, bool single) {
-  unsigned char *p = code->buf;
-  unsigned char prefix = single ? 0xf3 : 0xf2;
-  if (inst->src.type == REG_XMM && inst->dst.type == REG) {
-    unsigned char sno = inst->src.regxmm - XMM0;
-    unsigned char dno = opr_regno(&inst->dst.reg);
-    short buf[] = {
-      prefix,
-      sno >= 8 || dno >= 8 || inst->dst.reg.size == REG64 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) | (inst->dst.reg.size == REG64 ? 8 : 0) : -1,
-      0x0f,
-      0x2c,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-  }
-  return p;
-}
-
-static unsigned char *assemble_cvtsd2ss(Inst *inst, Code *code, bool single) {
-  unsigned char *p = code->buf;
-  unsigned char prefix = single ? 0xf3 : 0xf2;
-  if (inst->src.type == REG_XMM && inst->dst.type == REG_XMM) {
-    unsigned char sno = inst->src.regxmm - XMM0;
-    unsigned char dno = inst->dst.regxmm - XMM0;
-    short buf[] = {
-      prefix,
-      sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-      0x0f,
-      0x5a,
-      (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-    };
-    p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
+  {MOVSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x10, 0, 0},
+  {MOVSD, K_XMM, K_MEM, SZ_NONE, MAP_0F, 0xf2, 0x11, ENC_STORE, 0},
+  {ADDSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x58, 0, 0},
+  {SUBSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x5c, 0, 0},
+  {MULSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x59, 0, 0},
+  {DIVSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x5e, 0, 0},
+  {UCOMISD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0x66, 0x2e, 0, 0},
+  {CVTSI2SD, K_R32 | K_R64, K_XMM, SZ_SRC, MAP_0F, 0xf2, 0x2a, 0, 0},
+  {CVTTSD2SI, K_XM, K_R32 | K_R64, SZ_DST, MAP_0F, 0xf2, 0x2c, 0, 0},
+  {SQRTSD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x51, 0, 0},
+
+  {MOVSS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x10, 0, 0},
+  {MOVSS, K_XMM, K_MEM, SZ_NONE, MAP_0F, 0xf3, 0x11, ENC_STORE, 0},
+  {ADDSS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x58, 0, 0},
+  {SUBSS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x5c, 0, 0},
+  {MULSS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x59, 0, 0},
+  {DIVSS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x5e, 0, 0},
+  {UCOMISS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0, 0x2e, 0, 0},
+  {CVTSI2SS, K_R32 | K_R64, K_XMM, SZ_SRC, MAP_0F, 0xf3, 0x2a, 0, 0},
+  {CVTTSS2SI, K_XM, K_R32 | K_R64, SZ_DST, MAP_0F, 0xf3, 0x2c, 0, 0},
+
+  {CVTSD2SS, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf2, 0x5a, 0, 0},
+  {CVTSS2SD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x5a, 0, 0},
+
+  {MOVDQU, K_XM, K_XMM, SZ_NONE, MAP_0F, 0xf3, 0x6f, 0, 0},
+  {MOVDQU, K_XMM, K_MEM, SZ_NONE, MAP_0F, 0xf3, 0x7f, ENC_STORE, 0},
+  {PXOR, K_XM, K_XMM, SZ_NONE, MAP_0F, 0x66, 0xef, 0, 0},
+  {MOVDQA, K_XM, K_XMM, SZ_NONE, MAP_0F, 0x66, 0x6f, 0, 0},
+  {MOVDQA, K_XMM, K_MEM, SZ_NONE, MAP_0F, 0x66, 0x7f, ENC_STORE, 0},
+  {PADDD, K_XM, K_XMM, SZ_NONE, MAP_0F, 0x66, 0xfe, 0, 0},
+  {PCMPEQB, K_XM, K_XMM, SZ_NONE, MAP_0F, 0x66, 0x74, 0, 0},
+  {PMOVMSKB, K_XMM, K_R32 | K_R64, SZ_NONE, MAP_0F, 0x66, 0xd7, 0, 0},
+  {PSHUFB, K_XM, K_XMM, SZ_NONE, MAP_0F38, 0x66, 0x00, 0, 0},
+  // Register to register can be encoded in both ways: the store form avoids VEX.B.
+  {VMOVDQU, K_VM, K_V, SZ_NONE, MAP_0F, 0xf3, 0x6f, ENC_VEX, 0},
+  {VMOVDQU, K_V, K_VM, SZ_NONE, MAP_0F, 0xf3, 0x7f, ENC_VEX | ENC_STORE, 0},
+  {VMOVDQA, K_VM, K_V, SZ_NONE, MAP_0F, 0x66, 0x6f, ENC_VEX, 0},
+  {VMOVDQA, K_V, K_VM, SZ_NONE, MAP_0F, 0x66, 0x7f, ENC_VEX | ENC_STORE, 0},
+  {VZEROUPPER, K_NONE, K_NONE, SZ_NONE, MAP_0F, 0, 0x77, ENC_VEX, 0},
+#endif
+};
+
+typedef struct {
+  short first;  // Index of the first row in kEncodings.
+  short count;
+  signed char size;  // Operand size from the mnemonic suffix, or -1.
+  unsigned char cc;  // Condition code.
+} OpcodeInfo;
+
+static const struct {
+  enum Opcode op;
+  enum Opcode base;
+  enum RegSize size;
+} kSuffixedOpcodes[] = {
+  {MOVB, MOV, REG8}, {MOVW, MOV, REG16}, {MOVL, MOV, REG32}, {MOVQ, MOV, REG64},
+  {ADDQ, ADD, REG64}, {SUBQ, SUB, REG64},
+  {INCB, INC, REG8}, {INCW, INC, REG16}, {INCL, INC, REG32}, {INCQ, INC, REG64},
+  {DECB, DEC, REG8}, {DECW, DEC, REG16}, {DECL, DEC, REG32}, {DECQ, DEC, REG64},
+};
+
+static const OpcodeInfo *get_opcode_info(enum Opcode op) {
+  static OpcodeInfo infos[OPCODE_COUNT];
+  static bool initialized;
+  if (!initialized) {
+    for (int i = 0; i < OPCODE_COUNT; ++i) {
+      infos[i].first = infos[i].count = 0;
+      infos[i].size = -1;
+      infos[i].cc = 0;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(kEncodings); ++i) {
+      OpcodeInfo *info = &infos[kEncodings[i].op];
+      if (info->count == 0)
+        info->first = i;
+      assert(info->first + info->count == (int)i);
+      ++info->count;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(kSuffixedOpcodes); ++i) {
+      OpcodeInfo *info = &infos[kSuffixedOpcodes[i].op];
+      *info = infos[kSuffixedOpcodes[i].base];
+      info->size = kSuffixedOpcodes[i].size;
+    }
+    for (int cc = 1; cc < 16; ++cc) {
+      infos[SETO + cc] = infos[SETO];
+      infos[SETO + cc].cc = cc;
+      infos[CMOVO + cc] = infos[CMOVO];
+      infos[CMOVO + cc].cc = cc;
+    }
+    initialized = true;
   }
-  return p;
+  return &infos[op];
 }
-#endif
 
 static long signed_immediate(long value, enum RegSize size) {
   switch (size) {
@@ -435,844 +305,312 @@ static long signed_immediate(long value, enum RegSize size) {
   }
 }
 
-bool assemble_inst(Inst *inst, const ParseInfo *info, Code *code) {
-  unsigned char *p = code->buf;
-
-  code->flag = 0;
-  code->len = 0;
-
-  switch(inst->op) {
-  case NOOP:
-    return true;
-  case MOV:
-    return assemble_mov(inst, info, code);
-  case MOVB:
-  case MOVW:
-  case MOVL:
-  case MOVQ:
-    if (inst->src.type == IMMEDIATE && inst->dst.type == INDIRECT) {
-      long offset = inst->dst.indirect.offset->fixnum;
-      unsigned char sno = 0;
-      unsigned char dno = opr_regno(&inst->dst.indirect.reg);
-      unsigned char code = (offset == 0 && (dno & 7) != RBP - RAX) ? 0x00 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-      short buf[] = {
-        inst->op == MOVW ? 0x66 : (inst->op == MOVQ || dno >= 8) ? 0x48 | ((dno & 8) >> 3) | ((sno & 8) >> 1) : -1,
-        0xc6 | (inst->op == MOVB ? 0 : 1),
-        code | (dno & 7) | ((sno & 7) << 3),
-        (dno & 7) == RSP - RAX ? 0x24 : -1,
-      };
-
-      p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-      if (offset == 0 && (dno & 7) != RBP - RAX) {
-        ;
-      } else if (is_im8(offset)) {
-        *p++ = IM8(offset);
-      } else if (is_im32(offset)) {
-        PUT_CODE(p, IM32(offset));
-        p += 4;
-      }
-
-      long value = inst->src.immediate;
-      switch (inst->op) {
-      case MOVB: *p++ = IM8(value); break;
-      case MOVW: PUT_CODE(p, IM16(value)); p += 2; break;
-      case MOVL: case MOVQ:
-        PUT_CODE(p, IM32(value));
-        p += 4;
-        break;
-      default: assert(false); break;
-      }
-    }
-    break;
-  case MOVSX:
-  case MOVZX:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      int s = inst->src.reg.no;
-      int d = inst->dst.reg.no;
-      unsigned char op = inst->op == MOVZX ? 0xb6 : 0xbe;
-      switch (inst->src.reg.size) {
-      case REG8:
-        switch (inst->dst.reg.size) {
-        case REG16:
-          if (opr_reg8(&inst->src.reg) && !inst->dst.reg.x) {
-            MAKE_CODE(inst, code, 0x66, 0x0f, op, 0xc0 + s + d * 8);
-          } else {
-            int pre = (!inst->src.reg.x ? 0x40 : 0x41) + (!inst->dst.reg.x ? 0 : 4);
-            MAKE_CODE(inst, code, 0x66, pre, 0x0f, op, 0xc0 + s + d * 8);
-          }
-          return true;
-        case REG32:
-          if (opr_reg8(&inst->src.reg) && !inst->dst.reg.x) {
-            MAKE_CODE(inst, code, 0x0f, op, 0xc0 + s + d * 8);
-          } else {
-            int pre = (!inst->src.reg.x ? 0x40 : 0x41) + (!inst->dst.reg.x ? 0 : 4);
-            MAKE_CODE(inst, code, pre, 0x0f, op, 0xc0 + s + d * 8);
-          }
-          return true;
-        case REG64:
-          {
-            int pre = (!inst->src.reg.x ? 0x48 : 0x49) + (!inst->dst.reg.x ? 0 : 4);
-            MAKE_CODE(inst, code, pre, 0x0f, op, 0xc0 + s + d * 8);
-            return true;
-          }
-        default:
-          break;
-        }
-        break;
-      case REG16:
-        switch (inst->dst.reg.size) {
-        case REG32:
-          if (!inst->src.reg.x && !inst->dst.reg.x) {
-            MAKE_CODE(inst, code, 0x0f, op | 1, 0xc0 + s + d * 8);
-          } else {
-            int pre = (!inst->src.reg.x ? 0x40 : 0x41) + (!inst->dst.reg.x ? 0 : 4);
-            MAKE_CODE(inst, code, pre, 0x0f, op | 1, 0xc0 + s + d * 8);
-          }
-          return true;
-        case REG64:
-          {
-            int pre = (!inst->src.reg.x ? 0x48 : 0x49) + (!inst->dst.reg.x ? 0 : 4);
-            MAKE_CODE(inst, code, pre, 0x0f, op | 1, 0xc0 + s + d * 8);
-            return true;
-          }
-        default:
-          break;
-        }
-        break;
-      case REG32:
-        // "MOVZX %32bit, %64bit" doesn't exist!
-        if (inst->dst.reg.size == REG64 && inst->op == MOVSX) {
-          int pre = (!inst->src.reg.x ? 0x48 : 0x49) + (!inst->dst.reg.x ? 0 : 4);
-          MAKE_CODE(inst, code, pre, 0x63, 0xc0 + s + d * 8);
-          return true;
-        }
-        break;
-      default:
-        break;
-      }
-      return assemble_error(info, "Illegal operand");
-    }
-    break;
-  case LEA:
-    if (inst->src.type == INDIRECT && inst->dst.type == REG) {
-      if (inst->dst.reg.size != REG64)
-        return assemble_error(info, "64 bit register expected for destination");
-
-      assert(inst->src.indirect.offset != NULL);
-      if (inst->src.indirect.reg.no == NOREG) {
-        //
-      } else if (inst->src.indirect.reg.no != RIP) {
-        if (inst->src.indirect.offset->kind == EX_FIXNUM) {
-          long offset = inst->src.indirect.offset->fixnum;
-          enum RegSize size = inst->dst.reg.size;
-          p = put_rex_indirect(
-              p, size,
-              opr_regno(&inst->dst.reg),
-              opr_regno(&inst->src.indirect.reg),
-              0x8c, 0x00, offset);
-        }
-      } else {
-        if (inst->src.indirect.offset->kind != EX_FIXNUM) {
-          int pre = !inst->dst.reg.x ? 0x48 : 0x4c;
-          int d = inst->dst.reg.no;
-          MAKE_CODE(inst, code, pre, 0x8d, 0x05 | (d << 3), IM32(0));
-          return true;
-        }
-      }
-    } else if (inst->src.type == INDIRECT_WITH_INDEX && inst->dst.type == REG) {
-      if (inst->dst.reg.size != REG64)
-        return assemble_error(info, "64 bit register expected for destination");
-
-      Expr *offset_expr = inst->src.indirect_with_index.offset;
-      Expr *scale_expr = inst->src.indirect_with_index.scale;
-      if ((offset_expr == NULL || offset_expr->kind == EX_FIXNUM) &&
-          (scale_expr == NULL || scale_expr->kind == EX_FIXNUM)) {
-        long offset = offset_expr != NULL ? offset_expr->fixnum : 0;
-        long scale = scale_expr != NULL ? scale_expr->fixnum : 1;
-        if (is_im32(offset) && 1 <= scale && scale <= 8 && IS_POWER_OF_2(scale)) {
-          const Reg *base_reg = &inst->src.indirect_with_index.base_reg;
-          const Reg *index_reg = &inst->src.indirect_with_index.index_reg;
-          p = put_rex_indirect_with_index(
-              p,
-              opr_regno(base_reg),
-              opr_regno(index_reg),
-              opr_regno(&inst->dst.reg),
-              0x8c, 0x00, offset, scale);
-        }
-      }
-    }
-    break;
-  case ADD:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
-
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x00 : 0x01);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      long value = inst->src.immediate;
-      if (is_im32(value)) {
-        bool im8 = is_im8(value);
-        enum RegSize size = inst->dst.reg.size;
-        int d = opr_regno(&inst->dst.reg);
-        if (d == RAX - RAX && (size == REG8 || !is_im8(value)))
-          p = put_rex0(p, size, 0, d, im8 ? 0x04 : 0x05);
-        else
-          p = put_rex1(p, size, 0xc0, d, im8 ? 0x83 : 0x81);
-
-        if (im8) {
-          *p++ = IM8(value);
-        } else {
-          switch (size) {
-          case REG8:   *p++ = IM8(value); break;
-          case REG16:  PUT_CODE(p, IM16(value)); p += 2; break;
-          case REG32:
-          case REG64:
-            PUT_CODE(p, IM32(value));
-            p += 4;
-            break;
-          default:  assert(false); break;
-          }
-        }
-      }
-    } else if (inst->src.type == INDIRECT && inst->dst.type == REG) {
-      if (inst->src.indirect.offset->kind == EX_FIXNUM && inst->src.indirect.reg.no != RIP) {
-        long offset = inst->src.indirect.offset->fixnum;
-        enum RegSize size = inst->dst.reg.size;
-        p = put_rex_indirect(
-            p, size,
-            opr_regno(&inst->dst.reg),
-            opr_regno(&inst->src.indirect.reg),
-            0x02, 0x00, offset);
-      }
-    } else if (inst->src.type == INDIRECT_WITH_INDEX && inst->dst.type == REG) {
-      assert(inst->src.indirect_with_index.offset->kind == EX_FIXNUM && inst->src.indirect_with_index.offset->fixnum == 0);  // TODO
-      unsigned char scale = 0;
-      if (inst->src.indirect_with_index.scale != NULL) {
-        assert(inst->src.indirect_with_index.scale->kind == EX_FIXNUM);
-        int s = inst->src.indirect_with_index.scale->fixnum;
-        assert(s == 1 || s == 2 || s == 4 || s == 8);
-        scale = kPow2Table[s];
-      }
-
-      unsigned char bno = inst->src.indirect_with_index.base_reg.no;
-      unsigned char ino = inst->src.indirect_with_index.index_reg.no;
-      unsigned char dno = inst->dst.reg.no;
-      short buf[] = {
-        (unsigned char)0x48 | (inst->src.indirect_with_index.base_reg.x) | (inst->src.indirect_with_index.index_reg.x << 1) | (inst->dst.reg.x << 2),
-        0x03,
-        0x04 | (dno << 3),
-        bno | (ino << 3) | (scale << 6),
-      };
-      p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-    }
-    break;
-  case ADDQ:
-    if (inst->src.type == IMMEDIATE && inst->dst.type == INDIRECT) {
-      if (inst->dst.indirect.offset->kind == EX_FIXNUM &&
-          inst->dst.indirect.reg.no != NOREG) {
-        long value = inst->src.immediate;
-        if (is_im32(value)) {
-          long offset = inst->dst.indirect.offset->fixnum;
-          unsigned char sno = 0;
-          unsigned char dno = opr_regno(&inst->dst.indirect.reg);
-          unsigned char code = (offset == 0 && (dno & 7) != RBP - RAX) ? 0x00 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-          short buf[] = {
-            (unsigned char)0x48 | ((dno & 8) >> 3) | ((sno & 8) >> 1),
-            (is_im8(value) ? 0x83 : 0x81),
-            code | (dno & 7) | ((sno & 7) << 3),
-            (dno & 7) == RSP - RAX ? 0x24 : -1,
-          };
-          p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-          if (offset == 0 && (dno & 7) != RBP - RAX) {
-            ;
-          } else if (is_im8(offset)) {
-            *p++ = IM8(offset);
-          } else if (is_im32(offset)) {
-            PUT_CODE(p, IM32(offset));
-            p += 4;
-          }
-
-          if (is_im8(value)) {
-            *p++ = IM8(value);
-          } else {
-            PUT_CODE(p, IM32(value));
-            p += 4;
-          }
-        }
-      }
-    }
-    break;
-  case SUB:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
-
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x28 : 0x29);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      long value = inst->src.immediate;
-      if (is_im32(value)) {
-        bool im8 = is_im8(value);
-        enum RegSize size = inst->dst.reg.size;
-        int d = opr_regno(&inst->dst.reg);
-        if (d == RAX - RAX && (size == REG8 || !is_im8(value)))
-          p = put_rex0(p, size, 0, d, im8 ? 0x2c : 0x2d);
-        else
-          p = put_rex1(p, size, 0xe8, d, im8 ? 0x83 : 0x81);
-
-        if (im8) {
-          *p++ = IM8(value);
-        } else {
-          switch (size) {
-          case REG8:   *p++ = IM8(value); break;
-          case REG16:  PUT_CODE(p, IM16(value)); p += 2; break;
-          case REG32:
-          case REG64:
-            PUT_CODE(p, IM32(value));
-            p += 4;
-            break;
-          default:  assert(false); break;
-          }
-        }
-      }
-    } else if (inst->src.type == INDIRECT && inst->dst.type == REG) {
-      if (inst->src.indirect.offset->kind == EX_FIXNUM && inst->src.indirect.reg.no != RIP) {
-        long offset = inst->src.indirect.offset->fixnum;
-        enum RegSize size = inst->dst.reg.size;
-        p = put_rex_indirect(
-            p, size,
-            opr_regno(&inst->dst.reg),
-            opr_regno(&inst->src.indirect.reg),
-            0x2a, 0x00, offset);
-      }
-    } else if (inst->src.type == INDIRECT_WITH_INDEX && inst->dst.type == REG) {
-      assert(inst->src.indirect_with_index.offset->kind == EX_FIXNUM && inst->src.indirect_with_index.offset->fixnum == 0);  // TODO
-      unsigned char scale = 0;
-      if (inst->src.indirect_with_index.scale != NULL) {
-        assert(inst->src.indirect_with_index.scale->kind == EX_FIXNUM);
-        int s = inst->src.indirect_with_index.scale->fixnum;
-        assert(s == 1 || s == 2 || s == 4 || s == 8);
-        scale = kPow2Table[s];
-      }
-
-      unsigned char bno = inst->src.indirect_with_index.base_reg.no;
-      unsigned char ino = inst->src.indirect_with_index.index_reg.no;
-      unsigned char dno = inst->dst.reg.no;
-      short buf[] = {
-        (unsigned char)0x48 | (inst->src.indirect_with_index.base_reg.x) | (inst->src.indirect_with_index.index_reg.x << 1) | (inst->dst.reg.x << 2),
-        0x2b,
-        0x04 | (dno << 3),
-        bno | (ino << 3) | (scale << 6),
-      };
-      p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-    }
-    break;
-  case SUBQ:
-    if (inst->src.type == IMMEDIATE && inst->dst.type == INDIRECT) {
-      if (inst->dst.indirect.offset->kind == EX_FIXNUM &&
-          inst->dst.indirect.reg.no != NOREG) {
-        long value = inst->src.immediate;
-        if (is_im32(value)) {
-          long offset = inst->dst.indirect.offset->fixnum;
-          unsigned char sno = 0;
-          unsigned char dno = opr_regno(&inst->dst.indirect.reg);
-          unsigned char code = (offset == 0 && (dno & 7) != RBP - RAX) ? 0x28 : is_im8(offset) ? (unsigned char)0x40 : (unsigned char)0x80;
-          short buf[] = {
-            (unsigned char)0x48 | ((dno & 8) >> 3) | ((sno & 8) >> 1),
-            (is_im8(value) ? 0x83 : 0x81),
-            code | (dno & 7) | ((sno & 7) << 3),
-            (dno & 7) == RSP - RAX ? 0x24 : -1,
-          };
-          p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-          if (offset == 0 && (dno & 7) != RBP - RAX) {
-            ;
-          } else if (is_im8(offset)) {
-            *p++ = IM8(offset);
-          } else if (is_im32(offset)) {
-            PUT_CODE(p, IM32(offset));
-            p += 4;
-          }
-
-          if (is_im8(value)) {
-            *p++ = IM8(value);
-          } else {
-            PUT_CODE(p, IM32(value));
-            p += 4;
-          }
-        }
-      }
-    }
-    break;
-  case MUL:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex0(p, size, 0, opr_regno(&inst->src.reg),
-                   0xf6 | (size == REG8 ? 0 : 1));
-      *p++ = 0xe0 | inst->src.reg.no;
-    }
-    break;
-  case DIV:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex0(p, size, 0, opr_regno(&inst->src.reg),
-                   0xf6 | (size == REG8 ? 0 : 1));
-      *p++ = 0xf0 | inst->src.reg.no;
-    }
-    break;
-  case IDIV:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex0(p, size, 0, opr_regno(&inst->src.reg),
-                   0xf6 | (size == REG8 ? 0 : 1));
-      *p++ = 0xf8 | inst->src.reg.no;
-    }
-    break;
-  case NEG:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      p = put_rex1(p, inst->src.reg.size,
-                   0xd8, opr_regno(&inst->src.reg), 0xf7);
-    }
-    break;
-  case NOT:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
+static int immediate_size(unsigned int kind, enum RegSize size) {
+  switch (kind) {
+  case K_IMM8: case K_UIMM8:  return 1;
+  case K_IMM:    return size == REG64 ? 4 : 1 << size;
+  case K_IMM64:  return 1 << size;
+  default:       return 0;
+  }
+}
 
-    if (inst->src.type == REG) {
-      p = put_rex1(p, inst->src.reg.size,
-                   0xd0, opr_regno(&inst->src.reg), 0xf7);
-    }
+// Facts about an operand which don't depend on the encoding row.
+typedef struct {
+  const Operand *opr;
+  unsigned int kinds;  // Immediates whose width depends on the size are checked afterward.
+  int size;  // Register size, or the size from the mnemonic suffix, or -1.
+  int regno;  // Register number with the extension bit.
+  unsigned char rex;  // REX.X and REX.B when placed in ModRM.rm.
+  bool rex_byte;  // spl, bpl, sil and dil need REX.
+} OperandInfo;
+
+static void init_operand_info(OperandInfo *oi, const Operand *opr, int size_hint) {
+  oi->opr = opr;
+  oi->kinds = 0;
+  oi->size = size_hint;
+  oi->regno = 0;
+  oi->rex = 0;
+  oi->rex_byte = false;
+  switch (opr->type) {
+  case NOOPERAND:
+    oi->kinds = K_NONE;
+    break;
+  case REG:
+    {
+      int no = opr_regno(&opr->reg);
+      oi->kinds = K_R8 << opr->reg.size;
+      if (no == 0)
+        oi->kinds |= K_ACC;
+      else if (no == CL - AL && opr->reg.size == REG8)
+        oi->kinds |= K_CL;
+      oi->size = opr->reg.size;
+      oi->regno = no;
+      oi->rex = no >> 3;
+      oi->rex_byte = opr->reg.size == REG8 && no >= 4 && no < 8;
+    }
+    break;
+  case INDIRECT:
+  case DEREF_INDIRECT:
+    {
+      const Reg *base = &opr->indirect.reg;
+      oi->kinds = opr->type == INDIRECT ? K_MEM : K_DMEM;
+      oi->rex = base->no == RIP || base->no == NOREG ? 0 : base->x;
+    }
+    break;
+  case INDIRECT_WITH_INDEX:
+  case DEREF_INDIRECT_WITH_INDEX:
+    oi->kinds = opr->type == INDIRECT_WITH_INDEX ? K_MEM : K_DMEM;
+    oi->rex = opr->indirect_with_index.base_reg.x | (opr->indirect_with_index.index_reg.x << 1);
+    break;
+  case DEREF_REG:
+    if (opr->reg.size == REG64)
+      oi->kinds = K_DREG;
+    oi->regno = opr_regno(&opr->reg);
+    oi->rex = oi->regno >> 3;
     break;
-  case INC:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      p = put_rex1(p, inst->src.reg.size,
-                   0xc0, opr_regno(&inst->src.reg), 0xff);
-    }
+#ifndef __NO_FLONUM
+  case REG_XMM:
+  case REG_YMM:
+    oi->kinds = opr->type == REG_XMM ? K_XMM : K_YMM;
+    oi->regno = opr->regxmm - XMM0;
+    oi->rex = oi->regno >> 3;
     break;
-  case INCB:
-  case INCW:
-  case INCL:
-  case INCQ:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == INDIRECT &&
-        inst->src.indirect.reg.no != NOREG && inst->src.indirect.reg.no != RIP) {
-      enum RegSize size = inst->op + (REG8 - INCB);
-      long offset = inst->src.indirect.offset->fixnum;
-      p = put_rex_indirect(
-          p, size,
-          0, opr_regno(&inst->src.indirect.reg),
-          0xfe, 0x00, offset);
+#endif
+  case IMMEDIATE:
+    {
+      long value = opr->immediate;
+      oi->kinds = K_IMM8 | K_IMM | K_IMM64;
+      if (value == 1)
+        oi->kinds |= K_ONE;
+      if (value >= -0x80 && value <= 0xff)
+        oi->kinds |= K_UIMM8;
     }
     break;
-  case DEC:
-    if (inst->src.type == NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == REG) {
-      p = put_rex1(p, inst->src.reg.size,
-                   0xc8, opr_regno(&inst->src.reg), 0xff);
-    }
+  default:
     break;
-  case DECB:
-  case DECW:
-  case DECL:
-  case DECQ:
-    if (inst->src.type == NOOPERAND)
-      return assemble_error(info, "Illegal operand");
+  }
+}
 
-    if (inst->src.type == INDIRECT &&
-        inst->src.indirect.reg.no != NOREG && inst->src.indirect.reg.no != RIP) {
-      enum RegSize size = inst->op + (REG8 - DECB);
-      long offset = inst->src.indirect.offset->fixnum;
-      p = put_rex_indirect(
-          p, size,
-          1, opr_regno(&inst->src.indirect.reg),
-          0xfe, 0x08, offset);
+static bool immediate_fits(long value, unsigned int kind, int size) {
+  switch (kind) {
+  case K_IMM8:
+    return size >= 0 && is_im8(signed_immediate(value, size));
+  case K_IMM:
+  case K_IMM64:
+    switch (size) {
+    case -1:     return false;
+    case REG8:   return value >= -0x80 && value <= 0xff;
+    case REG16:  return value >= -0x8000 && value <= 0xffff;
+    case REG32:  return value >= -0x80000000L && value <= 0xffffffffL;
+    default:     return kind == K_IMM64 || is_im32(value);
     }
-    break;
-  case AND:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
-
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x20 : 0x21);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      long value = inst->src.immediate;
-      enum RegSize size = inst->dst.reg.size;
-      if (is_im8(value) && (size != REG8 || opr_regno(&inst->dst.reg) != AL - AL)) {
-        p = put_rex1(p, size,
-                     0xe0, opr_regno(&inst->dst.reg),
-                     0x83);
-        *p++ = IM8(value);
-      } else if (size <= REG32 || is_im32(value)) {
-        if (opr_regno(&inst->dst.reg) == RAX - RAX) {
-          p = put_rex0(p, size,
-                       0, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x24 : 0x25);
-        } else {
-          p = put_rex1(p, size,
-                       0xe0, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x80 : 0x81);
-        }
+  default:
+    return true;
+  }
+}
 
-        switch (size) {
-        case REG8:  PUT_CODE(p, IM8(value)); p += 1; break;
-        case REG16: PUT_CODE(p, IM16(value)); p += 2; break;
-        case REG32: case REG64:
-          PUT_CODE(p, IM32(value));
-          p += 4;
-          break;
-        default: assert(false); break;
-        }
-      } else {
-        return assemble_error(info, "Too large constant");
-      }
-    }
-    break;
-  case OR:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
+static unsigned char *put_modrm_disp(unsigned char *p, int modrm, int sib, int base_no,
+                                     long offset) {
+  // Base rbp (and r13) has no form without displacement.
+  unsigned char mod = (offset == 0 && base_no != RBP - RAX) ? 0x00 : is_im8(offset) ? 0x40 : 0x80;
+  *p++ = mod | modrm;
+  if (sib >= 0)
+    *p++ = sib;
+  if (mod == 0x40) {
+    *p++ = IM8(offset);
+  } else if (mod == 0x80) {
+    PUT_CODE(p, IM32(offset));
+    p += 4;
+  }
+  return p;
+}
 
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x08 : 0x09);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      long value = inst->src.immediate;
-      enum RegSize size = inst->dst.reg.size;
-      if (is_im8(value) && (size != REG8 || opr_regno(&inst->dst.reg) != AL - AL)) {
-        p = put_rex1(p, size,
-                     0xc8, opr_regno(&inst->dst.reg),
-                     0x83);
-        *p++ = IM8(value);
-      } else if (size <= REG32 || is_im32(value)) {
-        if (opr_regno(&inst->dst.reg) == RAX - RAX) {
-          p = put_rex0(p, size,
-                       0, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x0c : 0x0d);
-        } else {
-          p = put_rex1(p, size,
-                       0xc8, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x80 : 0x81);
-        }
-        switch (size) {
-        case REG8:  PUT_CODE(p, IM8(value)); p += 1; break;
-        case REG16: PUT_CODE(p, IM16(value)); p += 2; break;
-        case REG32: case REG64:
-          PUT_CODE(p, IM32(value));
-          p += 4;
-          break;
-        default: assert(false); break;
-        }
-      } else {
-        return assemble_error(info, "Too large constant");
+// Puts ModRM, SIB and displacement, or returns NULL if the operand cannot be encoded.
+// `reloc' points to the RIP-relative displacement if it is resolved later.
+static unsigned char *put_modrm(unsigned char *p, int regno, const OperandInfo *oi,
+                                unsigned char **reloc) {
+  const Operand *rm = oi->opr;
+  int r = (regno & 7) << 3;
+  *reloc = NULL;
+  switch (rm->type) {
+  case INDIRECT:
+  case DEREF_INDIRECT:
+    {
+      const Expr *offset_expr = rm->indirect.offset;
+      const Reg *base = &rm->indirect.reg;
+      if (base->no == RIP) {
+        long offset = 0;
+        if (offset_expr != NULL && offset_expr->kind == EX_FIXNUM)
+          offset = offset_expr->fixnum;
+        else
+          *reloc = p + 1;
+        if (!is_im32(offset))
+          return NULL;
+        *p++ = 0x05 | r;
+        PUT_CODE(p, IM32(offset));
+        p += 4;
+        break;
       }
-    }
-    break;
-  case XOR:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
 
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x30 : 0x31);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      long value = inst->src.immediate;
-      enum RegSize size = inst->dst.reg.size;
-      if (is_im8(value) && (size != REG8 || opr_regno(&inst->dst.reg) != AL - AL)) {
-        p = put_rex1(p, size,
-                     0xf0, opr_regno(&inst->dst.reg),
-                     0x83);
-        *p++ = IM8(value);
-      } else if (size <= REG32 || is_im32(value)) {
-        if (opr_regno(&inst->dst.reg) == RAX - RAX) {
-          p = put_rex0(p, size,
-                       0, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x34 : 0x35);
-        } else {
-          p = put_rex1(p, size,
-                       0xf0, opr_regno(&inst->dst.reg),
-                       size == REG8 ? 0x80 : 0x81);
-        }
-        switch (size) {
-        case REG8:  PUT_CODE(p, IM8(value)); p += 1; break;
-        case REG16: PUT_CODE(p, IM16(value)); p += 2; break;
-        case REG32: case REG64:
-          PUT_CODE(p, IM32(value));
-          p += 4;
-          break;
-        default: assert(false); break;
-        }
+      if (offset_expr != NULL && offset_expr->kind != EX_FIXNUM)
+        return NULL;
+      long offset = offset_expr != NULL ? offset_expr->fixnum : 0;
+      if (!is_im32(offset))
+        return NULL;
+      if (base->no == NOREG) {
+        *p++ = 0x04 | r;
+        *p++ = 0x25;
+        PUT_CODE(p, IM32(offset));
+        p += 4;
       } else {
-        return assemble_error(info, "Too large constant");
+        p = put_modrm_disp(p, r | base->no, base->no == RSP - RAX ? 0x24 : -1, base->no, offset);
       }
     }
     break;
-  case SHL:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (opr_regno(&inst->src.reg) != CL - AL)
-        return assemble_error(info, "`%cl` expected");
-
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex1(p, size, 0xe0, opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0xd2 : 0xd3);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      enum RegSize size = inst->dst.reg.size;
-      if (inst->src.immediate == 1) {
-        p = put_rex1(p, size, 0xe0, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xd0 : 0xd1);
-      } else {
-        p = put_rex1(p, size, 0xe0, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xc0 : 0xc1);
-        *p++ = IM8(inst->src.immediate);
-      }
+  case INDIRECT_WITH_INDEX:
+  case DEREF_INDIRECT_WITH_INDEX:
+    {
+      const Expr *offset_expr = rm->indirect_with_index.offset;
+      const Expr *scale_expr = rm->indirect_with_index.scale;
+      if ((offset_expr != NULL && offset_expr->kind != EX_FIXNUM) ||
+          (scale_expr != NULL && scale_expr->kind != EX_FIXNUM))
+        return NULL;
+      long offset = offset_expr != NULL ? offset_expr->fixnum : 0;
+      long scale = scale_expr != NULL ? scale_expr->fixnum : 1;
+      const Reg *base = &rm->indirect_with_index.base_reg;
+      const Reg *index = &rm->indirect_with_index.index_reg;
+      if (!is_im32(offset) || scale < 1 || scale > 8 || !IS_POWER_OF_2(scale) ||
+          opr_regno(index) == RSP - RAX)
+        return NULL;
+      p = put_modrm_disp(p, r | 0x04, (kPow2Table[scale] << 6) | (index->no << 3) | base->no,
+                         base->no, offset);
     }
     break;
-  case SHR:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (opr_regno(&inst->src.reg) != CL - AL)
-        return assemble_error(info, "`%cl` expected");
-
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex1(p, size, 0xe8, opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0xd2 : 0xd3);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      enum RegSize size = inst->dst.reg.size;
-      if (inst->src.immediate == 1) {
-        p = put_rex1(p, size, 0xe8, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xd0 : 0xd1);
-      } else {
-        p = put_rex1(p, size, 0xe8, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xc0 : 0xc1);
-        *p++ = IM8(inst->src.immediate);
-      }
+  default:
+    {
+      *p++ = 0xc0 | r | (oi->regno & 7);
     }
     break;
-  case SAR:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (opr_regno(&inst->src.reg) != CL - AL)
-        return assemble_error(info, "`%cl` expected");
+  }
+  return p;
+}
 
-      enum RegSize size = inst->dst.reg.size;
-      p = put_rex1(p, size, 0xf8, opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0xd2 : 0xd3);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      enum RegSize size = inst->dst.reg.size;
-      if (inst->src.immediate == 1) {
-        p = put_rex1(p, size, 0xf8, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xd0 : 0xd1);
-      } else {
-        p = put_rex1(p, size, 0xf8, opr_regno(&inst->dst.reg),
-                     size == REG8 ? 0xc0 : 0xc1);
-        *p++ = IM8(inst->src.immediate);
-      }
-    }
-    break;
-  case CMP:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
+// Returns NULL if the row cannot encode the operands: their kinds are checked by the caller.
+static unsigned char *encode_inst(unsigned char *p, const Encoding *enc, const Inst *inst,
+                                  const OpcodeInfo *info, const OperandInfo *oi,
+                                  unsigned char **reloc) {
+  int size = enc->size >= SZ_8 ? enc->size - SZ_8 + REG8 :
+      enc->size == SZ_SRC ? oi[0].size : enc->size == SZ_DST ? oi[1].size : -1;
+  if ((enc->size != SZ_NONE && size < 0) || (info->size >= 0 && size != info->size) ||
+      ((enc->flag & ENC_BYTE) != 0) != (size == REG8))
+    return NULL;
+
+  unsigned int kinds[] = {enc->src & oi[0].kinds, enc->dst & oi[1].kinds};
+  if (!immediate_fits(inst->src.immediate, kinds[0], size))
+    return NULL;
+
+  // Operands encoded in ModRM or in the opcode.
+  const OperandInfo *regs[2];
+  int nregs = 0;
+  bool rex_byte = false;
+  for (int i = 0; i < 2; ++i) {
+    if (kinds[i] & (K_R8 | K_R)) {
+      if (enc->size != SZ_NONE && !(enc->flag & ENC_MIXED) && oi[i].size != size)
+        return NULL;
+      rex_byte |= oi[i].rex_byte;
+    }
+    if (kinds[i] & (K_R8 | K_R | K_MEM | K_DREG | K_DMEM | K_XMM | K_YMM))
+      regs[nregs++] = &oi[i];
+  }
 
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x38 : 0x39);
-    } else if (inst->src.type == IMMEDIATE && inst->dst.type == REG) {
-      enum RegSize size = inst->dst.reg.size;
-      long value = signed_immediate(inst->src.immediate, size);
-      if (is_im32(value) || size <= REG32) {
-        bool im8 = is_im8(value);
-        int d = opr_regno(&inst->dst.reg);
-        if (d == RAX - RAX && (size == REG8 || !im8))
-          p = put_rex0(p, size, 0, d, size == REG8 ? 0x3c : 0x3d);
-        else
-          p = put_rex1(p, size, 0xf8, d, 0x80 | (size == REG8 ? 0 : im8 ? 3 : 1));
+  const OperandInfo *rm = NULL;
+  int regno = 0;
+  if (enc->flag & ENC_OPREG) {
+    assert(nregs == 1);
+    regno = regs[0]->regno;
+  } else if (enc->flag & ENC_DIGIT) {
+    assert(nregs == 1);
+    rm = regs[0];
+    regno = enc->digit;
+  } else if (enc->flag & ENC_DUP) {
+    assert(nregs == 1);
+    rm = regs[0];
+    regno = rm->regno;
+  } else if (nregs == 2) {
+    rm = &oi[enc->flag & ENC_STORE ? 1 : 0];
+    regno = oi[enc->flag & ENC_STORE ? 0 : 1].regno;
+  } else {
+    assert(nregs == 0);
+  }
 
-        if (im8) {
-          *p++ = IM8(value);
-        } else {
-          switch (size) {
-          case REG8:   *p++ = IM8(value); break;
-          case REG16:  PUT_CODE(p, IM16(value)); p += 2; break;
-          case REG32:
-          case REG64:
-            PUT_CODE(p, IM32(value));
-            p += 4;
-            break;
-          }
-        }
-      }
-    }
-    break;
-  case TEST:
-    if (inst->src.type == REG && inst->dst.type == REG) {
-      if (inst->dst.reg.size != inst->src.reg.size)
-        return assemble_error(info, "Different source and destination register size");
+  bool w = size == REG64 && enc->size != SZ_NONE && !(enc->flag & ENC_NO_W);
+  int rex = w ? 8 : 0;
+  if (rm != NULL)
+    rex |= (regno & 8) >> 1 | rm->rex;
+  else if (enc->flag & ENC_OPREG)
+    rex |= regno >> 3;  // REX.B
 
-      enum RegSize size = inst->src.reg.size;
-      p = put_rex2(p, size, opr_regno(&inst->src.reg), opr_regno(&inst->dst.reg),
-                   size == REG8 ? 0x84 : 0x85);
+  if (inst->prefix != 0)
+    *p++ = inst->prefix;
+  if (enc->flag & ENC_VEX) {
+#ifndef __NO_FLONUM
+    bool l = inst->src.type == REG_YMM || inst->dst.type == REG_YMM;
+    if (l && (inst->src.type == REG_XMM || inst->dst.type == REG_XMM))
+      return NULL;
+    int pp = enc->prefix == 0x66 ? 1 : enc->prefix == 0xf3 ? 2 : enc->prefix == 0xf2 ? 3 : 0;
+    // VEX.vvvv is unused (1111b), R, X, B and vvvv are stored inverted.
+    if ((rex & 0x0b) == 0 && enc->map == MAP_0F) {
+      *p++ = 0xc5;
+      *p++ = (~rex & 4) << 5 | 0x78 | l << 2 | pp;
+    } else {
+      *p++ = 0xc4;
+      *p++ = (~rex & 7) << 5 | (enc->map == MAP_0F38 ? 2 : 1);
+      *p++ = (rex & 8) << 4 | 0x78 | l << 2 | pp;
+    }
+#else
+    assert(false);
+#endif
+  } else {
+    if (size == REG16 && enc->size != SZ_NONE)
+      *p++ = 0x66;
+    if (enc->prefix != 0)
+      *p++ = enc->prefix;
+    if (rex != 0 || rex_byte)
+      *p++ = 0x40 | rex;
+    if (enc->map != MAP_NONE) {
+      *p++ = 0x0f;
+      if (enc->map == MAP_0F38)
+        *p++ = 0x38;
     }
-    break;
-  case CWTL:
-    if (inst->src.type != NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
+  }
+  *p++ = enc->opcode + info->cc + (enc->flag & ENC_OPREG ? regno & 7 : 0);
+  int imm_size = immediate_size(kinds[0], size);
+  *reloc = NULL;
+  if (rm != NULL) {
+    p = put_modrm(p, regno, rm, reloc);
+    if (p == NULL)
+      return NULL;
+  }
 
-    MAKE_CODE(inst, code, 0x98);
-    return true;
-  case CLTD:
-    if (inst->src.type != NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
+  long value = inst->src.immediate;
+  for (int i = 0; i < imm_size; ++i, value >>= 8)
+    *p++ = value;
+  return p;
+}
 
-    MAKE_CODE(inst, code, 0x99);
-    return true;
-  case CQTO:
-    if (inst->src.type != NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
+bool assemble_inst(Inst *inst, const ParseInfo *info, Code *code) {
+  code->flag = 0;
+  code->len = 0;
+  code->rip_disp = 0;
 
-    MAKE_CODE(inst, code, 0x48, 0x99);
+  switch (inst->op) {
+  case NOOP:
     return true;
-
-  case SETO: case SETNO: case SETB:  case SETAE:
-  case SETE: case SETNE: case SETBE: case SETA:
-  case SETS: case SETNS: case SETP:  case SETNP:
-  case SETL: case SETGE: case SETLE: case SETG:
-    if (inst->dst.type != NOOPERAND || inst->src.type != REG ||
-        inst->src.reg.size != REG8)
-      return assemble_error(info, "Illegal opeand");
-
-    p = put_rex0(p, REG8, 0, opr_regno(&inst->src.reg), 0x0f);
-    *p++ = 0x90 | (inst->op - SETO);
-    *p++ = 0xc0 | inst->src.reg.no;
-    break;
-  case PUSH:
-    if (inst->dst.type == NOOPERAND) {
-      if (inst->src.type == REG && inst->src.reg.size == REG64) {
-        p = put_rex0(p, REG32, 0, opr_regno(&inst->src.reg),
-                     0x50 | inst->src.reg.no);
-        break;
-      } else if (inst->src.type == IMMEDIATE) {
-        long value = inst->src.immediate;
-        if (is_im8(value)) {
-          *p++ = 0x6a;
-          *p++ = IM8(value);
-          break;
-        } else if (is_im32(value)) {
-          *p++ = 0x68;
-          PUT_CODE(p, IM32(value));
-          p += 4;
-          break;
-        }
-      }
-    }
-    return assemble_error(info, "Illegal operand");
-  case POP:
-    if (inst->dst.type != NOOPERAND || inst->src.type != REG ||
-        inst->src.reg.size != REG64)
-      return assemble_error(info, "Illegal operand");
-
-    p = put_rex0(p, REG32, 0, opr_regno(&inst->src.reg),
-                 0x58 | inst->src.reg.no);
-    break;
   case JMP:
-    if (inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    switch (inst->src.type) {
-    case DIRECT:
+    if (inst->src.type == DIRECT && inst->dst.type == NOOPERAND) {
       //MAKE_CODE(inst, code, 0xe9, IM32(0));
       MAKE_CODE(inst, code, 0xeb, IM8(0));  // Short jmp in default.
       return true;
-    case DEREF_REG:
-      {
-        int s = inst->src.reg.no;
-        short buf[] = {
-          inst->src.reg.x ? 0x41 : -1,
-          0xff, 0xe0 | s,
-        };
-        p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-      }
-      break;
-    case DEREF_INDIRECT:
-      {
-        Expr *offset_expr = inst->src.indirect.offset;
-        if ((offset_expr == NULL || offset_expr->kind == EX_FIXNUM)) {
-          long offset = offset_expr != NULL ? offset_expr->fixnum : 0;
-          if (is_im32(offset)) {
-            short offset_bit = offset == 0 ? 0x20 : is_im8(offset) ? 0x60 : 0xa0;
-            short b = inst->src.indirect.reg.no;
-            short buf[] = {
-              inst->src.indirect.reg.x ? 0x41 : -1,
-              0xff, offset_bit | b,
-            };
-            p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-            if (offset != 0) {
-              if (is_im8(offset)) {
-                *p++ = IM8(offset);
-              } else {
-                PUT_CODE(p, IM32(offset));
-                p += 4;
-              }
-            }
-          }
-        }
-      }
-      break;
-    case DEREF_INDIRECT_WITH_INDEX:
-      {
-        Expr *offset_expr = inst->src.indirect_with_index.offset;
-        Expr *scale_expr = inst->src.indirect_with_index.scale;
-        if ((offset_expr == NULL || offset_expr->kind == EX_FIXNUM) &&
-            (scale_expr == NULL || scale_expr->kind == EX_FIXNUM)) {
-          long offset = offset_expr != NULL ? offset_expr->fixnum : 0;
-          long scale = scale_expr != NULL ? scale_expr->fixnum : 1;
-          if (is_im32(offset) && 1 <= scale && scale <= 8 && IS_POWER_OF_2(scale)) {
-            short offset_bit = offset == 0 ? 0x20 : is_im8(offset) ? 0x60 : 0xa0;
-            short b = inst->src.indirect_with_index.base_reg.no;
-            short scale_bit = kPow2Table[scale];
-            short i = inst->src.indirect_with_index.index_reg.no;
-            short prefix = inst->src.indirect_with_index.base_reg.x | (inst->src.indirect_with_index.index_reg.x << 1);
-            short buf[] = {
-              prefix != 0 ? 0x40 | prefix : -1,
-              0xff,
-              offset_bit | 0x04,
-              (scale_bit << 6) | (i << 3) | b,
-            };
-            p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-            if (offset != 0) {
-              if (is_im8(offset)) {
-                *p++ = IM8(offset);
-              } else {
-                PUT_CODE(p, IM32(offset));
-                p += 4;
-              }
-            }
-          }
-        }
-      }
-      break;
-    default: break;
     }
     break;
   case JO: case JNO: case JB:  case JAE:
@@ -1286,129 +624,52 @@ bool assemble_inst(Inst *inst, const ParseInfo *info, Code *code) {
     MAKE_CODE(inst, code, 0x70 + (inst->op - JO), IM8(0));  // Short jmp in default.
     return true;
   case CALL:
-    if (inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == DIRECT) {
+    if (inst->src.type == DIRECT && inst->dst.type == NOOPERAND) {
       MAKE_CODE(inst, code, 0xe8, IM32(0));
       return true;
-    } else if (inst->src.type == DEREF_REG) {
-      int s = inst->src.reg.no;
-      if (!inst->src.reg.x) {
-        MAKE_CODE(inst, code, 0xff, 0xd0 + s);
-      } else {
-        MAKE_CODE(inst, code, 0x41, 0xff, 0xd0 + s);
-      }
-      return true;
     }
     break;
-  case RET:
-    if (inst->src.type != NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    MAKE_CODE(inst, code, 0xc3);
-    return true;
-  case INT:
-    if (inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    if (inst->src.type == IMMEDIATE) {
-      long value = inst->src.immediate;
-      MAKE_CODE(inst, code, 0xcd, IM8(value));
-      return true;
-    }
-    return true;
-  case SYSCALL:
-    if (inst->src.type != NOOPERAND || inst->dst.type != NOOPERAND)
-      return assemble_error(info, "Illegal operand");
-
-    MAKE_CODE(inst, code, 0x0f, 0x05);
-    return true;
-#ifndef __NO_FLONUM
-  case MOVSD:
-    p = assemble_movsd(inst, code, false);
-    break;
-  case ADDSD:
-    p = assemble_bop_sd(inst, code, false, 0x58);
-    break;
-  case SUBSD:
-    p = assemble_bop_sd(inst, code, false, 0x5c);
-    break;
-  case MULSD:
-    p = assemble_bop_sd(inst, code, false, 0x59);
-    break;
-  case DIVSD:
-    p = assemble_bop_sd(inst, code, false, 0x5e);
-    break;
-  case UCOMISD:
-    p = assemble_ucomisd(inst, code, false);
-    break;
-  case CVTSI2SD:
-    p = assemble_cvtsi2sd(inst, code, false);
-    break;
-  case CVTTSD2SI:
-    p = assemble_cvttsd2si(inst, code, false);
-    break;
-  case SQRTSD:
-    if (inst->src.type == REG_XMM && inst->dst.type == REG_XMM) {
-      unsigned char sno = inst->src.regxmm - XMM0;
-      unsigned char dno = inst->dst.regxmm - XMM0;
-      short buf[] = {
-        0xf2,
-        sno >= 8 || dno >= 8 ? (unsigned char)0x40 | ((sno & 8) >> 3) | ((dno & 8) >> 1) : -1,
-        0x0f,
-        0x51,
-        (unsigned char)0xc0 | ((dno & 7) << 3) | (sno & 7),
-      };
-      p = put_code_filtered(p, buf, ARRAY_SIZE(buf));
-    }
-    break;
-
-  case MOVSS:
-    p = assemble_movsd(inst, code, true);
-    break;
-  case ADDSS:
-    p = assemble_bop_sd(inst, code, true, 0x58);
-    break;
-  case SUBSS:
-    p = assemble_bop_sd(inst, code, true, 0x5c);
-    break;
-  case MULSS:
-    p = assemble_bop_sd(inst, code, true, 0x59);
-    break;
-  case DIVSS:
-    p = assemble_bop_sd(inst, code, true, 0x5e);
-    break;
-  case UCOMISS:
-    p = assemble_ucomisd(inst, code, true);
-    break;
-  case CVTSI2SS:
-    p = assemble_cvtsi2sd(inst, code, true);
-    break;
-  case CVTTSS2SI:
-    p = assemble_cvttsd2si(inst, code, true);
-    break;
-
-  case CVTSD2SS:
-    p = assemble_cvtsd2ss(inst, code, false);
-    break;
-  case CVTSS2SD:
-    p = assemble_cvtsd2ss(inst, code, true);
-    break;
-#endif
   default:
     break;
   }
 
-  if (p > code->buf) {
-    code->inst = inst;
-    code->len = p - code->buf;
-    assert((size_t)code->len <= sizeof(code->buf));
-    return true;
+  const OpcodeInfo *opinfo = get_opcode_info(inst->op);
+  if (opinfo->count == 0) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "op=%2d: not handled", inst->op);
+    return assemble_error(info, buf);
   }
 
-  char buf[64];
-  snprintf(buf, sizeof(buf), "op=%2d: not handled", inst->op);
-  assemble_error(info, buf);
-  return false;
+  OperandInfo oi[2];
+  init_operand_info(&oi[0], &inst->src, opinfo->size);
+  init_operand_info(&oi[1], &inst->dst, opinfo->size);
+  int len = 0;
+  for (int i = 0; i < opinfo->count; ++i) {
+    const Encoding *enc = &kEncodings[opinfo->first + i];
+    if (!(enc->src & oi[0].kinds) || !(enc->dst & oi[1].kinds))
+      continue;
+    unsigned char *reloc;
+    if (len == 0) {
+      unsigned char *p = encode_inst(code->buf, enc, inst, opinfo, oi, &reloc);
+      if (p != NULL) {
+        len = p - code->buf;
+        code->rip_disp = reloc != NULL ? reloc - code->buf : 0;
+      }
+    } else {
+      unsigned char buf[sizeof(code->buf)];
+      unsigned char *p = encode_inst(buf, enc, inst, opinfo, oi, &reloc);
+      if (p != NULL && p - buf < len) {
+        len = p - buf;
+        memcpy(code->buf, buf, len);
+        code->rip_disp = reloc != NULL ? reloc - buf : 0;
+      }
+    }
+  }
+  if (len == 0)
+    return assemble_error(info, "Illegal operand");
+
+  code->inst = inst;
+  code->len = len;
+  assert((size_t)code->len <= sizeof(code->buf));
+  return true;
 }
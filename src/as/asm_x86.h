@@ -13,6 +13,7 @@ typedef struct Code {
   Inst *inst;
   char flag;
   char len;
+  char rip_disp;  // Position of the RIP-relative displacement resolved later, or 0.
   unsigned char buf[14];
 } Code;
 
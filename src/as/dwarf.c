@@ -0,0 +1,318 @@
+#include "../config.h"
+#include "dwarf.h"
+
+#include <assert.h>
+#include <stdlib.h>  // malloc
+#include <string.h>
+#include <unistd.h>  // getcwd
+
+#include "elfutil.h"  // SHF_EXECINSTR
+#include "gen_section.h"
+#include "ir_asm.h"
+#include "util.h"
+
+#define DWARF_VERSION  (4)
+
+#define DW_TAG_compile_unit  (0x11)
+#define DW_CHILDREN_no       (0)
+
+#define DW_AT_name       (0x03)
+#define DW_AT_stmt_list  (0x10)
+#define DW_AT_low_pc     (0x11)
+#define DW_AT_high_pc    (0x12)
+#define DW_AT_language   (0x13)
+#define DW_AT_comp_dir   (0x1b)
+
+#define DW_FORM_addr        (0x01)
+#define DW_FORM_data8       (0x07)
+#define DW_FORM_string      (0x08)
+#define DW_FORM_data1       (0x0b)
+#define DW_FORM_sec_offset  (0x17)
+
+#define DW_LANG_C99  (0x0c)
+
+#define DW_LNS_copy         (1)
+#define DW_LNS_advance_pc   (2)
+#define DW_LNS_advance_line (3)
+#define DW_LNS_set_file     (4)
+
+#define DW_LNE_end_sequence (1)
+#define DW_LNE_set_address  (2)
+
+// Parameters for special opcodes.
+#define LINE_BASE    (-5)
+#define LINE_RANGE   (14)
+#define OPCODE_BASE  (13)
+
+const char *kDebugSectionNames[DEBUG_SECTION_COUNT] = {
+  ".debug_info",
+  ".debug_abbrev",
+  ".debug_line",
+};
+
+static Vector *debug_files;  // <const char*>, file number - 1
+
+void add_debug_file(int index, const char *filename) {
+  assert(index > 0);
+  if (debug_files == NULL)
+    debug_files = new_vector();
+  while (debug_files->len < index)
+    vec_push(debug_files, NULL);
+  debug_files->data[index - 1] = (void*)filename;
+}
+
+static void put_byte(Buffer *buf, int value) {
+  unsigned char c = value;
+  buf_put(buf, &c, 1);
+}
+
+static void put_fixed(Buffer *buf, uintptr_t value, int size) {
+  for (int i = 0; i < size; ++i) {
+    put_byte(buf, value);
+    value >>= 8;
+  }
+}
+
+static void put_uleb128(Buffer *buf, uintptr_t value) {
+  do {
+    int c = value & 0x7f;
+    value >>= 7;
+    put_byte(buf, value != 0 ? c | 0x80 : c);
+  } while (value != 0);
+}
+
+static void put_sleb128(Buffer *buf, intptr_t value) {
+  for (;;) {
+    int c = value & 0x7f;
+    value >>= 7;  // Arithmetic shift.
+    if ((value == 0 && !(c & 0x40)) || (value == -1 && (c & 0x40))) {
+      put_byte(buf, c);
+      break;
+    }
+    put_byte(buf, c | 0x80);
+  }
+}
+
+static void put_string(Buffer *buf, const char *str) {
+  buf_put(buf, str, strlen(str) + 1);
+}
+
+static void patch_fixed(Buffer *buf, size_t offset, uintptr_t value, int size) {
+  assert(offset + size <= buf->size);
+  for (int i = 0; i < size; ++i) {
+    buf->data[offset + i] = value;
+    value >>= 8;
+  }
+}
+
+// Put a placeholder which is filled by the linker.
+static void put_rela(DebugSection *section, int size, enum DebugRelaTarget target, int secno,
+                     intptr_t addend) {
+  DebugRela *rela = malloc(sizeof(*rela));
+  rela->offset = section->buf.size;
+  rela->size = size;
+  rela->target = target;
+  rela->section = secno;
+  rela->addend = addend;
+  vec_push(section->relas, rela);
+  put_fixed(&section->buf, 0, size);
+}
+
+static const char *debug_file_name(int index) {
+  const char *filename = NULL;
+  if (debug_files != NULL && index > 0 && index <= debug_files->len)
+    filename = debug_files->data[index - 1];
+  if (filename == NULL)
+    error("Unknown file number: %d", index);
+  return filename;
+}
+
+// Abbreviation 1 has the address range of the code, and 2 doesn't: used when the code spreads
+// over several sections, then the ranges are known from the line number information.
+static void gen_abbrev(DebugSection *section) {
+  static const int kAttrs[][2] = {
+    {DW_AT_name, DW_FORM_string},
+    {DW_AT_comp_dir, DW_FORM_string},
+    {DW_AT_language, DW_FORM_data1},
+    {DW_AT_stmt_list, DW_FORM_sec_offset},
+    {DW_AT_low_pc, DW_FORM_addr},
+    {DW_AT_high_pc, DW_FORM_data8},  // Length from low_pc.
+  };
+  Buffer *buf = &section->buf;
+  for (int code = 1; code <= 2; ++code) {
+    put_uleb128(buf, code);  // Abbreviation code
+    put_uleb128(buf, DW_TAG_compile_unit);
+    put_byte(buf, DW_CHILDREN_no);
+    size_t n = sizeof(kAttrs) / sizeof(*kAttrs) - (code == 1 ? 0 : 2);
+    for (size_t i = 0; i < n; ++i) {
+      put_uleb128(buf, kAttrs[i][0]);
+      put_uleb128(buf, kAttrs[i][1]);
+    }
+    put_uleb128(buf, 0);
+    put_uleb128(buf, 0);
+  }
+  put_uleb128(buf, 0);  // End of abbreviations
+}
+
+// `code_secno' is the section which has all the code, or -1 if there are several.
+static void gen_info(DebugSection *section, int code_secno) {
+  Buffer *buf = &section->buf;
+  put_fixed(buf, 0, 4);  // unit_length: patched later
+  put_fixed(buf, DWARF_VERSION, 2);
+  put_rela(section, 4, DR_ABBREV, -1, 0);
+  put_byte(buf, 8);  // address_size
+
+  char cwd[1024];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    cwd[0] = '\0';
+
+  put_uleb128(buf, code_secno >= 0 ? 1 : 2);  // Abbreviation code
+  put_string(buf, debug_file_name(1));
+  put_string(buf, cwd);
+  put_byte(buf, DW_LANG_C99);
+  put_rela(section, 4, DR_LINE, -1, 0);
+  if (code_secno >= 0) {
+    size_t code_size;
+    get_section_size(code_secno, &code_size, NULL);
+    put_rela(section, 8, DR_SECTION, code_secno, 0);
+    put_fixed(buf, code_size, 8);
+  }
+
+  patch_fixed(buf, 0, buf->size - 4, 4);
+}
+
+typedef struct {
+  uintptr_t address;
+  int file;
+  int line;
+} LineRow;
+
+static void put_line_row(Buffer *buf, LineRow *state, const LineRow *row) {
+  if (row->file != state->file) {
+    put_byte(buf, DW_LNS_set_file);
+    put_uleb128(buf, row->file);
+  }
+
+  intptr_t line_delta = row->line - state->line;
+  uintptr_t addr_delta = row->address - state->address;
+  if (line_delta < LINE_BASE || line_delta >= LINE_BASE + LINE_RANGE) {
+    put_byte(buf, DW_LNS_advance_line);
+    put_sleb128(buf, line_delta);
+    line_delta = 0;
+  }
+  uintptr_t opcode = (line_delta - LINE_BASE) + LINE_RANGE * addr_delta + OPCODE_BASE;
+  if (opcode > 255) {
+    put_byte(buf, DW_LNS_advance_pc);
+    put_uleb128(buf, addr_delta);
+    opcode = (line_delta - LINE_BASE) + OPCODE_BASE;
+  }
+  put_byte(buf, opcode);  // Special opcode: advance address and line, and append a row.
+  *state = *row;
+}
+
+// Sequence of rows for a code section.
+static void gen_line_sequence(DebugSection *section, Vector *irs, int secno) {
+  Buffer *buf = &section->buf;
+  uintptr_t start_address;
+  size_t code_size;
+  get_section_size(secno, &code_size, &start_address);
+
+  put_byte(buf, 0);  // Extended opcode
+  put_uleb128(buf, 1 + 8);
+  put_byte(buf, DW_LNE_set_address);
+  put_rela(section, 8, DR_SECTION, secno, 0);
+
+  // Only the last location is used for the same address.
+  LineRow state = {.address = 0, .file = 1, .line = 1};
+  LineRow pending = {.address = 0, .file = 0, .line = 0};
+  for (int i = 0; i < irs->len; ++i) {
+    IR *ir = irs->data[i];
+    if (ir->kind != IR_LOC)
+      continue;
+    LineRow row = {.address = ir->address - start_address, .file = ir->loc.file, .line = ir->loc.line};
+    debug_file_name(row.file);  // Check.
+    if (pending.file != 0 && pending.address != row.address)
+      put_line_row(buf, &state, &pending);
+    pending = row;
+  }
+  if (pending.file != 0)
+    put_line_row(buf, &state, &pending);
+
+  if (code_size > state.address) {
+    put_byte(buf, DW_LNS_advance_pc);
+    put_uleb128(buf, code_size - state.address);
+  }
+  put_byte(buf, 0);  // Extended opcode
+  put_uleb128(buf, 1);
+  put_byte(buf, DW_LNE_end_sequence);
+}
+
+static void gen_line(DebugSection *section, Vector *section_irs, const bool *has_loc) {
+  Buffer *buf = &section->buf;
+  put_fixed(buf, 0, 4);  // unit_length: patched later
+  put_fixed(buf, DWARF_VERSION, 2);
+  size_t header_length_pos = buf->size;
+  put_fixed(buf, 0, 4);  // header_length: patched later
+  put_byte(buf, 1);  // minimum_instruction_length
+  put_byte(buf, 1);  // maximum_operations_per_instruction
+  put_byte(buf, 1);  // default_is_stmt
+  put_byte(buf, LINE_BASE);
+  put_byte(buf, LINE_RANGE);
+  put_byte(buf, OPCODE_BASE);
+  static const unsigned char kStandardOpcodeLengths[OPCODE_BASE - 1] = {
+    0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1,
+  };
+  buf_put(buf, kStandardOpcodeLengths, sizeof(kStandardOpcodeLengths));
+  put_byte(buf, 0);  // include_directories: empty
+  for (int i = 0; i < debug_files->len; ++i) {
+    put_string(buf, debug_file_name(i + 1));
+    put_uleb128(buf, 0);  // Directory index
+    put_uleb128(buf, 0);  // Modification time
+    put_uleb128(buf, 0);  // File length
+  }
+  put_byte(buf, 0);
+  patch_fixed(buf, header_length_pos, buf->size - (header_length_pos + 4), 4);
+
+  for (int sec = 0; sec < section_irs->len; ++sec) {
+    if (has_loc[sec])
+      gen_line_sequence(section, section_irs->data[sec], sec);
+  }
+
+  patch_fixed(buf, 0, buf->size - 4, 4);
+}
+
+// Returns false if there is no line information.
+bool gen_debug_sections(Vector *section_irs, DebugSection *sections) {
+  bool *has_loc = calloc(section_irs->len, sizeof(*has_loc));
+  int code_secno = -1, count = 0;
+  for (int sec = 0; sec < section_irs->len; ++sec) {
+    if (!(get_section(sec)->flag & SHF_EXECINSTR))
+      continue;
+    Vector *irs = section_irs->data[sec];
+    for (int i = 0; i < irs->len; ++i) {
+      IR *ir = irs->data[i];
+      if (ir->kind == IR_LOC) {
+        has_loc[sec] = true;
+        code_secno = sec;
+        ++count;
+        break;
+      }
+    }
+  }
+  if (count == 0 || debug_files == NULL) {
+    free(has_loc);
+    return false;
+  }
+
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    DebugSection *section = &sections[i];
+    section->buf.data = NULL;
+    section->buf.capa = section->buf.size = 0;
+    section->relas = new_vector();
+  }
+  gen_info(&sections[DS_INFO], count == 1 ? code_secno : -1);
+  gen_abbrev(&sections[DS_ABBREV]);
+  gen_line(&sections[DS_LINE], section_irs, has_loc);
+  free(has_loc);
+  return true;
+}
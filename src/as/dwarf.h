@@ -0,0 +1,44 @@
+// DWARF line number information
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uintptr_t
+
+#include "util.h"  // Buffer
+
+typedef struct Vector Vector;
+
+enum DebugSectionType {
+  DS_INFO,    // .debug_info
+  DS_ABBREV,  // .debug_abbrev
+  DS_LINE,    // .debug_line
+};
+
+#define DEBUG_SECTION_COUNT  (3)
+
+extern const char *kDebugSectionNames[DEBUG_SECTION_COUNT];
+
+// Relocation in a debug section refers to the top of a code section or another debug section.
+enum DebugRelaTarget {
+  DR_SECTION,
+  DR_ABBREV,
+  DR_LINE,
+};
+
+typedef struct {
+  uintptr_t offset;
+  int size;  // 4 or 8
+  enum DebugRelaTarget target;
+  int section;  // Section number for DR_SECTION.
+  intptr_t addend;
+} DebugRela;
+
+typedef struct {
+  Buffer buf;
+  Vector *relas;  // <DebugRela*>
+} DebugSection;
+
+void add_debug_file(int index, const char *filename);  // .file index "filename"
+bool gen_debug_sections(Vector *section_irs, DebugSection *sections);
@@ -5,85 +5,149 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "elfutil.h"
+#include "table.h"
 #include "util.h"
 
-typedef struct {
-  uintptr_t start_address;
-  Buffer buf;
-} Section;
+static Vector *sections;  // <Section*>
 
-static Section sections[SECTION_COUNT];
-static size_t bss_size;
+void init_sections(void) {
+  static const struct {
+    const char *name;
+    int type;
+    int flag;
+  } kPredefined[] = {
+    [SEC_CODE] = {".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR},
+    [SEC_RODATA] = {".rodata", SHT_PROGBITS, SHF_ALLOC},
+    [SEC_DATA] = {".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE},
+    [SEC_BSS] = {".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE},
+  };
 
-size_t section_aligns[SECTION_COUNT] = {1, 1, 1, 1};
-uintptr_t section_start_addresses[SECTION_COUNT];
+  sections = new_vector();
+  for (size_t i = 0; i < sizeof(kPredefined) / sizeof(*kPredefined); ++i)
+    add_section(alloc_name(kPredefined[i].name, NULL, false), kPredefined[i].type,
+                kPredefined[i].flag);
+}
 
-void add_bss(size_t size) {
-  bss_size += size;
+int section_count(void) {
+  return sections->len;
 }
 
-void align_section_size(enum SectionType secno, size_t align) {
-  if (align > section_aligns[secno])
-    section_aligns[secno] = align;
+Section *get_section(int secno) {
+  assert(secno >= 0 && secno < sections->len);
+  return sections->data[secno];
+}
 
-  if (secno != SEC_BSS) {
-    Section *sec = &sections[secno];
-    buf_align(&sec->buf, align);
-  } else {
-    bss_size = ALIGN(bss_size, align);
+int find_section(const Name *name) {
+  for (int i = 0; i < sections->len; ++i) {
+    Section *sec = sections->data[i];
+    if (equal_name(sec->name, name))
+      return i;
   }
+  return -1;
 }
 
-void add_section_data(enum SectionType secno, const void *data, size_t bytes) {
-  assert(secno != SEC_BSS);
-  Section *sec = &sections[secno];
-  buf_put(&sec->buf, data, bytes);
+int add_section(const Name *name, int type, int flag) {
+  assert(find_section(name) < 0);
+  Section *sec = calloc(1, sizeof(*sec));
+  sec->name = name;
+  sec->type = type;
+  sec->flag = flag;
+  sec->align = 1;
+  vec_push(sections, sec);
+  return sections->len - 1;
 }
 
-void add_code(const void *buf, size_t bytes) {
-  add_section_data(SEC_CODE, buf, bytes);
+// Code, read-only data, writable data, and bss.
+static int section_rank(const Section *sec) {
+  if (sec->type == SHT_NOBITS)
+    return 3;
+  if (sec->flag & SHF_EXECINSTR)
+    return 0;
+  return sec->flag & SHF_WRITE ? 2 : 1;
 }
 
-void fix_section_size(uintptr_t start_address) {
-  sections[SEC_CODE].start_address = start_address;
-  int rodata_align = MAX(section_aligns[SEC_RODATA], 1);
-  uintptr_t rodata_addr = ALIGN(start_address + sections[SEC_CODE].buf.size, rodata_align);
-  sections[SEC_RODATA].start_address = rodata_addr;
-
-  int data_align = MAX(section_aligns[SEC_DATA], 1);
-  sections[SEC_DATA].start_address =
-      ALIGN(sections[SEC_RODATA].start_address + sections[SEC_RODATA].buf.size, data_align);
-  int bss_align = MAX(section_aligns[SEC_BSS], 1);
-  sections[SEC_BSS].start_address =
-      sections[SEC_DATA].start_address + ALIGN(sections[SEC_DATA].buf.size, bss_align);
+void get_section_layout(int *order) {
+  int n = 0;
+  for (int rank = 0; rank < 4; ++rank) {
+    for (int i = 0; i < sections->len; ++i) {
+      if (section_rank(sections->data[i]) == rank)
+        order[n++] = i;
+    }
+  }
+  assert(n == sections->len);
 }
 
-void get_section_size(int section, size_t *psize, uintptr_t *ploadadr) {
-  switch (section) {
-  case SEC_CODE:
-  case SEC_RODATA:
-  case SEC_DATA:
-    {
-      const Section *sec = &sections[section];
-      if (ploadadr != NULL)
-        *ploadadr = sec->start_address;
-      *psize = sec->buf.size;
-    }
-    break;
-  case SEC_BSS:
-    {
-      assert(ploadadr == NULL);
-      *psize = bss_size;
-    }
-    break;
-  default:
-    assert(!"Illegal");
-    break;
+void add_bss(int secno, size_t size) {
+  Section *sec = get_section(secno);
+  assert(sec->type == SHT_NOBITS);
+  sec->bss_size += size;
+}
+
+// Recommended multi-byte NOP sequences (Intel SDM, NOP instruction).
+static const unsigned char kNops[][9] = {
+  {0x90},
+  {0x66, 0x90},
+  {0x0f, 0x1f, 0x00},
+  {0x0f, 0x1f, 0x40, 0x00},
+  {0x0f, 0x1f, 0x44, 0x00, 0x00},
+  {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+  {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+  {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+  {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+#define MAX_NOP_SIZE  ((size_t)(sizeof(kNops) / sizeof(*kNops)))
+
+static void put_nops(Buffer *buf, size_t size) {
+  while (size > 0) {
+    size_t n = size < MAX_NOP_SIZE ? size : MAX_NOP_SIZE;
+    buf_put(buf, kNops[n - 1], n);
+    size -= n;
   }
 }
 
-void output_section(FILE *fp, int section) {
-  Section *sec = &sections[section];
-  const void *data = sec->buf.data;
-  fwrite(data, sec->buf.size, 1, fp);
+// Code is padded with NOPs, because the padding might be executed.
+void align_section_size(int secno, size_t align) {
+  Section *sec = get_section(secno);
+  if (align > sec->align)
+    sec->align = align;
+
+  if (sec->type == SHT_NOBITS)
+    sec->bss_size = ALIGN(sec->bss_size, align);
+  else if (sec->flag & SHF_EXECINSTR)
+    put_nops(&sec->buf, ALIGN(sec->buf.size, align) - sec->buf.size);
+  else
+    buf_align(&sec->buf, align);
+}
+
+void add_section_data(int secno, const void *data, size_t bytes) {
+  Section *sec = get_section(secno);
+  assert(sec->type != SHT_NOBITS);
+  buf_put(&sec->buf, data, bytes);
+}
+
+void fix_section_size(uintptr_t start_address) {
+  int *order = malloc(sizeof(*order) * sections->len);
+  get_section_layout(order);
+  uintptr_t address = start_address;
+  for (int i = 0; i < sections->len; ++i) {
+    Section *sec = sections->data[order[i]];
+    address = ALIGN(address, MAX(sec->align, 1));
+    sec->start_address = address;
+    address += sec->type == SHT_NOBITS ? sec->bss_size : sec->buf.size;
+  }
+  free(order);
+}
+
+void get_section_size(int secno, size_t *psize, uintptr_t *ploadadr) {
+  const Section *sec = get_section(secno);
+  if (ploadadr != NULL)
+    *ploadadr = sec->start_address;
+  *psize = sec->type == SHT_NOBITS ? sec->bss_size : sec->buf.size;
+}
+
+void output_section(FILE *fp, int secno) {
+  Section *sec = get_section(secno);
+  fwrite(sec->buf.data, sec->buf.size, 1, fp);
 }
@@ -4,8 +4,11 @@
 #include <stdint.h>  // uintptr_t
 #include <stdio.h>   // FILE
 
-#define SECTION_COUNT  (4)
+#include "util.h"  // Buffer
 
+typedef struct Name Name;
+
+// Predefined sections: other sections are added by name after them.
 enum SectionType {
   SEC_CODE,
   SEC_RODATA,
@@ -13,14 +16,27 @@ enum SectionType {
   SEC_BSS,
 };
 
-extern size_t section_aligns[SECTION_COUNT];
-extern uintptr_t section_start_addresses[SECTION_COUNT];
+typedef struct {
+  const Name *name;
+  int type;  // SHT_PROGBITS or SHT_NOBITS
+  int flag;  // SHF_ALLOC, SHF_WRITE and SHF_EXECINSTR
+  size_t align;
+  uintptr_t start_address;
+  Buffer buf;       // Contents, unused for SHT_NOBITS.
+  size_t bss_size;  // Size for SHT_NOBITS.
+} Section;
+
+void init_sections(void);
+int section_count(void);
+Section *get_section(int secno);
+int find_section(const Name *name);  // -1 if not found.
+int add_section(const Name *name, int type, int flag);
+void get_section_layout(int *order);  // Section numbers in the order of addresses.
 
-void add_code(const void *buf, size_t bytes);
-void add_section_data(enum SectionType secno, const void *data, size_t bytes);
-void add_bss(size_t size);
-void align_section_size(enum SectionType secno, size_t align);
+void add_section_data(int secno, const void *data, size_t bytes);
+void add_bss(int secno, size_t size);
+void align_section_size(int secno, size_t align);
 
 void fix_section_size(uintptr_t start_address);
-void get_section_size(int section, size_t *psize, uintptr_t *ploadadr);
-void output_section(FILE *fp, int section);
+void get_section_size(int secno, size_t *psize, uintptr_t *ploadadr);
+void output_section(FILE *fp, int secno);
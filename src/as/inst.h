@@ -23,6 +23,7 @@ enum Opcode {
   MUL,
   DIV,
   IDIV,
+  IMUL,
   NEG,
   NOT,
   INC,
@@ -64,6 +65,23 @@ enum Opcode {
   SETLE,
   SETG,
 
+  CMOVO,
+  CMOVNO,
+  CMOVB,
+  CMOVAE,
+  CMOVE,
+  CMOVNE,
+  CMOVBE,
+  CMOVA,
+  CMOVS,
+  CMOVNS,
+  CMOVP,
+  CMOVNP,
+  CMOVL,
+  CMOVGE,
+  CMOVLE,
+  CMOVG,
+
   JMP,
   JO,
   JNO,
@@ -88,6 +106,16 @@ enum Opcode {
 
   INT,
   SYSCALL,
+  REP,
+  MOVSB,
+  STOSB,
+  POPCNT,
+  TZCNT,
+  BSF,
+  PREFETCHT0,
+  PREFETCHT1,
+  PREFETCHT2,
+  PREFETCHNTA,
 
 #ifndef __NO_FLONUM
   MOVSD,
@@ -111,12 +139,23 @@ enum Opcode {
 
   CVTSD2SS,
   CVTSS2SD,
+
+  MOVDQU,
+  PXOR,
+  MOVDQA,
+  PADDD,
+  PCMPEQB,
+  PMOVMSKB,
+  PSHUFB,
+  VMOVDQU,
+  VMOVDQA,
+  VZEROUPPER,
 #endif
+
+  OPCODE_COUNT,  // Not an instruction.
 };
 
 enum RegType {
-  NOREG,
-
   // 8bit
   AL,
   CL,
@@ -198,6 +237,8 @@ enum RegType {
   R15,
 
   RIP,
+
+  NOREG,  // Placed last to differ from the register numbers 0~7 in `Reg.no'.
 };
 
 #ifndef __NO_FLONUM
@@ -217,7 +258,7 @@ enum RegSize {
 
 typedef struct {
   char size;  // RegSize
-  char no;  // 0~7, or RIP
+  char no;  // 0~7, RIP, or NOREG
   char x;   // 0 or 1
 } Reg;
 
@@ -232,7 +273,8 @@ enum OperandType {
   DEREF_INDIRECT,  // *ofs(%rax)
   DEREF_INDIRECT_WITH_INDEX,  // *(%rax, %rcx, 4)
 #ifndef __NO_FLONUM
-  REG_XMM,
+  REG_XMM,    // %xmm0
+  REG_YMM,    // %ymm0: regxmm holds the register number, too.
 #endif
 };
 
@@ -294,6 +336,7 @@ typedef struct {
 
 typedef struct Inst {
   enum Opcode op;
+  unsigned char prefix;  // 0xf3 for `rep', or 0.
   Operand src;
   Operand dst;
 } Inst;
@@ -313,6 +356,19 @@ enum DirectiveType {
   DT_GLOBL,
   DT_LOCAL,
   DT_EXTERN,
+  DT_ZERO,
+  DT_SKIP,
+  DT_FILL,
+  DT_INCBIN,
+  DT_TYPE,
+  DT_SIZE,
+  DT_FILE,
+  DT_LOC,
+  DT_BSS,
+  DT_PUSHSECTION,
+  DT_POPSECTION,
+  DT_BALIGN,
+  DT_P2ALIGN,
 #ifndef __NO_FLONUM
   DT_FLOAT,
   DT_DOUBLE,
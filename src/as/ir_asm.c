@@ -2,8 +2,9 @@
 #include "ir_asm.h"
 
 #include <assert.h>
-#include <stdlib.h>  // malloc
+#include <stdlib.h>  // calloc
 
+#include "elfutil.h"  // SHT_NOBITS
 #include "gen_section.h"
 #include "inst.h"
 #include "table.h"
@@ -15,10 +16,11 @@
 #define QUAD_SIZE  (8)
 
 static LabelInfo *new_label(int section, uintptr_t address) {
-  LabelInfo *info = malloc(sizeof(*info));
+  LabelInfo *info = arena_alloc(sizeof(*info));
   info->section = section;
   info->flag = 0;
   info->address = address;
+  info->size = NULL;
   return info;
 }
 
@@ -45,21 +47,21 @@ bool add_label_table(Table *label_table, const Name *label, int section, bool de
 }
 
 IR *new_ir_label(const Name *label) {
-  IR *ir = malloc(sizeof(*ir));
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = IR_LABEL;
   ir->label = label;
   return ir;
 }
 
 IR *new_ir_code(const Code *code) {
-  IR *ir = malloc(sizeof(*ir));
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = IR_CODE;
   ir->code = *code;
   return ir;
 }
 
 IR *new_ir_data(const void *data, size_t size) {
-  IR *ir = malloc(sizeof(*ir));
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = IR_DATA;
   ir->data.len = size;
   ir->data.buf = (unsigned char*)data;
@@ -67,41 +69,51 @@ IR *new_ir_data(const void *data, size_t size) {
 }
 
 IR *new_ir_bss(size_t size) {
-  IR *ir = malloc(sizeof(*ir));
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = IR_BSS;
   ir->bss = size;
   return ir;
 }
 
-IR *new_ir_align(int align) {
-  IR *ir = malloc(sizeof(*ir));
+IR *new_ir_align(int align, int max_skip) {
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = IR_ALIGN;
-  ir->align = align;
+  ir->align.value = align;
+  ir->align.max_skip = max_skip;
   return ir;
 }
 
 IR *new_ir_expr(enum IrKind kind, const Expr *expr) {
-  IR *ir = malloc(sizeof(*ir));
+  IR *ir = arena_alloc(sizeof(*ir));
   ir->kind = kind;
   ir->expr = expr;
   return ir;
 }
 
-static uintptr_t align_next_section(enum SectionType sec, uintptr_t address) {
-  size_t align = section_aligns[sec];
+IR *new_ir_loc(int file, int line) {
+  IR *ir = arena_alloc(sizeof(*ir));
+  ir->kind = IR_LOC;
+  ir->loc.file = file;
+  ir->loc.line = line;
+  return ir;
+}
+
+static uintptr_t align_next_section(int sec, uintptr_t address) {
+  size_t align = get_section(sec)->align;
   if (align > 1)
     address = ALIGN(address, align);
   return address;
 }
 
-bool calc_label_address(uintptr_t start_address, Vector **section_irs, Table *label_table) {
+bool calc_label_address(uintptr_t start_address, Vector *section_irs, Table *label_table) {
   bool settle = true;
   uintptr_t address = start_address;
-  for (int sec = 0; sec < SECTION_COUNT; ++sec) {
+  for (int sec = 0; sec < section_irs->len; ++sec) {
+    Section *section = get_section(sec);
     address = align_next_section(sec, address);
-    section_start_addresses[sec] = address;
+    section->start_address = address;
 
-    Vector *irs = section_irs[sec];
+    Vector *irs = section_irs->data[sec];
     for (int i = 0, len = irs->len; i < len; ++i) {
       IR *ir = irs->data[i];
       ir->address = address;
@@ -127,10 +139,16 @@ bool calc_label_address(uintptr_t start_address, Vector **section_irs, Table *la
         address += ir->bss;
         break;
       case IR_ALIGN:
-        ir->address = address = ALIGN(address, ir->align);
-        if ((size_t)ir->align > section_aligns[sec]) {
-          section_aligns[sec] = ir->align;
-          settle = false;
+        {
+          uintptr_t aligned = ALIGN(address, ir->align.value);
+          if (ir->align.max_skip <= 0 || aligned - address <= (uintptr_t)ir->align.max_skip)
+            address = aligned;
+          ir->address = address;
+          // Section is aligned even if skipped, to keep the same padding in the output.
+          if ((size_t)ir->align.value > section->align) {
+            section->align = ir->align.value;
+            settle = false;
+          }
         }
         break;
       case IR_EXPR_BYTE:
@@ -145,6 +163,8 @@ bool calc_label_address(uintptr_t start_address, Vector **section_irs, Table *la
       case IR_EXPR_QUAD:
         address += QUAD_SIZE;
         break;
+      case IR_LOC:
+        break;
       default:  assert(false); break;
       }
     }
@@ -196,12 +216,14 @@ static Value calc_expr(Table *label_table, const Expr *expr) {
         return (Value){.label = rhs.label, .offset = lhs.offset + rhs.offset};
       }
       if (lhs.label != NULL) {
-        if (expr->kind != EX_ADD) {
+        if (expr->kind != EX_ADD && expr->kind != EX_SUB) {
           error("Illegal expression");
           return lhs;
         }
-        // label + offset
-        return (Value){.label = lhs.label, .offset = lhs.offset + rhs.offset};
+        // label + offset, label - offset
+        return (Value){.label = lhs.label,
+                       .offset = expr->kind == EX_ADD ? lhs.offset + rhs.offset
+                                                      : lhs.offset - rhs.offset};
       }
 
       assert(lhs.label == NULL && rhs.label == NULL);
@@ -246,15 +268,194 @@ static bool make_jmp_long(IR *ir) {
   return true;
 }
 
-bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *unresolved) {
+// Branch relaxation
+//
+// All jumps start short. When a jump cannot reach its target it grows to long, and only the
+// short jumps around it are checked again: a short jump whose span contains the grown one
+// is within the reach of a short offset. The address shifts made by the grown jumps are kept
+// in a Fenwick tree for each section, so IRs don't have to be walked again.
+
+#define RELAX_WINDOW  (256)  // Enough to cover the span of any short jump.
+
+typedef struct {
+  IR *ir;
+  int index;  // Index in the section IRs.
+  int target;  // Index of the target label.
+  intptr_t offset;
+  bool in_list;
+} Branch;
+
+static void shift_add(int *tree, int n, int index, int value) {
+  for (int i = index + 1; i <= n; i += i & -i)
+    tree[i - 1] += value;
+}
+
+static intptr_t shift_sum(const int *tree, int index) {  // Total shift before `index`.
+  intptr_t sum = 0;
+  for (int i = index; i > 0; i -= i & -i)
+    sum += tree[i - 1];
+  return sum;
+}
+
+static bool is_jmp(const Inst *inst) {
+  return (inst->op == JMP || (inst->op >= JO && inst->op <= JG)) && inst->src.type == DIRECT;
+}
+
+static int relax_section(Vector *irs, int sec, Table *label_table) {
+  Table label_indices;
+  table_init(&label_indices);
+  for (int i = 0; i < irs->len; ++i) {
+    IR *ir = irs->data[i];
+    if (ir->kind == IR_LABEL)
+      table_put(&label_indices, ir->label, (void*)(intptr_t)(i + 1));
+  }
+
+  int *shifts = calloc(irs->len, sizeof(*shifts));
+  Vector *branches = new_vector();
+  Vector *worklist = new_vector();
+  int grown = 0;
+  for (int i = 0; i < irs->len; ++i) {
+    IR *ir = irs->data[i];
+    if (ir->kind != IR_CODE || !is_jmp(ir->code.inst) || (ir->code.flag & INST_LONG_OFFSET))
+      continue;
+    Value value = calc_expr(label_table, ir->code.inst->src.direct.expr);
+    if (value.label == NULL)
+      continue;
+    LabelInfo *label_info = table_get(label_table, value.label);
+    intptr_t target = (intptr_t)table_get(&label_indices, value.label);
+    if (label_info == NULL || label_info->section != sec || target == 0) {
+      // Unresolved or in other section: cannot be short.
+      int len = ir->code.len;
+      make_jmp_long(ir);
+      shift_add(shifts, irs->len, i, ir->code.len - len);
+      ++grown;
+      continue;
+    }
+
+    Branch *branch = arena_alloc(sizeof(*branch));
+    branch->ir = ir;
+    branch->index = i;
+    branch->target = target - 1;
+    branch->offset = value.offset;
+    branch->in_list = true;
+    vec_push(branches, branch);
+    vec_push(worklist, (void*)(intptr_t)branches->len);  // 1-origin
+  }
+
+  while (worklist->len > 0) {
+    int b = (intptr_t)vec_pop(worklist) - 1;
+    Branch *branch = branches->data[b];
+    branch->in_list = false;
+    IR *ir = branch->ir;
+    if (ir->code.flag & INST_LONG_OFFSET)
+      continue;
+
+    IR *target_ir = irs->data[branch->target];
+    intptr_t src = ir->address + shift_sum(shifts, branch->index);
+    intptr_t dst = target_ir->address + shift_sum(shifts, branch->target) + branch->offset;
+    if (is_im8(dst - (src + ir->code.len)))
+      continue;
+
+    int len = ir->code.len;
+    make_jmp_long(ir);
+    shift_add(shifts, irs->len, branch->index, ir->code.len - len);
+    ++grown;
+
+    // Check again the short jumps around this.
+    for (int dir = -1; dir <= 1; dir += 2) {
+      for (int k = b + dir; k >= 0 && k < branches->len; k += dir) {
+        Branch *other = branches->data[k];
+        intptr_t address = other->ir->address + shift_sum(shifts, other->index);
+        if ((address > src ? address - src : src - address) > RELAX_WINDOW)
+          break;
+        if (!other->in_list && !(other->ir->code.flag & INST_LONG_OFFSET)) {
+          other->in_list = true;
+          vec_push(worklist, (void*)(intptr_t)(k + 1));
+        }
+      }
+    }
+  }
+
+  free(shifts);
+  return grown;
+}
+
+// Returns the number of jumps grown to long.
+int relax_branches(uintptr_t start_address, Vector *section_irs, Table *label_table) {
+  calc_label_address(start_address, section_irs, label_table);
+  int grown = 0;
+  for (int sec = 0; sec < section_irs->len; ++sec)
+    grown += relax_section(section_irs->data[sec], sec, label_table);
+  return grown;
+}
+
+// Reference to a label in another section is resolved by the linker.
+// `tail' is the distance from the displacement to the end of the instruction.
+static void add_other_section_reference(Vector *unresolved, const LabelInfo *label_info,
+                                        const Value *value, int sec, uintptr_t offset,
+                                        int tail) {
+  UnresolvedInfo *info = arena_alloc(sizeof(*info));
+  info->kind = UNRES_OTHER_SECTION;
+  info->label = value->label;
+  info->src_section = sec;
+  info->offset = offset;
+  info->add = label_info->address + value->offset - get_section(label_info->section)->start_address - tail;
+  vec_push(unresolved, info);
+}
+
+static const Expr *rip_relative_offset(const Operand *opr) {
+  if ((opr->type == INDIRECT || opr->type == DEREF_INDIRECT) && opr->indirect.reg.no == RIP)
+    return opr->indirect.offset;
+  return NULL;
+}
+
+static void resolve_rip_relative(IR *ir, int sec, Table *label_table, Vector *unresolved) {
+  int disp_pos = ir->code.rip_disp;
+  if (disp_pos == 0)
+    return;
+  Inst *inst = ir->code.inst;
+  const Expr *offset_expr = rip_relative_offset(&inst->src);
+  if (offset_expr == NULL)
+    offset_expr = rip_relative_offset(&inst->dst);
+  assert(offset_expr != NULL && offset_expr->kind != EX_FIXNUM);
+
+  // An immediate might follow the displacement.
+  int tail = ir->code.len - disp_pos;
+  uintptr_t address = ir->address;
+  uintptr_t start_address = get_section(sec)->start_address;
+  Value value = calc_expr(label_table, offset_expr);
+  if (value.label != NULL) {
+    LabelInfo *label_info = table_get(label_table, value.label);
+    if (label_info == NULL) {
+      UnresolvedInfo *info = arena_alloc(sizeof(*info));
+      info->kind = UNRES_EXTERN_PC32;
+      info->label = value.label;
+      info->src_section = sec;
+      info->offset = address + disp_pos - start_address;
+      info->add = value.offset - tail;
+      vec_push(unresolved, info);
+      return;
+    }
+    if (label_info->section != sec) {
+      add_other_section_reference(unresolved, label_info, &value, sec,
+                                  address + disp_pos - start_address, tail);
+      return;
+    }
+    value.offset += label_info->address;
+  }
+  intptr_t offset = value.offset - ((intptr_t)address + ir->code.len);
+  put_value(ir->code.buf + disp_pos, offset, sizeof(int32_t));
+}
+
+bool resolve_relative_address(Vector *section_irs, Table *label_table, Vector *unresolved) {
   assert(unresolved != NULL);
   Table unresolved_labels;
   table_init(&unresolved_labels);
   vec_clear(unresolved);
   bool size_upgraded = false;
-  for (int sec = 0; sec < SECTION_COUNT; ++sec) {
-    Vector *irs = section_irs[sec];
-    uintptr_t start_address = irs->len > 0 ? ((IR*)irs->data[0])->address : 0;
+  for (int sec = 0; sec < section_irs->len; ++sec) {
+    Vector *irs = section_irs->data[sec];
+    uintptr_t start_address = get_section(sec)->start_address;
     for (int i = 0, len = irs->len; i < len; ++i) {
       IR *ir = irs->data[i];
       uintptr_t address = ir->address;
@@ -263,48 +464,17 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
         {
           Inst *inst = ir->code.inst;
           switch (inst->op) {
-          case LEA:
-            if (inst->src.type == INDIRECT &&
-                inst->src.indirect.reg.no == RIP &&
-                inst->src.indirect.offset->kind != EX_FIXNUM) {
-              Value value = calc_expr(label_table, inst->src.indirect.offset);
-              if (value.label != NULL) {
-                LabelInfo *label_info = table_get(label_table, value.label);
-                if (label_info == NULL) {
-                  UnresolvedInfo *info = malloc(sizeof(*info));
-                  info->kind = UNRES_EXTERN_PC32;
-                  info->label = value.label;
-                  info->src_section = sec;
-                  info->offset = address + 3 - start_address;
-                  info->add = value.offset - 4;
-                  vec_push(unresolved, info);
-                  break;
-                }
-                if (label_info->section != sec) {
-                  Vector *irs2 = section_irs[label_info->section];
-                  uintptr_t dst_start_address = irs2->len > 0 ? ((IR *)irs2->data[0])->address : 0;
-
-                  UnresolvedInfo *info = malloc(sizeof(*info));
-                  info->kind = UNRES_OTHER_SECTION;
-                  info->label = value.label;
-                  info->src_section = sec;
-                  info->offset = address + 3 - start_address;
-                  info->add = label_info->address + value.offset - dst_start_address - 4;
-                  vec_push(unresolved, info);
-                  break;
-                }
-                value.offset += label_info->address;
-              }
-              intptr_t offset = value.offset - ((intptr_t)address + ir->code.len);
-              put_value(ir->code.buf + 3, offset, sizeof(int32_t));
-            }
+          default:
+            resolve_rip_relative(ir, sec, label_table, unresolved);
             break;
           case JMP:
           case JO: case JNO: case JB:  case JAE:
           case JE: case JNE: case JBE: case JA:
           case JS: case JNS: case JP:  case JNP:
           case JL: case JGE: case JLE: case JG:
-            if (inst->src.type == DIRECT) {
+            if (inst->src.type != DIRECT) {
+              resolve_rip_relative(ir, sec, label_table, unresolved);
+            } else {
               Value value = calc_expr(label_table, inst->src.direct.expr);
               if (value.label != NULL) {
                 LabelInfo *label_info = table_get(label_table, value.label);
@@ -312,7 +482,7 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
                   // Make unresolved label jmp to long.
                   size_upgraded |= make_jmp_long(ir);
 
-                  UnresolvedInfo *info = malloc(sizeof(*info));
+                  UnresolvedInfo *info = arena_alloc(sizeof(*info));
                   info->kind = UNRES_EXTERN;
                   info->label = value.label;
                   info->src_section = sec;
@@ -320,6 +490,11 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
                   info->add = value.offset - 4;
                   vec_push(unresolved, info);
                   break;
+                } else if (label_info->section != sec) {
+                  size_upgraded |= make_jmp_long(ir);
+                  add_other_section_reference(unresolved, label_info, &value, sec,
+                                              address + ir->code.len - 4 - start_address, 4);
+                  break;
                 } else {
                   value.offset += label_info->address;
                 }
@@ -343,12 +518,14 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
             }
             break;
           case CALL:
-            if (inst->src.type == DIRECT) {
+            if (inst->src.type != DIRECT) {
+              resolve_rip_relative(ir, sec, label_table, unresolved);
+            } else {
               Value value = calc_expr(label_table, inst->src.direct.expr);
               if (value.label != NULL) {
                 LabelInfo *label_info = table_get(label_table, value.label);
                 if (label_info == NULL) {
-                  UnresolvedInfo *info = malloc(sizeof(*info));
+                  UnresolvedInfo *info = arena_alloc(sizeof(*info));
                   info->kind = UNRES_EXTERN;
                   info->label = value.label;
                   info->src_section = sec;
@@ -357,14 +534,17 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
                   vec_push(unresolved, info);
                   break;
                 }
+                if (label_info->section != sec) {
+                  add_other_section_reference(unresolved, label_info, &value, sec,
+                                              address + 1 - start_address, 4);
+                  break;
+                }
                 value.offset += label_info->address;
               }
               intptr_t offset = value.offset - ((intptr_t)address + ir->code.len);
               put_value(ir->code.buf + 1, offset, sizeof(int32_t));
             }
             break;
-          default:
-            break;
           }
         }
         break;
@@ -375,7 +555,7 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
         {
           Value value = calc_expr(label_table, ir->expr);
           assert(value.label != NULL);
-          UnresolvedInfo *info = malloc(sizeof(*info));
+          UnresolvedInfo *info = arena_alloc(sizeof(*info));
           info->kind = UNRES_ABS64;  // TODO:
           info->label = value.label;
           info->src_section = sec;
@@ -388,6 +568,7 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
       case IR_DATA:
       case IR_BSS:
       case IR_ALIGN:
+      case IR_LOC:
         break;
       default:  assert(false); break;
       }
@@ -409,25 +590,46 @@ bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *
   return !size_upgraded;
 }
 
-void emit_irs(Vector **section_irs) {
-  for (int sec = 0; sec < SECTION_COUNT; ++sec) {
-    Vector *irs = section_irs[sec];
+static bool has_contents(const IR *ir) {
+  switch (ir->kind) {
+  case IR_CODE:
+  case IR_DATA:
+  case IR_EXPR_BYTE:
+  case IR_EXPR_WORD:
+  case IR_EXPR_LONG:
+  case IR_EXPR_QUAD:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void emit_irs(Vector *section_irs) {
+  for (int sec = 0; sec < section_irs->len; ++sec) {
+    Vector *irs = section_irs->data[sec];
+    bool nobits = get_section(sec)->type == SHT_NOBITS;
     for (int i = 0, len = irs->len; i < len; ++i) {
       IR *ir = irs->data[i];
+      if (nobits && has_contents(ir)) {
+        const Name *name = get_section(sec)->name;
+        error("Contents in nobits section: %.*s", name->bytes, name->chars);
+      }
       switch (ir->kind) {
       case IR_LABEL:
+      case IR_LOC:
         break;
       case IR_CODE:
-        add_code(ir->code.buf, ir->code.len);
+        add_section_data(sec, ir->code.buf, ir->code.len);
         break;
       case IR_DATA:
         add_section_data(sec, ir->data.buf, ir->data.len);
         break;
       case IR_BSS:
-        add_bss(ir->bss);
+        add_bss(sec, ir->bss);
         break;
       case IR_ALIGN:
-        align_section_size(sec, ir->align);
+        if (ir->address % ir->align.value == 0)  // Otherwise skipped for the limit.
+          align_section_size(sec, ir->align.value);
         break;
       case IR_EXPR_BYTE:
       case IR_EXPR_WORD:
@@ -444,3 +646,14 @@ void emit_irs(Vector **section_irs) {
     }
   }
 }
+
+size_t calc_label_size(Table *label_table, const LabelInfo *info) {
+  if (info->size == NULL)
+    return 0;
+  Value value = calc_expr(label_table, info->size);
+  if (value.label != NULL || value.offset < 0) {
+    error("Illegal size");
+    return 0;
+  }
+  return value.offset;
+}
@@ -14,11 +14,14 @@ typedef struct Vector Vector;
 
 #define LF_GLOBAL   (1 << 0)
 #define LF_DEFINED  (1 << 1)
+#define LF_FUNC     (1 << 2)  // .type @function
+#define LF_OBJECT   (1 << 3)  // .type @object
 
 typedef struct {
   int section;
   int flag;
   uintptr_t address;
+  const Expr *size;  // .size
 } LabelInfo;
 
 bool add_label_table(Table *label_table, const Name *label, int section, bool define, bool global);
@@ -53,6 +56,7 @@ enum IrKind {
   IR_EXPR_WORD,
   IR_EXPR_LONG,
   IR_EXPR_QUAD,
+  IR_LOC,  // Source location (.loc), no code.
 };
 
 typedef struct {
@@ -63,8 +67,15 @@ typedef struct {
     Data data;
     const Expr *expr;
     size_t bss;
-    int align;
+    struct {
+      int value;
+      int max_skip;  // Alignment is skipped if it needs more bytes than this, 0 for no limit.
+    } align;
     int section;
+    struct {
+      int file;
+      int line;
+    } loc;
   };
   uintptr_t address;
 } IR;
@@ -73,9 +84,13 @@ IR *new_ir_label(const Name *label);
 IR *new_ir_code(const Code *code);
 IR *new_ir_data(const void *data, size_t size);
 IR *new_ir_bss(size_t size);
-IR *new_ir_align(int align);
+IR *new_ir_align(int align, int max_skip);
 IR *new_ir_expr(enum IrKind kind, const Expr *expr);
+IR *new_ir_loc(int file, int line);
 
-bool calc_label_address(uintptr_t start_address, Vector **section_irs, Table *label_table);
-bool resolve_relative_address(Vector **section_irs, Table *label_table, Vector *unresolved);
-void emit_irs(Vector **section_irs);
+// `section_irs' is <Vector<IR*>*>, indexed by section number.
+bool calc_label_address(uintptr_t start_address, Vector *section_irs, Table *label_table);
+int relax_branches(uintptr_t start_address, Vector *section_irs, Table *label_table);
+bool resolve_relative_address(Vector *section_irs, Table *label_table, Vector *unresolved);
+void emit_irs(Vector *section_irs);
+size_t calc_label_size(Table *label_table, const LabelInfo *info);
@@ -4,10 +4,13 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stddef.h>
-#include <stdlib.h>  // strtoul
+#include <stdint.h>  // uint32_t
+#include <stdlib.h>  // calloc, strtoul
 #include <string.h>
 #include <strings.h>
 
+#include "dwarf.h"
+#include "elfutil.h"  // SHT_PROGBITS, SHF_ALLOC
 #include "gen_section.h"
 #include "ir_asm.h"
 #include "table.h"
@@ -33,6 +36,7 @@ static const char *kOpTable[] = {
   "mul",
   "div",
   "idiv",
+  "imul",
   "neg",
   "not",
   "inc",
@@ -74,6 +78,23 @@ static const char *kOpTable[] = {
   "setle",
   "setg",
 
+  "cmovo",
+  "cmovno",
+  "cmovb",
+  "cmovae",
+  "cmove",
+  "cmovne",
+  "cmovbe",
+  "cmova",
+  "cmovs",
+  "cmovns",
+  "cmovp",
+  "cmovnp",
+  "cmovl",
+  "cmovge",
+  "cmovle",
+  "cmovg",
+
   "jmp",
   "jo",
   "jno",
@@ -98,6 +119,16 @@ static const char *kOpTable[] = {
 
   "int",
   "syscall",
+  "rep",
+  "movsb",
+  "stosb",
+  "popcnt",
+  "tzcnt",
+  "bsf",
+  "prefetcht0",
+  "prefetcht1",
+  "prefetcht2",
+  "prefetchnta",
 
 #ifndef __NO_FLONUM
   "movsd",
@@ -121,6 +152,17 @@ static const char *kOpTable[] = {
 
   "cvtsd2ss",
   "cvtss2sd",
+
+  "movdqu",
+  "pxor",
+  "movdqa",
+  "paddd",
+  "pcmpeqb",
+  "pmovmskb",
+  "pshufb",
+  "vmovdqu",
+  "vmovdqa",
+  "vzeroupper",
 #endif
 };
 
@@ -208,6 +250,11 @@ static const char kXmmRegisters[][6] = {
   "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
   "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
 };
+
+static const char kYmmRegisters[][6] = {
+  "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+  "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+};
 #endif
 
 static const char *kDirectiveTable[] = {
@@ -224,6 +271,19 @@ static const char *kDirectiveTable[] = {
   "globl",
   "local",
   "extern",
+  "zero",
+  "skip",
+  "fill",
+  "incbin",
+  "type",
+  "size",
+  "file",
+  "loc",
+  "bss",
+  "pushsection",
+  "popsection",
+  "balign",
+  "p2align",
 #ifndef __NO_FLONUM
   "float",
   "double",
@@ -254,72 +314,132 @@ static bool is_reg64(enum RegType reg) {
   return reg >= RAX && reg <= R15;
 }
 
-static int find_match_index(const char **pp, const char **table, size_t count) {
-  const char *p = *pp;
-  const char *start = p;
+// Keyword lookup: open addressing hash tables, built at the first use.
+
+typedef struct {
+  const char *name;
+  int value;
+} Keyword;
+
+typedef struct {
+  Keyword *entries;
+  uint32_t mask;  // Capacity - 1, capacity is power of 2.
+  bool ignore_case;
+} KeywordTable;
+
+static uint32_t hash_keyword(const char *p, size_t n) {
+  // FNV1a, case insensitive.
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < n; ++i)
+    hash = (hash ^ (unsigned char)tolower(p[i])) * 16777619u;
+  return hash;
+}
+
+static void init_keyword_table(KeywordTable *kt, size_t count, bool ignore_case) {
+  uint32_t capacity = 16;
+  while (capacity < count * 2)
+    capacity <<= 1;
+  kt->entries = calloc(capacity, sizeof(*kt->entries));
+  kt->mask = capacity - 1;
+  kt->ignore_case = ignore_case;
+}
+
+static void put_keyword(KeywordTable *kt, const char *name, int value) {
+  uint32_t i = hash_keyword(name, strlen(name)) & kt->mask;
+  while (kt->entries[i].name != NULL)
+    i = (i + 1) & kt->mask;
+  kt->entries[i].name = name;
+  kt->entries[i].value = value;
+}
+
+static const Keyword *find_keyword(const KeywordTable *kt, const char *p, size_t n) {
+  for (uint32_t i = hash_keyword(p, n) & kt->mask; ; i = (i + 1) & kt->mask) {
+    const Keyword *keyword = &kt->entries[i];
+    const char *name = keyword->name;
+    if (name == NULL)
+      return NULL;
+    if ((kt->ignore_case ? strncasecmp(p, name, n) : strncmp(p, name, n)) == 0 && name[n] == '\0')
+      return keyword;
+  }
+}
 
+static enum Opcode find_opcode(ParseInfo *info) {
+  static KeywordTable kt;
+  if (kt.entries == NULL) {
+    size_t count = sizeof(kOpTable) / sizeof(*kOpTable);
+    init_keyword_table(&kt, count, true);
+    for (size_t i = 0; i < count; ++i)
+      put_keyword(&kt, kOpTable[i], i + 1);
+  }
+
+  const char *p = info->p;
+  const char *start = p;
   while (isalnum(*p))
     ++p;
   if (*p == '\0' || isspace(*p)) {
-    size_t n = p - start;
-    for (size_t i = 0; i < count; ++i) {
-      const char *name = table[i];
-      size_t len = strlen(name);
-      if (n == len && strncasecmp(start, name, n) == 0) {
-        *pp = skip_whitespaces(p);
-        return i;
-      }
+    const Keyword *keyword = find_keyword(&kt, start, p - start);
+    if (keyword != NULL) {
+      info->p = skip_whitespaces(p);
+      return keyword->value;
     }
   }
-  return -1;
-}
-
-static enum Opcode find_opcode(ParseInfo *info) {
-  return find_match_index(&info->p, kOpTable, sizeof(kOpTable) / sizeof(*kOpTable)) + 1;
+  return NOOP;
 }
 
 static enum DirectiveType find_directive(const char *p, size_t n) {
-  const char **table = kDirectiveTable;
-  size_t count = sizeof(kDirectiveTable) / sizeof(*kDirectiveTable);
-  for (size_t i = 0; i < count; ++i) {
-    const char *name = table[i];
-    if (strncasecmp(p, name, n) == 0 && name[n] == '\0') {
-      return i + 1;
-    }
+  static KeywordTable kt;
+  if (kt.entries == NULL) {
+    size_t count = sizeof(kDirectiveTable) / sizeof(*kDirectiveTable);
+    init_keyword_table(&kt, count, true);
+    for (size_t i = 0; i < count; ++i)
+      put_keyword(&kt, kDirectiveTable[i], i + 1);
   }
-  return -1;
+
+  const Keyword *keyword = find_keyword(&kt, p, n);
+  return keyword != NULL ? (enum DirectiveType)keyword->value : NODIRECTIVE;
 }
 
 static enum RegType find_register(const char **pp) {
-  const char *p = *pp;
-  for (int i = 0, len = sizeof(kRegisters) / sizeof(*kRegisters); i < len; ++i) {
-    const char *name = kRegisters[i].name;
-    size_t n = strlen(name);
-    if (strncmp(p, name, n) == 0) {
-      *pp = p + n;
-      return kRegisters[i].reg;
-    }
+  static KeywordTable kt;
+  if (kt.entries == NULL) {
+    size_t count = sizeof(kRegisters) / sizeof(*kRegisters);
+    init_keyword_table(&kt, count, false);
+    for (size_t i = 0; i < count; ++i)
+      put_keyword(&kt, kRegisters[i].name, kRegisters[i].reg);
   }
-  return NOREG;
+
+  const char *p = *pp;
+  const char *q;
+  for (q = p; isalnum(*q); ++q)
+    ;
+  const Keyword *keyword = find_keyword(&kt, p, q - p);
+  if (keyword == NULL)
+    return NOREG;
+  *pp = q;
+  return keyword->value;
 }
 
 #ifndef __NO_FLONUM
-static enum RegXmmType find_xmm_register(const char **pp) {
+static enum RegXmmType find_xmm_register(const char **pp, bool ymm) {
+  static KeywordTable kts[2];
+  KeywordTable *kt = &kts[ymm];
+  if (kt->entries == NULL) {
+    const char (*names)[6] = ymm ? kYmmRegisters : kXmmRegisters;
+    size_t count = sizeof(kXmmRegisters) / sizeof(*kXmmRegisters);
+    init_keyword_table(kt, count, false);
+    for (size_t i = 0; i < count; ++i)
+      put_keyword(kt, names[i], i + XMM0);
+  }
+
   const char *p = *pp;
   const char *q;
   for (q = p; isalnum(*q); ++q)
     ;
-  size_t l = q - p;
-
-  for (int i = 0, len = sizeof(kXmmRegisters) / sizeof(*kXmmRegisters); i < len; ++i) {
-    const char *name = kXmmRegisters[i];
-    size_t n = strlen(name);
-    if (l == n && strncmp(p, name, n) == 0) {
-      *pp = p + n;
-      return i + XMM0;
-    }
-  }
-  return NOREGXMM;
+  const Keyword *keyword = find_keyword(kt, p, q - p);
+  if (keyword == NULL)
+    return NOREGXMM;
+  *pp = q;
+  return keyword->value;
 }
 #endif
 
@@ -429,10 +549,10 @@ static const Name *parse_section_name(ParseInfo *info) {
 
 static enum RegType parse_direct_register(ParseInfo *info, Operand *operand) {
 #ifndef __NO_FLONUM
-  {
-    enum RegXmmType regxmm = find_xmm_register(&info->p);
+  for (int ymm = 0; ymm < 2; ++ymm) {
+    enum RegXmmType regxmm = find_xmm_register(&info->p, ymm);
     if (regxmm != NOREGXMM) {
-      operand->type = REG_XMM;
+      operand->type = ymm ? REG_YMM : REG_XMM;
       operand->regxmm = regxmm;
       return true;
     }
@@ -593,7 +713,8 @@ static bool parse_deref_indirect(ParseInfo *info, Operand *operand) {
   else
     ++info->p;
 
-  if (!is_reg64(base_reg) || (index_reg != NOREG && !is_reg64(index_reg)))
+  if (!(is_reg64(base_reg) || (base_reg == RIP && index_reg == NOREG)) ||
+      (index_reg != NOREG && !is_reg64(index_reg)))
     parse_error(info, "Register expected");
 
   if (index_reg == NOREG) {
@@ -601,7 +722,7 @@ static bool parse_deref_indirect(ParseInfo *info, Operand *operand) {
     operand->indirect.offset = offset;
     char reg_no = base_reg - RAX;
     operand->indirect.reg.size = REG64;
-    operand->indirect.reg.no = reg_no & 7;
+    operand->indirect.reg.no = base_reg != RIP ? reg_no & 7 : RIP;
     operand->indirect.reg.x = (reg_no & 8) >> 3;
   } else {
     operand->type = DEREF_INDIRECT_WITH_INDEX;
@@ -646,7 +767,7 @@ typedef struct Token {
 } Token;
 
 static Token *new_token(enum TokenKind kind) {
-  Token *token = malloc(sizeof(*token));
+  Token *token = arena_alloc(sizeof(*token));
   token->kind = kind;
   return token;
 }
@@ -735,7 +856,7 @@ static const Token *match(ParseInfo *info, enum TokenKind kind) {
 }
 
 static Expr *new_expr(enum ExprKind kind) {
-  Expr *expr = malloc(sizeof(*expr));
+  Expr *expr = arena_alloc(sizeof(*expr));
   expr->kind = kind;
   return expr;
 }
@@ -822,7 +943,7 @@ static Expr *parse_mul(ParseInfo *info) {
     if (lhs->kind == EX_FIXNUM && rhs->kind == EX_FIXNUM) {
       switch (tok->kind) {
       case TK_MUL:  lhs->fixnum *= rhs->fixnum; break;
-      case TK_DIV:  lhs->fixnum += rhs->fixnum; break;
+      case TK_DIV:  lhs->fixnum /= rhs->fixnum; break;
       default:  assert(false); break;
       }
     } else {
@@ -852,7 +973,7 @@ static Expr *parse_add(ParseInfo *info) {
     if (lhs->kind == EX_FIXNUM && rhs->kind == EX_FIXNUM) {
       switch (tok->kind) {
       case TK_ADD:  lhs->fixnum += rhs->fixnum; break;
-      case TK_SUB:  lhs->fixnum += rhs->fixnum; break;
+      case TK_SUB:  lhs->fixnum -= rhs->fixnum; break;
       default:  assert(false); break;
       }
     } else {
@@ -910,7 +1031,7 @@ static bool parse_operand(ParseInfo *info, Operand *operand) {
     if (info->p[1] == '%') {
       info->p += 2;
       if (expr == NULL) {
-        expr = malloc(sizeof(*expr));
+        expr = arena_alloc(sizeof(*expr));
         expr->kind = EX_FIXNUM;
         expr->fixnum = 0;
       }
@@ -926,6 +1047,12 @@ static bool parse_operand(ParseInfo *info, Operand *operand) {
 
 static void parse_inst(ParseInfo *info, Inst *inst) {
   enum Opcode op = find_opcode(info);
+  if (op == REP && isalpha(*info->p)) {  // rep movsb
+    op = find_opcode(info);
+    if (op != MOVSB && op != STOSB)
+      parse_error(info, "Illegal prefix");
+    inst->prefix = 0xf3;
+  }
   inst->op = op;
   if (op != NOOP) {
     if (parse_operand(info, &inst->src)) {
@@ -942,9 +1069,10 @@ static void parse_inst(ParseInfo *info, Inst *inst) {
 int current_section = SEC_CODE;
 
 Line *parse_line(ParseInfo *info) {
-  Line *line = malloc(sizeof(*line));
+  Line *line = arena_alloc(sizeof(*line));
   line->label = NULL;
   line->inst.op = NOOP;
+  line->inst.prefix = 0;
   line->inst.src.type = line->inst.dst.type = NOOPERAND;
   line->dir = NODIRECTIVE;
 
@@ -1032,9 +1160,180 @@ static size_t unescape_string(ParseInfo *info, char *dst) {
   return len;
 }
 
-void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_irs,
+// Replaces the label `.' in the expression with `dot', or just checks it if `dot' is NULL.
+static bool replace_dot_label(Expr *expr, const Name *dot) {
+  switch (expr->kind) {
+  case EX_LABEL:
+    if (expr->label->bytes == 1 && expr->label->chars[0] == '.') {
+      if (dot != NULL)
+        expr->label = dot;
+      return true;
+    }
+    return false;
+  case EX_ADD: case EX_SUB: case EX_MUL: case EX_DIV:
+    {
+      bool l = replace_dot_label(expr->bop.lhs, dot);
+      bool r = replace_dot_label(expr->bop.rhs, dot);
+      return l || r;
+    }
+  case EX_POS: case EX_NEG:
+    return replace_dot_label(expr->unary.sub, dot);
+  default:
+    return false;
+  }
+}
+
+static void put_value(Buffer *buf, long value, int size) {
+  unsigned char bytes[8];
+  for (int i = 0; i < size; ++i)
+    bytes[i] = value >> (8 * i);
+  buf_put(buf, bytes, size);
+}
+
+static void flush_buffer(Vector *irs, Buffer *buf) {
+  if (buf->size > 0)
+    vec_push(irs, new_ir_data(buf->data, buf->size));
+  buf->data = NULL;
+  buf->capa = buf->size = 0;
+}
+
+// Attributes for the section names known by convention, other sections have none of them.
+static int default_section_flag(const Name *name, int *ptype) {
+  static const struct {
+    const char *prefix;
+    int type;
+    int flag;
+  } kDefaults[] = {
+    {".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR},
+    {".rodata", SHT_PROGBITS, SHF_ALLOC},
+    {".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE},
+    {".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE},
+  };
+  for (size_t i = 0; i < sizeof(kDefaults) / sizeof(*kDefaults); ++i) {
+    size_t len = strlen(kDefaults[i].prefix);
+    if ((size_t)name->bytes >= len && strncmp(name->chars, kDefaults[i].prefix, len) == 0 &&
+        ((size_t)name->bytes == len || name->chars[len] == '.')) {
+      *ptype = kDefaults[i].type;
+      return kDefaults[i].flag;
+    }
+  }
+  *ptype = SHT_PROGBITS;
+  return 0;
+}
+
+// .section name [, "flags" [, @type]]
+static int parse_section(ParseInfo *info, Vector *section_irs) {
+  const Name *name;
+  if (*info->p == '"') {
+    const char *start = info->p + 1;
+    const char *end = strchr(start, '"');
+    if (end == NULL) {
+      parse_error(info, "`\"' expected");
+      return -1;
+    }
+    name = alloc_name(start, end, false);
+    info->p = end + 1;
+  } else {
+    name = parse_section_name(info);
+  }
+  if (name == NULL) {
+    parse_error(info, ".section: section name expected");
+    return -1;
+  }
+
+  int type;
+  int flag = default_section_flag(name, &type);
+  info->p = skip_whitespaces(info->p);
+  if (*info->p == ',') {
+    info->p = skip_whitespaces(info->p + 1);
+    if (*info->p != '"') {
+      parse_error(info, ".section: flags expected");
+      return -1;
+    }
+    flag = 0;
+    const char *p;
+    for (p = info->p + 1; *p != '"'; ++p) {
+      switch (*p) {
+      case 'a':  flag |= SHF_ALLOC; break;
+      case 'w':  flag |= SHF_WRITE; break;
+      case 'x':  flag |= SHF_EXECINSTR; break;
+      default:
+        parse_error(info, ".section: unknown flag");
+        return -1;
+      }
+    }
+    info->p = skip_whitespaces(p + 1);
+    if (*info->p == ',') {
+      info->p = skip_whitespaces(info->p + 1);
+      if (*info->p != '@' && *info->p != '%') {
+        parse_error(info, ".section: type expected");
+        return -1;
+      }
+      const char *start = ++info->p;
+      while (isalnum_(*info->p))
+        ++info->p;
+      const Name *type_name = alloc_name(start, info->p, false);
+      if (equal_name(type_name, alloc_name("progbits", NULL, false))) {
+        type = SHT_PROGBITS;
+      } else if (equal_name(type_name, alloc_name("nobits", NULL, false))) {
+        type = SHT_NOBITS;
+      } else {
+        parse_error(info, ".section: unknown type");
+        return -1;
+      }
+    }
+  }
+
+  int secno = find_section(name);
+  if (secno < 0) {
+    secno = add_section(name, type, flag);
+    assert(secno == section_irs->len);
+    vec_push(section_irs, new_vector());
+  }
+  return secno;
+}
+
+// .align bytes[, fill[, max]], .balign is same, and .p2align takes power of 2.
+// Padding is NOPs in code, and zeros in data: explicit fill value is not supported.
+static void parse_align(ParseInfo *info, Vector *irs, bool p2) {
+  long align;
+  if (!immediate(&info->p, &align) || align < 0 || (p2 && align >= 32)) {
+    parse_error(info, ".align: number expected");
+    return;
+  }
+  if (p2)
+    align = 1L << align;
+  else if (align == 0)
+    align = 1;
+  if (!IS_POWER_OF_2(align)) {
+    parse_error(info, ".align: power of 2 expected");
+    return;
+  }
+
+  long max_skip = 0;
+  info->p = skip_whitespaces(info->p);
+  if (*info->p == ',') {
+    info->p = skip_whitespaces(info->p + 1);
+    if (*info->p != ',' && *info->p != '\0') {
+      parse_error(info, ".align: fill value is not supported");
+      return;
+    }
+    if (*info->p == ',') {
+      info->p = skip_whitespaces(info->p + 1);
+      if (!immediate(&info->p, &max_skip) || max_skip < 0) {
+        parse_error(info, ".align: maximum skip expected");
+        return;
+      }
+    }
+  }
+  if (align > 1)
+    vec_push(irs, new_ir_align(align, max_skip));
+}
+
+void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector *section_irs,
                       Table *label_table) {
-  Vector *irs = section_irs[current_section];
+  static Vector *section_stack;  // <int>, .pushsection and .popsection
+  Vector *irs = section_irs->data[current_section];
 
   switch (dir) {
   case DT_ASCII:
@@ -1044,7 +1343,7 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
       ++info->p;
       const char *p = info->p;
       size_t len = unescape_string(info, NULL);
-      char *str = malloc(len);
+      char *str = arena_alloc(len);
       info->p = p;  // Again.
       unescape_string(info, str);
 
@@ -1077,14 +1376,19 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
       }
 
       enum SectionType sec = SEC_BSS;
-      irs = section_irs[sec];
+      irs = section_irs->data[sec];
       if (align > 1)
-        vec_push(irs, new_ir_align(align));
+        vec_push(irs, new_ir_align(align, 0));
       vec_push(irs, new_ir_label(label));
       vec_push(irs, new_ir_bss(count));
 
       if (!add_label_table(label_table, label, sec, true, false))
         return;
+      LabelInfo *label_info = table_get(label_table, label);
+      label_info->flag |= LF_OBJECT;
+      Expr *size = new_expr(EX_FIXNUM);
+      size->fixnum = count;
+      label_info->size = size;
     }
     break;
 
@@ -1096,13 +1400,14 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
     current_section = SEC_DATA;
     break;
 
+  case DT_BSS:
+    current_section = SEC_BSS;
+    break;
+
   case DT_ALIGN:
-    {
-      long align;
-      if (!immediate(&info->p, &align))
-        parse_error(info, ".align: number expected");
-      vec_push(irs, new_ir_align(align));
-    }
+  case DT_BALIGN:
+  case DT_P2ALIGN:
+    parse_align(info, irs, dir == DT_P2ALIGN);
     break;
 
   case DT_BYTE:
@@ -1110,29 +1415,154 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
   case DT_LONG:
   case DT_QUAD:
     {
-      Expr *expr = parse_expr(info);
-      if (expr == NULL) {
-        parse_error(info, "expression expected");
-        break;
-      }
+      // Comma separated values: consecutive constants are packed into one data.
+      int size = 1 << (dir - DT_BYTE);
+      Buffer buf = {.data = NULL, .capa = 0, .size = 0};
+      for (;;) {
+        Expr *expr = parse_expr(info);
+        if (expr == NULL) {
+          parse_error(info, "expression expected");
+          break;
+        }
 
 #ifndef __NO_FLONUM
-      assert(expr->kind != EX_FLONUM);
+        assert(expr->kind != EX_FLONUM);
 #endif
-      if (expr->kind == EX_FIXNUM) {
-        // TODO: Target endian.
-        long value = expr->fixnum;
-        int size = 1 << (dir - DT_BYTE);
-        unsigned char *buf = malloc(size);
-        for (int i = 0; i < size; ++i)
-          buf[i] = value >> (8 * i);
-        vec_push(irs, new_ir_data(buf, size));
-      } else {
-        vec_push(irs, new_ir_expr((enum IrKind)(IR_EXPR_BYTE + (dir - DT_BYTE)), expr));
+        if (expr->kind == EX_FIXNUM) {
+          // TODO: Target endian.
+          put_value(&buf, expr->fixnum, size);
+        } else {
+          flush_buffer(irs, &buf);
+          vec_push(irs, new_ir_expr((enum IrKind)(IR_EXPR_BYTE + (dir - DT_BYTE)), expr));
+        }
+
+        info->p = skip_whitespaces(info->p);
+        if (*info->p != ',')
+          break;
+        ++info->p;
+      }
+      flush_buffer(irs, &buf);
+    }
+    break;
+
+  case DT_ZERO:
+  case DT_SKIP:
+    {
+      long size, value = 0;
+      if (!immediate(&info->p, &size) || size < 0) {
+        parse_error(info, "size expected");
+        break;
+      }
+      info->p = skip_whitespaces(info->p);
+      if (*info->p == ',') {
+        info->p = skip_whitespaces(info->p + 1);
+        if (!immediate(&info->p, &value)) {
+          parse_error(info, "fill value expected");
+          break;
+        }
+      }
+      if (size > 0) {
+        if (get_section(current_section)->type == SHT_NOBITS) {
+          vec_push(irs, new_ir_bss(size));
+        } else {
+          unsigned char *buf = arena_alloc(size);
+          memset(buf, value, size);
+          vec_push(irs, new_ir_data(buf, size));
+        }
       }
     }
     break;
 
+  case DT_FILL:
+    {
+      // .fill repeat, size, value: value is 4 bytes at most, like GNU as.
+      long repeat, size = 1, value = 0;
+      if (!immediate(&info->p, &repeat) || repeat < 0) {
+        parse_error(info, "repeat count expected");
+        break;
+      }
+      info->p = skip_whitespaces(info->p);
+      if (*info->p == ',') {
+        info->p = skip_whitespaces(info->p + 1);
+        if (!immediate(&info->p, &size) || size < 0 || size > 8) {
+          parse_error(info, "size expected");
+          break;
+        }
+        info->p = skip_whitespaces(info->p);
+        if (*info->p == ',') {
+          info->p = skip_whitespaces(info->p + 1);
+          if (!immediate(&info->p, &value)) {
+            parse_error(info, "fill value expected");
+            break;
+          }
+        }
+      }
+      if (size > 4)
+        value &= 0xffffffffL;
+      Buffer buf = {.data = NULL, .capa = 0, .size = 0};
+      for (long i = 0; i < repeat; ++i)
+        put_value(&buf, value, size);
+      flush_buffer(irs, &buf);
+    }
+    break;
+
+  case DT_INCBIN:
+    {
+      if (*info->p != '"') {
+        parse_error(info, ".incbin: file name expected");
+        break;
+      }
+      ++info->p;
+      const char *p = info->p;
+      size_t len = unescape_string(info, NULL);
+      char *path = malloc(len + 1);
+      info->p = p;  // Again.
+      unescape_string(info, path);
+      path[len] = '\0';
+
+      long skip = 0, count = -1;
+      info->p = skip_whitespaces(info->p);
+      if (*info->p == ',') {
+        info->p = skip_whitespaces(info->p + 1);
+        if (!immediate(&info->p, &skip) || skip < 0) {
+          parse_error(info, ".incbin: skip expected");
+          break;
+        }
+        info->p = skip_whitespaces(info->p);
+        if (*info->p == ',') {
+          info->p = skip_whitespaces(info->p + 1);
+          if (!immediate(&info->p, &count) || count < 0) {
+            parse_error(info, ".incbin: count expected");
+            break;
+          }
+        }
+      }
+
+      FILE *fp = fopen(path, "rb");
+      if (fp == NULL) {
+        parse_error(info, ".incbin: cannot open file");
+        break;
+      }
+      Buffer buf = {.data = NULL, .capa = 0, .size = 0};
+      if (skip > 0 && fseek(fp, skip, SEEK_SET) != 0)
+        parse_error(info, ".incbin: cannot seek");
+      for (;;) {
+        unsigned char chunk[4096];
+        size_t n = sizeof(chunk);
+        if (count >= 0 && (size_t)count - buf.size < n)
+          n = count - buf.size;
+        if (n == 0)
+          break;
+        size_t read = fread(chunk, 1, n, fp);
+        buf_put(&buf, chunk, read);
+        if (read < n)
+          break;
+      }
+      fclose(fp);
+      flush_buffer(irs, &buf);
+    }
+    break;
+
 #ifndef __NO_FLONUM
   case DT_FLOAT:
   case DT_DOUBLE:
@@ -1153,7 +1583,7 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
         break;
       }
       int size = dir == DT_FLOAT ? sizeof(float) : sizeof(double);
-      unsigned char *buf = malloc(size);
+      unsigned char *buf = arena_alloc(size);
       if (dir == DT_FLOAT) {
         float fval = value;
         memcpy(buf, (void*)&fval, sizeof(fval));  // TODO: Endian
@@ -1182,22 +1612,143 @@ void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_
     break;
 
   case DT_SECTION:
+  case DT_PUSHSECTION:
+    {
+      int secno = parse_section(info, section_irs);
+      if (secno < 0)
+        return;
+      if (dir == DT_PUSHSECTION) {
+        if (section_stack == NULL)
+          section_stack = new_vector();
+        vec_push(section_stack, (void*)(intptr_t)current_section);
+      }
+      current_section = secno;
+    }
+    break;
+
+  case DT_POPSECTION:
+    if (section_stack == NULL || section_stack->len <= 0) {
+      parse_error(info, ".popsection without .pushsection");
+      return;
+    }
+    current_section = (intptr_t)vec_pop(section_stack);
+    break;
+
+  case DT_EXTERN:
+    break;
+
+  case DT_TYPE:
     {
-      const Name *name = parse_section_name(info);
-      if (name == NULL) {
-        parse_error(info, ".section: section name expected");
+      // .type label, @function|@object
+      const Name *label = parse_label(info);
+      if (label == NULL) {
+        parse_error(info, ".type: label expected");
+        return;
+      }
+      info->p = skip_whitespaces(info->p);
+      if (*info->p != ',') {
+        parse_error(info, ".type: `,' expected");
         return;
       }
-      if (equal_name(name, alloc_name(".rodata", NULL, false))) {
-        current_section = SEC_RODATA;
+      info->p = skip_whitespaces(info->p + 1);
+      if (*info->p == '@' || *info->p == '%')
+        ++info->p;
+      const char *p = info->p;
+      while (isalpha(*info->p))
+        ++info->p;
+      int flag;
+      if (info->p - p == 8 && strncmp(p, "function", 8) == 0) {
+        flag = LF_FUNC;
+      } else if (info->p - p == 6 && strncmp(p, "object", 6) == 0) {
+        flag = LF_OBJECT;
+      } else if (info->p - p == 6 && strncmp(p, "notype", 6) == 0) {
+        flag = 0;
       } else {
-        parse_error(info, "Unknown section name");
+        parse_error(info, ".type: unknown type");
         return;
       }
+
+      if (!add_label_table(label_table, label, current_section, false, false))
+        err = true;
+      LabelInfo *label_info = table_get(label_table, label);
+      label_info->flag = (label_info->flag & ~(LF_FUNC | LF_OBJECT)) | flag;
     }
     break;
 
-  case DT_EXTERN:
+  case DT_SIZE:
+    {
+      // .size label, expr: `.' in expr means the current location.
+      const Name *label = parse_label(info);
+      if (label == NULL) {
+        parse_error(info, ".size: label expected");
+        return;
+      }
+      info->p = skip_whitespaces(info->p);
+      if (*info->p != ',') {
+        parse_error(info, ".size: `,' expected");
+        return;
+      }
+      info->p = skip_whitespaces(info->p + 1);
+      Expr *expr = parse_expr(info);
+      if (expr == NULL) {
+        parse_error(info, ".size: expression expected");
+        return;
+      }
+      if (replace_dot_label(expr, NULL)) {
+        static int dot_count;
+        char buf[32];
+        snprintf(buf, sizeof(buf), ".L.size%d", ++dot_count);
+        const Name *dot = alloc_name(buf, NULL, true);
+        vec_push(irs, new_ir_label(dot));
+        if (!add_label_table(label_table, dot, current_section, true, false))
+          err = true;
+        replace_dot_label(expr, dot);
+      }
+
+      if (!add_label_table(label_table, label, current_section, false, false))
+        err = true;
+      LabelInfo *label_info = table_get(label_table, label);
+      label_info->size = expr;
+    }
+    break;
+
+  case DT_FILE:
+    {
+      // .file "name" (ignored), or .file index "name" for line number information.
+      long index;
+      if (!immediate(&info->p, &index))
+        break;
+      info->p = skip_whitespaces(info->p);
+      if (index <= 0 || *info->p != '"') {
+        parse_error(info, ".file: file number and name expected");
+        return;
+      }
+      ++info->p;
+      const char *p = info->p;
+      size_t len = unescape_string(info, NULL);
+      char *filename = malloc(len + 1);
+      info->p = p;  // Again.
+      unescape_string(info, filename);
+      filename[len] = '\0';
+      add_debug_file(index, filename);
+    }
+    break;
+
+  case DT_LOC:
+    {
+      // .loc file line [column]: following options are ignored.
+      long file, line;
+      if (!immediate(&info->p, &file) || file <= 0) {
+        parse_error(info, ".loc: file number expected");
+        return;
+      }
+      info->p = skip_whitespaces(info->p);
+      if (!immediate(&info->p, &line) || line < 0) {
+        parse_error(info, ".loc: line number expected");
+        return;
+      }
+      vec_push(irs, new_ir_loc(file, line));
+    }
     break;
 
   default:
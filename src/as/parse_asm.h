@@ -27,10 +27,10 @@ typedef struct Line {
   enum DirectiveType dir;
 } Line;
 
-extern int current_section;  // enum SectionType
+extern int current_section;  // Section number
 extern bool err;
 
 Line *parse_line(ParseInfo *info);
-void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector **section_irs,
+void handle_directive(ParseInfo *info, enum DirectiveType dir, Vector *section_irs,
                       Table *label_table);
 void parse_error(const ParseInfo *info, const char *message);
@@ -4,7 +4,10 @@
 #include <inttypes.h>  // PRIdPTR
 #include <stdarg.h>
 #include <stdint.h>  // intptr_t
+#include <stdlib.h>  // malloc
+#include <string.h>
 
+#include "peephole.h"
 #include "table.h"
 #include "util.h"
 
@@ -13,6 +16,12 @@
 #endif
 
 static FILE *emit_fp;
+static Vector *asm_lines;  // Instructions and labels which are not output yet.
+
+// Line number information: `.loc' is output when the location changes.
+static Table *loc_files;  // <Name*, file number>
+static int cur_file, cur_lineno;  // Location for instructions to be emitted.
+static int out_file, out_lineno;  // Location last output.
 
 char *fmt(const char *s, ...) {
   static char buf[4][64];
@@ -94,21 +103,69 @@ char *mangle(char *label) {
 #endif
 }
 
-void emit_asm2(const char *op, const char *operand1, const char *operand2) {
-  if (operand1 == NULL) {
-    fprintf(emit_fp, "\t%s\n", op);
-  } else if (operand2 == NULL) {
-    fprintf(emit_fp, "\t%s %s\n", op, operand1);
-  } else {
-    fprintf(emit_fp, "\t%s %s, %s\n", op, operand1, operand2);
+static char *dup_operand(const char *s) {
+  return s != NULL ? strdup(s) : NULL;
+}
+
+static void push_asm_line(enum AsmLineKind kind, const char *op, const char *operand1,
+                          const char *operand2) {
+  AsmLine *line = malloc(sizeof(*line));
+  line->kind = kind;
+  line->op = strdup(op);
+  line->operand1 = dup_operand(operand1);
+  line->operand2 = dup_operand(operand2);
+  parse_asm_operand(&line->opr1, operand1);
+  parse_asm_operand(&line->opr2, operand2);
+  line->file = line->lineno = 0;
+  if (kind == AL_INST && op[0] != '.') {
+    line->file = cur_file;
+    line->lineno = cur_lineno;
   }
+  vec_push(asm_lines, line);
+}
+
+void emit_asm2(const char *op, const char *operand1, const char *operand2) {
+  push_asm_line(AL_INST, op, operand1, operand2);
 }
 
 void emit_label(const char *label) {
-  fprintf(emit_fp, "%s:\n", label);
+  push_asm_line(AL_LABEL, label, NULL, NULL);
+}
+
+void emit_flush(void) {
+  peephole_optimize(asm_lines);
+
+  for (int i = 0; i < asm_lines->len; ++i) {
+    AsmLine *line = asm_lines->data[i];
+    switch (line->kind) {
+    case AL_INST:
+      if (line->file != 0 && (line->file != out_file || line->lineno != out_lineno)) {
+        fprintf(emit_fp, "\t.loc %d %d\n", line->file, line->lineno);
+        out_file = line->file;
+        out_lineno = line->lineno;
+      }
+      if (line->operand1 == NULL) {
+        fprintf(emit_fp, "\t%s\n", line->op);
+      } else if (line->operand2 == NULL) {
+        fprintf(emit_fp, "\t%s %s\n", line->op, line->operand1);
+      } else {
+        fprintf(emit_fp, "\t%s %s, %s\n", line->op, line->operand1, line->operand2);
+      }
+      break;
+    case AL_LABEL:
+      fprintf(emit_fp, "%s:\n", line->op);
+      break;
+    }
+    free(line->op);
+    free(line->operand1);
+    free(line->operand2);
+    free(line);
+  }
+  vec_clear(asm_lines);
 }
 
 void emit_comment(const char *comment, ...) {
+  emit_flush();
   if (comment == NULL) {
     fprintf(emit_fp, "\n");
     return;
@@ -122,19 +179,33 @@ void emit_comment(const char *comment, ...) {
   va_end(ap);
 }
 
+void emit_loc(const char *filename, int lineno) {
+  if (loc_files == NULL)
+    loc_files = alloc_table();
+  const Name *name = alloc_name(filename, NULL, false);
+  intptr_t file = (intptr_t)table_get(loc_files, name);
+  if (file == 0) {
+    file = loc_files->count + 1;
+    table_put(loc_files, name, (void*)file);
+    StringBuffer sb;
+    sb_init(&sb);
+    sb_append(&sb, fmt("%d \"", (int)file), NULL);
+    escape_string(filename, strlen(filename), &sb);
+    sb_append(&sb, "\"", NULL);
+    push_asm_line(AL_INST, ".file", sb_to_string(&sb), NULL);
+  }
+  cur_file = file;
+  cur_lineno = lineno;
+}
+
 void emit_align(int align) {
   if (align <= 1)
     return;
+  emit_flush();
   fprintf(emit_fp, "\t.align %d\n", align);
 }
 
-void emit_align_p2(int align) {
-  if (align <= 1)
-    return;
-
-  // On Apple platform,
-  // .align directive is actually .p2align,
-  // so it has to find power of 2.
+static int log2_of(int align) {
   assert(IS_POWER_OF_2(align));
   int bit, x = align;
   for (bit = 0;; ++bit) {
@@ -142,9 +213,28 @@ void emit_align_p2(int align) {
     if (x <= 0)
       break;
   }
-  fprintf(emit_fp, "\t.p2align %d\n", bit);
+  return bit;
+}
+
+void emit_align_p2(int align) {
+  if (align <= 1)
+    return;
+  emit_flush();
+
+  // On Apple platform,
+  // .align directive is actually .p2align,
+  // so it has to find power of 2.
+  fprintf(emit_fp, "\t.p2align %d\n", log2_of(align));
+}
+
+void emit_align_code(int align, int max_skip) {
+  if (align <= 1)
+    return;
+  int bit = log2_of(align);
+  push_asm_line(AL_INST, ".p2align", max_skip > 0 ? fmt("%d,,%d", bit, max_skip) : num(bit), NULL);
 }
 
 void init_emit(FILE *fp) {
   emit_fp = fp;
+  asm_lines = new_vector();
 }
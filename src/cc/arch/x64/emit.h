@@ -26,4 +26,9 @@ void emit_label(const char *label);
 void emit_asm2(const char *op, const char *operand1, const char *operand2);
 void emit_align(int align);
 void emit_align_p2(int align);
+// Align code with NOPs, skipped if more than `max_skip' bytes are needed (0: no limit).
+// Kept in the pending lines, so the peephole optimization sees through it.
+void emit_align_code(int align, int max_skip);
 void emit_comment(const char *comment, ...);
+void emit_loc(const char *filename, int lineno);  // Source location of following instructions.
+void emit_flush(void);  // Optimize and output pending instructions.
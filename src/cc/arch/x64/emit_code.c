@@ -72,9 +72,59 @@ static void eval_initial_value(Expr *expr, Expr **pvar, Fixnum *poffset) {
   }
 }
 
+// Static data is emitted compactly: values of the same size are packed into a line,
+// and consecutive zeros are merged into `.zero`.
+
+#define DATA_PACK_COUNT  (16)
+
+static struct {
+  int size;  // Size of pending values.
+  int count;
+  StringBuffer values;
+  size_t zeros;  // Pending zero bytes.
+} data_pack;
+
+static void flush_data(void) {
+  static const char *kDataOps[] = {".byte", ".word", NULL, ".long", NULL, NULL, NULL, ".quad"};
+  if (data_pack.count > 0) {
+    EMIT_ASM1(kDataOps[data_pack.size - 1], sb_to_string(&data_pack.values));
+    sb_clear(&data_pack.values);
+    data_pack.count = 0;
+  }
+  if (data_pack.zeros > 0) {
+    _ZERO(NUM(data_pack.zeros));
+    data_pack.zeros = 0;
+  }
+}
+
+static void emit_zeros(size_t size) {
+  if (data_pack.count > 0)
+    flush_data();
+  data_pack.zeros += size;
+}
+
+static void emit_data(int size, const char *value) {
+  assert(size == 1 || size == 2 || size == 4 || size == 8);
+  if (data_pack.zeros > 0 ||
+      (data_pack.count > 0 && (data_pack.size != size || data_pack.count >= DATA_PACK_COUNT)))
+    flush_data();
+  if (data_pack.values.elems == NULL)
+    sb_init(&data_pack.values);
+  if (data_pack.count > 0)
+    sb_append(&data_pack.values, ", ", NULL);
+  sb_append(&data_pack.values, strdup(value), NULL);  // `value` might be a temporary buffer.
+  data_pack.size = size;
+  ++data_pack.count;
+}
+
 static void construct_initial_value(const Type *type, const Initializer *init) {
   assert(init == NULL || init->kind != IK_DOT);
 
+  if (init == NULL) {
+    emit_zeros(type_size(type));
+    return;
+  }
+
   switch (type->kind) {
 #ifndef __NO_FLONUM
   case TY_FLONUM:
@@ -82,37 +132,29 @@ static void construct_initial_value(const Type *type, const Initializer *init) {
     case FL_DOUBLE:
       {
         union {double f; uint64_t h;} v;
-        v.f = 0;
-        if (init != NULL) {
-          assert(init->kind == IK_SINGLE);
-          Expr *value = init->single;
-          if (!(is_const(value) && is_flonum(value->type)))
-            error("Illegal initializer: constant number expected");
-          v.f = value->flonum;
-        }
-#if 0
-        _DOUBLE(FLONUM(v.d));
-#else
-        _QUAD(HEXNUM(v.h));
-#endif
+        assert(init->kind == IK_SINGLE);
+        Expr *value = init->single;
+        if (!(is_const(value) && is_flonum(value->type)))
+          error("Illegal initializer: constant number expected");
+        v.f = value->flonum;
+        if (v.h == 0)
+          emit_zeros(sizeof(v.h));
+        else
+          emit_data(sizeof(v.h), HEXNUM(v.h));
       }
       break;
     case FL_FLOAT:
       {
         union {float f; uint32_t h;} v;
-        v.f = 0;
-        if (init != NULL) {
-          assert(init->kind == IK_SINGLE);
-          Expr *value = init->single;
-          if (!(is_const(value) && is_flonum(value->type)))
-            error("Illegal initializer: constant number expected");
-          v.f = value->flonum;
-        }
-#if 0
-        _FLOAT(FLONUM(v.f));
-#else
-        _LONG(HEXNUM(v.h));
-#endif
+        assert(init->kind == IK_SINGLE);
+        Expr *value = init->single;
+        if (!(is_const(value) && is_flonum(value->type)))
+          error("Illegal initializer: constant number expected");
+        v.f = value->flonum;
+        if (v.h == 0)
+          emit_zeros(sizeof(v.h));
+        else
+          emit_data(sizeof(v.h), HEXNUM(v.h));
       }
       break;
     }
@@ -123,74 +165,58 @@ static void construct_initial_value(const Type *type, const Initializer *init) {
     {
       Expr *var = NULL;
       Fixnum offset = 0;
-      if (init != NULL) {
-        assert(init->kind == IK_SINGLE);
-        eval_initial_value(init->single, &var, &offset);
-      }
-      const char *output;
+      assert(init->kind == IK_SINGLE);
+      eval_initial_value(init->single, &var, &offset);
+      int size = type_size(type);
       if (var == NULL) {
-        output = NUM(offset);
-      } else {
-        const Name *name = var->var.name;
-        Scope *scope;
-        VarInfo *varinfo = scope_find(var->var.scope, name, &scope);
+        if (offset == 0)
+          emit_zeros(size);
+        else
+          emit_data(size, NUM(offset));
+        break;
+      }
+
+      const Name *name = var->var.name;
+      Scope *scope;
+      VarInfo *varinfo = scope_find(var->var.scope, name, &scope);
+      assert(varinfo != NULL);
+      if (!is_global_scope(scope) && varinfo->storage & VS_STATIC) {
+        varinfo = varinfo->static_.gvar;
         assert(varinfo != NULL);
-        if (!is_global_scope(scope) && varinfo->storage & VS_STATIC) {
-          varinfo = varinfo->static_.gvar;
-          assert(varinfo != NULL);
-          name = varinfo->name;
-        }
+        name = varinfo->name;
+      }
 
-        char *label = fmt_name(name);
-        if ((varinfo->storage & VS_STATIC) == 0)
-          label = MANGLE(label);
-        label = quote_label(label);
+      char *label = fmt_name(name);
+      if ((varinfo->storage & VS_STATIC) == 0)
+        label = MANGLE(label);
+      label = quote_label(label);
 
-        if (offset == 0) {
-          output = label;
-        } else {
-          output = fmt("%s + %" PRIdPTR, label, offset);
-        }
-      }
-      if (type->kind == TY_PTR) {
-        _QUAD(output);
-      } else {
-        switch (type->fixnum.kind) {
-        case FX_CHAR:  _BYTE(output); break;
-        case FX_SHORT: _WORD(output); break;
-        case FX_LONG:  _QUAD(output); break;
-        case FX_LLONG: _QUAD(output); break;
-        default:
-          assert(false);
-          // Fallthrough
-        case FX_INT: case FX_ENUM:
-          _LONG(output);
-          break;
-        }
-      }
+      if (offset == 0)
+        emit_data(size, label);
+      else
+        emit_data(size, fmt("%s + %" PRIdPTR, label, offset));
     }
     break;
   case TY_ARRAY:
-    if (init == NULL || init->kind == IK_MULTI) {
+    if (init->kind == IK_MULTI) {
       const Type *elem_type = type->pa.ptrof;
+      size_t elem_size = type_size(elem_type);
       ssize_t index = 0;
-      if (init != NULL) {
-        Vector *init_array = init->multi;
-        for (ssize_t i = 0; i < init_array->len; ++i, ++index) {
-          const Initializer *init_elem = init_array->data[i];
-          if (init_elem->kind == IK_ARR) {
-            ssize_t next = init_elem->arr.index->fixnum;
-            for (ssize_t j = index; j < next; ++j)
-              construct_initial_value(elem_type, NULL);
-            index = next;
-            init_elem = init_elem->arr.value;
-          }
-          construct_initial_value(elem_type, init_elem);
+      Vector *init_array = init->multi;
+      for (ssize_t i = 0; i < init_array->len; ++i, ++index) {
+        const Initializer *init_elem = init_array->data[i];
+        if (init_elem->kind == IK_ARR) {
+          ssize_t next = init_elem->arr.index->fixnum;
+          if (next > index)
+            emit_zeros((next - index) * elem_size);
+          index = next;
+          init_elem = init_elem->arr.value;
         }
+        construct_initial_value(elem_type, init_elem);
       }
       // Padding
-      for (ssize_t i = index, n = type->pa.length; i < n; ++i)
-        construct_initial_value(elem_type, NULL);
+      if (type->pa.length > index)
+        emit_zeros((type->pa.length - index) * elem_size);
       break;
     }
     if (init->kind == IK_SINGLE && is_char_type(type->pa.ptrof)) {
@@ -201,18 +227,20 @@ static void construct_initial_value(const Type *type, const Initializer *init) {
         if (src_size > size)
           src_size = size;
 
-        UNUSED(size);
-        StringBuffer sb;
-        sb_init(&sb);
-        sb_append(&sb, "\"", NULL);
-        escape_string(e->str.buf, src_size, &sb);
-        if (size > src_size) {
-          const char NULCHR[] = "\\0";
-          for (size_t i = 0, n = size - src_size; i < n; ++i)
-            sb_append(&sb, NULCHR, NULL);
+        // Trailing nul characters are merged into the padding.
+        while (src_size > 0 && e->str.buf[src_size - 1] == '\0')
+          --src_size;
+        if (src_size > 0) {
+          flush_data();
+          StringBuffer sb;
+          sb_init(&sb);
+          sb_append(&sb, "\"", NULL);
+          escape_string(e->str.buf, src_size, &sb);
+          sb_append(&sb, "\"", NULL);
+          _ASCII(sb_to_string(&sb));
         }
-        sb_append(&sb, "\"", NULL);
-        _ASCII(sb_to_string(&sb));
+        if (size > src_size)
+          emit_zeros(size - src_size);
         break;
       }
     }
@@ -221,29 +249,19 @@ static void construct_initial_value(const Type *type, const Initializer *init) {
   case TY_STRUCT:
     {
       const StructInfo *sinfo = type->struct_.info;
-      assert(init == NULL || (init->kind == IK_MULTI && init->multi->len == sinfo->members->len));
+      assert(init->kind == IK_MULTI && init->multi->len == sinfo->members->len);
       int count = 0;
       int offset = 0;
       for (int i = 0, n = sinfo->members->len; i < n; ++i) {
         const MemberInfo *member = sinfo->members->data[i];
-        const Initializer *mem_init;
-        if (init == NULL) {
-          if (sinfo->is_union)
-            continue;
-          mem_init = NULL;
-        } else {
-          mem_init = init->multi->data[i];
-        }
+        const Initializer *mem_init = init->multi->data[i];
         if (mem_init != NULL || !sinfo->is_union) {
-          int align = align_size(member->type);
-          if (offset % align != 0) {
-            EMIT_ALIGN(align);
-            offset = ALIGN(offset, align);
-          }
+          int aligned = ALIGN(offset, align_size(member->type));
+          if (aligned > offset)
+            emit_zeros(aligned - offset);
           construct_initial_value(member->type, mem_init);
           ++count;
-          offset = ALIGN(offset, align);
-          offset += type_size(member->type);
+          offset = aligned + type_size(member->type);
         }
       }
       if (sinfo->is_union && count <= 0) {
@@ -252,21 +270,10 @@ static void construct_initial_value(const Type *type, const Initializer *init) {
         offset += type_size(member->type);
       }
 
+      // Put padding.
       size_t size = type_size(type);
-      if (size != (size_t)offset) {
-        // Put padding.
-        int d = size - offset;
-        switch (d) {
-        case 1:  _BYTE(NUM(0)); break;
-        case 2:  _WORD(NUM(0)); break;
-        case 4:  _LONG(NUM(0)); break;
-        case 8:  _QUAD(NUM(0)); break;
-        default:
-          for (int i = 0; i < d; ++i)
-            _BYTE(NUM(0));
-          break;
-        }
-      }
+      if (size > (size_t)offset)
+        emit_zeros(size - offset);
     }
     break;
   default:
@@ -296,9 +303,11 @@ static void emit_varinfo(const VarInfo *varinfo, const Initializer *init) {
 
   if (init != NULL) {
     EMIT_ALIGN(align_size(varinfo->type));
+    _TYPE(label, "@object");
+    _SIZE(label, NUM(type_size(varinfo->type)));
     EMIT_LABEL(label);
-    //size_t size = type_size(varinfo->type);
     construct_initial_value(varinfo->type, init);
+    flush_data();
   } else {
     size_t size = type_size(varinfo->type);
     if (size < 1)
@@ -343,7 +352,7 @@ static void put_args_to_stack(Function *func) {
     int offset = varinfo->local.reg->offset;
     assert(size < (int)(sizeof(kRegTable) / sizeof(*kRegTable)) &&
            kRegTable[size] != NULL);
-    MOV(kRegTable[size][0], OFFSET_INDIRECT(offset, RBP, NULL, 1));
+    MOV(kRegTable[size][0], frame_indirect(offset));
     ++arg_index;
   }
 
@@ -352,113 +361,198 @@ static void put_args_to_stack(Function *func) {
   if (params == NULL)
     return;
 
-  int len = params->len;
-  if (!func->type->func.vaargs) {
+  if (func->type->func.vaargs) {
+    // Fill the register save area: register parameters are also located there.
+    for (int i = arg_index; i < MAX_REG_ARGS; ++i) {
+      int offset = (i - MAX_REG_ARGS - MAX_FREG_ARGS) * WORD_SIZE;
+      MOV(kReg64s[i], frame_indirect(offset));
+    }
 #ifndef __NO_FLONUM
-    int farg_index = 0;
+    for (int i = 0; i < MAX_FREG_ARGS; ++i) {
+      int offset = (i - MAX_FREG_ARGS) * WORD_SIZE;
+      MOVSD(kFReg64s[i], frame_indirect(offset));
+    }
 #endif
-    for (int i = 0; i < len; ++i) {
-      const VarInfo *varinfo = params->data[i];
-      const Type *type = varinfo->type;
-      int offset = varinfo->local.reg->offset;
+  }
 
-      if (is_stack_param(type))
-        continue;
+  ArgClassifier classifier = {.ireg_index = arg_index};
+  for (int i = 0; i < params->len; ++i) {
+    const VarInfo *varinfo = params->data[i];
+    const Type *type = varinfo->type;
+    int offset = varinfo->local.reg->offset;
+    ArgInfo info;
+    classify_arg(&classifier, type, &info);
+    if (info.offset >= 0)
+      continue;
 
+    if (info.sregs.count > 0) {
+      for (int k = 0; k < info.sregs.count; ++k) {
+        int n = info.size - k * WORD_SIZE;
+        if (n > WORD_SIZE)
+          n = WORD_SIZE;
+        int index = info.sregs.index[k];
 #ifndef __NO_FLONUM
-      if (is_flonum(type)) {
-        if (farg_index < MAX_FREG_ARGS) {
-          switch (type->flonum.kind) {
-          case FL_FLOAT:   MOVSS(kFReg64s[farg_index], OFFSET_INDIRECT(offset, RBP, NULL, 1)); break;
-          case FL_DOUBLE:  MOVSD(kFReg64s[farg_index], OFFSET_INDIRECT(offset, RBP, NULL, 1)); break;
-          default: assert(false); break;
-          }
-          ++farg_index;
+        if (info.sregs.flonum[k]) {
+          store_eightbyte(NULL, kFReg64s[index], n, offset + k * WORD_SIZE);
+          continue;
         }
-        continue;
-      }
 #endif
+        const char *regs[] = {kReg8s[index], kReg16s[index], kReg32s[index], kReg64s[index]};
+        store_eightbyte(regs, NULL, n, offset + k * WORD_SIZE);
+      }
+      continue;
+    }
+    if (func->type->func.vaargs)
+      continue;
 
-      switch (type->kind) {
-      case TY_FIXNUM:
-      case TY_PTR:
-        break;
+#ifndef __NO_FLONUM
+    if (info.is_flonum) {
+      switch (type->flonum.kind) {
+      case FL_FLOAT:   MOVSS(kFReg64s[info.reg_index], frame_indirect(offset)); break;
+      case FL_DOUBLE:  MOVSD(kFReg64s[info.reg_index], frame_indirect(offset)); break;
       default: assert(false); break;
       }
+      continue;
+    }
+#endif
 
-      if (arg_index < MAX_REG_ARGS) {
-        int size = type_size(type);
-        assert(size < (int)(sizeof(kRegTable) / sizeof(*kRegTable)) &&
-               kRegTable[size] != NULL);
-        MOV(kRegTable[size][arg_index], OFFSET_INDIRECT(offset, RBP, NULL, 1));
-        ++arg_index;
-      }
+    switch (type->kind) {
+    case TY_FIXNUM:
+    case TY_PTR:
+      break;
+    default: assert(false); break;
     }
-  } else {  // vaargs
-    int ip = 0;
-    for (int i = arg_index; i < MAX_REG_ARGS; ++i) {
-      const VarInfo *varinfo = NULL;
-      while (ip < len) {
-        const VarInfo *p = params->data[ip++];
-        const Type *type = p->type;
-        if (!is_stack_param(type)
-#ifndef __NO_FLONUM
-            && !is_flonum(type)
+
+    int size = info.size;
+    assert(size < (int)(sizeof(kRegTable) / sizeof(*kRegTable)) &&
+           kRegTable[size] != NULL);
+    MOV(kRegTable[size][info.reg_index], frame_indirect(offset));
+  }
+}
+
+bool omit_frame_pointer = true;
+bool emit_debug_line;
+bool function_sections;
+int align_functions = 16;
+int align_loops = 16;
+
+static char *code_section;  // Section of the current function, NULL for `.text'.
+
+void emit_code_section(void) {
+  if (code_section != NULL)
+    _SECTION(code_section);
+  else
+    _TEXT();
+}
+
+static void set_code_section(Function *func) {
+  free(code_section);
+  code_section = NULL;
+#ifndef __APPLE__
+  const char *prefix = (func->flag & FUNCF_COLD) ? ".text.unlikely" : NULL;
+  if (function_sections) {
+    code_section = fmt("%s.%.*s", prefix != NULL ? prefix : ".text", func->name->bytes,
+                       func->name->chars);
+  } else if (prefix != NULL) {
+    code_section = (char*)prefix;
+  } else {
+    return;
+  }
+  code_section = strdup(fmt("%s,\"ax\",@progbits", quote_label(code_section)));
+#else
+  (void)func;
 #endif
-        ) {
-          varinfo = p;
-          break;
-        }
-      }
-      if (varinfo != NULL) {
-        const Type *type = varinfo->type;
-        assert(type->kind == TY_FIXNUM || type->kind == TY_PTR);
-        int size = type_size(type);
-        assert(size < (int)(sizeof(kRegTable) / sizeof(*kRegTable)) &&
-               kRegTable[size] != NULL);
-        int offset = varinfo->local.reg->offset;
-        MOV(kRegTable[size][i], OFFSET_INDIRECT(offset, RBP, NULL, 1));
-      } else {
-        int size = type_size(&tyVoidPtr);
-        assert(size < (int)(sizeof(kRegTable) / sizeof(*kRegTable)) &&
-               kRegTable[size] != NULL);
-        int offset = (i - MAX_REG_ARGS - MAX_FREG_ARGS) * WORD_SIZE;
-        MOV(kRegTable[size][i], OFFSET_INDIRECT(offset, RBP, NULL, 1));
+}
+
+#define RED_ZONE_SIZE  (128)
+
+// Frame pointer can be omitted if the stack pointer is kept unchanged in the function body:
+// no call (except tail call), no alloca, and no inline assembly which might touch the stack.
+static bool can_omit_frame_pointer(Function *func) {
+  if (!omit_frame_pointer || (func->flag & FUNCF_STACK_MODIFIED) || func->type->func.vaargs)
+    return false;
+
+  BBContainer *bbcon = ((FuncBackend*)func->extra)->bbcon;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      switch (ir->kind) {
+      case IR_PRECALL: case IR_SUBSP: case IR_ASM:
+        return false;
+      case IR_CALL:
+        if (!ir->call.tail)
+          return false;
+        break;
+      default: break;
       }
     }
+  }
+  return true;
+}
 
-#ifndef __NO_FLONUM
-    ip = 0;
-    for (int i = 0; i < MAX_FREG_ARGS; ++i) {
-      const VarInfo *varinfo = NULL;
-      while (ip < len) {
-        const VarInfo *p = params->data[ip++];
-        const Type *type = p->type;
-        if (!is_stack_param(type)
-            && is_flonum(type)
-        ) {
-          varinfo = p;
-          break;
-        }
-      }
-      if (varinfo != NULL) {
-        const Type *type = varinfo->type;
-        assert(type->kind == TY_FLONUM);
-        int offset = varinfo->local.reg->offset;
-        switch (type->flonum.kind) {
-        case FL_FLOAT:   MOVSS(kFReg64s[i], OFFSET_INDIRECT(offset, RBP, NULL, 1)); break;
-        case FL_DOUBLE:  MOVSD(kFReg64s[i], OFFSET_INDIRECT(offset, RBP, NULL, 1)); break;
-        default: assert(false); break;
-        }
-      } else {
-        int offset = (i - MAX_FREG_ARGS) * WORD_SIZE;
-        MOVSD(kFReg64s[i], OFFSET_INDIRECT(offset, RBP, NULL, 1));
-      }
+static Function *emitting_func;
+static int frame_sp_offset;  // Size of frame allocated by `sub` when frame pointer is omitted.
+
+void emit_epilogue(void) {
+  Function *func = emitting_func;
+  FuncBackend *fnbe = func->extra;
+  if (frame_pointer_omitted) {
+    pop_callee_save_regs(fnbe->ra->used_reg_bits);
+    if (frame_sp_offset > 0) {
+      ADD(IM(frame_sp_offset), RSP);
+      stackpos -= frame_sp_offset;
     }
-#endif
+  } else {
+    if (func->flag & FUNCF_STACK_MODIFIED) {
+      // Stack pointer might be changed if alloca is used, so it need to be recalculated.
+      int callee_saved_count = count_callee_save_regs(fnbe->ra->used_reg_bits);
+      LEA(OFFSET_INDIRECT(callee_saved_count * -WORD_SIZE - fnbe->ra->frame_size, RBP, NULL, 1),
+          RSP);
+    }
+
+    pop_callee_save_regs(fnbe->ra->used_reg_bits);
+
+    MOV(RBP, RSP);
+    stackpos -= fnbe->ra->frame_size;
+    POP(RBP); POP_STACK_POS();
   }
 }
 
+static char *ascii_string(const char *str, size_t size) {
+  StringBuffer sb;
+  sb_init(&sb);
+  sb_append(&sb, "\"", NULL);
+  escape_string(str, size, &sb);
+  sb_append(&sb, "\\0\"", NULL);
+  return sb_to_string(&sb);
+}
+
+// Counter record for `-fprofile-generate`, which has the same layout as the one in the runtime.
+static void emit_profile_record(Function *func) {
+  FuncBackend *fnbe = func->extra;
+  const Name *name_label = alloc_label();
+  const Name *path_label = alloc_label();
+  _RODATA();
+  EMIT_LABEL(fmt_name(name_label));
+  _ASCII(ascii_string(func->name->chars, func->name->bytes));
+  EMIT_LABEL(fmt_name(path_label));
+  _ASCII(ascii_string(profile_generate_path, strlen(profile_generate_path)));
+
+  _DATA();
+  EMIT_ALIGN(WORD_SIZE);
+  EMIT_LABEL(fmt_name(fnbe->prof_record));
+  _QUAD(NUM(0));  // Link, set at registration.
+  _QUAD(fmt_name(name_label));
+  _QUAD(fmt_name(path_label));
+  _QUAD(NUM(fnbe->prof_count));
+  _QUAD(fmt_name(fnbe->prof_counters));
+
+  char *counters = fmt_name(fnbe->prof_counters);
+  _LOCAL(counters);
+  _COMM(counters, fmt("%d,%d", fnbe->prof_count * WORD_SIZE, WORD_SIZE));
+}
+
 static void emit_defun(Function *func) {
   if (func->scopes == NULL)  // Prototype definition
     return;
@@ -466,7 +560,8 @@ static void emit_defun(Function *func) {
   assert(stackpos == 8);
 
   emit_comment(NULL);
-  _TEXT();
+  set_code_section(func);
+  emit_code_section();
 
   bool global = true;
   const VarInfo *varinfo = scope_find(global_scope, func->name, NULL);
@@ -482,6 +577,9 @@ static void emit_defun(Function *func) {
     label = quote_label(label);
     _LOCAL(label);
   }
+  label = strdup(label);  // Used for `.size' at the end.
+  _TYPE(label, "@function");
+  emit_align_code(align_functions, 0);
   EMIT_LABEL(label);
 
   bool no_stmt = true;
@@ -497,42 +595,56 @@ static void emit_defun(Function *func) {
     }
   }
 
+  if (emit_debug_line && func->ident->line != NULL) {
+    // Attribute the prologue to the function definition, like gcc.
+    emit_loc(func->ident->line->filename, func->ident->line->lineno);
+  }
+
   // Prologue
   // Allocate variable bufer.
   FuncBackend *fnbe = func->extra;
-  int callee_saved_count = 0;
-  if (!no_stmt) {
+  int frame_size = fnbe->ra->frame_size;
+  emitting_func = func;
+  frame_sp_offset = 0;
+  frame_pointer_omitted = !no_stmt && can_omit_frame_pointer(func);
+  if (frame_pointer_omitted) {
+    // Keep the frame at the same place as it would be with %rbp (8 bytes below return address),
+    // and put it in the red zone if it fits and no register is pushed.
+    if (count_callee_save_regs(fnbe->ra->used_reg_bits) > 0 ||
+        frame_size + WORD_SIZE > RED_ZONE_SIZE)
+      frame_sp_offset = frame_size + WORD_SIZE;
+    if (frame_sp_offset > 0) {
+      SUB(IM(frame_sp_offset), RSP);
+      stackpos += frame_sp_offset;
+    }
+
+    put_args_to_stack(func);
+
+    push_callee_save_regs(fnbe->ra->used_reg_bits);
+  } else if (!no_stmt) {
     PUSH(RBP); PUSH_STACK_POS();
     MOV(RSP, RBP);
-    if (fnbe->ra->frame_size > 0) {
-      SUB(IM(fnbe->ra->frame_size), RSP);
-      stackpos += fnbe->ra->frame_size;
+    if (frame_size > 0) {
+      SUB(IM(frame_size), RSP);
+      stackpos += frame_size;
     }
 
     put_args_to_stack(func);
 
     // Callee save.
-    callee_saved_count = push_callee_save_regs(fnbe->ra->used_reg_bits);
+    push_callee_save_regs(fnbe->ra->used_reg_bits);
   }
 
   emit_bb_irs(fnbe->bbcon);
 
   // Epilogue
-  if (!no_stmt) {
-    if (func->flag & FUNCF_STACK_MODIFIED) {
-      // Stack pointer might be changed if alloca is used, so it need to be recalculated.
-      LEA(OFFSET_INDIRECT(callee_saved_count * -WORD_SIZE - fnbe->ra->frame_size, RBP, NULL, 1),
-          RSP);
-    }
-
-    pop_callee_save_regs(((FuncBackend*)func->extra)->ra->used_reg_bits);
-
-    MOV(RBP, RSP);
-    stackpos -= ((FuncBackend*)func->extra)->ra->frame_size;
-    POP(RBP); POP_STACK_POS();
-  }
+  if (!no_stmt)
+    emit_epilogue();
+  frame_pointer_omitted = false;
+  emitting_func = NULL;
 
   RET();
+  _SIZE(label, fmt(".-%s", label));
 
   // Output static local variables.
   for (int i = 0; i < func->scopes->len; ++i) {
@@ -549,6 +661,9 @@ static void emit_defun(Function *func) {
     }
   }
 
+  if (fnbe->prof_record != NULL)
+    emit_profile_record(func);
+
   assert(stackpos == 8);
 }
 
@@ -560,7 +675,8 @@ void emit_code(Vector *decls) {
 
     switch (decl->kind) {
     case DCL_DEFUN:
-      emit_defun(decl->defun.func);
+      if (!(decl->defun.func->flag & FUNCF_COLD))
+        emit_defun(decl->defun.func);
       break;
     case DCL_VARDECL:
       {
@@ -587,4 +703,12 @@ void emit_code(Vector *decls) {
       break;
     }
   }
+
+  // Functions which are never executed in the profile are put apart from the others.
+  for (int i = 0, len = decls->len; i < len; ++i) {
+    Declaration *decl = decls->data[i];
+    if (decl != NULL && decl->kind == DCL_DEFUN && (decl->defun.func->flag & FUNCF_COLD))
+      emit_defun(decl->defun.func);
+  }
+  emit_flush();
 }
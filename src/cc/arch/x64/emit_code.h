@@ -2,6 +2,15 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 typedef struct Vector Vector;
 
+extern bool omit_frame_pointer;  // Don't set up %rbp for functions without call.
+extern bool emit_debug_line;  // Output `.loc' for instructions.
+extern bool function_sections;  // Put each function into its own `.text.<name>' section.
+extern int align_functions;  // Alignment of function entries, 0 for none.
+extern int align_loops;  // Alignment of loop heads, 0 for none.
+
 void emit_code(Vector *decls);
+void emit_code_section(void);  // Switch back to the section of the current function.
@@ -2,7 +2,10 @@
 
 #include <assert.h>
 #include <stdlib.h>  // malloc
+#include <string.h>
 
+#include "emit_code.h"
+#include "lexer.h"
 #include "regalloc.h"
 #include "table.h"
 #include "util.h"
@@ -14,6 +17,15 @@ static void push_caller_save_regs(unsigned short living, int base);
 static void pop_caller_save_regs(unsigned short living);
 
 int stackpos = 8;
+bool frame_pointer_omitted;
+
+// Frame slot [rbp + offset]. Without frame pointer, %rbp is virtual:
+// it would be at stackpos 16 (just below return address), so the slot is addressed from %rsp.
+char *frame_indirect(int offset) {
+  if (frame_pointer_omitted)
+    return OFFSET_INDIRECT(offset + stackpos - 2 * WORD_SIZE, RSP, NULL, 1);
+  return OFFSET_INDIRECT(offset, RBP, NULL, 1);
+}
 
 static enum ConditionKind invert_cond(enum ConditionKind cond) {
   assert(COND_EQ <= cond && cond <= COND_UGT);
@@ -40,12 +52,46 @@ const char *kRegSizeTable[][7] = {
 const char *kRegATable[] = {AL, AX, EAX, RAX};
 const char *kRegDTable[] = {DL, DX, EDX, RDX};
 
+static const char *kArgReg32s[] = {EDI, ESI, EDX, ECX, R8D, R9D};
+static const char *kArgReg64s[] = {RDI, RSI, RDX, RCX, R8, R9};
+#ifndef __NO_FLONUM
+static const char *kArgFReg64s[] = {XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7};
+#endif
+
 #ifndef __NO_FLONUM
 #define SZ_FLOAT   (4)
 #define SZ_DOUBLE  (8)
 const char *kFReg64s[7] = {XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14};
 #endif
 
+// Store the lower `size` bytes of the register into the frame, without writing beyond:
+// `regs` are the names of the register for each size (8, 16, 32, 64bit), or `freg` for SSE.
+void store_eightbyte(const char **regs, const char *freg, int size, int offset) {
+#ifndef __NO_FLONUM
+  if (freg != NULL) {
+    switch (size) {
+    case SZ_FLOAT:  MOVSS(freg, frame_indirect(offset)); break;
+    case SZ_DOUBLE: MOVSD(freg, frame_indirect(offset)); break;
+    default: assert(false); break;
+    }
+    return;
+  }
+#else
+  UNUSED(freg);
+#endif
+  // Odd size is split into smaller stores, shifting the register.
+  for (int pow = 3; size > 0; --pow) {
+    int n = 1 << pow;
+    if (n > size)
+      continue;
+    MOV(regs[pow], frame_indirect(offset));
+    offset += n;
+    size -= n;
+    if (size > 0)
+      SHR(IM(n * 8), regs[3]);
+  }
+}
+
 #define CALLEE_SAVE_REG_COUNT  ((int)(sizeof(kCalleeSaveRegs) / sizeof(*kCalleeSaveRegs)))
 const int kCalleeSaveRegs[] = {
   0,  // RBX
@@ -70,56 +116,391 @@ const int kCallerSaveFRegs[] = {0, 1, 2, 3, 4, 5};
 static const int kPow2Table[] = {-1, 0, 1, -1, 2, -1, -1, -1, 3};
 #define kPow2TableSize ((int)(sizeof(kPow2Table) / sizeof(*kPow2Table)))
 
+// Block copy and clear:
+//   Small and medium sizes are unrolled into 16byte (movdqu) and 8/4/2/1byte moves,
+//   the last fraction is done by overlapping the preceding bytes if possible.
+//   Large sizes use `rep movsb/stosb`, which is fast on recent processors.
+#define BLOCK_UNROLL_MAX  (128)
+
 static void ir_memcpy(int dst_reg, int src_reg, ssize_t size) {
   const char *dst = kReg64s[dst_reg];
   const char *src = kReg64s[src_reg];
 
-  // Break %rcx, %dl
-  switch (size) {
-  case 1:
-    MOV(INDIRECT(src, NULL, 1), DL);
-    MOV(DL, INDIRECT(dst, NULL, 1));
-    break;
-  case 2:
-    MOV(INDIRECT(src, NULL, 1), DX);
-    MOV(DX, INDIRECT(dst, NULL, 1));
-    break;
-  case 4:
-    MOV(INDIRECT(src, NULL, 1), EDX);
-    MOV(EDX, INDIRECT(dst, NULL, 1));
-    break;
-  case 8:
-    MOV(INDIRECT(src, NULL, 1), RDX);
-    MOV(RDX, INDIRECT(dst, NULL, 1));
-    break;
-  default:
-    {
-      const Name *name = alloc_label();
-      const char *label = fmt_name(name);
-      PUSH(src);
-      PUSH(dst);
-      MOV(IM(size), RCX);
-      EMIT_LABEL(label);
-      MOV(INDIRECT(src, NULL, 1), DL);
-      MOV(DL, INDIRECT(dst, NULL, 1));
-      INC(src);
-      INC(dst);
-      DEC(RCX);
-      JNE(label);
-      POP(dst);
-      POP(src);
+  if (size > BLOCK_UNROLL_MAX) {
+    // Break %rsi, %rdi, %rcx
+    MOV(src, RSI);
+    MOV(dst, RDI);
+    MOV(IM(size), ECX);
+    REP();
+    MOVSB();
+    return;
+  }
+
+  // Break %xmm0, %rdx
+  ssize_t offset = 0;
+#ifndef __NO_FLONUM
+  if (size >= 16) {
+    for (; offset + 16 <= size; offset += 16) {
+      MOVDQU(OFFSET_INDIRECT(offset, src, NULL, 1), XMM0);
+      MOVDQU(XMM0, OFFSET_INDIRECT(offset, dst, NULL, 1));
     }
-    break;
+    if (offset < size) {
+      offset = size - 16;
+      MOVDQU(OFFSET_INDIRECT(offset, src, NULL, 1), XMM0);
+      MOVDQU(XMM0, OFFSET_INDIRECT(offset, dst, NULL, 1));
+    }
+    return;
+  }
+#endif
+  for (int pow = 3; pow >= 0; --pow) {
+    int n = 1 << pow;
+    for (; offset + n <= size; offset += n) {
+      MOV(OFFSET_INDIRECT(offset, src, NULL, 1), kRegDTable[pow]);
+      MOV(kRegDTable[pow], OFFSET_INDIRECT(offset, dst, NULL, 1));
+    }
+    if (pow == 3 && offset > 0 && offset < size) {
+      offset = size - n;
+      MOV(OFFSET_INDIRECT(offset, src, NULL, 1), kRegDTable[pow]);
+      MOV(kRegDTable[pow], OFFSET_INDIRECT(offset, dst, NULL, 1));
+      break;
+    }
+  }
+}
+
+static void ir_clear(int dst_reg, ssize_t size) {
+  const char *dst = kReg64s[dst_reg];
+
+  if (size > BLOCK_UNROLL_MAX) {
+    // Break %rdi, %rcx, %rax
+    MOV(dst, RDI);
+    MOV(IM(size), ECX);
+    XOR(EAX, EAX);
+    REP();
+    STOSB();
+    return;
+  }
+
+  // Break %xmm0, %rax
+  ssize_t offset = 0;
+#ifndef __NO_FLONUM
+  if (size >= 16) {
+    PXOR(XMM0, XMM0);
+    for (; offset + 16 <= size; offset += 16)
+      MOVDQU(XMM0, OFFSET_INDIRECT(offset, dst, NULL, 1));
+    if (offset < size)
+      MOVDQU(XMM0, OFFSET_INDIRECT(size - 16, dst, NULL, 1));
+    return;
+  }
+#endif
+  if (size > 0)
+    XOR(EAX, EAX);
+  for (int pow = 3; pow >= 0; --pow) {
+    int n = 1 << pow;
+    for (; offset + n <= size; offset += n)
+      MOV(kRegATable[pow], OFFSET_INDIRECT(offset, dst, NULL, 1));
+    if (pow == 3 && offset > 0 && offset < size) {
+      MOV(kRegATable[pow], OFFSET_INDIRECT(size - n, dst, NULL, 1));
+      break;
+    }
+  }
+}
+
+// Multiplication and division by constant
+
+static int count_trailing_zeros(uintptr_t x) {
+  assert(x != 0);
+  int n = 0;
+  for (; !(x & 1); x >>= 1)
+    ++n;
+  return n;
+}
+
+static intptr_t normalize_const(intptr_t value, int pow, bool is_unsigned) {
+  switch (pow) {
+  case 0:  return is_unsigned ? (intptr_t)(unsigned char)value : (intptr_t)(signed char)value;
+  case 1:  return is_unsigned ? (intptr_t)(unsigned short)value : (intptr_t)(short)value;
+  case 2:  return is_unsigned ? (intptr_t)(unsigned int)value : (intptr_t)(int)value;
+  default: return value;
+  }
+}
+
+// Magic number for signed division, from "Hacker's Delight" 10-1.
+static intptr_t signed_magic(intptr_t d, int bits, int *pshift) {
+  const uintptr_t mask = bits >= 64 ? ~(uintptr_t)0 : ((uintptr_t)1 << bits) - 1;
+  const uintptr_t two_n1 = (uintptr_t)1 << (bits - 1);
+  uintptr_t ad = (d < 0 ? -(uintptr_t)d : (uintptr_t)d) & mask;
+  uintptr_t t = two_n1 + (d < 0 ? 1 : 0);
+  uintptr_t anc = t - 1 - t % ad;
+  uintptr_t q1 = two_n1 / anc, r1 = two_n1 - q1 * anc;
+  uintptr_t q2 = two_n1 / ad, r2 = two_n1 - q2 * ad;
+  uintptr_t delta;
+  int p = bits - 1;
+  do {
+    ++p;
+    q1 = (q1 * 2) & mask;
+    r1 = (r1 * 2) & mask;
+    if (r1 >= anc) {
+      q1 = (q1 + 1) & mask;
+      r1 -= anc;
+    }
+    q2 = (q2 * 2) & mask;
+    r2 = (r2 * 2) & mask;
+    if (r2 >= ad) {
+      q2 = (q2 + 1) & mask;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  uintptr_t m = (q2 + 1) & mask;
+  if (d < 0)
+    m = -m & mask;
+  *pshift = p - bits;
+  return bits >= 64 ? (intptr_t)m : (intptr_t)(int)m;
+}
+
+// Magic number for unsigned division, from "Hacker's Delight" 10-2.
+static uintptr_t unsigned_magic(uintptr_t d, int bits, int *pshift, bool *padd) {
+  const uintptr_t mask = bits >= 64 ? ~(uintptr_t)0 : ((uintptr_t)1 << bits) - 1;
+  const uintptr_t two_n1 = (uintptr_t)1 << (bits - 1);
+  uintptr_t nc = mask - (-d & mask) % d;
+  uintptr_t q1 = two_n1 / nc, r1 = two_n1 - q1 * nc;
+  uintptr_t q2 = (two_n1 - 1) / d, r2 = (two_n1 - 1) - q2 * d;
+  uintptr_t delta;
+  bool add = false;
+  int p = bits - 1;
+  do {
+    ++p;
+    if (r1 >= nc - r1) {
+      q1 = (2 * q1 + 1) & mask;
+      r1 = (2 * r1 - nc) & mask;
+    } else {
+      q1 = (2 * q1) & mask;
+      r1 = (2 * r1) & mask;
+    }
+    if (r2 + 1 >= d - r2) {
+      if (q2 >= two_n1 - 1)
+        add = true;
+      q2 = (2 * q2 + 1) & mask;
+      r2 = (2 * r2 + 1 - d) & mask;
+    } else {
+      if (q2 >= two_n1)
+        add = true;
+      q2 = (2 * q2) & mask;
+      r2 = (2 * r2 + 1) & mask;
+    }
+    delta = d - 1 - r2;
+  } while (p < 2 * bits && (q1 < delta || (q1 == delta && r1 == 0)));
+
+  *pshift = p - bits;
+  *padd = add;
+  return (q2 + 1) & mask;
+}
+
+// dst *= value
+static void mul_const(int phys, int pow, intptr_t value) {
+  const char *dst = kRegSizeTable[pow][phys];
+  // 8 and 16 bit multiplications are done in 32 bit registers: lower bits are same.
+  const char *wdst = kRegSizeTable[pow < 2 ? 2 : pow][phys];
+  if (value == 0) {
+    XOR(kReg32s[phys], kReg32s[phys]);
+    return;
+  }
+
+  uintptr_t abs = value < 0 ? -(uintptr_t)value : (uintptr_t)value;
+  int shift = count_trailing_zeros(abs);
+  uintptr_t odd = abs >> shift;
+  if (odd == 1 || odd == 3 || odd == 5 || odd == 9) {
+    if (odd != 1)
+      LEA(INDIRECT(kReg64s[phys], kReg64s[phys], odd - 1), wdst);
+    if (shift > 0)
+      SHL(IM(shift), dst);
+    if (value < 0)
+      NEG(dst);
+  } else if (is_im32(value)) {
+    IMUL(IM(value), wdst);
+  } else {
+    MOV(IM(value), kReg64s[WORK_REG_NO]);
+    IMUL(kReg64s[WORK_REG_NO], wdst);
+  }
+}
+
+// dst = dst / value, or dst % value
+// Returns false if the divisor is not suitable.
+static bool div_const(int phys, int pow, intptr_t value, bool is_unsigned, bool mod) {
+  // 8 and 16 bit division are left to DIV/IDIV.
+  if (pow < 2)
+    return false;
+
+  const int bits = 8 << pow;
+  const char **regs = kRegSizeTable[pow];
+  const char *dst = regs[phys];
+  const char *work = regs[WORK_REG_NO];
+  const char *a = kRegATable[pow];
+  const char *d = kRegDTable[pow];
+
+  if (!is_unsigned) {
+    if (value == 1 || value == -1) {
+      if (mod)
+        XOR(kReg32s[phys], kReg32s[phys]);
+      else if (value == -1)
+        NEG(dst);
+      return true;
+    }
+
+    uintptr_t abs = value < 0 ? -(uintptr_t)value : (uintptr_t)value;
+    if (bits < 64)
+      abs &= ((uintptr_t)1 << bits) - 1;
+    if ((abs & (abs - 1)) == 0) {
+      // Add (2^k - 1) to negative dividend to round toward zero.
+      int k = count_trailing_zeros(abs);
+      intptr_t mask = normalize_const(-(intptr_t)abs, pow, false);
+      if (mod && !is_im32(mask))
+        return false;
+      MOV(dst, work);
+      if (k > 1)
+        SAR(IM(bits - 1), work);
+      SHR(IM(bits - k), work);
+      if (!mod) {
+        ADD(work, dst);
+        SAR(IM(k), dst);
+        if (value < 0)
+          NEG(dst);
+      } else {
+        ADD(dst, work);
+        AND(IM(mask), work);
+        SUB(work, dst);
+      }
+      return true;
+    }
+
+    int shift;
+    intptr_t magic = signed_magic(value, bits, &shift);
+    MOV(IM(magic), a);
+    IMUL1(dst);
+    if (value > 0 && magic < 0)
+      ADD(dst, d);
+    else if (value < 0 && magic > 0)
+      SUB(dst, d);
+    if (shift > 0)
+      SAR(IM(shift), d);
+    MOV(d, a);
+    SHR(IM(bits - 1), a);
+    ADD(a, d);
+  } else {
+    uintptr_t divisor = value;
+    if (bits < 64)
+      divisor &= ((uintptr_t)1 << bits) - 1;
+    // Divisor larger than half of the range: quotient is 0 or 1.
+    if (divisor >> (bits - 1))
+      return false;
+
+    if ((divisor & (divisor - 1)) == 0) {
+      int k = count_trailing_zeros(divisor);
+      if (!mod) {
+        if (k > 0)
+          SHR(IM(k), dst);
+      } else {
+        intptr_t mask = divisor - 1;
+        if (is_im32(mask)) {
+          AND(IM(mask), dst);
+        } else {
+          MOV(IM(mask), work);
+          AND(work, dst);
+        }
+      }
+      return true;
+    }
+
+    int shift;
+    bool add;
+    uintptr_t magic = unsigned_magic(divisor, bits, &shift, &add);
+    MOV(IM(magic), a);
+    MUL(dst);
+    if (!add) {
+      if (shift > 0)
+        SHR(IM(shift), d);
+    } else {
+      assert(shift > 0);
+      MOV(dst, a);
+      SUB(d, a);
+      SHR(IM(1), a);
+      ADD(a, d);
+      if (shift > 1)
+        SHR(IM(shift - 1), d);
+    }
+  }
+
+  // Quotient is in %rdx.
+  if (!mod) {
+    MOV(d, dst);
+  } else {
+    if (is_im32(value)) {
+      IMUL(IM(value), d);
+    } else {
+      MOV(IM(value), work);
+      IMUL(work, d);
+    }
+    SUB(d, dst);
+  }
+  return true;
+}
+
+// Memory operand for LOAD, STORE and LEA: [base + index * scale + disp]
+static const char *mem_operand(IR *ir, VReg *base, VReg *index) {
+  intptr_t disp = ir->value;
+  if (ir->mem.label != NULL) {
+    assert(base == NULL && index == NULL);
+    char *label = fmt_name(ir->mem.label);
+    if (ir->mem.global)
+      label = MANGLE(label);
+    label = quote_label(label);
+    if (disp != 0)
+      label = fmt("%s%+d", label, (int)disp);
+    return LABEL_INDIRECT(label, RIP);
+  }
+
+  const char *base_reg;
+  if (ir->mem.frame != NULL) {
+    assert(base == NULL);
+    VReg *frame = ir->mem.frame;
+    disp += (frame->flag & VRF_CONST) ? frame->fixnum : frame->offset;
+    base_reg = RBP;
+    if (frame_pointer_omitted) {
+      disp += stackpos - 2 * WORD_SIZE;
+      base_reg = RSP;
+    }
+  } else {
+    assert(base != NULL && !(base->flag & VRF_CONST));
+    base_reg = kReg64s[base->phys];
+  }
+  assert(is_im32(disp));
+  if (index == NULL)
+    return OFFSET_INDIRECT(disp, base_reg, NULL, 1);
+  assert(!(index->flag & VRF_CONST));
+  return OFFSET_INDIRECT(disp, base_reg, kReg64s[index->phys], ir->mem.scale);
+}
+
+#ifndef __NO_FLONUM
+// Number of floating-point register arguments for the call.
+static int count_freg_args(IR *ir) {
+  int freg = 0;
+  for (int i = 0; i < ir->call.total_arg_count; ++i) {
+    const VRegType *vtype = ir->call.arg_vtypes[i];
+    if (!(vtype->flag & VRTF_NON_REG) && (vtype->flag & VRTF_FLONUM) && freg < MAX_FREG_ARGS)
+      ++freg;
   }
+  return freg;
 }
+#endif
 
 static void ir_out(IR *ir) {
   switch (ir->kind) {
   case IR_BOFS:
     if (ir->opr1->flag & VRF_CONST)
-      LEA(OFFSET_INDIRECT(ir->opr1->fixnum, RBP, NULL, 1), kReg64s[ir->dst->phys]);
+      LEA(frame_indirect(ir->opr1->fixnum), kReg64s[ir->dst->phys]);
     else
-      LEA(OFFSET_INDIRECT(ir->opr1->offset, RBP, NULL, 1), kReg64s[ir->dst->phys]);
+      LEA(frame_indirect(ir->opr1->offset), kReg64s[ir->dst->phys]);
     break;
 
   case IR_IOFS:
@@ -137,15 +518,20 @@ static void ir_out(IR *ir) {
     break;
 
   case IR_LOAD:
+    if (ir->opr1 != NULL && (ir->opr1->flag & VRF_CONST)) {
+      assert(ir->opr2 == NULL);
+      assert(0 <= ir->size && ir->size < kPow2TableSize);
+      int pow = kPow2Table[ir->size];
+      assert(0 <= pow && pow < 4);
+      MOV(INDIRECT(NUM(ir->opr1->fixnum), NULL, 1), kRegSizeTable[pow][ir->dst->phys]);
+      break;
+    }
 #ifndef __NO_FLONUM
     if (ir->dst->vtype->flag & VRTF_FLONUM) {
+      const char *src = mem_operand(ir, ir->opr1, ir->opr2);
       switch (ir->size) {
-      case SZ_FLOAT:
-        MOVSS(INDIRECT(kReg64s[ir->opr1->phys], NULL, 1), kFReg64s[ir->dst->phys]);
-        break;
-      case SZ_DOUBLE:
-        MOVSD(INDIRECT(kReg64s[ir->opr1->phys], NULL, 1), kFReg64s[ir->dst->phys]);
-        break;
+      case SZ_FLOAT:  MOVSS(src, kFReg64s[ir->dst->phys]); break;
+      case SZ_DOUBLE: MOVSD(src, kFReg64s[ir->dst->phys]); break;
       default: assert(false); break;
       }
       break;
@@ -155,37 +541,29 @@ static void ir_out(IR *ir) {
       assert(0 <= ir->size && ir->size < kPow2TableSize);
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
-      const char **regs = kRegSizeTable[pow];
-      if (ir->opr1->flag & VRF_CONST)
-        MOV(INDIRECT(NUM(ir->opr1->fixnum), NULL, 1), regs[ir->dst->phys]);
-      else
-        MOV(INDIRECT(kReg64s[ir->opr1->phys], NULL, 1), regs[ir->dst->phys]);
+      MOV(mem_operand(ir, ir->opr1, ir->opr2), kRegSizeTable[pow][ir->dst->phys]);
     }
     break;
 
   case IR_STORE:
 #ifndef __NO_FLONUM
     if (ir->opr1->vtype->flag & VRTF_FLONUM) {
+      const char *dst = mem_operand(ir, ir->opr2, NULL);
       switch (ir->size) {
-      case SZ_FLOAT:
-        MOVSS(kFReg64s[ir->opr1->phys], INDIRECT(kReg64s[ir->opr2->phys], NULL, 1));
-        break;
-      case SZ_DOUBLE:
-        MOVSD(kFReg64s[ir->opr1->phys], INDIRECT(kReg64s[ir->opr2->phys], NULL, 1));
-        break;
+      case SZ_FLOAT:  MOVSS(kFReg64s[ir->opr1->phys], dst); break;
+      case SZ_DOUBLE: MOVSD(kFReg64s[ir->opr1->phys], dst); break;
       default: assert(false); break;
       }
       break;
     }
 #endif
     {
-      assert(!(ir->opr2->flag & VRF_CONST));
+      assert(ir->opr2 == NULL || !(ir->opr2->flag & VRF_CONST));
       assert(0 <= ir->size && ir->size < kPow2TableSize);
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
-      const char **regs = kRegSizeTable[pow];
+      const char *dst = mem_operand(ir, ir->opr2, NULL);
       if (ir->opr1->flag & VRF_CONST) {
-        const char *dst = INDIRECT(kReg64s[ir->opr2->phys], NULL, 1);
         switch (pow) {
         case 0: MOVB(IM(ir->opr1->fixnum), dst); break;
         case 1: MOVW(IM(ir->opr1->fixnum), dst); break;
@@ -194,11 +572,15 @@ static void ir_out(IR *ir) {
         default: assert(false); break;
         }
       } else {
-        MOV(regs[ir->opr1->phys], INDIRECT(kReg64s[ir->opr2->phys], NULL, 1));
+        MOV(kRegSizeTable[pow][ir->opr1->phys], dst);
       }
     }
     break;
 
+  case IR_LEA:
+    LEA(mem_operand(ir, ir->opr1, ir->opr2), kReg64s[ir->dst->phys]);
+    break;
+
   case IR_ADD:
     {
       assert(ir->dst->phys == ir->opr1->phys);
@@ -285,20 +667,16 @@ static void ir_out(IR *ir) {
 #endif
       assert(0 <= ir->size && ir->size < kPow2TableSize);
       assert(!(ir->opr1->flag & VRF_CONST));
+      assert(ir->dst->phys == ir->opr1->phys);
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
-      const char **regs = kRegSizeTable[pow];
-      const char *a = kRegATable[pow];
-      MOV(regs[ir->opr1->phys], a);
-      const char *opr2;
       if (ir->opr2->flag & VRF_CONST) {
-        MOV(IM(ir->opr2->fixnum), regs[WORK_REG_NO]);
-        opr2 = regs[WORK_REG_NO];
-      } else {
-        opr2 = regs[ir->opr2->phys];
+        mul_const(ir->dst->phys, pow, normalize_const(ir->opr2->fixnum, pow, false));
+        break;
       }
-      MUL(opr2);
-      MOV(a, regs[ir->dst->phys]);
+      // Lower bits of the product are same for signed and unsigned.
+      const char **regs = kRegSizeTable[pow < 2 ? 2 : pow];
+      IMUL(regs[ir->opr2->phys], regs[ir->dst->phys]);
     }
     break;
 
@@ -316,6 +694,15 @@ static void ir_out(IR *ir) {
       break;
     }
 #endif
+    if (ir->opr2->flag & VRF_CONST) {
+      assert(ir->dst->phys == ir->opr1->phys);
+      assert(0 <= ir->size && ir->size < kPow2TableSize);
+      int pow = kPow2Table[ir->size];
+      bool is_unsigned = (ir->dst->vtype->flag & VRTF_UNSIGNED) != 0;
+      if (div_const(ir->dst->phys, pow, normalize_const(ir->opr2->fixnum, pow, is_unsigned),
+                    is_unsigned, false))
+        break;
+    }
     if (ir->size == 1) {
       if (!(ir->dst->vtype->flag & VRTF_UNSIGNED)) {
         MOVSX(kReg8s[ir->opr1->phys], AX);
@@ -376,6 +763,15 @@ static void ir_out(IR *ir) {
 
   case IR_MOD:
     assert(!(ir->opr1->flag & VRF_CONST));
+    if (ir->opr2->flag & VRF_CONST) {
+      assert(ir->dst->phys == ir->opr1->phys);
+      assert(0 <= ir->size && ir->size < kPow2TableSize);
+      int pow = kPow2Table[ir->size];
+      bool is_unsigned = (ir->dst->vtype->flag & VRTF_UNSIGNED) != 0;
+      if (div_const(ir->dst->phys, pow, normalize_const(ir->opr2->fixnum, pow, is_unsigned),
+                    is_unsigned, true))
+        break;
+    }
     if (ir->size == 1) {
       if (!(ir->dst->vtype->flag & VRTF_UNSIGNED)) {
         MOVSX(kReg8s[ir->opr1->phys], AX);
@@ -596,6 +992,32 @@ static void ir_out(IR *ir) {
     }
     break;
 
+  case IR_CMOV:
+    {
+      assert(ir->dst->phys == ir->opr1->phys);
+      assert(!(ir->opr2->flag & VRF_CONST));
+      assert(0 <= ir->size && ir->size < kPow2TableSize);
+      int pow = kPow2Table[ir->size];
+      assert(0 <= pow && pow < 4);
+      // No 8bit cmov: use 32bit registers instead for small size.
+      const char **regs = kRegSizeTable[pow < 2 ? 2 : pow];
+      const char *src = regs[ir->opr2->phys], *dst = regs[ir->dst->phys];
+      switch (ir->cond.kind) {
+      case COND_EQ: CMOVE(src, dst); break;
+      case COND_NE: CMOVNE(src, dst); break;
+      case COND_LT: CMOVL(src, dst); break;
+      case COND_GT: CMOVG(src, dst); break;
+      case COND_LE: CMOVLE(src, dst); break;
+      case COND_GE: CMOVGE(src, dst); break;
+      case COND_ULT: CMOVB(src, dst); break;
+      case COND_UGT: CMOVA(src, dst); break;
+      case COND_ULE: CMOVBE(src, dst); break;
+      case COND_UGE: CMOVAE(src, dst); break;
+      default: assert(false); break;
+      }
+    }
+    break;
+
   case IR_JMP:
     switch (ir->jmp.cond) {
     case COND_ANY: JMP(fmt_name(ir->jmp.bb->label)); break;
@@ -640,7 +1062,7 @@ static void ir_out(IR *ir) {
         BB *bb = ir->tjmp.bbs[i];
         _QUAD(fmt("%.*s", bb->label->bytes, bb->label->chars));
       }
-      _TEXT();
+      emit_code_section();
     }
     break;
 
@@ -674,76 +1096,65 @@ static void ir_out(IR *ir) {
     break;
 
   case IR_PUSHARG:
+    // Argument registers are never allocated to vregs, and every source is already in
+    // an allocatable register (or constant), so moving them one by one is safe.
 #ifndef __NO_FLONUM
     if (ir->opr1->vtype->flag & VRTF_FLONUM) {
-      SUB(IM(WORD_SIZE), RSP);
-      PUSH_STACK_POS();
+      assert(ir->pusharg.index < MAX_FREG_ARGS);
       switch (ir->opr1->vtype->size) {
-      case SZ_FLOAT: MOVSS(kFReg64s[ir->opr1->phys], INDIRECT(RSP, NULL, 1)); break;
-      case SZ_DOUBLE: MOVSD(kFReg64s[ir->opr1->phys], INDIRECT(RSP, NULL, 1)); break;
+      case SZ_FLOAT: MOVSS(kFReg64s[ir->opr1->phys], kArgFReg64s[ir->pusharg.index]); break;
+      case SZ_DOUBLE: MOVSD(kFReg64s[ir->opr1->phys], kArgFReg64s[ir->pusharg.index]); break;
       default: assert(false); break;
       }
       break;
     }
 #endif
+    assert(ir->pusharg.index < MAX_REG_ARGS);
     if (ir->opr1->flag & VRF_CONST) {
-      if (is_im32(ir->opr1->fixnum)) {
-        PUSH(IM(ir->opr1->fixnum));
-        PUSH_STACK_POS();
-      } else {
-        MOV(IM(ir->opr1->fixnum), RAX);  // TODO: Check.
-        PUSH(RAX);
-        PUSH_STACK_POS();
-      }
+      intptr_t value = ir->opr1->fixnum;
+      if (value == 0)
+        XOR(kArgReg32s[ir->pusharg.index], kArgReg32s[ir->pusharg.index]);
+      else
+        MOV(IM(value), kArgReg64s[ir->pusharg.index]);
     } else {
-      PUSH(kReg64s[ir->opr1->phys]);
-      PUSH_STACK_POS();
+      MOV(kReg64s[ir->opr1->phys], kArgReg64s[ir->pusharg.index]);
     }
     break;
 
   case IR_CALL:
+    if (ir->call.tail) {
+      // Argument registers are already set, and stack arguments are put on the incoming area.
+      if (ir->call.label == NULL) {
+        assert(!(ir->opr1->flag & VRF_CONST));
+        MOV(kReg64s[ir->opr1->phys], R11);  // Callee save registers are restored in epilogue.
+      }
+#ifndef __NO_FLONUM
+      if (ir->call.vaargs)
+        MOV(IM(count_freg_args(ir)), AL);
+#endif
+      int saved_stackpos = stackpos;
+      emit_epilogue();
+      stackpos = saved_stackpos;
+      if (ir->call.label != NULL) {
+        char *label = fmt_name(ir->call.label);
+        if (ir->call.global)
+          label = MANGLE(label);
+        JMP(quote_label(label));
+      } else {
+        JMP(fmt("*%s", R11));
+      }
+      break;
+    }
     {
       IR *precall = ir->call.precall;
-      int reg_args = ir->call.reg_arg_count;
       push_caller_save_regs(
           precall->precall.living_pregs,
-          reg_args * WORD_SIZE + precall->precall.stack_args_size + precall->precall.stack_aligned);
-
-      static const char *kArgReg64s[] = {RDI, RSI, RDX, RCX, R8, R9};
-#ifndef __NO_FLONUM
-      static const char *kArgFReg64s[] = {XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7};
-      int freg = 0;
-#endif
-
-      // Pop register arguments.
-      int ireg = 0;
-      int total_arg_count = ir->call.total_arg_count;
-      for (int i = 0; i < total_arg_count; ++i) {
-        if (ir->call.arg_vtypes[i]->flag & VRTF_NON_REG)
-          continue;
-#ifndef __NO_FLONUM
-        if (ir->call.arg_vtypes[i]->flag & VRTF_FLONUM) {
-          if (freg < MAX_FREG_ARGS) {
-            switch (ir->call.arg_vtypes[i]->size) {
-            case SZ_FLOAT: MOVSS(INDIRECT(RSP, NULL, 1), kArgFReg64s[freg]); break;
-            case SZ_DOUBLE: MOVSD(INDIRECT(RSP, NULL, 1), kArgFReg64s[freg]); break;
-            default: assert(false); break;
-            }
-            ++freg;
-            ADD(IM(WORD_SIZE), RSP);
-            POP_STACK_POS();
-          }
-          continue;
-        }
-#endif
-        if (ireg < MAX_REG_ARGS) {
-          POP(kArgReg64s[ireg++]);
-          POP_STACK_POS();
-        }
-      }
+          precall->precall.stack_args_size + precall->precall.stack_aligned);
 
 #ifndef __NO_FLONUM
       if (ir->call.vaargs) {
+        // Pass the number of floating-point register arguments in %al.
+        int freg = count_freg_args(ir);
         if (freg > 0)
           MOV(IM(freg), AL);
         else
@@ -769,6 +1180,25 @@ static void ir_out(IR *ir) {
       // Resore caller save registers.
       pop_caller_save_regs(precall->precall.living_pregs);
 
+      if (ir->call.ret_struct != NULL) {
+        // Store eightbytes in %rax, %rdx (INTEGER) and %xmm0, %xmm1 (SSE) into the variable.
+        static const char **kRetRegs[] = {kRegATable, kRegDTable};
+        static const char *kRetFRegs[] = {XMM0, XMM1};
+        VReg *var = ir->call.ret_struct;
+        int size = var->vtype->size;
+        int iindex = 0, findex = 0;
+        for (int i = 0; i * WORD_SIZE < size; ++i) {
+          int n = size - i * WORD_SIZE;
+          if (n > WORD_SIZE)
+            n = WORD_SIZE;
+          if (ir->call.ret_flonum_bits & (1 << i))
+            store_eightbyte(NULL, kRetFRegs[findex++], n, var->offset + i * WORD_SIZE);
+          else
+            store_eightbyte(kRetRegs[iindex++], NULL, n, var->offset + i * WORD_SIZE);
+        }
+        break;
+      }
+
 #ifndef __NO_FLONUM
       if (ir->dst->vtype->flag & VRTF_FLONUM) {
         switch (ir->size) {
@@ -790,11 +1220,14 @@ static void ir_out(IR *ir) {
     break;
 
   case IR_RESULT:
+    // Second eightbyte of a struct is returned in %rdx or %xmm1.
+    assert(0 <= ir->result.index && ir->result.index < 2);
 #ifndef __NO_FLONUM
     if (ir->opr1->vtype->flag & VRTF_FLONUM) {
+      const char *dst = ir->result.index == 0 ? XMM0 : XMM1;
       switch (ir->size) {
-      case SZ_FLOAT: MOVSS(kFReg64s[ir->opr1->phys], XMM0); break;
-      case SZ_DOUBLE: MOVSD(kFReg64s[ir->opr1->phys], XMM0); break;
+      case SZ_FLOAT: MOVSS(kFReg64s[ir->opr1->phys], dst); break;
+      case SZ_DOUBLE: MOVSD(kFReg64s[ir->opr1->phys], dst); break;
       default: assert(false); break;
       }
       break;
@@ -805,10 +1238,11 @@ static void ir_out(IR *ir) {
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
       const char **regs = kRegSizeTable[pow];
+      const char *dst = (ir->result.index == 0 ? kRegATable : kRegDTable)[pow];
       if (ir->opr1->flag & VRF_CONST)
-        MOV(IM(ir->opr1->fixnum), kRegATable[pow]);
+        MOV(IM(ir->opr1->fixnum), dst);
       else
-        MOV(regs[ir->opr1->phys], kRegATable[pow]);
+        MOV(regs[ir->opr1->phys], dst);
     }
     break;
 
@@ -935,18 +1369,8 @@ static void ir_out(IR *ir) {
     break;
 
   case IR_CLEAR:
-    {
-      assert(!(ir->opr1->flag & VRF_CONST));
-      const char *loop = fmt_name(alloc_label());
-      MOV(kReg64s[ir->opr1->phys], RSI);
-      MOV(IM(ir->size), EDI);
-      XOR(AL, AL);
-      EMIT_LABEL(loop);
-      MOV(AL, INDIRECT(RSI, NULL, 1));
-      INC(RSI);
-      DEC(EDI);
-      JNE(loop);
-    }
+    assert(!(ir->opr1->flag & VRF_CONST));
+    ir_clear(ir->opr1->phys, ir->size);
     break;
 
   case IR_ASM:
@@ -967,8 +1391,8 @@ static void ir_out(IR *ir) {
     if (ir->opr1->vtype->flag & VRTF_FLONUM) {
       const char **regs = kFReg64s;
       switch (ir->size) {
-      case SZ_FLOAT: MOVSS(OFFSET_INDIRECT(ir->opr1->offset, RBP, NULL, 1), regs[ir->dst->phys]); break;
-      case SZ_DOUBLE: MOVSD(OFFSET_INDIRECT(ir->opr1->offset, RBP, NULL, 1), regs[ir->dst->phys]); break;
+      case SZ_FLOAT: MOVSS(frame_indirect(ir->opr1->offset), regs[ir->dst->phys]); break;
+      case SZ_DOUBLE: MOVSD(frame_indirect(ir->opr1->offset), regs[ir->dst->phys]); break;
       default: assert(false); break;
       }
       break;
@@ -979,7 +1403,7 @@ static void ir_out(IR *ir) {
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
       const char **regs = kRegSizeTable[pow];
-      MOV(OFFSET_INDIRECT(ir->opr1->offset, RBP, NULL, 1), regs[ir->dst->phys]);
+      MOV(frame_indirect(ir->opr1->offset), regs[ir->dst->phys]);
     }
     break;
 
@@ -989,8 +1413,8 @@ static void ir_out(IR *ir) {
     if (ir->opr2->vtype->flag & VRTF_FLONUM) {
       const char **regs = kFReg64s;
       switch (ir->size) {
-      case SZ_FLOAT: MOVSS(regs[ir->opr1->phys], OFFSET_INDIRECT(ir->opr2->offset, RBP, NULL, 1)); break;
-      case SZ_DOUBLE: MOVSD(regs[ir->opr1->phys], OFFSET_INDIRECT(ir->opr2->offset, RBP, NULL, 1)); break;
+      case SZ_FLOAT: MOVSS(regs[ir->opr1->phys], frame_indirect(ir->opr2->offset)); break;
+      case SZ_DOUBLE: MOVSD(regs[ir->opr1->phys], frame_indirect(ir->opr2->offset)); break;
       default: assert(false); break;
       }
       break;
@@ -1001,7 +1425,7 @@ static void ir_out(IR *ir) {
       int pow = kPow2Table[ir->size];
       assert(0 <= pow && pow < 4);
       const char **regs = kRegSizeTable[pow];
-      MOV(regs[ir->opr1->phys], OFFSET_INDIRECT(ir->opr2->offset, RBP, NULL, 1));
+      MOV(regs[ir->opr1->phys], frame_indirect(ir->opr2->offset));
     }
     break;
 
@@ -1011,123 +1435,327 @@ static void ir_out(IR *ir) {
 
 //
 
-static IR *is_last_jmp(BB *bb) {
-  int len;
-  IR *ir;
-  if ((len = bb->irs->len) > 0 && (ir = bb->irs->data[len - 1])->kind == IR_JMP)
-    return ir;
-  return NULL;
+// Basic block layout
+
+#define ROTATE_IR_MAX  (8)  // Loop condition up to this size is duplicated at the bottom.
+
+// Calls to these functions never return (or rarely happen), so the block is cold.
+static const char *kColdFunctions[] = {"abort", "exit", "_exit", "__assert_failed", "longjmp"};
+
+typedef struct {
+  BB *fall;  // Fallthrough destination, or NULL.
+  int pred_count;
+  bool reachable;
+  bool cold;
+  bool placed;
+} BBInfo;
+
+typedef struct {
+  Vector *bbs;
+  Table index_table;  // <BB label, index + 1>
+  BBInfo *infos;
+} Layout;
+
+static IR *last_ir(BB *bb) {
+  int len = bb->irs->len;
+  return len > 0 ? bb->irs->data[len - 1] : NULL;
 }
 
-static IR *is_last_any_jmp(BB *bb) {
-  IR *ir = is_last_jmp(bb);
-  return ir != NULL && ir->jmp.cond == COND_ANY ? ir : NULL;
+static BBInfo *bb_info(Layout *layout, BB *bb) {
+  intptr_t index = (intptr_t)table_get(&layout->index_table, bb->label);
+  assert(index > 0);
+  return &layout->infos[index - 1];
 }
 
-static IR *is_last_jtable(BB *bb) {
-  int len;
-  IR *ir;
-  if ((len = bb->irs->len) > 0 && (ir = bb->irs->data[len - 1])->kind == IR_TJMP)
-    return ir;
-  return NULL;
+static bool can_fall_through(BB *bb) {
+  IR *ir = last_ir(bb);
+  if (ir == NULL)
+    return true;
+  switch (ir->kind) {
+  case IR_JMP:  return ir->jmp.cond != COND_ANY;
+  case IR_TJMP: return false;
+  case IR_CALL: return !ir->call.tail;
+  default:      return true;
+  }
 }
 
-static void replace_jmp_destination(BBContainer *bbcon, BB *src, BB *dst) {
-  Vector *bbs = bbcon->bbs;
+// Follow empty and jump-only blocks, and returns the actual destination.
+// `chain` is a work buffer for the blocks on the way.
+static BB *thread_jump(Table *dest_table, Vector *chain, BB *bb) {
+  vec_clear(chain);
+  BB *dst = bb;
+  for (;;) {
+    void *dest;
+    if (table_try_get(dest_table, dst->label, &dest)) {
+      dst = dest;
+      break;
+    }
+    table_put(dest_table, dst->label, dst);  // Guard for cyclic jumps.
+    vec_push(chain, dst);
+
+    IR *ir = last_ir(dst);
+    BB *next = NULL;
+    if (ir == NULL)
+      next = dst->next;
+    else if (dst->irs->len == 1 && ir->kind == IR_JMP && ir->jmp.cond == COND_ANY)
+      next = ir->jmp.bb;
+    if (next == NULL)
+      break;
+    dst = next;
+  }
+  for (int i = 0; i < chain->len; ++i)
+    table_put(dest_table, ((BB*)chain->data[i])->label, dst);
+  return dst;
+}
+
+static void thread_jumps(Layout *layout) {
+  Table dest_table;
+  table_init(&dest_table);
+  Vector *chain = new_vector();
+  Vector *bbs = layout->bbs;
   for (int i = 0; i < bbs->len; ++i) {
     BB *bb = bbs->data[i];
-    if (bb == src)
+    BBInfo *info = &layout->infos[i];
+    if (bb->next != NULL && can_fall_through(bb))
+      info->fall = thread_jump(&dest_table, chain, bb->next);
+
+    IR *ir = last_ir(bb);
+    if (ir == NULL)
       continue;
+    if (ir->kind == IR_JMP) {
+      ir->jmp.bb = thread_jump(&dest_table, chain, ir->jmp.bb);
+      if (ir->jmp.bb == info->fall)  // Both destinations are same.
+        vec_pop(bb->irs);
+    } else if (ir->kind == IR_TJMP) {
+      BB **dsts = ir->tjmp.bbs;
+      for (size_t j = 0; j < ir->tjmp.len; ++j)
+        dsts[j] = thread_jump(&dest_table, chain, dsts[j]);
+    }
+  }
+}
 
-    IR *ir = is_last_jmp(bb);
-    if (ir != NULL && ir->jmp.bb == src)
-      ir->jmp.bb = dst;
+static void visit_edge(Layout *layout, Vector *stack, BB *dst) {
+  BBInfo *info = bb_info(layout, dst);
+  ++info->pred_count;
+  if (!info->reachable) {
+    info->reachable = true;
+    vec_push(stack, dst);
+  }
+}
 
-    IR *tjmp = is_last_jtable(bb);
-    if (tjmp != NULL) {
-      BB **bbs = tjmp->tjmp.bbs;
-      for (size_t j = 0, len = tjmp->tjmp.len; j < len; ++j) {
-        if (bbs[j] == src)
-          bbs[j] = dst;
-      }
+static void mark_reachable(Layout *layout) {
+  Vector *stack = new_vector();
+  layout->infos[0].reachable = true;
+  vec_push(stack, layout->bbs->data[0]);
+  while (stack->len > 0) {
+    BB *bb = vec_pop(stack);
+    BBInfo *info = bb_info(layout, bb);
+    if (info->fall != NULL)
+      visit_edge(layout, stack, info->fall);
+
+    IR *ir = last_ir(bb);
+    if (ir == NULL)
+      continue;
+    if (ir->kind == IR_JMP) {
+      visit_edge(layout, stack, ir->jmp.bb);
+    } else if (ir->kind == IR_TJMP) {
+      for (size_t j = 0; j < ir->tjmp.len; ++j)
+        visit_edge(layout, stack, ir->tjmp.bbs[j]);
     }
   }
 }
 
-void remove_unnecessary_bb(BBContainer *bbcon) {
-  Vector *bbs = bbcon->bbs;
-  Table keeptbl;
-  for (;;) {
-    table_init(&keeptbl);
-    assert(bbs->len > 0);
-    BB *bb0 = bbs->data[0];
-    table_put(&keeptbl, bb0->label, bb0);
-
-    for (int i = 0; i < bbs->len - 1; ++i) {
-      BB *bb = bbs->data[i];
-      bool remove = false;
-      IR *ir_jmp = is_last_jmp(bb);
-      if (bb->irs->len == 0) {  // Empty BB.
-        replace_jmp_destination(bbcon, bb, bb->next);
-        remove = true;
-      } else if (bb->irs->len == 1 && ir_jmp != NULL && ir_jmp->jmp.cond == COND_ANY &&
-                 !equal_name(bb->label, ir_jmp->jmp.bb->label)) {  // jmp only.
-        replace_jmp_destination(bbcon, bb, ir_jmp->jmp.bb);
-        if (i > 0) {
-          BB *pbb = bbs->data[i - 1];
-          IR *ir0 = is_last_jmp(pbb);
-          if (ir0 != NULL && ir0->jmp.cond != COND_ANY) {  // Fallthrough pass exists.
-            if (ir0->jmp.bb == bb->next) {                 // Skip jmp: Fix bb connection.
-              // Invert prev jmp condition and change jmp destination.
-              ir0->jmp.cond = invert_cond(ir0->jmp.cond);
-              ir0->jmp.bb = ir_jmp->jmp.bb;
-              remove = true;
-            }
-          }
-        }
-      }
+static bool is_duplicatable(BB *bb) {
+  IR *ir = last_ir(bb);
+  if (ir == NULL || ir->kind != IR_JMP || ir->jmp.cond == COND_ANY || bb->irs->len > ROTATE_IR_MAX)
+    return false;
+  for (int i = 0; i < bb->irs->len; ++i) {
+    switch (((IR*)bb->irs->data[i])->kind) {
+    case IR_PRECALL: case IR_PUSHARG: case IR_CALL: case IR_TJMP: case IR_SUBSP: case IR_ASM:
+      return false;
+    default: break;
+    }
+  }
+  return true;
+}
 
-      if (ir_jmp != NULL)
-        table_put(&keeptbl, ir_jmp->jmp.bb->label, bb);
-      if (ir_jmp == NULL || ir_jmp->jmp.cond != COND_ANY)
-        table_put(&keeptbl, bb->next->label, bb);
+// Loop rotation:
+//   H: if (!cond) goto X;  body...  B: goto H;  X:
+//   => duplicate the condition to the bottom, and branch back to the body directly:
+//   H: if (!cond) goto X;  body...  B: if (cond) goto body;  X:
+static void rotate_loops(Layout *layout) {
+  Vector *bbs = layout->bbs;
+  for (int i = 0; i < bbs->len; ++i) {
+    BB *bb = bbs->data[i];
+    BBInfo *info = &layout->infos[i];
+    IR *jmp = last_ir(bb);
+    if (!info->reachable || jmp == NULL || jmp->kind != IR_JMP || jmp->jmp.cond != COND_ANY)
+      continue;
+    BB *header = jmp->jmp.bb;
+    BBInfo *hinfo = bb_info(layout, header);
+    if (hinfo >= info || hinfo->fall == NULL || !is_duplicatable(header))  // Only back edge.
+      continue;
 
-      IR *tjmp = is_last_jtable(bb);
-      if (tjmp != NULL) {
-        BB **bbs = tjmp->tjmp.bbs;
-        for (size_t j = 0, len = tjmp->tjmp.len; j < len; ++j)
-          table_put(&keeptbl, bbs[j]->label, bb);
-      }
+    vec_pop(bb->irs);
+    for (int j = 0; j < header->irs->len; ++j)
+      vec_push(bb->irs, copy_ir(header->irs->data[j]));
+    IR *cjmp = last_ir(bb);
+    BB *exit_bb = cjmp->jmp.bb;
+    cjmp->jmp.cond = invert_cond(cjmp->jmp.cond);
+    cjmp->jmp.bb = hinfo->fall;
+    info->fall = exit_bb;
+
+    --hinfo->pred_count;
+    ++bb_info(layout, hinfo->fall)->pred_count;
+    ++bb_info(layout, exit_bb)->pred_count;
+  }
+}
 
-      if (remove)
-        table_delete(&keeptbl, bb->label);
+static bool is_cold(BB *bb) {
+  if (bb->count == 0)  // Never executed in the profile.
+    return true;
+  for (int i = 0; i < bb->irs->len; ++i) {
+    IR *ir = bb->irs->data[i];
+    if (ir->kind != IR_CALL || ir->call.label == NULL)
+      continue;
+    const Name *name = ir->call.label;
+    for (size_t j = 0; j < sizeof(kColdFunctions) / sizeof(*kColdFunctions); ++j) {
+      const char *func = kColdFunctions[j];
+      if ((size_t)name->bytes == strlen(func) && strncmp(name->chars, func, name->bytes) == 0)
+        return true;
     }
+  }
+  return false;
+}
 
-    bool again = false;
-    for (int i = 0; i < bbs->len - 1; ++i) {  // Make last one keeps alive.
-      BB *bb = bbs->data[i];
-      if (!table_try_get(&keeptbl, bb->label, NULL)) {
-        if (i > 0) {
-          BB *pbb = bbs->data[i - 1];
-          pbb->next = bb->next;
-        }
+// Static prediction: prefer fallthrough, but avoid cold block,
+// and merge a block which is only reached from the jump.
+// With the profile, the more frequent destination is preferred.
+static BB *likely_successor(Layout *layout, BB *bb) {
+  BBInfo *info = bb_info(layout, bb);
+  IR *ir = last_ir(bb);
+  if (ir != NULL && ir->kind == IR_JMP) {
+    BBInfo *dinfo = bb_info(layout, ir->jmp.bb);
+    if (ir->jmp.cond == COND_ANY)
+      return dinfo->pred_count == 1 ? ir->jmp.bb : NULL;
+    BBInfo *finfo = bb_info(layout, info->fall);
+    if (finfo->placed || (finfo->cold && !dinfo->cold))
+      return ir->jmp.bb;
+    if (!dinfo->placed && info->fall->count >= 0 && ir->jmp.bb->count > info->fall->count)
+      return ir->jmp.bb;
+  }
+  return info->fall;
+}
+
+static void place_chain(Layout *layout, Vector *order, BB *bb, BB *last) {
+  bool cold = bb_info(layout, bb)->cold;
+  for (;;) {
+    bb_info(layout, bb)->placed = true;
+    vec_push(order, bb);
+
+    bb = likely_successor(layout, bb);
+    if (bb == NULL || bb == last)
+      break;
+    BBInfo *info = bb_info(layout, bb);
+    if (info->placed || info->cold != cold)
+      break;
+  }
+}
 
-        vec_remove_at(bbs, i);
-        --i;
-        again = true;
+static void append_jmp(BB *bb, BB *dst) {
+  BB *saved = curbb;
+  curbb = bb;
+  new_ir_jmp(COND_ANY, dst);
+  curbb = saved;
+}
+
+// Reorder blocks: chain blocks along likely successors, and put cold blocks at the end.
+// Entry block stays at the top, and the return block at the bottom.
+static Vector *place_blocks(Layout *layout) {
+  Vector *bbs = layout->bbs;
+  BB *last = bbs->data[bbs->len - 1];
+  Vector *order = new_vector();
+  place_chain(layout, order, bbs->data[0], last);
+  for (int pass = 0; pass < 2; ++pass) {
+    bool cold = pass != 0;
+    for (int i = 1; i < bbs->len - 1; ++i) {
+      BBInfo *info = &layout->infos[i];
+      if (info->reachable && !info->placed && info->cold == cold)
+        place_chain(layout, order, bbs->data[i], last);
+    }
+  }
+  if (last != bbs->data[0])
+    vec_push(order, last);
+
+  // Fix jumps according to the new order.
+  Vector *result = new_vector();
+  for (int i = 0; i < order->len; ++i) {
+    BB *bb = order->data[i];
+    BB *next = i + 1 < order->len ? order->data[i + 1] : NULL;
+    BB *fall = bb_info(layout, bb)->fall;
+    vec_push(result, bb);
+    IR *ir = last_ir(bb);
+    if (ir != NULL && ir->kind == IR_JMP && ir->jmp.cond != COND_ANY) {
+      if (ir->jmp.bb == next) {
+        ir->jmp.cond = invert_cond(ir->jmp.cond);
+        ir->jmp.bb = fall;
+      } else if (fall != next) {
+        BB *trampoline = new_bb();
+        append_jmp(trampoline, fall);
+        vec_push(result, trampoline);
+        bb->next = trampoline;
+        bb = trampoline;
       }
+    } else if (fall != NULL && fall != next) {
+      append_jmp(bb, fall);
+    } else if (ir != NULL && ir->kind == IR_JMP && ir->jmp.bb == next) {
+      vec_pop(bb->irs);  // Jump to next block.
     }
-    if (!again)
-      break;
+    bb->next = next;
   }
+  return result;
+}
 
-  // Remove jmp to next instruction.
-  for (int i = 0; i < bbs->len - 1; ++i) {  // Make last one keeps alive.
+// Thread jumps, remove unreachable blocks, rotate loops and reorder blocks.
+// Every step is linear to the number of blocks (and instructions).
+void layout_bbs(BBContainer *bbcon) {
+  Vector *bbs = bbcon->bbs;
+  assert(bbs->len > 0);
+
+  Layout layout;
+  layout.bbs = bbs;
+  layout.infos = calloc(bbs->len, sizeof(*layout.infos));
+  table_init(&layout.index_table);
+  for (int i = 0; i < bbs->len; ++i) {
     BB *bb = bbs->data[i];
-    IR *ir = is_last_any_jmp(bb);
-    if (ir != NULL && ir->jmp.bb == bb->next)
-      vec_pop(bb->irs);
+    table_put(&layout.index_table, bb->label, (void*)(intptr_t)(i + 1));
   }
+
+  thread_jumps(&layout);
+  mark_reachable(&layout);
+  layout.infos[bbs->len - 1].reachable = true;  // Return block is always kept.
+  rotate_loops(&layout);
+  for (int i = 0; i < bbs->len; ++i)
+    layout.infos[i].cold = is_cold(bbs->data[i]);
+
+  bbcon->bbs = place_blocks(&layout);
+  free(layout.infos);
+}
+
+unsigned short callee_save_reg_bits(void) {
+  unsigned short bits = 0;
+  for (int i = 0; i < CALLEE_SAVE_REG_COUNT; ++i)
+    bits |= 1 << kCalleeSaveRegs[i];
+  return bits;
+}
+
+int count_callee_save_regs(unsigned short used) {
+  int count = 0;
+  for (int i = 0; i < CALLEE_SAVE_REG_COUNT; ++i) {
+    if (used & (1 << kCalleeSaveRegs[i]))
+      ++count;
+  }
+  return count;
 }
 
 int push_callee_save_regs(unsigned short used) {
@@ -1204,7 +1832,28 @@ static void pop_caller_save_regs(unsigned short living) {
   }
 }
 
+// Loop head in the layout: target of a backward jump, which is aligned unless it is cold.
+static void find_loop_heads(BBContainer *bbcon, Table *heads) {
+  Table placed;  // <BB label, BB*>
+  table_init(&placed);
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    table_put(&placed, bb->label, bb);
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind == IR_JMP && table_get(&placed, ir->jmp.bb->label) != NULL &&
+          ir->jmp.bb != bbcon->bbs->data[0] && !is_cold(ir->jmp.bb))
+        table_put(heads, ir->jmp.bb->label, ir->jmp.bb);
+    }
+  }
+}
+
 void emit_bb_irs(BBContainer *bbcon) {
+  Table loop_heads;  // <BB label, BB*>
+  table_init(&loop_heads);
+  if (align_loops > 1)
+    find_loop_heads(bbcon, &loop_heads);
+
   for (int i = 0; i < bbcon->bbs->len; ++i) {
     BB *bb = bbcon->bbs->data[i];
 #ifndef NDEBUG
@@ -1218,19 +1867,382 @@ void emit_bb_irs(BBContainer *bbcon) {
     }
 #endif
 
+    // Like gcc, padding more than 5/8 of the alignment is not worth the NOPs on the fall through.
+    if (table_get(&loop_heads, bb->label) != NULL)
+      emit_align_code(align_loops, align_loops * 5 / 8);
     EMIT_LABEL(fmt_name(bb->label));
     for (int j = 0; j < bb->irs->len; ++j) {
       IR *ir = bb->irs->data[j];
+      if (emit_debug_line && ir->token != NULL && ir->token->line != NULL)
+        emit_loc(ir->token->line->filename, ir->token->line->lineno);
       ir_out(ir);
     }
   }
 }
 
+// Fold address calculation into memory operand: [base + index * scale + disp]
+
+typedef struct {
+  int *def_counts;
+  int *use_counts;
+} DefUse;
+
+typedef struct {
+  VReg *base;
+  VReg *index;
+  int scale;
+  intptr_t disp;
+  VReg *frame;
+  const Name *label;
+  bool global;
+} MemOperand;
+
+static void count_def_use(RegAlloc *ra, BBContainer *bbcon, DefUse *du) {
+  int vreg_count = ra->vregs->len;
+  du->def_counts = calloc(vreg_count, sizeof(*du->def_counts));
+  du->use_counts = calloc(vreg_count, sizeof(*du->use_counts));
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->dst != NULL)
+        ++du->def_counts[ir->dst->virt];
+      if (ir->opr1 != NULL)
+        ++du->use_counts[ir->opr1->virt];
+      if (ir->opr2 != NULL)
+        ++du->use_counts[ir->opr2->virt];
+    }
+  }
+}
+
+// Whether `vreg` keeps its value from `from` to `to` in the block.
+static bool is_stable_between(BB *bb, int from, int to, VReg *vreg) {
+  if (vreg == NULL || (vreg->flag & VRF_CONST))
+    return true;
+  if (vreg->flag & VRF_REF)  // Might be modified through pointer.
+    return false;
+  for (int i = from + 1; i < to; ++i) {
+    IR *ir = bb->irs->data[i];
+    if (ir != NULL && ir->dst == vreg)
+      return false;
+  }
+  return true;
+}
+
+// Returns the definition of `vreg` if it is a temporary which is defined in the same block
+// before `pos` and used only once. Folded definitions are cleared to NULL until the block is
+// compacted.
+static IR *foldable_def(DefUse *du, BB *bb, int pos, VReg *vreg, int *pdefpos) {
+  if (vreg == NULL || (vreg->flag & (VRF_CONST | VRF_REF | VRF_SPILLED | VRF_PARAM)) ||
+      du->def_counts[vreg->virt] != 1 || du->use_counts[vreg->virt] != 1)
+    return NULL;
+  for (int i = pos; --i >= 0;) {
+    IR *ir = bb->irs->data[i];
+    if (ir != NULL && ir->dst == vreg) {
+      if (ir->size != WORD_SIZE)
+        return NULL;
+#ifndef __NO_FLONUM
+      if (vreg->vtype->flag & VRTF_FLONUM)
+        return NULL;
+#endif
+      *pdefpos = i;
+      return ir;
+    }
+  }
+  return NULL;
+}
+
+static bool is_scaling_def(DefUse *du, BB *bb, int pos, VReg *vreg) {
+  int defpos;
+  IR *def = foldable_def(du, bb, pos, vreg, &defpos);
+  return def != NULL && (def->kind == IR_LSHIFT || def->kind == IR_MUL) &&
+      def->opr2 != NULL && (def->opr2->flag & VRF_CONST);
+}
+
+static bool fold_mem_operand(DefUse *du, BB *bb, int pos, MemOperand *mem, bool allow_index,
+                             bool allow_label) {
+  bool folded = false;
+  for (;;) {
+    int defpos;
+    IR *def;
+    if ((def = foldable_def(du, bb, pos, mem->base, &defpos)) != NULL) {
+      bool ok = false;
+      switch (def->kind) {
+      case IR_ADD:
+      case IR_SUB:
+        if (def->opr1->flag & VRF_CONST)
+          break;
+        if (def->opr2->flag & VRF_CONST) {
+          intptr_t disp = mem->disp + (def->kind == IR_ADD ? def->opr2->fixnum : -def->opr2->fixnum);
+          if (is_im32(disp) && is_stable_between(bb, defpos, pos, def->opr1)) {
+            mem->base = def->opr1;
+            mem->disp = disp;
+            ok = true;
+          }
+        } else if (def->kind == IR_ADD && allow_index && mem->index == NULL &&
+                   is_stable_between(bb, defpos, pos, def->opr1) &&
+                   is_stable_between(bb, defpos, pos, def->opr2)) {
+          VReg *base = def->opr1, *index = def->opr2;
+          if (is_scaling_def(du, bb, defpos, base) && !is_scaling_def(du, bb, defpos, index)) {
+            VReg *tmp = base;
+            base = index;
+            index = tmp;
+          }
+          mem->base = base;
+          mem->index = index;
+          mem->scale = 1;
+          ok = true;
+        }
+        break;
+      case IR_BOFS:
+        mem->base = NULL;
+        mem->frame = def->opr1;
+        ok = true;
+        break;
+      case IR_IOFS:
+        if (allow_label && mem->index == NULL) {
+          mem->base = NULL;
+          mem->label = def->iofs.label;
+          mem->global = def->iofs.global;
+          ok = true;
+        }
+        break;
+      case IR_LEA:
+        if ((def->opr2 != NULL && (!allow_index || mem->index != NULL)) ||
+            (def->mem.label != NULL && (!allow_label || mem->index != NULL)) ||
+            !is_im32(mem->disp + def->value) ||
+            !is_stable_between(bb, defpos, pos, def->opr1) ||
+            !is_stable_between(bb, defpos, pos, def->opr2))
+          break;
+        mem->base = def->opr1;
+        mem->frame = def->mem.frame;
+        mem->label = def->mem.label;
+        mem->global = def->mem.global;
+        mem->disp += def->value;
+        if (def->opr2 != NULL) {
+          mem->index = def->opr2;
+          mem->scale = def->mem.scale;
+        }
+        ok = true;
+        break;
+      default:
+        break;
+      }
+      if (ok) {
+        bb->irs->data[defpos] = NULL;
+        folded = true;
+        continue;
+      }
+    }
+
+    if ((def = foldable_def(du, bb, pos, mem->index, &defpos)) != NULL &&
+        def->opr1 != NULL && def->opr2 != NULL && !(def->opr1->flag & VRF_CONST) && (def->opr2->flag & VRF_CONST) &&
+        is_stable_between(bb, defpos, pos, def->opr1)) {
+      intptr_t value = def->opr2->fixnum;
+      bool ok = false;
+      switch (def->kind) {
+      case IR_LSHIFT:
+        if (0 <= value && value <= 3 && (mem->scale << value) <= 8) {
+          mem->scale <<= value;
+          ok = true;
+        }
+        break;
+      case IR_MUL:
+        if ((value == 1 || value == 2 || value == 4 || value == 8) && mem->scale * value <= 8) {
+          mem->scale *= value;
+          ok = true;
+        }
+        break;
+      case IR_ADD:
+      case IR_SUB:
+        {
+          intptr_t disp = mem->disp + (def->kind == IR_ADD ? value : -value) * mem->scale;
+          if (is_im32(disp)) {
+            mem->disp = disp;
+            ok = true;
+          }
+        }
+        break;
+      default:
+        break;
+      }
+      if (ok) {
+        mem->index = def->opr1;
+        bb->irs->data[defpos] = NULL;
+        folded = true;
+        continue;
+      }
+    }
+    break;
+  }
+  return folded;
+}
+
+static void set_mem_operand(IR *ir, const MemOperand *mem) {
+  ir->mem.frame = mem->frame;
+  ir->mem.label = mem->label;
+  ir->mem.global = mem->global;
+  ir->mem.scale = mem->scale;
+  ir->value = mem->disp;
+}
+
+void fold_address_operands(RegAlloc *ra, BBContainer *bbcon) {
+  DefUse du;
+  count_def_use(ra, bbcon, &du);
+
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    bool folded = false;
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      MemOperand mem = {.base = NULL, .index = NULL, .scale = 1, .disp = 0,
+                        .frame = NULL, .label = NULL, .global = false};
+      switch (ir->kind) {
+      case IR_LOAD:
+        if (ir->opr1->flag & VRF_CONST)
+          break;
+        {
+          bool flonum = false;
+#ifndef __NO_FLONUM
+          flonum = (ir->dst->vtype->flag & VRTF_FLONUM) != 0;
+#endif
+          mem.base = ir->opr1;
+          if (fold_mem_operand(&du, bb, j, &mem, !flonum, !flonum)) {
+            folded = true;
+            ir->opr1 = mem.base;
+            ir->opr2 = mem.index;
+            set_mem_operand(ir, &mem);
+          }
+        }
+        break;
+      case IR_STORE:
+        {
+          // Storing immediate or flonum into rip-relative address is not supported.
+          bool allow_label = !(ir->opr1->flag & VRF_CONST);
+#ifndef __NO_FLONUM
+          if (ir->opr1->vtype->flag & VRTF_FLONUM)
+            allow_label = false;
+#endif
+          mem.base = ir->opr2;
+          if (fold_mem_operand(&du, bb, j, &mem, false, allow_label)) {
+            folded = true;
+            ir->opr2 = mem.base;
+            set_mem_operand(ir, &mem);
+          }
+        }
+        break;
+      case IR_ADD:
+        if (ir->size != WORD_SIZE || (ir->opr1->flag & VRF_CONST))
+          break;
+#ifndef __NO_FLONUM
+        if (ir->dst->vtype->flag & VRTF_FLONUM)
+          break;
+#endif
+        mem.base = ir->opr1;
+        if (ir->opr2->flag & VRF_CONST) {
+          if (!is_im32(ir->opr2->fixnum))
+            break;
+          mem.disp = ir->opr2->fixnum;
+        } else {
+          mem.index = ir->opr2;
+          if (is_scaling_def(&du, bb, j, mem.base) && !is_scaling_def(&du, bb, j, mem.index)) {
+            mem.base = ir->opr2;
+            mem.index = ir->opr1;
+          }
+        }
+        if (fold_mem_operand(&du, bb, j, &mem, true, true)) {
+          folded = true;
+          ir->kind = IR_LEA;
+          ir->opr1 = mem.base;
+          ir->opr2 = mem.index;
+          set_mem_operand(ir, &mem);
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    if (folded)
+      compact_irs(bb);
+  }
+
+  free(du.def_counts);
+  free(du.use_counts);
+}
+
+// Branch with the flag directly, instead of testing the value which IR_COND materialized:
+//   COND t = cc; [MOV x, t;] CMP x, 0; JMP NE  =>  COND t = cc; [MOV x, t;] JMP cc
+// (MOV doesn't change the flag.) Then COND and MOV are removed if their results are unused.
+void fuse_cond_jmp(RegAlloc *ra, BBContainer *bbcon) {
+  DefUse du;
+  count_def_use(ra, bbcon, &du);
+
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    Vector *irs = bb->irs;
+    bool removed = false;
+    for (int j = 1; j < irs->len - 1; ++j) {
+      IR *cmp = irs->data[j];
+      IR *jmp = irs->data[j + 1];
+      if (cmp->kind != IR_CMP || !(cmp->opr2->flag & VRF_CONST) || cmp->opr2->fixnum != 0 ||
+          (cmp->opr1->flag & VRF_CONST) || jmp->kind != IR_JMP ||
+          (jmp->jmp.cond != COND_EQ && jmp->jmp.cond != COND_NE))
+        continue;
+
+      VReg *v = cmp->opr1;
+      IR *cond = NULL;
+      for (int k = j; --k >= 0;) {
+        IR *ir = irs->data[k];
+        if (ir == NULL)  // Removed compare.
+          continue;
+        if (ir->kind == IR_MOV) {
+          if (ir->dst == v) {
+            v = ir->opr1;
+            if (v->flag & VRF_CONST)
+              break;
+          }
+          continue;
+        }
+        if (ir->kind == IR_COND && ir->dst == v)
+          cond = ir;
+        break;
+      }
+      if (cond == NULL)
+        continue;
+
+      jmp->jmp.cond = jmp->jmp.cond == COND_NE ? cond->cond.kind : invert_cond(cond->cond.kind);
+      --du.use_counts[cmp->opr1->virt];
+      irs->data[j] = NULL;
+      removed = true;
+    }
+
+    // Remove unused results, backward to follow the chain.
+    for (int j = irs->len; --j >= 0;) {
+      IR *ir = irs->data[j];
+      if (ir != NULL && (ir->kind == IR_COND || ir->kind == IR_MOV) &&
+          du.use_counts[ir->dst->virt] == 0 &&
+          !(ir->dst->flag & (VRF_REF | VRF_SPILLED | VRF_PARAM))) {
+        if (ir->opr1 != NULL)
+          --du.use_counts[ir->opr1->virt];
+        irs->data[j] = NULL;
+        removed = true;
+      }
+    }
+    if (removed)
+      compact_irs(bb);
+  }
+
+  free(du.def_counts);
+  free(du.use_counts);
+}
+
 // Rewrite `A = B op C` to `A = B; A = A op C`.
 static void three_to_two(BB *bb) {
+  IrRewriter rw;
+  begin_rewrite(&rw, bb);
   Vector *irs = bb->irs;
   for (int i = 0; i < irs->len; ++i) {
-    IR *ir = bb->irs->data[i];
+    IR *ir = irs->data[i];
 
     switch (ir->kind) {
     case IR_ADD:  // binops
@@ -1243,6 +2255,7 @@ static void three_to_two(BB *bb) {
     case IR_BITXOR:
     case IR_LSHIFT:
     case IR_RSHIFT:
+    case IR_CMOV:
     case IR_NEG:  // unary ops
     case IR_BITNOT:
       {
@@ -1253,17 +2266,18 @@ static void three_to_two(BB *bb) {
         ir2->opr1 = ir->opr1;
         ir2->opr2 = NULL;
         ir2->size = ir->size;
-        vec_insert(irs, i, ir2);
+        ir2->token = ir->token;
+        rewrite_put(&rw, ir2);
 
         ir->opr1 = ir->dst;
-        ++i;
       }
       break;
 
     default: break;
     }
+    rewrite_put(&rw, ir);
   }
-  bb->irs = irs;
+  end_rewrite(&rw);
 }
 
 void convert_3to2(BBContainer *bbcon) {
@@ -0,0 +1,238 @@
+#include "peephole.h"
+
+#include <stdlib.h>  // free, strtol
+#include <string.h>
+
+#include "util.h"
+
+#define ARRAY_SIZE(array)  (sizeof(array) / sizeof(*(array)))
+
+static const char *kRegNames[4][16] = {
+  {"%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+   "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"},
+  {"%ax", "%cx", "%dx", "%bx", "%sp", "%bp", "%si", "%di",
+   "%r8w", "%r9w", "%r10w", "%r11w", "%r12w", "%r13w", "%r14w", "%r15w"},
+  {"%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+   "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"},
+  {"%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+   "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"},
+};
+
+#define RSP_NO  (4)
+#define RBP_NO  (5)
+
+// Returns register no and stores its size to `*ppow`, or -1.
+static int find_reg(const char *name, size_t len, int *ppow) {
+  for (int pow = 0; pow < 4; ++pow) {
+    for (int i = 0; i < 16; ++i) {
+      const char *s = kRegNames[pow][i];
+      if (strlen(s) == len && strncmp(name, s, len) == 0) {
+        *ppow = pow;
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+void parse_asm_operand(AsmOperand *opr, const char *operand) {
+  opr->kind = operand != NULL ? AO_OTHER : AO_NONE;
+  opr->reg = opr->pow = -1;
+  opr->disp = 0;
+  if (operand == NULL)
+    return;
+
+  int pow;
+  if (operand[0] == '%') {
+    int reg = find_reg(operand, strlen(operand), &pow);
+    if (reg >= 0) {
+      opr->kind = AO_REG;
+      opr->reg = reg;
+      opr->pow = pow;
+    }
+    return;
+  }
+
+  // disp(%base)
+  char *p;
+  long disp = strtol(operand, &p, 10);
+  size_t len = strlen(p);
+  if (p[0] != '(' || len < 3 || p[len - 1] != ')')
+    return;
+  int reg = find_reg(p + 1, len - 2, &pow);
+  if (reg < 0 || pow != 3)
+    return;
+  opr->kind = AO_MEM;
+  opr->reg = reg;
+  opr->disp = disp;
+}
+
+static bool same_operand(const AsmOperand *a, const AsmOperand *b) {
+  return a->kind == b->kind && a->reg == b->reg && a->pow == b->pow && a->disp == b->disp;
+}
+
+// Frame slot: nn(%rbp), or nn(%rsp) if frame pointer is omitted
+static bool is_frame_slot(const AsmOperand *opr) {
+  return opr->kind == AO_MEM && (opr->reg == RBP_NO || opr->reg == RSP_NO);
+}
+
+static const char *kCondPairs[][2] = {
+  {"o", "no"}, {"b", "ae"}, {"e", "ne"}, {"be", "a"},
+  {"s", "ns"}, {"p", "np"}, {"l", "ge"}, {"le", "g"},
+};
+
+static const char *invert_cond(const char *cc) {
+  for (size_t i = 0; i < ARRAY_SIZE(kCondPairs); ++i) {
+    if (strcmp(cc, kCondPairs[i][0]) == 0)
+      return kCondPairs[i][1];
+    if (strcmp(cc, kCondPairs[i][1]) == 0)
+      return kCondPairs[i][0];
+  }
+  return NULL;
+}
+
+static AsmLine *line_at(Vector *lines, int i) {
+  return 0 <= i && i < lines->len ? lines->data[i] : NULL;
+}
+
+static bool is_inst(AsmLine *line, const char *op) {
+  return line != NULL && line->kind == AL_INST && strcmp(line->op, op) == 0;
+}
+
+// Code alignment doesn't change the flow, so it is skipped when looking for a label.
+static AsmLine *label_at(Vector *lines, int i) {
+  AsmLine *line = line_at(lines, i);
+  if (is_inst(line, ".p2align"))
+    line = line_at(lines, i + 1);
+  return line != NULL && line->kind == AL_LABEL ? line : NULL;
+}
+
+// Returns condition code if the line is a conditional jump.
+static const char *cond_jump(AsmLine *line) {
+  if (line == NULL || line->kind != AL_INST || line->op[0] != 'j' ||
+      line->operand1 == NULL || line->operand2 != NULL)
+    return NULL;
+  const char *cc = line->op + 1;
+  return invert_cond(cc) != NULL ? cc : NULL;
+}
+
+static void set_op(AsmLine *line, const char *prefix, const char *cc) {
+  size_t len = strlen(prefix) + strlen(cc);
+  char *op = malloc(len + 1);
+  strcpy(op, prefix);
+  strcat(op, cc);
+  free(line->op);
+  line->op = op;
+}
+
+static void remove_line(Vector *lines, int i) {
+  AsmLine *line = lines->data[i];
+  free(line->op);
+  free(line->operand1);
+  free(line->operand2);
+  free(line);
+  vec_remove_at(lines, i);
+}
+
+// mov %r, %r  =>  (removed)
+// 32bit move is kept because it clears upper bits.
+static bool remove_self_move(Vector *lines, int i) {
+  AsmLine *line = line_at(lines, i);
+  if (!is_inst(line, "mov") || line->opr1.kind != AO_REG ||
+      !same_operand(&line->opr1, &line->opr2) || line->opr1.pow == 2)
+    return false;
+  remove_line(lines, i);
+  return true;
+}
+
+// mov %r, nn(%rbp); mov nn(%rbp), %s  =>  mov %r, nn(%rbp); mov %r, %s
+static bool forward_store_to_load(Vector *lines, int i) {
+  AsmLine *store = line_at(lines, i);
+  AsmLine *load = line_at(lines, i + 1);
+  if (!is_inst(store, "mov") || !is_inst(load, "mov") ||
+      !is_frame_slot(&store->opr2) || !same_operand(&store->opr2, &load->opr1) ||
+      store->opr1.kind != AO_REG || load->opr2.kind != AO_REG ||
+      store->opr1.pow != load->opr2.pow)
+    return false;
+  free(load->operand1);
+  load->operand1 = strdup(store->operand1);
+  load->opr1 = store->opr1;
+  return true;
+}
+
+// jmp L; L:  =>  L:
+static bool remove_jump_to_next(Vector *lines, int i) {
+  AsmLine *line = line_at(lines, i);
+  if (!(is_inst(line, "jmp") || cond_jump(line) != NULL) || line->operand1 == NULL)
+    return false;
+  for (int j = i + 1; j < lines->len; ++j) {
+    AsmLine *next = lines->data[j];
+    if (is_inst(next, ".p2align"))
+      continue;
+    if (next->kind != AL_LABEL)
+      break;
+    if (strcmp(next->op, line->operand1) == 0) {
+      remove_line(lines, i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// jCC L1; jmp L2; L1:  =>  jNCC L2; L1:
+static bool invert_branch_over_jump(Vector *lines, int i) {
+  AsmLine *jcc = line_at(lines, i);
+  AsmLine *jmp = line_at(lines, i + 1);
+  AsmLine *label = label_at(lines, i + 2);
+  const char *cc = cond_jump(jcc);
+  if (cc == NULL || !is_inst(jmp, "jmp") || jmp->operand1 == NULL || jmp->operand1[0] == '*' ||
+      label == NULL || strcmp(label->op, jcc->operand1) != 0)
+    return false;
+
+  set_op(jcc, "j", invert_cond(cc));
+  char *target = jmp->operand1;
+  jmp->operand1 = jcc->operand1;
+  jcc->operand1 = target;
+  AsmOperand opr = jmp->opr1;
+  jmp->opr1 = jcc->opr1;
+  jcc->opr1 = opr;
+  remove_line(lines, i + 1);
+  return true;
+}
+
+typedef struct {
+  const char *name;
+  bool (*apply)(Vector *lines, int i);
+} PeepholePattern;
+
+static const PeepholePattern kPatterns[] = {
+  {"self-move", remove_self_move},
+  {"store-to-load", forward_store_to_load},
+  {"jump-to-next", remove_jump_to_next},
+  {"branch-over-jump", invert_branch_over_jump},
+};
+
+static int hit_counts[ARRAY_SIZE(kPatterns)];
+
+void peephole_optimize(Vector *lines) {
+  for (int i = 0; i < lines->len;) {
+    bool applied = false;
+    for (size_t k = 0; k < ARRAY_SIZE(kPatterns); ++k) {
+      if (kPatterns[k].apply(lines, i)) {
+        ++hit_counts[k];
+        applied = true;
+        break;
+      }
+    }
+    // Rewriting might make a new chance for preceding lines.
+    if (applied)
+      i = i >= 2 ? i - 2 : 0;
+    else
+      ++i;
+  }
+}
+
+void dump_peephole_stats(FILE *fp) {
+  for (size_t k = 0; k < ARRAY_SIZE(kPatterns); ++k)
+    fprintf(fp, "%-20s %d\n", kPatterns[k].name, hit_counts[k]);
+}
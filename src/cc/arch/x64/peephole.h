@@ -0,0 +1,41 @@
+// Peephole optimization on emitted instructions
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct Vector Vector;
+
+enum AsmLineKind {
+  AL_INST,   // op operand1, operand2
+  AL_LABEL,  // op:
+};
+
+enum AsmOperandKind {
+  AO_NONE,
+  AO_REG,    // %reg
+  AO_MEM,    // disp(%base)
+  AO_OTHER,  // Immediate, label, indexed or rip relative memory, etc.
+};
+
+// Operand parsed when the line is buffered, to match patterns without comparing strings.
+typedef struct {
+  enum AsmOperandKind kind;
+  int reg;    // Register no for REG, base register no for MEM.
+  int pow;    // Register size for REG (0=8bit, 1=16bit, 2=32bit, 3=64bit).
+  long disp;  // Displacement for MEM.
+} AsmOperand;
+
+typedef struct {
+  enum AsmLineKind kind;
+  char *op;  // Mnemonic or directive for instruction, name for label.
+  char *operand1;
+  char *operand2;
+  AsmOperand opr1, opr2;  // Parsed operand1 and operand2.
+  int file, lineno;  // Source location of instruction, 0 if unknown.
+} AsmLine;
+
+void parse_asm_operand(AsmOperand *opr, const char *operand);
+void peephole_optimize(Vector *lines);
+void dump_peephole_stats(FILE *fp);
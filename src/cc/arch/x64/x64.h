@@ -148,6 +148,8 @@
 #define MUL(o1)        EMIT_ASM1("mul", o1)
 #define DIV(o1)        EMIT_ASM1("div", o1)
 #define IDIV(o1)       EMIT_ASM1("idiv", o1)
+#define IMUL1(o1)      EMIT_ASM1("imul", o1)
+#define IMUL(o1, o2)   EMIT_ASM2("imul", o1, o2)
 #define CMP(o1, o2)    EMIT_ASM2("cmp", o1, o2)
 #define AND(o1, o2)    EMIT_ASM2("and", o1, o2)
 #define OR(o1, o2)     EMIT_ASM2("or", o1, o2)
@@ -193,14 +195,28 @@
 #define SETA(o1)       EMIT_ASM1("seta", o1)
 #define SETBE(o1)      EMIT_ASM1("setbe", o1)
 #define SETAE(o1)      EMIT_ASM1("setae", o1)
+#define CMOVE(o1, o2)  EMIT_ASM2("cmove", o1, o2)
+#define CMOVNE(o1, o2) EMIT_ASM2("cmovne", o1, o2)
+#define CMOVL(o1, o2)  EMIT_ASM2("cmovl", o1, o2)
+#define CMOVG(o1, o2)  EMIT_ASM2("cmovg", o1, o2)
+#define CMOVLE(o1, o2) EMIT_ASM2("cmovle", o1, o2)
+#define CMOVGE(o1, o2) EMIT_ASM2("cmovge", o1, o2)
+#define CMOVB(o1, o2)  EMIT_ASM2("cmovb", o1, o2)
+#define CMOVA(o1, o2)  EMIT_ASM2("cmova", o1, o2)
+#define CMOVBE(o1, o2) EMIT_ASM2("cmovbe", o1, o2)
+#define CMOVAE(o1, o2) EMIT_ASM2("cmovae", o1, o2)
 #define CWTL()         EMIT_ASM0("cwtl")
 #define CLTD()         EMIT_ASM0("cltd")
 #define CQTO()         EMIT_ASM0("cqto")
+#define REP()          EMIT_ASM0("rep")
+#define MOVSB()        EMIT_ASM0("movsb")
+#define STOSB()        EMIT_ASM0("stosb")
 
 #define _BYTE(x)       EMIT_ASM1(".byte", x)
 #define _WORD(x)       EMIT_ASM1(".word", x)
 #define _LONG(x)       EMIT_ASM1(".long", x)
 #define _QUAD(x)       EMIT_ASM1(".quad", x)
+#define _ZERO(x)       EMIT_ASM1(".zero", x)
 #define _FLOAT(x)      EMIT_ASM1(".float", x)
 #define _DOUBLE(x)     EMIT_ASM1(".double", x)
 #define _GLOBL(x)      EMIT_ASM1(".globl", x)
@@ -214,10 +230,14 @@
 #define _RODATA()      _SECTION("__TEXT,__const")
 #define EMIT_ALIGN(x)  emit_align_p2(x)
 #define _LOCAL(x)      (0)
+#define _TYPE(x, y)    (0)
+#define _SIZE(x, y)    (0)
 #else
 #define _RODATA()      _SECTION(".rodata")
 #define EMIT_ALIGN(x)  emit_align(x)
 #define _LOCAL(x)      EMIT_ASM1(".local", x)
+#define _TYPE(x, y)    EMIT_ASM2(".type", x, y)
+#define _SIZE(x, y)    EMIT_ASM2(".size", x, y)
 #endif
 
 
@@ -243,4 +263,7 @@
 
 #define CVTSD2SS(o1, o2)  EMIT_ASM2("cvtsd2ss", o1, o2)  // double->single
 #define CVTSS2SD(o1, o2)  EMIT_ASM2("cvtss2sd", o1, o2)  // single->double
+
+#define MOVDQU(o1, o2)  EMIT_ASM2("movdqu", o1, o2)
+#define PXOR(o1, o2)    EMIT_ASM2("pxor", o1, o2)
 #endif
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdlib.h>  // malloc
 
+#include "lexer.h"  // Token
 #include "type.h"
 #include "util.h"
 
@@ -269,8 +270,8 @@ Stmt *new_stmt_label(const Token *label, Stmt *follow) {
   return stmt;
 }
 
-Stmt *new_stmt_vardecl(Vector *decls, Vector *inits) {
-  Stmt *stmt = new_stmt(ST_VARDECL, NULL);
+Stmt *new_stmt_vardecl(const Token *token, Vector *decls, Vector *inits) {
+  Stmt *stmt = new_stmt(ST_VARDECL, token);
   stmt->vardecl.decls = decls;
   stmt->vardecl.inits = inits;
   return stmt;
@@ -307,11 +308,12 @@ Declaration *new_decl_vardecl(Vector *decls) {
 
 // Function
 
-Function *new_func(Type *type, const Name *name) {
+Function *new_func(Type *type, const Token *ident) {
   assert(type->kind == TY_FUNC);
   Function *func = malloc(sizeof(*func));
   func->type = type;
-  func->name = name;
+  func->name = ident->ident;
+  func->ident = ident;
 
   func->scopes = NULL;
   func->stmts = NULL;
@@ -272,7 +272,7 @@ Stmt *new_stmt_for(const Token *token, Expr *pre, Expr *cond, Expr *post, Stmt *
 Stmt *new_stmt_return(const Token *token, Expr *val);
 Stmt *new_stmt_goto(const Token *tok, const Token *label);
 Stmt *new_stmt_label(const Token *label, Stmt *follow);
-Stmt *new_stmt_vardecl(Vector *decls, Vector *inits);
+Stmt *new_stmt_vardecl(const Token *token, Vector *decls, Vector *inits);
 Stmt *new_stmt_asm(const Token *token, Expr *str, Expr *arg);
 
 // ================================================
@@ -282,6 +282,7 @@ Stmt *new_stmt_asm(const Token *token, Expr *str, Expr *arg);
 typedef struct Function {
   Type *type;
   const Name *name;
+  const Token *ident;
 
   Vector *scopes;  // NULL => prototype definition.
   Vector *stmts;  // NULL => Prototype definition.
@@ -292,8 +293,9 @@ typedef struct Function {
 } Function;
 
 #define FUNCF_STACK_MODIFIED  (1 << 0)
+#define FUNCF_COLD            (1 << 1)  // Never executed in the profile.
 
-Function *new_func(Type *type, const Name *name);
+Function *new_func(Type *type, const Token *ident);
 
 // Declaration
 
@@ -19,6 +19,25 @@ static Expr *proc_builtin_type_kind(const Token *ident) {
   return new_expr_fixlit(&tySize, ident, type->kind);
 }
 
+// Eightbytes of struct passed in registers (0 if through memory),
+// and bit (2 + i) is set if i-th eightbyte is in SSE class.
+static Expr *proc_builtin_struct_regs(const Token *ident) {
+  consume(TK_LPAR, "`(' expected");
+  const Type *type = parse_var_def(NULL, NULL, NULL);
+  consume(TK_RPAR, "`)' expected");
+
+  int value = 0;
+  StructRegs sregs;
+  if (type->kind == TY_STRUCT && classify_struct(type, &sregs)) {
+    value = sregs.count;
+    for (int i = 0; i < sregs.count; ++i) {
+      if (sregs.flonum[i])
+        value |= 4 << i;
+    }
+  }
+  return new_expr_fixlit(&tySize, ident, value);
+}
+
 static VReg *gen_builtin_va_start(Expr *expr) {
   assert(expr->kind == EX_FUNCALL);
   Vector *args = expr->funcall.args;
@@ -27,25 +46,23 @@ static VReg *gen_builtin_va_start(Expr *expr) {
   Expr *var = strip_cast(args->data[1]);
   if (var->kind == EX_REF)
     var = var->unary.sub;
-  int gn = -1, fn = -1;
+  int gn = -1, fn = -1, stack_offset = 0;
   if (var->kind == EX_VAR) {
     const Vector *params = curfunc->type->func.params;
-    int g = 0, f = 0;
+    ArgClassifier classifier = {.ireg_index = is_stack_param(curfunc->type->func.ret) ? 1 : 0};
     for (int i = 0; i < params->len; ++i) {
       VarInfo *info = params->data[i];
-      const Type *t = info->type;
-      if (t->kind != TY_STRUCT) {
-#ifndef __NO_FLONUM
-        if (is_flonum(t))
-          ++f;
-        else
-#endif
-          ++g;
-      }
+      ArgInfo arg;
+      classify_arg(&classifier, info->type, &arg);
 
       if (info->name != NULL && equal_name(info->name, var->var.name)) {
-        gn = g;
-        fn = f;
+        gn = classifier.ireg_index;
+#ifndef __NO_FLONUM
+        fn = classifier.freg_index;
+#else
+        fn = 0;
+#endif
+        stack_offset = ALIGN(classifier.offset, WORD_SIZE);
         break;
       }
     }
@@ -65,7 +82,8 @@ static VReg *gen_builtin_va_start(Expr *expr) {
   {
     const VRegType *vtype = to_vtype(&tyVoidPtr);
     VReg *overflow_arg_area = new_ir_bop(IR_ADD, ap, new_const_vreg(type_size(&tyInt) + type_size(&tyInt), vtype), vtype);
-    VReg *offset = new_const_vreg(2 * WORD_SIZE, to_vtype(&tySize));
+    // Variadic arguments on the stack follow the named ones.
+    VReg *offset = new_const_vreg(2 * WORD_SIZE + stack_offset, to_vtype(&tySize));
     VReg *p = new_ir_bofs(offset);
     new_ir_store(overflow_arg_area, p);
   }
@@ -103,6 +121,8 @@ static VReg *gen_alloca(Expr *expr) {
 void install_builtins(void) {
   static BuiltinExprProc p_reg_class = &proc_builtin_type_kind;
   add_builtin_expr_ident("__builtin_type_kind", &p_reg_class);
+  static BuiltinExprProc p_struct_regs = &proc_builtin_struct_regs;
+  add_builtin_expr_ident("__builtin_struct_regs", &p_struct_regs);
 
   Type *tyVaList = create_struct_type(NULL, alloc_name("__va_elem", NULL, false), 0);
   Type *tyVaListPtr = ptrof(tyVaList);
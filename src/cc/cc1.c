@@ -11,12 +11,15 @@
 #include "emit_code.h"
 #include "lexer.h"
 #include "parser.h"
+#include "peephole.h"
 #include "type.h"
 #include "util.h"
 #include "var.h"
 
 ////////////////////////////////////////////////
 
+#define DEFAULT_PROFILE_PATH  "xcc.prof"
+
 extern void install_builtins(void);
 
 static void init_compiler(FILE *ofp) {
@@ -39,18 +42,68 @@ static void compile1(FILE *ifp, const char *filename, Vector *decls) {
   parse(decls);
 }
 
+// -falign-xxx=n, or -fno-align-xxx
+static bool parse_align_option(const char *arg, const char *name, int *palign) {
+  size_t len = strlen(name);
+  if (strncmp(arg, "no-", 3) == 0 && strcmp(arg + 3, name) == 0) {
+    *palign = 0;
+    return true;
+  }
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return false;
+  int align = atoi(arg + len + 1);
+  if (!IS_POWER_OF_2(align))
+    error("Alignment must be power of 2: -f%s", arg);
+  *palign = align;
+  return true;
+}
+
 int main(int argc, char *argv[]) {
   struct option longopts[] = {
     {"version", no_argument, NULL, 'V'},
+    {"peephole-stats", no_argument, NULL, 'P'},  // Show hit count of peephole patterns.
     {0},
   };
   int opt;
   int longindex;
-  while ((opt = getopt_long(argc, argv, "V", longopts, &longindex)) != -1) {
+  bool peephole_stats = false;
+  while ((opt = getopt_long(argc, argv, "Vgf:", longopts, &longindex)) != -1) {
     switch (opt) {
     case 'V':
       show_version("cc1");
       return 0;
+    case 'P':
+      peephole_stats = true;
+      break;
+    case 'g':
+      emit_debug_line = true;
+      break;
+    case 'f':
+      if (strcmp(optarg, "omit-frame-pointer") == 0) {
+        omit_frame_pointer = true;
+      } else if (strcmp(optarg, "no-omit-frame-pointer") == 0) {
+        omit_frame_pointer = false;
+      } else if (strcmp(optarg, "optimize-sibling-calls") == 0) {
+        optimize_sibling_calls = true;
+      } else if (strcmp(optarg, "no-optimize-sibling-calls") == 0) {
+        optimize_sibling_calls = false;
+      } else if (parse_align_option(optarg, "align-functions", &align_functions) ||
+                 parse_align_option(optarg, "align-loops", &align_loops)) {
+        // Handled.
+      } else if (strcmp(optarg, "function-sections") == 0) {
+        function_sections = true;
+      } else if (strcmp(optarg, "no-function-sections") == 0) {
+        function_sections = false;
+      } else if (strncmp(optarg, "profile-generate", 16) == 0 &&
+                 (optarg[16] == '\0' || optarg[16] == '=')) {
+        profile_generate_path = optarg[16] == '=' ? &optarg[17] : DEFAULT_PROFILE_PATH;
+      } else if (strncmp(optarg, "profile-use", 11) == 0 &&
+                 (optarg[11] == '\0' || optarg[11] == '=')) {
+        profile_use_path = optarg[11] == '=' ? &optarg[12] : DEFAULT_PROFILE_PATH;
+      } else {
+        fprintf(stderr, "unknown option: f%s\n", optarg);
+      }
+      break;
     }
   }
 
@@ -77,5 +130,8 @@ int main(int argc, char *argv[]) {
   gen(toplevel);
   emit_code(toplevel);
 
+  if (peephole_stats)
+    dump_peephole_stats(stderr);
+
   return 0;
 }
@@ -22,6 +22,8 @@ const int STACK_PARAM_BASE_OFFSET = (2 - MAX_REG_ARGS) * WORD_SIZE;
 
 const char RET_VAR_NAME[] = ".ret";
 
+bool optimize_sibling_calls = true;
+
 static void gen_expr_stmt(Expr *expr);
 
 void set_curbb(BB *bb) {
@@ -148,23 +150,81 @@ static void gen_return(Stmt *stmt) {
   BB *bb = new_bb();
   if (stmt->return_.val != NULL) {
     Expr *val = stmt->return_.val;
+    if (val->kind == EX_FUNCALL && gen_tail_call(val)) {
+      set_curbb(bb);
+      return;
+    }
     VReg *reg = gen_expr(val);
     VReg *retval = ((FuncBackend*)curfunc->extra)->retval;
-    if (retval == NULL) {
-      new_ir_result(reg);
-    } else {
+    if (retval != NULL) {
       size_t size = type_size(val->type);
       if (size > 0) {
         new_ir_memcpy(retval, reg, size);
-        new_ir_result(retval);
+        new_ir_result(retval, 0);
       }
+    } else if (val->type->kind == TY_STRUCT) {
+      // Return eightbytes in registers.
+      StructRegs sregs;
+      classify_struct(val->type, &sregs);
+      VReg *regs[MAX_STRUCT_REGS];
+      for (int i = 0; i < sregs.count; ++i)
+        regs[i] = load_eightbyte(reg, &sregs, i, type_size(val->type));
+      for (int i = 0; i < sregs.count; ++i)
+        new_ir_result(regs[i], sregs.index[i]);
+    } else {
+      new_ir_result(reg, 0);
     }
   }
   new_ir_jmp(COND_ANY, ((FuncBackend*)curfunc->extra)->ret_bb);
   set_curbb(bb);
 }
 
+// Returns assignment expression to local register variable, if the statement is only it.
+static Expr *single_local_assign(Stmt *stmt) {
+  if (stmt->kind == ST_BLOCK) {
+    if (stmt->block.stmts == NULL || stmt->block.stmts->len != 1)
+      return NULL;
+    stmt = stmt->block.stmts->data[0];
+  }
+  if (stmt == NULL || stmt->kind != ST_EXPR || stmt->expr->kind != EX_ASSIGN)
+    return NULL;
+  Expr *lhs = stmt->expr->bop.lhs;
+  if (lhs->kind != EX_VAR || !(is_fixnum(lhs->type->kind) || lhs->type->kind == TY_PTR))
+    return NULL;
+  Scope *scope;
+  const VarInfo *varinfo = scope_find(lhs->var.scope, lhs->var.name, &scope);
+  if (varinfo == NULL || is_global_scope(scope) || (varinfo->storage & (VS_STATIC | VS_EXTERN)))
+    return NULL;
+  return stmt->expr;
+}
+
+// Convert `if (cond) x = a; else x = b;` to `x = cond ? a : b` without branch.
+static bool gen_if_select(Stmt *stmt) {
+  Expr *tassign = single_local_assign(stmt->if_.tblock);
+  if (tassign == NULL)
+    return false;
+  Expr *var = tassign->bop.lhs;
+  Expr *fval = var;  // `if (cond) x = a;` keeps x as is.
+  if (stmt->if_.fblock != NULL) {
+    Expr *fassign = single_local_assign(stmt->if_.fblock);
+    if (fassign == NULL || fassign->bop.lhs->var.scope != var->var.scope ||
+        !equal_name(fassign->bop.lhs->var.name, var->var.name))
+      return false;
+    fval = fassign->bop.rhs;
+  }
+  if (!can_select(stmt->if_.cond, tassign->bop.rhs, fval))
+    return false;
+
+  const VarInfo *varinfo = scope_find(var->var.scope, var->var.name, NULL);
+  VReg *result = gen_select(stmt->if_.cond, tassign->bop.rhs, fval, var->type);
+  new_ir_mov(varinfo->local.reg, result);
+  return true;
+}
+
 static void gen_if(Stmt *stmt) {
+  if (gen_if_select(stmt))
+    return;
+
   BB *tbb = new_bb();
   BB *fbb = new_bb();
   gen_cond_jmp(stmt->if_.cond, false, fbb);
@@ -188,69 +248,314 @@ static int compare_cases(const void *pa, const void *pb) {
     return 1;
   if (cb->case_.value == NULL)
     return -1;
-  Fixnum d = ca->case_.value->fixnum - cb->case_.value->fixnum;
-  return d > 0 ? 1 : d < 0 ? -1 : 0;
+  Fixnum a = ca->case_.value->fixnum, b = cb->case_.value->fixnum;
+  return a > b ? 1 : a < b ? -1 : 0;
+}
+
+static int compare_unsigned_cases(const void *pa, const void *pb) {
+  Stmt *ca = *(Stmt**)pa;
+  Stmt *cb = *(Stmt**)pb;
+  if (ca->case_.value == NULL)
+    return 1;
+  if (cb->case_.value == NULL)
+    return -1;
+  UFixnum a = ca->case_.value->fixnum, b = cb->case_.value->fixnum;
+  return a > b ? 1 : a < b ? -1 : 0;
 }
 
-static void gen_switch_cond_table_jump(Stmt *swtch, VReg *reg, Stmt **cases, int len) {
-  Fixnum min = (cases[0])->case_.value->fixnum;
-  Fixnum max = (cases[len - 1])->case_.value->fixnum;
-  Fixnum range = max - min + 1;
+// Switch lowering: sorted cases are partitioned into clusters with a cost model,
+// and the clusters are searched with binary compare tree.
+
+#define JUMP_TABLE_MIN_CASES    (4)
+#define JUMP_TABLE_MIN_DENSITY  (40)  // Percent.
+#define BIT_TEST_MAX_TARGETS    (3)
+#define BIT_TEST_MIN_CASES      (3)
+#define BIT_TEST_BITS           (64)
+#define CLUSTER_SEARCH_COST     (2)  // Compare and branch in the search tree.
+
+enum SwitchClusterKind {
+  SC_SINGLE,    // One value.
+  SC_RANGE,     // Consecutive values to the same target.
+  SC_BIT_TEST,  // Few targets within a word: test with bit mask.
+  SC_TABLE,     // Jump table.
+};
+
+typedef struct {
+  enum SwitchClusterKind kind;
+  Stmt **cases;
+  int len;
+} SwitchCluster;
+
+static int cluster_cost(enum SwitchClusterKind kind, int target_count) {
+  switch (kind) {
+  case SC_SINGLE:    return 2;  // cmp, je
+  case SC_RANGE:     return 3;  // sub, cmp, jbe
+  case SC_BIT_TEST:  return 4 + 3 * target_count;  // sub, cmp, ja, shl + (and, test, jne) * targets
+  case SC_TABLE:     return 6;  // sub, cmp, ja, lea, mov, jmp (indirect)
+  }
+  assert(false);
+  return 0;
+}
+
+static Fixnum case_value(Stmt *c) {
+  return c->case_.value->fixnum;
+}
+
+// Large constant cannot be an immediate operand in x86, so put it into a register.
+static VReg *switch_const(Fixnum value, const VRegType *vtype) {
+  VReg *reg = new_const_vreg(value, vtype);
+  if (!is_im32(value)) {
+    VReg *tmp = reg_alloc_spawn(curra, vtype, 0);
+    new_ir_mov(tmp, reg);
+    reg = tmp;
+  }
+  return reg;
+}
+
+// Partition sorted cases into clusters which minimize the total cost (dynamic programming).
+static SwitchCluster *cluster_cases(Stmt **cases, int len, int *pcount) {
+  if (len > BIT_TEST_BITS) {
+    // Large and dense switch: single jump table, without quadratic search.
+    UFixnum range = (UFixnum)case_value(cases[len - 1]) - (UFixnum)case_value(cases[0]) + 1;
+    if (range != 0 && range * JUMP_TABLE_MIN_DENSITY <= (UFixnum)len * 100) {
+      SwitchCluster *cluster = malloc(sizeof(*cluster));
+      cluster->kind = SC_TABLE;
+      cluster->cases = cases;
+      cluster->len = len;
+      *pcount = 1;
+      return cluster;
+    }
+  }
+
+  int *best = malloc(sizeof(*best) * (len + 1));  // best[k]: Minimum cost for cases[0..k).
+  int *first = malloc(sizeof(*first) * (len + 1));
+  enum SwitchClusterKind *kinds = malloc(sizeof(*kinds) * (len + 1));
+  UFixnum max_range = (UFixnum)len * 100 / JUMP_TABLE_MIN_DENSITY;
+  if (max_range < BIT_TEST_BITS)
+    max_range = BIT_TEST_BITS;
+
+  best[0] = 0;
+  for (int k = 1; k <= len; ++k) {
+    best[k] = -1;
+    BB *targets[BIT_TEST_MAX_TARGETS];
+    int target_count = 0;
+    for (int i = k; --i >= 0; ) {  // Cluster for cases[i..k).
+      UFixnum range = (UFixnum)case_value(cases[k - 1]) - (UFixnum)case_value(cases[i]) + 1;
+      if (range == 0 || range > max_range)
+        break;
+      int n = k - i;
+
+      BB *bb = cases[i]->case_.bb;
+      if (target_count <= BIT_TEST_MAX_TARGETS) {
+        int j;
+        for (j = 0; j < target_count; ++j) {
+          if (targets[j] == bb)
+            break;
+        }
+        if (j >= target_count) {
+          if (target_count < BIT_TEST_MAX_TARGETS)
+            targets[target_count] = bb;
+          ++target_count;
+        }
+      }
+
+      enum SwitchClusterKind candidates[4];
+      int candidate_count = 0;
+      if (n == 1)
+        candidates[candidate_count++] = SC_SINGLE;
+      if (target_count == 1 && range == (UFixnum)n && n > 1)
+        candidates[candidate_count++] = SC_RANGE;
+      if (target_count <= BIT_TEST_MAX_TARGETS && range <= BIT_TEST_BITS && n >= BIT_TEST_MIN_CASES)
+        candidates[candidate_count++] = SC_BIT_TEST;
+      if (n >= JUMP_TABLE_MIN_CASES && range * JUMP_TABLE_MIN_DENSITY <= (UFixnum)n * 100)
+        candidates[candidate_count++] = SC_TABLE;
+
+      for (int j = 0; j < candidate_count; ++j) {
+        int cost = best[i] + CLUSTER_SEARCH_COST + cluster_cost(candidates[j], target_count);
+        if (best[k] < 0 || cost < best[k]) {
+          best[k] = cost;
+          first[k] = i;
+          kinds[k] = candidates[j];
+        }
+      }
+    }
+  }
 
-  BB **table = malloc(sizeof(*table) * range);
+  int count = 0;
+  for (int k = len; k > 0; k = first[k])
+    ++count;
+  SwitchCluster *clusters = malloc(sizeof(*clusters) * count);
+  int index = count;
+  for (int k = len; k > 0; k = first[k]) {
+    SwitchCluster *cluster = &clusters[--index];
+    cluster->kind = kinds[k];
+    cluster->cases = &cases[first[k]];
+    cluster->len = k - first[k];
+  }
+  free(best);
+  free(first);
+  free(kinds);
+  *pcount = count;
+  return clusters;
+}
+
+// Jump to the target if the value matches to the cluster, otherwise continue to the next block.
+static void gen_switch_cluster(Stmt *swtch, VReg *reg, SwitchCluster *cluster) {
+  Stmt **cases = cluster->cases;
+  int len = cluster->len;
   Stmt *def = swtch->switch_.default_;
   BB *skip_bb = def != NULL ? def->case_.bb : swtch->switch_.break_bb;
-  for (Fixnum i = 0; i < range; ++i)
-    table[i] = skip_bb;
-  for (int i = 0; i < len; ++i) {
-    Stmt *c = cases[i];
-    table[c->case_.value->fixnum - min] = c->case_.bb;
+  BB *nextbb = new_bb();
+
+  if (cluster->kind == SC_SINGLE) {
+    new_ir_cmp(reg, switch_const(case_value(cases[0]), reg->vtype));
+    new_ir_jmp(COND_EQ, cases[0]->case_.bb);
+    set_curbb(nextbb);
+    return;
   }
 
-  BB *nextbb = new_bb();
-  VReg *val = min == 0 ? reg : new_ir_bop(IR_SUB, reg, new_const_vreg(min, reg->vtype), reg->vtype);
-  new_ir_cmp(val, new_const_vreg(max - min, val->vtype));
-  new_ir_jmp(COND_UGT, skip_bb);
+  Fixnum min = case_value(cases[0]);
+  Fixnum max = case_value(cases[len - 1]);
+  VReg *val = min == 0 ? reg : new_ir_bop(IR_SUB, reg, switch_const(min, reg->vtype), reg->vtype);
+  new_ir_cmp(val, switch_const(max - min, val->vtype));
+  if (cluster->kind == SC_RANGE) {
+    new_ir_jmp(COND_ULE, cases[0]->case_.bb);
+    set_curbb(nextbb);
+    return;
+  }
+  new_ir_jmp(COND_UGT, nextbb);
+  set_curbb(new_bb());
+
+  switch (cluster->kind) {
+  case SC_BIT_TEST:
+    {
+      const VRegType *vtype = to_vtype(&tySSize);
+      VReg *bits = new_ir_bop(IR_LSHIFT, new_const_vreg(1, vtype), val, vtype);
+      BB *targets[BIT_TEST_MAX_TARGETS];
+      UFixnum masks[BIT_TEST_MAX_TARGETS];
+      int target_count = 0;
+      for (int i = 0; i < len; ++i) {
+        BB *bb = cases[i]->case_.bb;
+        int j;
+        for (j = 0; j < target_count; ++j) {
+          if (targets[j] == bb)
+            break;
+        }
+        if (j >= target_count) {
+          assert(target_count < BIT_TEST_MAX_TARGETS);
+          targets[j] = bb;
+          masks[j] = 0;
+          ++target_count;
+        }
+        masks[j] |= (UFixnum)1 << (case_value(cases[i]) - min);
+      }
+
+      for (int j = 0; j < target_count; ++j) {
+        VReg *masked = new_ir_bop(IR_BITAND, bits, switch_const(masks[j], vtype), vtype);
+        new_ir_cmp(masked, new_const_vreg(0, vtype));
+        new_ir_jmp(COND_NE, targets[j]);
+        set_curbb(new_bb());
+      }
+      new_ir_jmp(COND_ANY, skip_bb);
+    }
+    break;
+  case SC_TABLE:
+    {
+      UFixnum range = max - min + 1;
+      BB **table = malloc(sizeof(*table) * range);
+      for (UFixnum i = 0; i < range; ++i)
+        table[i] = skip_bb;
+      for (int i = 0; i < len; ++i) {
+        Stmt *c = cases[i];
+        table[case_value(c) - min] = c->case_.bb;
+      }
+      new_ir_tjmp(val, table, range);
+    }
+    break;
+  default: assert(false); break;
+  }
   set_curbb(nextbb);
-  new_ir_tjmp(val, table, range);
 }
 
-static void gen_switch_cond_recur(Stmt *swtch, VReg *reg, Stmt **cases, int len) {
-  if (len <= 2) {
-    for (int i = 0; i < len; ++i) {
-      BB *nextbb = new_bb();
-      Stmt *c = cases[i];
-      VReg *num = new_const_vreg(c->case_.value->fixnum, reg->vtype);
-      new_ir_cmp(reg, num);
-      new_ir_jmp(COND_EQ, c->case_.bb);
-      set_curbb(nextbb);
-    }
+static void gen_switch_cond_recur(Stmt *swtch, VReg *reg, SwitchCluster *clusters, int len) {
+  if (len <= 3) {
+    for (int i = 0; i < len; ++i)
+      gen_switch_cluster(swtch, reg, &clusters[i]);
     Stmt *def = swtch->switch_.default_;
     new_ir_jmp(COND_ANY, def != NULL ? def->case_.bb : swtch->switch_.break_bb);
   } else {
-    Stmt *min = cases[0];
-    Stmt *max = cases[len - 1];
-    Fixnum range = max->case_.value->fixnum - min->case_.value->fixnum + 1;
-    if (range >= 4 && len > (range >> 1)) {
-      gen_switch_cond_table_jump(swtch, reg, cases, len);
-      return;
-    }
-
-    BB *bbne = new_bb();
     int m = len >> 1;
-    Stmt *c = cases[m];
-    VReg *num = new_const_vreg(c->case_.value->fixnum, reg->vtype);
-    new_ir_cmp(reg, num);
-    new_ir_jmp(COND_EQ, c->case_.bb);
-    set_curbb(bbne);
-
     BB *bblt = new_bb();
-    BB *bbgt = new_bb();
-    new_ir_jmp(COND_GT, bbgt);
+    BB *bbge = new_bb();
+    new_ir_cmp(reg, switch_const(case_value(clusters[m].cases[0]), reg->vtype));
+    new_ir_jmp(reg->vtype->flag & VRTF_UNSIGNED ? COND_UGE : COND_GE, bbge);
     set_curbb(bblt);
-    gen_switch_cond_recur(swtch, reg, cases, m);
-    set_curbb(bbgt);
-    gen_switch_cond_recur(swtch, reg, cases + (m + 1), len - (m + 1));
+    gen_switch_cond_recur(swtch, reg, clusters, m);
+    set_curbb(bbge);
+    gen_switch_cond_recur(swtch, reg, clusters + m, len - m);
+  }
+}
+
+// Switch dispatch, which is reordered with the profile.
+typedef struct {
+  Stmt *stmt;
+  VReg *reg;
+  BB *bb;
+  int pos;  // Start of the dispatch in `bb`.
+} SwitchSite;
+
+static Vector *switch_sites;  // <SwitchSite*>, recorded only when the profile is used.
+
+// Test the dominant case first, before searching the clusters.
+static void prioritize_hot_cases(BBContainer *bbcon) {
+  for (int i = 0; i < switch_sites->len; ++i) {
+    SwitchSite *site = switch_sites->data[i];
+    BB *bb = site->bb;
+    Vector *cases = site->stmt->switch_.cases;
+    Stmt *hot = NULL;
+    int case_count = 0;
+    for (int j = 0; j < cases->len; ++j) {
+      Stmt *c = cases->data[j];
+      if (c->case_.value == NULL)
+        continue;
+      ++case_count;
+      if (hot == NULL || c->case_.bb->count > hot->case_.bb->count)
+        hot = c;
+    }
+    if (case_count <= 2 || bb->count <= 0 || hot->case_.bb->count * 2 < bb->count)
+      continue;
+    // Target block must be reached only by the value.
+    int n = 0;
+    for (int j = 0; j < cases->len; ++j) {
+      Stmt *c = cases->data[j];
+      if (c->case_.bb == hot->case_.bb)
+        ++n;
+    }
+    if (n > 1)
+      continue;
+
+    BB *rest = new_bb();
+    rest->count = MAX(bb->count - hot->case_.bb->count, 0);
+    for (int j = site->pos; j < bb->irs->len; ++j)
+      vec_push(rest->irs, bb->irs->data[j]);
+    while (bb->irs->len > site->pos)
+      vec_pop(bb->irs);
+    rest->next = bb->next;
+    bb->next = rest;
+
+    BB *saved = curbb;
+    curbb = bb;
+    new_ir_cmp(site->reg, switch_const(case_value(hot), site->reg->vtype));
+    new_ir_jmp(COND_EQ, hot->case_.bb);
+    curbb = saved;
+
+    Vector *bbs = bbcon->bbs;
+    for (int j = 0; j < bbs->len; ++j) {
+      if (bbs->data[j] == bb) {
+        vec_insert(bbs, j + 1, rest);
+        break;
+      }
+    }
   }
 }
 
@@ -277,12 +582,25 @@ static void gen_switch_cond(Stmt *stmt) {
     set_curbb(nextbb);
   } else {
     if (len > 0) {
+      if (switch_sites != NULL) {
+        SwitchSite *site = malloc(sizeof(*site));
+        site->stmt = stmt;
+        site->reg = reg;
+        site->bb = curbb;
+        site->pos = curbb->irs->len;
+        vec_push(switch_sites, site);
+      }
+
       // Sort cases in increasing order.
-      myqsort(cases->data, len, sizeof(void*), compare_cases);
+      myqsort(cases->data, len, sizeof(void*),
+              reg->vtype->flag & VRTF_UNSIGNED ? compare_unsigned_cases : compare_cases);
 
       if (stmt->switch_.default_ != NULL)
         --len;  // Ignore default.
-      gen_switch_cond_recur(stmt, reg, (Stmt**)cases->data, len);
+      int cluster_count;
+      SwitchCluster *clusters = cluster_cases((Stmt**)cases->data, len, &cluster_count);
+      gen_switch_cond_recur(stmt, reg, clusters, cluster_count);
+      free(clusters);
     } else {
       Stmt *def = stmt->switch_.default_;
       new_ir_jmp(COND_ANY, def != NULL ? def->case_.bb : stmt->switch_.break_bb);
@@ -295,11 +613,30 @@ static void gen_switch(Stmt *stmt) {
   BB *save_break;
   BB *break_bb = stmt->switch_.break_bb = push_break_bb(&save_break);
 
+  // Consecutive case labels share one block, so that they are treated as the same target.
+  Stmt *body = stmt->switch_.body;
+  if (body->kind == ST_BLOCK && body->block.stmts != NULL) {
+    Vector *stmts = body->block.stmts;
+    BB *bb = NULL;
+    for (int i = 0; i < stmts->len; ++i) {
+      Stmt *s = stmts->data[i];
+      if (s == NULL)
+        continue;
+      if (s->kind == ST_CASE || s->kind == ST_DEFAULT) {
+        if (bb == NULL)
+          bb = new_bb();
+        s->case_.bb = bb;
+      } else {
+        bb = NULL;
+      }
+    }
+  }
+
   Vector *cases = stmt->switch_.cases;
   for (int i = 0, len = cases->len; i < len; ++i) {
-    BB *bb = new_bb();
     Stmt *c = cases->data[i];
-    c->case_.bb = bb;
+    if (c->case_.bb == NULL)
+      c->case_.bb = new_bb();
   }
 
   gen_switch_cond(stmt);
@@ -314,7 +651,8 @@ static void gen_switch(Stmt *stmt) {
 }
 
 static void gen_case(Stmt *stmt) {
-  set_curbb(stmt->case_.bb);
+  if (curbb != stmt->case_.bb)
+    set_curbb(stmt->case_.bb);
 }
 
 static void gen_while(Stmt *stmt) {
@@ -448,6 +786,12 @@ void gen_stmt(Stmt *stmt) {
   if (stmt == NULL)
     return;
 
+  // IRs are tagged with the statement, and the outer one is restored for the rest of it
+  // (e.g. the increment of `for`).
+  const Token *saved_token = curtoken;
+  if (stmt->token != NULL)
+    curtoken = stmt->token;
+
   switch (stmt->kind) {
   case ST_EXPR:  gen_expr_stmt(stmt->expr); break;
   case ST_RETURN:  gen_return(stmt); break;
@@ -469,6 +813,7 @@ void gen_stmt(Stmt *stmt) {
     error("Unhandled stmt: %d", stmt->kind);
     break;
   }
+  curtoken = saved_token;
 }
 
 ////////////////////////////////////////////////
@@ -483,6 +828,8 @@ static void gen_defun(Function *func) {
   fnbe->bbcon = NULL;
   fnbe->ret_bb = NULL;
   fnbe->retval = NULL;
+  fnbe->prof_counters = fnbe->prof_record = NULL;
+  fnbe->prof_count = 0;
 
   fnbe->bbcon = new_func_blocks();
   set_curbb(new_bb());
@@ -507,16 +854,27 @@ static void gen_defun(Function *func) {
 
   curscope = func->scopes->data[0];
   fnbe->ret_bb = new_bb();
+  switch_sites = profile_use_path != NULL ? new_vector() : NULL;
 
   // Statements
   gen_stmts(func->stmts);
 
   set_curbb(fnbe->ret_bb);
   curbb = NULL;
+  curtoken = NULL;
+
+  if (profile_generate_path != NULL)
+    instrument_blocks(func);
+  if (profile_use_path != NULL && apply_profile(func))
+    prioritize_hot_cases(fnbe->bbcon);
+  switch_sites = NULL;
 
-  remove_unnecessary_bb(fnbe->bbcon);
+  optimize_loops(fnbe->ra, fnbe->bbcon);
+  layout_bbs(fnbe->bbcon);
 
   prepare_register_allocation(func);
+  fuse_cond_jmp(fnbe->ra, fnbe->bbcon);
+  fold_address_operands(fnbe->ra, fnbe->bbcon);
   convert_3to2(fnbe->bbcon);
   int reserved_size = func->type->func.vaargs ? (MAX_REG_ARGS + MAX_FREG_ARGS) * WORD_SIZE : 0;
   alloc_physical_registers(fnbe->ra, fnbe->bbcon, reserved_size);
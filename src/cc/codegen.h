@@ -7,6 +7,7 @@
 
 typedef struct BB BB;
 typedef struct Expr Expr;
+typedef struct Function Function;
 typedef struct Stmt Stmt;
 typedef struct StructInfo StructInfo;
 typedef struct Type Type;
@@ -20,13 +21,21 @@ extern const char RET_VAR_NAME[];
 
 // Public
 
+extern bool optimize_sibling_calls;
+extern const char *profile_generate_path;  // Count block executions, and write them to the file at exit.
+extern const char *profile_use_path;  // Optimize with the block counts in the file.
+
 void gen(Vector *decls);
 
 // Private
 
 VReg *gen_expr(Expr *expr);
 
+bool gen_tail_call(Expr *expr);
+
 void gen_cond_jmp(Expr *cond, bool tf, BB *bb);
+bool can_select(Expr *cond, Expr *tval, Expr *fval);
+VReg *gen_select(Expr *cond, Expr *tval, Expr *fval, const Type *type);
 
 void set_curbb(BB *bb);
 VReg *add_new_reg(const Type *type, int flag);
@@ -34,6 +43,39 @@ VRegType *to_vtype(const Type *type);
 
 bool is_stack_param(const Type *type);
 
+// Argument passing (SysV x86-64 ABI)
+
+#define MAX_STRUCT_REGS  (2)  // Struct up to 16 bytes can be passed in registers.
+
+typedef struct {
+  int count;  // Number of eightbytes, 0 if the struct is passed through memory.
+  bool flonum[MAX_STRUCT_REGS];  // SSE class, otherwise INTEGER.
+  int index[MAX_STRUCT_REGS];  // Register index in its class.
+} StructRegs;
+
+typedef struct {
+  int reg_index;
+  int offset;
+  int size;
+  bool stack_arg;
+#ifndef __NO_FLONUM
+  bool is_flonum;
+#endif
+  StructRegs sregs;  // Struct passed in registers.
+} ArgInfo;
+
+typedef struct {
+  int ireg_index;
+#ifndef __NO_FLONUM
+  int freg_index;
+#endif
+  int offset;  // Size of stack arguments.
+} ArgClassifier;
+
+bool classify_struct(const Type *type, StructRegs *sregs);
+void classify_arg(ArgClassifier *classifier, const Type *type, ArgInfo *p);
+VReg *load_eightbyte(VReg *ptr, const StructRegs *sregs, int i, int size);
+
 void gen_stmt(struct Stmt *stmt);
 void gen_stmts(Vector *stmts);
 
@@ -41,3 +83,8 @@ typedef VReg *(*BuiltinFunctionProc)(Expr *expr);
 void add_builtin_function(const char *str, Type *type, BuiltinFunctionProc *proc, bool add_to_scope);
 
 void gen_clear_local_var(const VarInfo *varinfo);
+
+// Profile
+
+void instrument_blocks(Function *func);
+bool apply_profile(Function *func);
@@ -16,8 +16,10 @@
 
 #include "parser.h"  // curfunc
 
+// Struct which is passed or returned through memory.
 bool is_stack_param(const Type *type) {
-  return type->kind == TY_STRUCT;
+  StructRegs sregs;
+  return type->kind == TY_STRUCT && !classify_struct(type, &sregs);
 }
 
 VRegType *to_vtype(const Type *type) {
@@ -35,7 +37,7 @@ VRegType *to_vtype(const Type *type) {
 #endif
   if (is_unsigned)
     flag |= VRTF_UNSIGNED;
-  if (is_stack_param(type))
+  if (type->kind == TY_STRUCT)
     flag |= VRTF_NON_REG;
   vtype->flag = flag;
 
@@ -315,7 +317,62 @@ static VReg *gen_variable(Expr *expr) {
   }
 }
 
+// Whether the expression has no side effect, never faults and is cheap enough,
+// so that it can be evaluated regardless of the condition.
+static bool is_speculatable(Expr *expr, int depth) {
+  if (!(is_fixnum(expr->type->kind) || expr->type->kind == TY_PTR))
+    return false;
+  switch (expr->kind) {
+  case EX_FIXNUM:
+    return true;
+  case EX_VAR:
+    // Volatile object must not be read when the branch is not taken.
+    return !(expr->type->qualifier & TQ_VOLATILE);
+  case EX_POS:
+  case EX_NEG:
+  case EX_BITNOT:
+  case EX_CAST:
+    return depth > 0 && is_speculatable(expr->unary.sub, depth - 1);
+  case EX_ADD:
+  case EX_SUB:
+  case EX_BITAND:
+  case EX_BITOR:
+  case EX_BITXOR:
+    return depth > 0 && is_speculatable(expr->bop.lhs, depth - 1) &&
+        is_speculatable(expr->bop.rhs, depth - 1);
+  default:
+    return false;
+  }
+}
+
+static bool is_speculatable_compare(Expr *cond) {
+  return EX_EQ <= cond->kind && cond->kind <= EX_GT &&
+      is_speculatable(cond->bop.lhs, 1) && is_speculatable(cond->bop.rhs, 1);
+}
+
+bool can_select(Expr *cond, Expr *tval, Expr *fval) {
+  return is_speculatable_compare(cond) && is_speculatable(tval, 2) && is_speculatable(fval, 2);
+}
+
+// Generate `cond ? tval : fval` without branch, using cmov.
+VReg *gen_select(Expr *cond, Expr *tval, Expr *fval, const Type *type) {
+  assert(can_select(cond, tval, fval));
+  // Both values are calculated before comparison, to keep the flag until cmov.
+  VReg *treg = gen_cast(gen_expr(tval), type);
+  VReg *freg = gen_cast(gen_expr(fval), type);
+  enum ConditionKind kind = gen_compare_expr(cond->kind, cond->bop.lhs, cond->bop.rhs);
+  switch (kind) {
+  case COND_NONE:  return freg;
+  case COND_ANY:   return treg;
+  default:         return new_ir_cmov(kind, freg, treg, to_vtype(type));
+  }
+}
+
 static VReg *gen_ternary(Expr *expr) {
+  if ((is_fixnum(expr->type->kind) || expr->type->kind == TY_PTR) &&
+      can_select(expr->ternary.cond, expr->ternary.tval, expr->ternary.fval))
+    return gen_select(expr->ternary.cond, expr->ternary.tval, expr->ternary.fval, expr->type);
+
   BB *tbb = new_bb();
   BB *fbb = new_bb();
   BB *nbb = new_bb();
@@ -344,15 +401,172 @@ static VReg *gen_ternary(Expr *expr) {
   return result;
 }
 
-typedef struct {
-  int reg_index;
-  int offset;
-  int size;
-  bool stack_arg;
+// Mark eightbytes which contain other than floating-point number as INTEGER class.
+static void classify_eightbytes(const Type *type, int offset, bool *integer) {
+  switch (type->kind) {
+  case TY_STRUCT:
+    {
+      const Vector *members = type->struct_.info->members;
+      for (int i = 0; i < members->len; ++i) {
+        const MemberInfo *member = members->data[i];
+        classify_eightbytes(member->type, offset + member->offset, integer);
+      }
+    }
+    break;
+  case TY_ARRAY:
+    {
+      int size = type_size(type->pa.ptrof);
+      for (ssize_t i = 0; i < type->pa.length; ++i)
+        classify_eightbytes(type->pa.ptrof, offset + i * size, integer);
+    }
+    break;
 #ifndef __NO_FLONUM
-  bool is_flonum;
+  case TY_FLONUM:
+    break;
 #endif
-} ArgInfo;
+  default:
+    integer[offset / WORD_SIZE] = true;
+    break;
+  }
+}
+
+// Struct up to 16 bytes is passed in registers, each eightbyte in general purpose register
+// or in SSE register if it consists of only floating-point numbers.
+bool classify_struct(const Type *type, StructRegs *sregs) {
+  assert(type->kind == TY_STRUCT);
+  int size = type_size(type);
+  sregs->count = 0;
+  if (size <= 0 || size > MAX_STRUCT_REGS * WORD_SIZE)
+    return false;
+
+  bool integer[MAX_STRUCT_REGS] = {false, false};
+  classify_eightbytes(type, 0, integer);
+  int count = (size + WORD_SIZE - 1) / WORD_SIZE;
+  int iindex = 0, findex = 0;
+  for (int i = 0; i < count; ++i) {
+#ifndef __NO_FLONUM
+    if (!integer[i]) {
+      sregs->flonum[i] = true;
+      sregs->index[i] = findex++;
+      continue;
+    }
+#endif
+    sregs->flonum[i] = false;
+    sregs->index[i] = iindex++;
+  }
+  sregs->count = count;
+  return true;
+}
+
+// Decide whether the argument is passed through register or stack.
+void classify_arg(ArgClassifier *classifier, const Type *type, ArgInfo *p) {
+  p->reg_index = -1;
+  p->offset = -1;
+  p->size = type_size(type);
+  p->sregs.count = 0;
+#ifndef __NO_FLONUM
+  p->is_flonum = is_flonum(type);
+#endif
+  p->stack_arg = type->kind == TY_STRUCT;
+  bool reg_arg = !p->stack_arg;
+  if (reg_arg) {
+#ifndef __NO_FLONUM
+    if (p->is_flonum)
+      reg_arg = classifier->freg_index < MAX_FREG_ARGS;
+    else
+#endif
+      reg_arg = classifier->ireg_index < MAX_REG_ARGS;
+  } else if (classify_struct(type, &p->sregs)) {
+    // Whole eightbytes must fit in the remaining registers.
+    int icount = 0, fcount = 0;
+    for (int i = 0; i < p->sregs.count; ++i) {
+      if (p->sregs.flonum[i])
+        ++fcount;
+      else
+        ++icount;
+    }
+    if (classifier->ireg_index + icount <= MAX_REG_ARGS
+#ifndef __NO_FLONUM
+        && classifier->freg_index + fcount <= MAX_FREG_ARGS
+#endif
+    ) {
+      for (int i = 0; i < p->sregs.count; ++i) {
+#ifndef __NO_FLONUM
+        if (p->sregs.flonum[i]) {
+          p->sregs.index[i] += classifier->freg_index;
+          continue;
+        }
+#endif
+        p->sregs.index[i] += classifier->ireg_index;
+      }
+      classifier->ireg_index += icount;
+#ifndef __NO_FLONUM
+      classifier->freg_index += fcount;
+#endif
+      p->stack_arg = false;
+      return;
+    }
+    p->sregs.count = 0;
+  }
+  if (!reg_arg) {
+    int offset = ALIGN(classifier->offset, align_size(type));
+    p->offset = offset;
+    classifier->offset = offset + ALIGN(p->size, WORD_SIZE);
+  } else {
+#ifndef __NO_FLONUM
+    if (p->is_flonum)
+      p->reg_index = classifier->freg_index++;
+    else
+#endif
+      p->reg_index = classifier->ireg_index++;
+  }
+}
+
+// Load i-th eightbyte of the struct (whose size is `size`) at `ptr`, without reading beyond it.
+VReg *load_eightbyte(VReg *ptr, const StructRegs *sregs, int i, int size) {
+  static const VRegType kFixnumVtypes[] = {
+    {.size = 1, .align = 1, .flag = VRTF_UNSIGNED},
+    {.size = 2, .align = 2, .flag = VRTF_UNSIGNED},
+    {.size = 4, .align = 4, .flag = VRTF_UNSIGNED},
+    {.size = 8, .align = 8, .flag = VRTF_UNSIGNED},
+  };
+  const VRegType *ptr_vtype = to_vtype(&tyVoidPtr);
+  int offset = i * WORD_SIZE;
+  int n = size - offset;
+  if (n > WORD_SIZE)
+    n = WORD_SIZE;
+
+#ifndef __NO_FLONUM
+  if (sregs->flonum[i]) {
+    const Type *type = n == (int)type_size(&tyFloat) ? &tyFloat : &tyDouble;
+    assert(n == (int)type_size(type));
+    VReg *addr = offset == 0 ? ptr : new_ir_bop(IR_ADD, ptr, new_const_vreg(offset, ptr_vtype), ptr_vtype);
+    return new_ir_unary(IR_LOAD, addr, to_vtype(type));
+  }
+#else
+  UNUSED(sregs);
+#endif
+
+  // Odd sized eightbyte is composed from smaller loads.
+  const VRegType *vtype64 = &kFixnumVtypes[3];
+  VReg *result = NULL;
+  for (int done = 0; done < n; ) {
+    int pow = 3;
+    while ((1 << pow) > n - done)
+      --pow;
+    int ofs = offset + done;
+    VReg *addr = ofs == 0 ? ptr : new_ir_bop(IR_ADD, ptr, new_const_vreg(ofs, ptr_vtype), ptr_vtype);
+    VReg *value = new_ir_unary(IR_LOAD, addr, &kFixnumVtypes[pow]);
+    if ((1 << pow) == n)
+      return value;
+    value = new_ir_cast(value, vtype64);
+    if (done > 0)
+      value = new_ir_bop(IR_LSHIFT, value, new_const_vreg(done * CHAR_BIT, vtype64), vtype64);
+    result = result == NULL ? value : new_ir_bop(IR_BITOR, result, value, vtype64);
+    done += 1 << pow;
+  }
+  return result;
+}
 
 static VReg *gen_funcall(Expr *expr) {
   Expr *func = expr->funcall.func;
@@ -368,87 +582,84 @@ static VReg *gen_funcall(Expr *expr) {
   int offset = 0;
 
   VReg *retvar_reg = NULL;  // Return value is on the stack.
-  if (is_stack_param(expr->type)) {
+  StructRegs ret_sregs = {.count = 0};  // Struct returned in registers.
+  if (expr->type->kind == TY_STRUCT) {
     const Name *name = alloc_label();
     VarInfo *ret_varinfo = scope_add(curscope, name, expr->type, 0);
     ret_varinfo->local.reg = retvar_reg = add_new_reg(expr->type, 0);
+    classify_struct(expr->type, &ret_sregs);
   }
+  bool ret_ptr = retvar_reg != NULL && ret_sregs.count == 0;  // Pass the pointer to receive.
 
-  int total_arg_count = arg_count + (retvar_reg != NULL ? 1 : 0);
-  VRegType **arg_vtypes = (retvar_reg == NULL && arg_count <= 0) ? NULL :
-    calloc(total_arg_count, sizeof(*arg_vtypes));
-
+  int arg_start = ret_ptr ? 1 : 0;
+  int total_arg_count = arg_start;
   ArgInfo *arg_infos = NULL;
   int stack_arg_count = 0;
   if (args != NULL) {
-    int arg_start = retvar_reg != NULL ? 1 : 0;
-    int ireg_index = arg_start;
-#ifndef __NO_FLONUM
-    int freg_index = 0;
-#endif
+    ArgClassifier classifier = {.ireg_index = arg_start};
 
     // Check stack arguments.
     arg_infos = ALLOCA(sizeof(*arg_infos) * arg_count);
     for (int i = 0; i < arg_count; ++i) {
-      ArgInfo *p = &arg_infos[i];
-      p->reg_index = -1;
-      p->offset = -1;
       Expr *arg = args->data[i];
       assert(arg->type->kind != TY_ARRAY);
-      p->size = type_size(arg->type);
-#ifndef __NO_FLONUM
-      p->is_flonum = is_flonum(arg->type);
-#endif
-      p->stack_arg = is_stack_param(arg->type);
-      bool reg_arg = !p->stack_arg;
-      if (reg_arg) {
-#ifndef __NO_FLONUM
-        if (p->is_flonum)
-          reg_arg = freg_index < MAX_FREG_ARGS;
-        else
-#endif
-          reg_arg = ireg_index < MAX_REG_ARGS;
-      }
-      if (!reg_arg) {
-        offset = ALIGN(offset, align_size(arg->type));
-        p->offset = offset;
-        offset += ALIGN(p->size, WORD_SIZE);
+      classify_arg(&classifier, arg->type, &arg_infos[i]);
+      if (arg_infos[i].offset >= 0)
         ++stack_arg_count;
-      } else {
-#ifndef __NO_FLONUM
-        if (p->is_flonum)
-          p->reg_index = freg_index++;
-        else
-#endif
-          p->reg_index = ireg_index++;
-      }
+      total_arg_count += arg_infos[i].sregs.count > 0 ? arg_infos[i].sregs.count : 1;
     }
+    offset = classifier.offset;
+  }
+  offset = ALIGN(offset, 8);
 
-    for (int i = 0; i < arg_count; ++i) {
-      Expr *arg = args->data[i];
-      arg_vtypes[i + arg_start] = to_vtype(arg->type);
+  // Each eightbyte of struct in registers is counted as an argument.
+  VRegType **arg_vtypes = total_arg_count <= 0 ? NULL : calloc(total_arg_count, sizeof(*arg_vtypes));
+  for (int i = 0, n = arg_start; i < arg_count; ++i) {
+    Expr *arg = args->data[i];
+    const StructRegs *sregs = &arg_infos[i].sregs;
+    if (sregs->count == 0) {
+      arg_vtypes[n++] = to_vtype(arg->type);
+      continue;
+    }
+    for (int k = 0; k < sregs->count; ++k) {
+#ifndef __NO_FLONUM
+      if (sregs->flonum[k]) {
+        arg_vtypes[n++] = to_vtype(&tyDouble);
+        continue;
+      }
+#endif
+      arg_vtypes[n++] = to_vtype(&tySize);
     }
   }
-  offset = ALIGN(offset, 8);
 
   IR *precall = new_ir_precall(arg_count - stack_arg_count, offset);
 
   int reg_arg_count = 0;
+  VReg **reg_args = NULL;  // MAX_STRUCT_REGS for each argument.
   if (offset > 0)
     new_ir_subsp(new_const_vreg(offset, to_vtype(&tySSize)), NULL);
   if (args != NULL) {
-    // Register arguments.
+    // Evaluate arguments: stack ones are stored directly,
+    // register ones are kept in vregs until just before the call.
+    reg_args = ALLOCA(sizeof(*reg_args) * arg_count * MAX_STRUCT_REGS);
     for (int i = arg_count; --i >= 0; ) {
       Expr *arg = args->data[i];
       VReg *reg = gen_expr(arg);
       const ArgInfo *p = &arg_infos[i];
+      VReg **dst_regs = &reg_args[i * MAX_STRUCT_REGS];
       if (p->offset < 0) {
-        new_ir_pusharg(reg, to_vtype(arg->type));
-        ++reg_arg_count;
+        if (p->sregs.count > 0) {
+          for (int k = 0; k < p->sregs.count; ++k)
+            dst_regs[k] = load_eightbyte(reg, &p->sregs, k, p->size);
+          reg_arg_count += p->sregs.count;
+        } else {
+          dst_regs[0] = reg;
+          ++reg_arg_count;
+        }
       } else {
+        dst_regs[0] = NULL;
         VRegType offset_type = {.size = 4, .align = 4, .flag = 0};  // TODO:
-        VReg *dst = new_ir_sofs(new_const_vreg(p->offset + reg_arg_count * WORD_SIZE,
-                                               &offset_type));
+        VReg *dst = new_ir_sofs(new_const_vreg(p->offset, &offset_type));
         if (p->stack_arg) {
           new_ir_memcpy(dst, reg, type_size(arg->type));
         } else {
@@ -457,12 +668,11 @@ static VReg *gen_funcall(Expr *expr) {
       }
     }
   }
-  if (retvar_reg != NULL) {
+  VReg *retvar_ptr = NULL;
+  if (ret_ptr) {
     // gen_lval(retvar)
-    VReg *dst = new_ir_bofs(retvar_reg);
-    VRegType *vtype = to_vtype(ptrof(expr->type));
-    new_ir_pusharg(dst, vtype);
-    arg_vtypes[0] = vtype;
+    retvar_ptr = new_ir_bofs(retvar_reg);
+    arg_vtypes[0] = to_vtype(ptrof(expr->type));
     ++reg_arg_count;
   }
 
@@ -474,24 +684,183 @@ static VReg *gen_funcall(Expr *expr) {
     label_call = varinfo->type->kind == TY_FUNC;
     global = !(varinfo->storage & VS_STATIC);
   }
-
-  VReg *result_reg = NULL;
-  {
-    Type *type = expr->type;
-    if (retvar_reg != NULL)
-      type = ptrof(type);
-    VRegType *ret_vtype = to_vtype(type);
-    if (label_call) {
-      result_reg = new_ir_call(func->var.name, global, NULL, total_arg_count, reg_arg_count,
-                               ret_vtype, precall, arg_vtypes, func->type->func.vaargs);
+  VReg *freg = label_call ? NULL : gen_expr(func);
+
+  // Set register arguments at last, so that nothing clobbers argument registers before the call.
+  if (retvar_ptr != NULL)
+    new_ir_pusharg(retvar_ptr, arg_vtypes[0], 0);
+  for (int i = 0; i < arg_count; ++i) {
+    const ArgInfo *p = &arg_infos[i];
+    VReg **src_regs = &reg_args[i * MAX_STRUCT_REGS];
+    if (src_regs[0] == NULL)
+      continue;
+    if (p->sregs.count > 0) {
+      for (int k = 0; k < p->sregs.count; ++k)
+        new_ir_pusharg(src_regs[k], src_regs[k]->vtype, p->sregs.index[k]);
     } else {
-      VReg *freg = gen_expr(func);
-      result_reg = new_ir_call(NULL, false, freg, total_arg_count, reg_arg_count, ret_vtype,
-                               precall, arg_vtypes, func->type->func.vaargs);
+      Expr *arg = args->data[i];
+      new_ir_pusharg(src_regs[0], to_vtype(arg->type), p->reg_index);
+    }
+  }
+
+  Type *type = expr->type;
+  if (ret_ptr)
+    type = ptrof(type);
+  else if (retvar_reg != NULL)
+    type = &tyVoid;
+  VRegType *ret_vtype = to_vtype(type);
+  IR *call = new_ir_call(label_call ? func->var.name : NULL, label_call && global, freg,
+                         total_arg_count, reg_arg_count, ret_vtype, precall, arg_vtypes,
+                         func->type->func.vaargs);
+  if (ret_sregs.count > 0) {
+    // Returned eightbytes are stored into the local variable just after the call.
+    call->call.ret_struct = retvar_reg;
+    for (int k = 0; k < ret_sregs.count; ++k) {
+      if (ret_sregs.flonum[k])
+        call->call.ret_flonum_bits |= 1 << k;
     }
+    return new_ir_bofs(retvar_reg);
   }
+  return call->dst;
+}
+
+// Locals must be dead when the frame is reused by tail call.
+static bool frame_escapes(Function *func) {
+  for (int i = 0; i < func->scopes->len; ++i) {
+    Scope *scope = func->scopes->data[i];
+    if (scope->vars == NULL)
+      continue;
+    for (int j = 0; j < scope->vars->len; ++j) {
+      VarInfo *varinfo = scope->vars->data[j];
+      if (varinfo->storage & (VS_STATIC | VS_EXTERN | VS_ENUM_MEMBER | VS_TYPEDEF))
+        continue;
+      if ((varinfo->storage & VS_REF_TAKEN) || varinfo->type->kind == TY_ARRAY ||
+          varinfo->type->kind == TY_STRUCT)
+        return true;
+    }
+  }
+  return false;
+}
 
-  return result_reg;
+static VReg *copy_vreg(VReg *reg) {
+  VReg *tmp = reg_alloc_spawn(curra, reg->vtype, 0);
+  new_ir_mov(tmp, reg);
+  return tmp;
+}
+
+// Evaluate arguments, and copy the ones which refer parameters of current function
+// because parameters are overwritten before the call.
+static VReg **gen_tail_args(Vector *args) {
+  int arg_count = args->len;
+  VReg **regs = malloc(sizeof(*regs) * arg_count);
+  for (int i = arg_count; --i >= 0; ) {
+    Expr *arg = args->data[i];
+    VReg *reg = gen_expr(arg);
+    regs[i] = reg->flag & VRF_PARAM ? copy_vreg(reg) : reg;
+  }
+  return regs;
+}
+
+// Generate call in tail position (`return f(...)`) as a jump, if possible:
+// self recursion becomes a loop, and other call tears down the frame and jumps to the callee.
+bool gen_tail_call(Expr *expr) {
+  assert(expr->kind == EX_FUNCALL);
+  Function *func = curfunc;
+  if (!optimize_sibling_calls || func->type->func.vaargs || (func->flag & FUNCF_STACK_MODIFIED) ||
+      func->type->func.ret->kind == TY_STRUCT || expr->type->kind == TY_STRUCT ||
+      frame_escapes(func))
+    return false;
+
+  Expr *fexpr = expr->funcall.func;
+  bool label_call = false;
+  bool global = false;
+  if (fexpr->kind == EX_VAR) {
+    const VarInfo *varinfo = scope_find(fexpr->var.scope, fexpr->var.name, NULL);
+    assert(varinfo != NULL);
+    label_call = varinfo->type->kind == TY_FUNC;
+    global = !(varinfo->storage & VS_STATIC);
+    if (label_call && is_global_scope(fexpr->var.scope) &&
+        table_get(&builtin_function_table, fexpr->var.name) != NULL)
+      return false;
+  }
+
+  Vector *args = expr->funcall.args;
+  int arg_count = args != NULL ? args->len : 0;
+  ArgInfo *arg_infos = ALLOCA(sizeof(*arg_infos) * (arg_count > 0 ? arg_count : 1));
+  ArgClassifier classifier = {.ireg_index = 0};
+  for (int i = 0; i < arg_count; ++i) {
+    Expr *arg = args->data[i];
+    classify_arg(&classifier, arg->type, &arg_infos[i]);
+    if (arg->type->kind == TY_STRUCT)
+      return false;
+  }
+
+  const Vector *params = func->type->func.params;
+  if (label_call && is_global_scope(fexpr->var.scope) && equal_name(fexpr->var.name, func->name) &&
+      params != NULL && params->len == arg_count) {
+    // Self recursion: assign arguments to parameters and jump to the top.
+    for (int i = 0; i < arg_count; ++i) {
+      VarInfo *varinfo = params->data[i];
+      Expr *arg = args->data[i];
+      if (!same_type(varinfo->type, arg->type))
+        return false;
+    }
+
+    VReg **regs = gen_tail_args(args);
+    for (int i = 0; i < arg_count; ++i) {
+      VarInfo *varinfo = params->data[i];
+      new_ir_mov(varinfo->local.reg, regs[i]);
+    }
+    free(regs);
+    BBContainer *bbcon = ((FuncBackend*)func->extra)->bbcon;
+    new_ir_jmp(COND_ANY, bbcon->bbs->data[0]);
+    return true;
+  }
+
+  // Sibling call: stack arguments must fit in the incoming area of current function.
+  if (classifier.offset > 0) {
+    ArgClassifier incoming = {.ireg_index = 0};
+    if (params != NULL) {
+      for (int i = 0; i < params->len; ++i) {
+        VarInfo *varinfo = params->data[i];
+        ArgInfo info;
+        classify_arg(&incoming, varinfo->type, &info);
+      }
+    }
+    if (classifier.offset > incoming.offset)
+      return false;
+  }
+
+  VReg **regs = args != NULL ? gen_tail_args(args) : NULL;
+  int reg_arg_count = 0;
+  VRegType **arg_vtypes = arg_count <= 0 ? NULL : calloc(arg_count, sizeof(*arg_vtypes));
+  for (int i = 0; i < arg_count; ++i) {
+    Expr *arg = args->data[i];
+    arg_vtypes[i] = to_vtype(arg->type);
+    const ArgInfo *p = &arg_infos[i];
+    if (p->offset >= 0) {
+      // Overwrite the incoming stack arguments: [rbp + 16 + offset].
+      VReg *dst = new_ir_bofs(new_const_vreg(WORD_SIZE * 2 + p->offset, to_vtype(&tySSize)));
+      new_ir_store(dst, regs[i]);
+    }
+  }
+
+  VReg *freg = label_call ? NULL : gen_expr(fexpr);
+  if (freg != NULL && (freg->flag & VRF_PARAM))
+    freg = copy_vreg(freg);
+
+  for (int i = 0; i < arg_count; ++i) {
+    if (arg_infos[i].offset < 0) {
+      Expr *arg = args->data[i];
+      new_ir_pusharg(regs[i], to_vtype(arg->type), arg_infos[i].reg_index);
+      ++reg_arg_count;
+    }
+  }
+  free(regs);
+
+  new_ir_tailcall(label_call ? fexpr->var.name : NULL, label_call && global, freg,
+                  arg_count, reg_arg_count, arg_vtypes, fexpr->type->func.vaargs);
+  return true;
 }
 
 VReg *gen_arith(enum ExprKind kind, const Type *type, VReg *lhs, VReg *rhs) {
@@ -879,6 +1248,12 @@ VReg *gen_expr(Expr *expr) {
     }
 
   case EX_LOGAND:
+    if (is_speculatable_compare(expr->bop.lhs) && is_speculatable_compare(expr->bop.rhs)) {
+      // Evaluate both sides and combine flags without branch.
+      VReg *lhs = gen_expr(expr->bop.lhs);
+      VReg *rhs = gen_expr(expr->bop.rhs);
+      return new_ir_bop(IR_BITAND, lhs, rhs, to_vtype(&tyBool));
+    }
     {
       BB *bb1 = new_bb();
       BB *bb2 = new_bb();
@@ -899,6 +1274,11 @@ VReg *gen_expr(Expr *expr) {
     }
 
   case EX_LOGIOR:
+    if (is_speculatable_compare(expr->bop.lhs) && is_speculatable_compare(expr->bop.rhs)) {
+      VReg *lhs = gen_expr(expr->bop.lhs);
+      VReg *rhs = gen_expr(expr->bop.rhs);
+      return new_ir_bop(IR_BITOR, lhs, rhs, to_vtype(&tyBool));
+    }
     {
       BB *bb1 = new_bb();
       BB *bb2 = new_bb();
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stdlib.h>  // malloc
+#include <string.h>  // memcpy
 
 #include "regalloc.h"
 #include "table.h"
@@ -32,17 +33,27 @@ RegAlloc *curra;
 
 // Intermediate Representation
 
+const Token *curtoken;
+
 static IR *new_ir(enum IrKind kind) {
   IR *ir = malloc(sizeof(*ir));
   ir->kind = kind;
   ir->dst = ir->opr1 = ir->opr2 = NULL;
   ir->value = 0;
   ir->size = -1;
+  ir->token = curtoken;
   if (curbb != NULL)
     vec_push(curbb->irs, ir);
   return ir;
 }
 
+static void init_mem_operand(IR *ir) {
+  ir->mem.frame = NULL;
+  ir->mem.label = NULL;
+  ir->mem.global = false;
+  ir->mem.scale = 1;
+}
+
 VReg *new_const_vreg(intptr_t value, const VRegType *vtype) {
   VReg *vreg = reg_alloc_spawn(curra, vtype, VRF_CONST);
   vreg->fixnum = value;
@@ -90,9 +101,9 @@ VReg *new_ir_bop(enum IrKind kind, VReg *opr1, VReg *opr2, const VRegType *vtype
           break;
         case IR_MOD:
           if (vtype->flag & VRTF_UNSIGNED)
-            value = opr1->fixnum / opr2->fixnum;
+            value = (uintptr_t)opr1->fixnum % opr2->fixnum;
           else
-            value = (uintptr_t)opr1->fixnum / opr2->fixnum;
+            value = opr1->fixnum % opr2->fixnum;
           break;
         default: assert(false); break;
         }
@@ -158,6 +169,11 @@ VReg *new_ir_bop(enum IrKind kind, VReg *opr1, VReg *opr2, const VRegType *vtype
           return opr1;
         break;
       case IR_MUL:
+        if (opr2->fixnum == 0)
+          return opr2;
+        if (opr2->fixnum == 1)
+          return opr1;
+        break;
       case IR_DIV:
         if (opr2->fixnum == 0)
           error("Divide by 0");
@@ -208,6 +224,8 @@ VReg *new_ir_unary(enum IrKind kind, VReg *opr, const VRegType *vtype) {
   IR *ir = new_ir(kind);
   ir->opr1 = opr;
   ir->size = vtype->size;
+  if (kind == IR_LOAD)
+    init_mem_operand(ir);
   return ir->dst = reg_alloc_spawn(curra, vtype, 0);
 }
 
@@ -238,6 +256,7 @@ void new_ir_store(VReg *dst, VReg *src) {
   ir->opr1 = src;
   ir->size = src->vtype->size;
   ir->opr2 = dst;  // `dst` is used by indirect, so it is not actually `dst`.
+  init_mem_operand(ir);
 }
 
 void new_ir_cmp(VReg *opr1, VReg *opr2) {
@@ -253,6 +272,20 @@ VReg *new_ir_cond(enum ConditionKind cond) {
   return ir->dst = reg_alloc_spawn(curra, &vtBool, 0);
 }
 
+VReg *new_ir_cmov(enum ConditionKind cond, VReg *opr1, VReg *opr2, const VRegType *vtype) {
+  if (opr2->flag & VRF_CONST) {  // cmov cannot take immediate: move it into register (keeps flag).
+    VReg *tmp = reg_alloc_spawn(curra, vtype, 0);
+    new_ir_mov(tmp, opr2);
+    opr2 = tmp;
+  }
+  IR *ir = new_ir(IR_CMOV);
+  ir->cond.kind = cond;
+  ir->opr1 = opr1;
+  ir->opr2 = opr2;
+  ir->size = vtype->size;
+  return ir->dst = reg_alloc_spawn(curra, vtype, 0);
+}
+
 void new_ir_jmp(enum ConditionKind cond, BB *bb) {
   if (cond == COND_NONE)
     return;
@@ -270,10 +303,11 @@ void new_ir_tjmp(VReg *val, BB **bbs, size_t len) {
   ir->size = val->vtype->size;
 }
 
-void new_ir_pusharg(VReg *vreg, const VRegType *vtype) {
+void new_ir_pusharg(VReg *vreg, const VRegType *vtype, int index) {
   IR *ir = new_ir(IR_PUSHARG);
   ir->opr1 = vreg;
   ir->size = vtype->size;
+  ir->pusharg.index = index;
 }
 
 IR *new_ir_precall(int arg_count, int stack_args_size) {
@@ -285,7 +319,7 @@ IR *new_ir_precall(int arg_count, int stack_args_size) {
   return ir;
 }
 
-VReg *new_ir_call(const Name *label, bool global, VReg *freg, int total_arg_count, int reg_arg_count,
+IR *new_ir_call(const Name *label, bool global, VReg *freg, int total_arg_count, int reg_arg_count,
                   const VRegType *result_type, IR *precall, VRegType **arg_vtypes, bool vaargs) {
   IR *ir = new_ir(IR_CALL);
   ir->call.label = label;
@@ -296,13 +330,34 @@ VReg *new_ir_call(const Name *label, bool global, VReg *freg, int total_arg_coun
   ir->call.total_arg_count = total_arg_count;
   ir->call.reg_arg_count = reg_arg_count;
   ir->call.vaargs = vaargs;
+  ir->call.tail = false;
+  ir->call.ret_struct = NULL;
+  ir->call.ret_flonum_bits = 0;
   ir->size = result_type->size;
-  return ir->dst = reg_alloc_spawn(curra, result_type, 0);
+  ir->dst = reg_alloc_spawn(curra, result_type, 0);
+  return ir;
 }
 
-void new_ir_result(VReg *reg) {
+void new_ir_tailcall(const Name *label, bool global, VReg *freg, int total_arg_count,
+                     int reg_arg_count, VRegType **arg_vtypes, bool vaargs) {
+  IR *ir = new_ir(IR_CALL);
+  ir->call.label = label;
+  ir->call.global = global;
+  ir->opr1 = freg;
+  ir->call.precall = NULL;
+  ir->call.arg_vtypes = arg_vtypes;
+  ir->call.total_arg_count = total_arg_count;
+  ir->call.reg_arg_count = reg_arg_count;
+  ir->call.vaargs = vaargs;
+  ir->call.tail = true;
+  ir->call.ret_struct = NULL;
+  ir->call.ret_flonum_bits = 0;
+}
+
+void new_ir_result(VReg *reg, int index) {
   IR *ir = new_ir(IR_RESULT);
   ir->opr1 = reg;
+  ir->result.index = index;
   ir->size = reg->vtype->size;
 }
 
@@ -366,6 +421,20 @@ IR *new_ir_store_spilled(VReg *dst, VReg *reg, int size) {
   return ir;
 }
 
+// Duplicate the IR with its own payload, which is not put into any BB.
+IR *copy_ir(const IR *src) {
+  // Call is linked with its precall, so they cannot be copied individually.
+  assert(src->kind != IR_PRECALL && src->kind != IR_CALL);
+  IR *ir = malloc(sizeof(*ir));
+  *ir = *src;
+  if (ir->kind == IR_TJMP) {
+    size_t size = sizeof(*ir->tjmp.bbs) * ir->tjmp.len;
+    ir->tjmp.bbs = malloc(size);
+    memcpy(ir->tjmp.bbs, src->tjmp.bbs, size);
+  }
+  return ir;
+}
+
 // Basic Block
 
 BB *curbb;
@@ -375,12 +444,41 @@ BB *new_bb(void) {
   bb->next = NULL;
   bb->label = alloc_label();
   bb->irs = new_vector();
+  bb->count = -1;
   bb->in_regs = NULL;
   bb->out_regs = NULL;
   bb->assigned_regs = NULL;
   return bb;
 }
 
+void begin_rewrite(IrRewriter *rw, BB *bb) {
+  rw->bb = bb;
+  rw->irs = new_vector();
+}
+
+void rewrite_put(IrRewriter *rw, IR *ir) {
+  vec_push(rw->irs, ir);
+}
+
+void end_rewrite(IrRewriter *rw) {
+  // Keep the vector itself, which might be referred.
+  Vector *irs = rw->bb->irs;
+  free(irs->data);
+  *irs = *rw->irs;
+  free(rw->irs);
+  rw->irs = NULL;
+}
+
+void compact_irs(BB *bb) {
+  Vector *irs = bb->irs;
+  int n = 0;
+  for (int i = 0; i < irs->len; ++i) {
+    if (irs->data[i] != NULL)
+      irs->data[n++] = irs->data[i];
+  }
+  irs->len = n;
+}
+
 BBContainer *new_func_blocks(void) {
   BBContainer *bbcon = malloc(sizeof(*bbcon));
   bbcon->bbs = new_vector();
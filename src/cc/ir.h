@@ -9,6 +9,7 @@
 typedef struct BB BB;
 typedef struct Name Name;
 typedef struct RegAlloc RegAlloc;
+typedef struct Token Token;
 typedef struct Vector Vector;
 
 #define MAX_REG_ARGS  (6)
@@ -57,8 +58,8 @@ enum IrKind {
   IR_BOFS,    // dst = [rbp + offset]
   IR_IOFS,    // dst = [rip + label]
   IR_SOFS,    // dst = [rsp + offset]
-  IR_LOAD,    // dst = [opr1]
-  IR_STORE,   // [opr2] = opr1
+  IR_LOAD,    // dst = [opr1 + opr2 * scale + value]
+  IR_STORE,   // [opr2 + value] = opr1
   IR_ADD,     // dst = opr1 + opr2
   IR_SUB,
   IR_MUL,
@@ -73,10 +74,11 @@ enum IrKind {
   IR_NEG,
   IR_BITNOT,
   IR_COND,    // dst <- flag
+  IR_CMOV,    // dst = flag ? opr2 : opr1
   IR_JMP,     // Jump with condition
   IR_TJMP,    // Table jump
   IR_PRECALL, // Prepare for call
-  IR_PUSHARG,
+  IR_PUSHARG, // Set argument register
   IR_CALL,    // Call label or opr1
   IR_RESULT,  // retval = opr1
   IR_SUBSP,   // RSP -= value
@@ -85,6 +87,7 @@ enum IrKind {
   IR_MEMCPY,  // memcpy(opr2, opr1, size)
   IR_CLEAR,   // memset(opr1, 0, size)
   IR_ASM,     // assembler code
+  IR_LEA,     // dst = opr1 + opr2 * scale + value
 
   IR_LOAD_SPILLED,   // dst(spilled) = [opr1]
   IR_STORE_SPILLED,  // [opr2] = opr1(spilled)
@@ -112,15 +115,23 @@ typedef struct IR {
   VReg *opr2;
   int size;
   intptr_t value;
+  const Token *token;  // Source location for line number information.
 
   union {
     struct {
       const Name *label;
       bool global;
     } iofs;
+    struct {
+      // Base of memory operand instead of register (LOAD: opr1, STORE: opr2, LEA: opr1).
+      VReg *frame;        // [rbp + frame->offset]
+      const Name *label;  // [rip + label]
+      bool global;
+      int scale;          // Scale for index register (opr2 of LOAD and LEA)
+    } mem;
     struct {
       enum ConditionKind kind;
-    } cond;
+    } cond;  // COND, CMOV
     struct {
       BB *bb;
       enum ConditionKind cond;
@@ -129,6 +140,12 @@ typedef struct IR {
       BB **bbs;
       size_t len;
     } tjmp;
+    struct {
+      int index;  // Argument register index (integer or floating-point).
+    } pusharg;
+    struct {
+      int index;  // Return register index (integer or floating-point).
+    } result;
     struct {
       int arg_count;
       int stack_args_size;
@@ -143,6 +160,9 @@ typedef struct IR {
       int reg_arg_count;
       bool global;
       bool vaargs;
+      bool tail;  // Tail call: tear down the frame and jump, precall is NULL.
+      VReg *ret_struct;  // Struct returned in registers is stored into this variable.
+      int ret_flonum_bits;  // Eightbytes of the struct in SSE class.
     } call;
     struct {
       const char *str;
@@ -150,6 +170,8 @@ typedef struct IR {
   };
 } IR;
 
+extern const Token *curtoken;  // Source location of IRs to be generated.
+
 VReg *new_const_vreg(intptr_t value, const VRegType *vtype);
 VReg *new_ir_bop(enum IrKind kind, VReg *opr1, VReg *opr2, const VRegType *vtype);
 VReg *new_ir_unary(enum IrKind kind, VReg *opr, const VRegType *vtype);
@@ -160,12 +182,14 @@ VReg *new_ir_sofs(VReg *src);
 void new_ir_store(VReg *dst, VReg *src);
 void new_ir_cmp(VReg *opr1, VReg *opr2);
 VReg *new_ir_cond(enum ConditionKind cond);
+VReg *new_ir_cmov(enum ConditionKind cond, VReg *opr1, VReg *opr2, const VRegType *vtype);
 void new_ir_jmp(enum ConditionKind cond, BB *bb);
 void new_ir_tjmp(VReg *val, BB **bbs, size_t len);
 IR *new_ir_precall(int arg_count, int stack_args_size);
-void new_ir_pusharg(VReg *vreg, const VRegType *vtype);
-VReg *new_ir_call(const Name *label, bool global, VReg *freg, int total_arg_count, int reg_arg_count, const VRegType *result_type, IR *precall, VRegType **arg_vtypes, bool vaargs);
-void new_ir_result(VReg *reg);
+void new_ir_pusharg(VReg *vreg, const VRegType *vtype, int index);
+IR *new_ir_call(const Name *label, bool global, VReg *freg, int total_arg_count, int reg_arg_count, const VRegType *result_type, IR *precall, VRegType **arg_vtypes, bool vaargs);
+void new_ir_tailcall(const Name *label, bool global, VReg *freg, int total_arg_count, int reg_arg_count, VRegType **arg_vtypes, bool vaargs);
+void new_ir_result(VReg *reg, int index);
 void new_ir_subsp(VReg *value, VReg *dst);
 VReg *new_ir_cast(VReg *vreg, const VRegType *dsttype);
 void new_ir_memcpy(VReg *dst, VReg *src, int size);
@@ -174,6 +198,7 @@ void new_ir_asm(const char *asm_, VReg *dst);
 
 IR *new_ir_load_spilled(VReg *reg, VReg *src, int size);
 IR *new_ir_store_spilled(VReg *dst, VReg *reg, int size);
+IR *copy_ir(const IR *src);
 
 // Register allocator
 
@@ -186,6 +211,7 @@ typedef struct BB {
   struct BB *next;
   const Name *label;
   Vector *irs;  // <IR*>
+  long count;  // Execution count in the profile, -1 if unknown.
 
   Vector *in_regs;  // <VReg*>
   Vector *out_regs;  // <VReg*>
@@ -196,17 +222,33 @@ extern BB *curbb;
 
 BB *new_bb(void);
 
+// Rewrite IRs of a BB in one pass: kept and new IRs are put into a new list in order,
+// instead of `vec_insert` or `vec_remove_at` for each, which moves all the following IRs.
+typedef struct IrRewriter {
+  BB *bb;
+  Vector *irs;  // <IR*>, new list.
+} IrRewriter;
+
+void begin_rewrite(IrRewriter *rw, BB *bb);
+void rewrite_put(IrRewriter *rw, IR *ir);
+void end_rewrite(IrRewriter *rw);
+void compact_irs(BB *bb);  // Remove IRs which are cleared to NULL.
+
 // Basic blocks in a function
 typedef struct BBContainer {
   Vector *bbs;  // <BB*>
 } BBContainer;
 
 BBContainer *new_func_blocks(void);
-void remove_unnecessary_bb(BBContainer *bbcon);
+void optimize_loops(RegAlloc *ra, BBContainer *bbcon);
+void layout_bbs(BBContainer *bbcon);
+unsigned short callee_save_reg_bits(void);
+int count_callee_save_regs(unsigned short used);
 int push_callee_save_regs(unsigned short used);
 void pop_callee_save_regs(unsigned short used);
 
 void emit_bb_irs(BBContainer *bbcon);
+void emit_epilogue(void);  // Tear down the frame of current function (before `ret` or tail `jmp`).
 
 // Function info for backend
 
@@ -215,6 +257,11 @@ typedef struct FuncBackend {
   BBContainer *bbcon;
   BB *ret_bb;
   VReg *retval;
+
+  // Block counters for `-fprofile-generate`.
+  const Name *prof_counters;
+  const Name *prof_record;
+  int prof_count;
 } FuncBackend;
 
 //
@@ -223,5 +270,10 @@ typedef struct FuncBackend {
 #define POP_STACK_POS()   do { stackpos -= WORD_SIZE; } while (0)
 
 extern int stackpos;
+extern bool frame_pointer_omitted;  // Current function addresses its frame by %rsp.
+char *frame_indirect(int offset);
+void store_eightbyte(const char **regs, const char *freg, int size, int offset);
 
+void fuse_cond_jmp(RegAlloc *ra, BBContainer *bbcon);  // Jump with flag instead of bool value.
+void fold_address_operands(RegAlloc *ra, BBContainer *bbcon);  // Use x86 addressing modes.
 void convert_3to2(BBContainer *bbcon);  // Make 3 address code to 2.
@@ -0,0 +1,876 @@
+// Loop optimization: loop-invariant code motion and induction variable strength reduction.
+//
+// Runs before the block layout, so the fallthrough destination of a block is `bb->next`.
+
+#include "../config.h"
+#include "ir.h"
+
+#include <assert.h>
+#include <stdlib.h>  // malloc
+
+#include "regalloc.h"
+#include "table.h"
+#include "type.h"
+#include "util.h"
+#include "var.h"
+
+#define MAX_DERIVED_IVS  (3)  // Strength reduced pointer occupies a register during the loop.
+
+// Natural loop: header and blocks which reach to the back edge without passing the header.
+typedef struct {
+  BB *header;
+  Vector *bbs;  // <BB*>
+  Table bb_table;  // <BB label, BB*>
+  BB *preheader;
+} Loop;
+
+typedef struct {
+  RegAlloc *ra;
+  Vector *bbs;  // <BB*>, blocks before the optimization.
+  Table index_table;  // <BB label, index + 1>
+  Vector **succs;  // <BB*>
+  Vector **preds;  // <BB*>
+  Vector *loops;  // <Loop*>
+  Table preheader_table;  // <BB label, Vector<BB*>>, preheaders to be put before the block.
+
+  // Following tables are indexed by vreg no, and sized for vregs which exist before the optimization.
+  // Vregs created in the optimization are treated conservatively.
+  int vreg_count;
+  int *def_counts;
+  int *use_counts;
+  IR **def_irs;  // Definition of single def vreg.
+  IR **use_irs;  // User of single use vreg.
+  int *loop_defs;  // Definition count in current loop.
+} LoopOpt;
+
+// Basic induction variable: `var = var + step` at one place in the loop.
+typedef struct {
+  VReg *var;
+  intptr_t step;
+  IR *update;  // MOV var = tmp
+} InductionVar;
+
+// Pointer which follows an induction variable: `ptr = base + var * stride`.
+typedef struct {
+  InductionVar *iv;
+  VReg *base;
+  intptr_t stride;
+  VReg *ptr;
+  IR *advance;  // `ptr += step * stride`, put after the update of the induction variable.
+} DerivedIV;
+
+static IR *last_ir(BB *bb) {
+  int len = bb->irs->len;
+  return len > 0 ? bb->irs->data[len - 1] : NULL;
+}
+
+static bool can_fall_through(BB *bb) {
+  IR *ir = last_ir(bb);
+  if (ir == NULL)
+    return true;
+  switch (ir->kind) {
+  case IR_JMP:  return ir->jmp.cond != COND_ANY;
+  case IR_TJMP: return false;
+  case IR_CALL: return !ir->call.tail;
+  default:      return true;
+  }
+}
+
+static int bb_index(LoopOpt *lo, BB *bb) {
+  intptr_t index = (intptr_t)table_get(&lo->index_table, bb->label);
+  assert(index > 0);
+  return index - 1;
+}
+
+static bool in_loop(Loop *loop, BB *bb) {
+  return table_get(&loop->bb_table, bb->label) != NULL;
+}
+
+static int find_ir(BB *bb, IR *ir) {
+  for (int i = bb->irs->len; --i >= 0; ) {
+    if (bb->irs->data[i] == ir)
+      return i;
+  }
+  return -1;
+}
+
+// Control flow graph
+
+static void add_edge(LoopOpt *lo, int from, BB *dst) {
+  vec_push(lo->succs[from], dst);
+  vec_push(lo->preds[bb_index(lo, dst)], lo->bbs->data[from]);
+}
+
+static void build_cfg(LoopOpt *lo) {
+  Vector *bbs = lo->bbs;
+  lo->succs = malloc(sizeof(*lo->succs) * bbs->len);
+  lo->preds = malloc(sizeof(*lo->preds) * bbs->len);
+  for (int i = 0; i < bbs->len; ++i) {
+    lo->succs[i] = new_vector();
+    lo->preds[i] = new_vector();
+  }
+  for (int i = 0; i < bbs->len; ++i) {
+    BB *bb = bbs->data[i];
+    if (bb->next != NULL && can_fall_through(bb))
+      add_edge(lo, i, bb->next);
+    IR *ir = last_ir(bb);
+    if (ir == NULL)
+      continue;
+    if (ir->kind == IR_JMP) {
+      add_edge(lo, i, ir->jmp.bb);
+    } else if (ir->kind == IR_TJMP) {
+      for (size_t j = 0; j < ir->tjmp.len; ++j)
+        add_edge(lo, i, ir->tjmp.bbs[j]);
+    }
+  }
+}
+
+// Returns the number of reachable blocks, and `order` is filled with block indices in reverse postorder.
+static int reverse_postorder(LoopOpt *lo, int *order, int *rpo_nums) {
+  int n = lo->bbs->len;
+  int *stack = malloc(sizeof(*stack) * n);
+  int *iters = calloc(n, sizeof(*iters));
+  for (int i = 0; i < n; ++i)
+    rpo_nums[i] = -1;
+
+  int count = 0, sp = 0;
+  stack[sp++] = 0;
+  rpo_nums[0] = 0;  // Mark as visited.
+  while (sp > 0) {
+    int i = stack[sp - 1];
+    Vector *succs = lo->succs[i];
+    if (iters[i] < succs->len) {
+      int j = bb_index(lo, succs->data[iters[i]++]);
+      if (rpo_nums[j] < 0) {
+        rpo_nums[j] = 0;
+        stack[sp++] = j;
+      }
+    } else {
+      --sp;
+      order[count++] = i;  // Postorder.
+    }
+  }
+  for (int i = 0, j = count - 1; i < j; ++i, --j) {
+    int tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (int i = 0; i < count; ++i)
+    rpo_nums[order[i]] = i;
+  free(stack);
+  free(iters);
+  return count;
+}
+
+// Immediate dominators (Cooper, Harvey and Kennedy: "A Simple, Fast Dominance Algorithm").
+static int *compute_dominators(LoopOpt *lo, int *order, int count, int *rpo_nums) {
+  int n = lo->bbs->len;
+  int *idoms = malloc(sizeof(*idoms) * n);
+  for (int i = 0; i < n; ++i)
+    idoms[i] = -1;
+  idoms[0] = 0;
+
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int k = 1; k < count; ++k) {
+      int b = order[k];
+      int idom = -1;
+      Vector *preds = lo->preds[b];
+      for (int i = 0; i < preds->len; ++i) {
+        int p = bb_index(lo, preds->data[i]);
+        if (idoms[p] < 0)
+          continue;
+        if (idom < 0) {
+          idom = p;
+          continue;
+        }
+        int x = p, y = idom;
+        while (x != y) {
+          while (rpo_nums[x] > rpo_nums[y])
+            x = idoms[x];
+          while (rpo_nums[y] > rpo_nums[x])
+            y = idoms[y];
+        }
+        idom = x;
+      }
+      if (idoms[b] != idom) {
+        idoms[b] = idom;
+        changed = true;
+      }
+    }
+  }
+  return idoms;
+}
+
+static bool dominates(int *idoms, int dom, int b) {
+  while (b != dom) {
+    if (b == 0)
+      return false;
+    b = idoms[b];
+  }
+  return true;
+}
+
+static int compare_loop_size(const void *pa, const void *pb) {
+  const Loop *a = *(const Loop**)pa;
+  const Loop *b = *(const Loop**)pb;
+  return a->bbs->len - b->bbs->len;
+}
+
+// Find natural loops, and sort them from inner to outer.
+static void find_loops(LoopOpt *lo) {
+  int n = lo->bbs->len;
+  int *order = malloc(sizeof(*order) * n);
+  int *rpo_nums = malloc(sizeof(*rpo_nums) * n);
+  int count = reverse_postorder(lo, order, rpo_nums);
+  int *idoms = compute_dominators(lo, order, count, rpo_nums);
+
+  Table header_table;  // <Header label, Loop*>
+  table_init(&header_table);
+  Vector *stack = new_vector();
+  for (int k = 0; k < count; ++k) {
+    int t = order[k];
+    Vector *succs = lo->succs[t];
+    for (int i = 0; i < succs->len; ++i) {
+      BB *header = succs->data[i];
+      if (!dominates(idoms, bb_index(lo, header), t))
+        continue;
+
+      // Back edge: t -> header
+      Loop *loop = table_get(&header_table, header->label);
+      if (loop == NULL) {
+        loop = malloc(sizeof(*loop));
+        loop->header = header;
+        loop->bbs = new_vector();
+        table_init(&loop->bb_table);
+        loop->preheader = NULL;
+        table_put(&loop->bb_table, header->label, header);
+        table_put(&header_table, header->label, loop);
+        vec_push(lo->loops, loop);
+      }
+      BB *tail = lo->bbs->data[t];
+      if (table_put(&loop->bb_table, tail->label, tail))
+        vec_push(stack, tail);
+      while (stack->len > 0) {
+        BB *bb = vec_pop(stack);
+        Vector *preds = lo->preds[bb_index(lo, bb)];
+        for (int j = 0; j < preds->len; ++j) {
+          BB *pred = preds->data[j];
+          if (rpo_nums[bb_index(lo, pred)] >= 0 && !in_loop(loop, pred)) {
+            table_put(&loop->bb_table, pred->label, pred);
+            vec_push(stack, pred);
+          }
+        }
+      }
+    }
+  }
+
+  // Blocks in each loop are kept in the original order.
+  for (int i = 0; i < lo->loops->len; ++i) {
+    Loop *loop = lo->loops->data[i];
+    for (int j = 0; j < n; ++j) {
+      BB *bb = lo->bbs->data[j];
+      if (in_loop(loop, bb))
+        vec_push(loop->bbs, bb);
+    }
+  }
+  qsort(lo->loops->data, lo->loops->len, sizeof(*lo->loops->data), compare_loop_size);
+
+  free(order);
+  free(rpo_nums);
+  free(idoms);
+}
+
+// Preheader: block which is executed just before entering the loop.
+static BB *get_preheader(LoopOpt *lo, Loop *loop) {
+  if (loop->preheader != NULL)
+    return loop->preheader;
+
+  BB *header = loop->header;
+  BB *preheader = new_bb();
+  preheader->next = header;
+
+  // Entering edges go to the preheader, back edges are kept.
+  Vector *preds = lo->preds[bb_index(lo, header)];
+  for (int i = 0; i < preds->len; ++i) {
+    BB *pred = preds->data[i];
+    if (in_loop(loop, pred))
+      continue;
+    if (pred->next == header && can_fall_through(pred))
+      pred->next = preheader;
+    IR *ir = last_ir(pred);
+    if (ir == NULL)
+      continue;
+    if (ir->kind == IR_JMP) {
+      if (ir->jmp.bb == header)
+        ir->jmp.bb = preheader;
+    } else if (ir->kind == IR_TJMP) {
+      for (size_t j = 0; j < ir->tjmp.len; ++j) {
+        if (ir->tjmp.bbs[j] == header)
+          ir->tjmp.bbs[j] = preheader;
+      }
+    }
+  }
+
+  // Enclosing loops contain the preheader.
+  for (int i = 0; i < lo->loops->len; ++i) {
+    Loop *outer = lo->loops->data[i];
+    if (outer != loop && in_loop(outer, header)) {
+      table_put(&outer->bb_table, preheader->label, preheader);
+      vec_push(outer->bbs, preheader);
+    }
+  }
+
+  // Put before the first block of the loop, not to break the fallthrough into the header
+  // (e.g. while loop: `jmp cond; body: ...; cond: ...; jcc body`).
+  BB *first = loop->bbs->data[0];
+  Vector *preheaders = table_get(&lo->preheader_table, first->label);
+  if (preheaders == NULL) {
+    preheaders = new_vector();
+    table_put(&lo->preheader_table, first->label, preheaders);
+  }
+  vec_push(preheaders, preheader);
+  loop->preheader = preheader;
+  return preheader;
+}
+
+// Def-use information
+
+static void count_def_use(LoopOpt *lo, BBContainer *bbcon) {
+  int vreg_count = lo->vreg_count;
+  lo->def_counts = calloc(vreg_count, sizeof(*lo->def_counts));
+  lo->use_counts = calloc(vreg_count, sizeof(*lo->use_counts));
+  lo->def_irs = calloc(vreg_count, sizeof(*lo->def_irs));
+  lo->use_irs = calloc(vreg_count, sizeof(*lo->use_irs));
+  lo->loop_defs = calloc(vreg_count, sizeof(*lo->loop_defs));
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->dst != NULL) {
+        ++lo->def_counts[ir->dst->virt];
+        lo->def_irs[ir->dst->virt] = ir;
+      }
+      VReg *oprs[] = {ir->opr1, ir->opr2};
+      for (int k = 0; k < 2; ++k) {
+        VReg *opr = oprs[k];
+        if (opr != NULL) {
+          ++lo->use_counts[opr->virt];
+          lo->use_irs[opr->virt] = ir;
+        }
+      }
+    }
+  }
+}
+
+static bool is_known(LoopOpt *lo, VReg *vreg) {
+  return vreg->virt < lo->vreg_count;
+}
+
+static void add_use(LoopOpt *lo, VReg *vreg) {
+  if (is_known(lo, vreg))
+    ++lo->use_counts[vreg->virt];
+}
+
+static void remove_use(LoopOpt *lo, VReg *vreg) {
+  if (vreg != NULL && is_known(lo, vreg))
+    --lo->use_counts[vreg->virt];
+}
+
+// Temporary: defined only once in the function (so the definition dominates all uses).
+static bool is_temporary(LoopOpt *lo, VReg *vreg) {
+  return is_known(lo, vreg) && lo->def_counts[vreg->virt] == 1 &&
+      !(vreg->flag & (VRF_CONST | VRF_REF | VRF_PARAM));
+}
+
+static IR *single_def(LoopOpt *lo, VReg *vreg) {
+  return vreg != NULL && is_temporary(lo, vreg) ? lo->def_irs[vreg->virt] : NULL;
+}
+
+static bool defined_in_loop(LoopOpt *lo, VReg *vreg) {
+  return !is_known(lo, vreg) || lo->loop_defs[vreg->virt] > 0;
+}
+
+static void count_loop_defs(LoopOpt *lo, Loop *loop, int delta) {
+  for (int i = 0; i < loop->bbs->len; ++i) {
+    BB *bb = loop->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->dst != NULL && is_known(lo, ir->dst))
+        lo->loop_defs[ir->dst->virt] += delta;
+    }
+  }
+}
+
+// Loop-invariant code motion
+
+typedef struct {
+  bool unknown_writes;  // Store through pointer, or function call.
+  Vector *written_labels;  // <Name*>, global variables which are stored directly.
+} MemoryEffect;
+
+static void scan_memory_effect(LoopOpt *lo, Loop *loop, MemoryEffect *effect) {
+  effect->unknown_writes = false;
+  effect->written_labels = new_vector();
+  for (int i = 0; i < loop->bbs->len; ++i) {
+    BB *bb = loop->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      switch (ir->kind) {
+      case IR_STORE:
+        {
+          IR *def = single_def(lo, ir->opr2);
+          if (def != NULL && def->kind == IR_IOFS)
+            vec_push(effect->written_labels, (void*)def->iofs.label);
+          else
+            effect->unknown_writes = true;
+        }
+        break;
+      case IR_CALL: case IR_MEMCPY: case IR_CLEAR: case IR_ASM:
+        effect->unknown_writes = true;
+        break;
+      default: break;
+      }
+    }
+  }
+}
+
+static bool is_invariant(LoopOpt *lo, VReg *vreg, const MemoryEffect *effect) {
+  if (vreg->flag & VRF_CONST)
+    return true;
+  if (defined_in_loop(lo, vreg))
+    return false;
+  // Variable whose address is taken might be modified through pointer.
+  return !(vreg->flag & VRF_REF) || !effect->unknown_writes;
+}
+
+// Used only as an address of load or store, where constant offset can be folded.
+static bool is_address_only(LoopOpt *lo, VReg *vreg) {
+  if (lo->use_counts[vreg->virt] != 1)
+    return false;
+  IR *user = lo->use_irs[vreg->virt];
+  return (user->kind == IR_LOAD && user->opr1 == vreg) ||
+      (user->kind == IR_STORE && user->opr2 == vreg);
+}
+
+static bool is_hoistable(LoopOpt *lo, IR *ir, const MemoryEffect *effect) {
+  if (ir->dst == NULL || !is_temporary(lo, ir->dst))
+    return false;
+  switch (ir->kind) {
+  case IR_ADD:
+  case IR_SUB:
+    if ((ir->opr2->flag & VRF_CONST) && is_address_only(lo, ir->dst))
+      return false;
+    break;
+  case IR_DIV:
+  case IR_MOD:
+    // Hoisted division must not trap.
+    if (!(ir->opr2->flag & VRF_CONST) || ir->opr2->fixnum == 0 || ir->opr2->fixnum == -1)
+      return false;
+    break;
+  case IR_MUL:
+  case IR_BITAND:
+  case IR_BITOR:
+  case IR_BITXOR:
+  case IR_LSHIFT:
+  case IR_RSHIFT:
+  case IR_NEG:
+  case IR_BITNOT:
+    break;
+  case IR_CAST:
+  case IR_MOV:
+    if (ir->opr1->flag & VRF_CONST)  // Immediate is cheaper than occupying a register.
+      return false;
+    break;
+  default:
+    return false;
+  }
+  return is_invariant(lo, ir->opr1, effect) &&
+      (ir->opr2 == NULL || is_invariant(lo, ir->opr2, effect));
+}
+
+// Load from global variable which is not modified in the loop.
+// Returns the address calculation (IOFS).
+static IR *hoistable_load(LoopOpt *lo, IR *ir, const MemoryEffect *effect) {
+  if (ir->kind != IR_LOAD || effect->unknown_writes || !is_temporary(lo, ir->dst))
+    return NULL;
+  IR *def = single_def(lo, ir->opr1);
+  if (def == NULL || def->kind != IR_IOFS)
+    return NULL;
+  const Name *label = def->iofs.label;
+  VarInfo *varinfo = scope_find(global_scope, label, NULL);
+  if (varinfo == NULL || (varinfo->type->qualifier & TQ_VOLATILE) ||
+      !(varinfo->type->kind == TY_FIXNUM || varinfo->type->kind == TY_PTR
+#ifndef __NO_FLONUM
+        || varinfo->type->kind == TY_FLONUM
+#endif
+      ))
+    return NULL;
+  for (int i = 0; i < effect->written_labels->len; ++i) {
+    if (equal_name(effect->written_labels->data[i], label))
+      return NULL;
+  }
+  return def;
+}
+
+static void hoist(LoopOpt *lo, Loop *loop, IR *ir) {
+  vec_push(get_preheader(lo, loop)->irs, ir);
+  --lo->loop_defs[ir->dst->virt];
+}
+
+static void hoist_invariants(LoopOpt *lo, Loop *loop, const MemoryEffect *effect) {
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int i = 0; i < loop->bbs->len; ++i) {
+      BB *bb = loop->bbs->data[i];
+      if (bb == loop->preheader)
+        continue;
+      // Hoisted IRs are cleared, and removed at once.
+      Vector *irs = bb->irs;
+      bool removed = false;
+      for (int j = 0; j < irs->len; ++j) {
+        IR *ir = irs->data[j];
+        IR *addr = NULL;
+        if (ir == NULL ||
+            (!is_hoistable(lo, ir, effect) && (addr = hoistable_load(lo, ir, effect)) == NULL))
+          continue;
+        if (addr != NULL && defined_in_loop(lo, addr->dst)) {
+          int k = find_ir(bb, addr);
+          if (k < 0 || k > j)
+            continue;
+          irs->data[k] = NULL;
+          hoist(lo, loop, addr);
+        }
+        irs->data[j] = NULL;
+        hoist(lo, loop, ir);
+        removed = changed = true;
+      }
+      if (removed)
+        compact_irs(bb);
+    }
+  }
+}
+
+// Induction variable strength reduction:
+//   base + (long)i * stride  =>  ptr (ptr = base + i * stride at preheader, ptr += step * stride with i)
+
+static void find_induction_vars(LoopOpt *lo, Loop *loop, Vector *ivs) {
+  for (int i = 0; i < loop->bbs->len; ++i) {
+    BB *bb = loop->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      VReg *var = ir->dst;
+      if (ir->kind != IR_MOV || !is_known(lo, var) || lo->loop_defs[var->virt] != 1 ||
+          (var->flag & (VRF_CONST | VRF_REF | VRF_PARAM)) ||
+          (var->vtype->flag & VRTF_NON_REG))
+        continue;
+#ifndef __NO_FLONUM
+      if (var->vtype->flag & VRTF_FLONUM)
+        continue;
+#endif
+      // Signed int is sign extended for the address: overflow doesn't have to be considered.
+      if (!(var->vtype->size == WORD_SIZE ||
+            (var->vtype->size == 4 && !(var->vtype->flag & VRTF_UNSIGNED))))
+        continue;
+
+      IR *def = single_def(lo, ir->opr1);
+      if (def == NULL || (def->kind != IR_ADD && def->kind != IR_SUB) || def->opr1 != var ||
+          !(def->opr2->flag & VRF_CONST))
+        continue;
+      int k = find_ir(bb, def);
+      if (k < 0 || k > j)
+        continue;
+
+      InductionVar *iv = malloc(sizeof(*iv));
+      iv->var = var;
+      iv->step = def->kind == IR_ADD ? def->opr2->fixnum : -def->opr2->fixnum;
+      iv->update = ir;
+      vec_push(ivs, iv);
+    }
+  }
+}
+
+// index = (long)var * stride  (cast and multiplication are optional)
+static InductionVar *match_scaled_iv(LoopOpt *lo, Vector *ivs, VReg *index, intptr_t *pstride) {
+  intptr_t stride = 1;
+  IR *def = single_def(lo, index);
+  if (def != NULL && defined_in_loop(lo, index) && (def->opr2 != NULL && (def->opr2->flag & VRF_CONST))) {
+    if (def->kind == IR_MUL) {
+      stride = def->opr2->fixnum;
+      index = def->opr1;
+    } else if (def->kind == IR_LSHIFT && 0 <= def->opr2->fixnum && def->opr2->fixnum < 31) {
+      stride = (intptr_t)1 << def->opr2->fixnum;
+      index = def->opr1;
+    }
+  }
+
+  def = single_def(lo, index);
+  if (def != NULL && def->kind == IR_CAST && defined_in_loop(lo, index) &&
+      def->size == WORD_SIZE && (def->opr1->vtype->size == 4 || def->opr1->vtype->size == WORD_SIZE)) {
+#ifndef __NO_FLONUM
+    if (index->vtype->flag & VRTF_FLONUM)
+      return NULL;
+#endif
+    index = def->opr1;
+  } else if (index->vtype->size != WORD_SIZE) {
+    return NULL;
+  }
+
+  for (int i = 0; i < ivs->len; ++i) {
+    InductionVar *iv = ivs->data[i];
+    if (iv->var == index) {
+      *pstride = stride;
+      return iv;
+    }
+  }
+  return NULL;
+}
+
+// Base pointer can be calculated at the preheader.
+static bool is_base_available(LoopOpt *lo, VReg *base, const MemoryEffect *effect) {
+  if (base->flag & VRF_CONST)
+    return false;
+  if (is_invariant(lo, base, effect))
+    return true;
+  IR *def = single_def(lo, base);
+  return def != NULL && (def->kind == IR_IOFS || def->kind == IR_BOFS);
+}
+
+static void gen_derived_iv(LoopOpt *lo, Loop *loop, DerivedIV *derived, const VRegType *vtype,
+                           const MemoryEffect *effect) {
+  InductionVar *iv = derived->iv;
+  VReg *base = derived->base;
+  intptr_t stride = derived->stride;
+  BB *saved = curbb;
+
+  // Initialize at the preheader.
+  curbb = get_preheader(lo, loop);
+  if (!is_invariant(lo, base, effect)) {
+    // Duplicate address calculation.
+    IR *def = lo->def_irs[base->virt];
+    IR *ir = malloc(sizeof(*ir));
+    *ir = *def;
+    ir->dst = reg_alloc_spawn(lo->ra, base->vtype, 0);
+    if (ir->opr1 != NULL)
+      add_use(lo, ir->opr1);
+    vec_push(curbb->irs, ir);
+    base = ir->dst;
+  } else {
+    add_use(lo, base);
+  }
+  VReg *index = iv->var;
+  add_use(lo, index);
+  if (index->vtype->size < WORD_SIZE)
+    index = new_ir_cast(index, vtype);
+  VReg *offset = new_ir_bop(IR_MUL, index, new_const_vreg(stride, vtype), vtype);
+  VReg *ptr = reg_alloc_spawn(lo->ra, vtype, 0);
+  new_ir_mov(ptr, new_ir_bop(IR_ADD, base, offset, vtype));
+
+  // Advance together with the induction variable.
+  BB bb = {.irs = new_vector()};
+  curbb = &bb;
+  new_ir_bop(IR_ADD, ptr, new_const_vreg(iv->step * stride, vtype), vtype);
+  IR *add = bb.irs->data[0];
+  add->dst = ptr;
+
+  curbb = saved;
+  derived->ptr = ptr;
+  derived->advance = add;
+}
+
+// Removed definitions are kept in place until the loop is rewritten: known vreg without definition.
+static bool is_removed(LoopOpt *lo, IR *ir) {
+  return ir->dst != NULL && is_known(lo, ir->dst) && lo->def_counts[ir->dst->virt] == 0;
+}
+
+// Remove the definition of the temporary in the loop if it is not used anymore.
+static void remove_dead_def(LoopOpt *lo, VReg *vreg) {
+  while (vreg != NULL && is_temporary(lo, vreg) && lo->use_counts[vreg->virt] == 0 &&
+         lo->loop_defs[vreg->virt] > 0) {
+    IR *def = lo->def_irs[vreg->virt];
+    switch (def->kind) {
+    case IR_MUL: case IR_LSHIFT: case IR_CAST: case IR_IOFS: case IR_BOFS:
+      break;
+    default:
+      return;
+    }
+    --lo->loop_defs[vreg->virt];
+    --lo->def_counts[vreg->virt];
+    if (def->kind == IR_BOFS)
+      return;
+    remove_use(lo, def->opr2);
+    remove_use(lo, def->opr1);
+    vreg = def->opr1;
+  }
+}
+
+// Replace the use of the address with the pointer directly, if the pointer is not advanced meanwhile.
+static bool replace_use(LoopOpt *lo, BB *bb, int pos, VReg *addr, VReg *ptr, InductionVar *iv) {
+  if (lo->use_counts[addr->virt] != 1)
+    return false;
+  IR *user = lo->use_irs[addr->virt];
+  for (int i = pos + 1; i < bb->irs->len; ++i) {
+    IR *ir = bb->irs->data[i];
+    if (ir == user) {
+      if (user->opr1 == addr)
+        user->opr1 = ptr;
+      if (user->opr2 == addr)
+        user->opr2 = ptr;
+      return true;
+    }
+    if (ir == iv->update)
+      return false;
+  }
+  return false;
+}
+
+static void reduce_strength(LoopOpt *lo, Loop *loop, const MemoryEffect *effect) {
+  Vector *ivs = new_vector();
+  find_induction_vars(lo, loop, ivs);
+  if (ivs->len == 0)
+    return;
+
+  DerivedIV deriveds[MAX_DERIVED_IVS];
+  int derived_count = 0;
+  for (int i = 0; i < loop->bbs->len; ++i) {
+    BB *bb = loop->bbs->data[i];
+    if (bb == loop->preheader)
+      continue;
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind != IR_ADD || ir->size != WORD_SIZE || !is_temporary(lo, ir->dst) ||
+          (ir->opr1->flag & VRF_CONST) || (ir->opr2->flag & VRF_CONST))
+        continue;
+#ifndef __NO_FLONUM
+      if (ir->dst->vtype->flag & VRTF_FLONUM)
+        continue;
+#endif
+
+      VReg *base = ir->opr1, *index = ir->opr2;
+      intptr_t stride;
+      InductionVar *iv = match_scaled_iv(lo, ivs, index, &stride);
+      if (iv == NULL) {
+        base = ir->opr2;
+        index = ir->opr1;
+        iv = match_scaled_iv(lo, ivs, index, &stride);
+      }
+      if (iv == NULL || !is_base_available(lo, base, effect) ||
+          !is_im32(stride) || !is_im32(iv->step * stride))
+        continue;
+
+      DerivedIV *derived = NULL;
+      for (int k = 0; k < derived_count; ++k) {
+        DerivedIV *p = &deriveds[k];
+        if (p->iv == iv && p->base == base && p->stride == stride)
+          derived = p;
+      }
+      if (derived == NULL) {
+        if (derived_count >= MAX_DERIVED_IVS)
+          continue;
+        derived = &deriveds[derived_count++];
+        derived->iv = iv;
+        derived->base = base;
+        derived->stride = stride;
+        gen_derived_iv(lo, loop, derived, ir->dst->vtype, effect);
+      }
+
+      remove_use(lo, ir->opr1);
+      remove_use(lo, ir->opr2);
+      if (replace_use(lo, bb, j, ir->dst, derived->ptr, iv)) {
+        --lo->loop_defs[ir->dst->virt];
+        --lo->def_counts[ir->dst->virt];
+      } else {
+        ir->kind = IR_MOV;
+        ir->opr1 = derived->ptr;
+        ir->opr2 = NULL;
+      }
+      remove_dead_def(lo, index);
+      remove_dead_def(lo, base);
+    }
+  }
+  if (derived_count == 0)
+    return;
+
+  // Drop the removed definitions and put the advances after the updates, rewriting each block once.
+  for (int i = 0; i < loop->bbs->len; ++i) {
+    BB *bb = loop->bbs->data[i];
+    IrRewriter rw;
+    begin_rewrite(&rw, bb);
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (is_removed(lo, ir))
+        continue;
+      rewrite_put(&rw, ir);
+      for (int k = 0; k < derived_count; ++k) {
+        if (deriveds[k].iv->update == ir)
+          rewrite_put(&rw, deriveds[k].advance);
+      }
+    }
+    end_rewrite(&rw);
+  }
+}
+
+static void optimize_loop(LoopOpt *lo, Loop *loop) {
+  if (loop->header == lo->bbs->data[0])  // No place for the preheader.
+    return;
+
+  count_loop_defs(lo, loop, 1);
+  MemoryEffect effect;
+  scan_memory_effect(lo, loop, &effect);
+  hoist_invariants(lo, loop, &effect);
+  reduce_strength(lo, loop, &effect);
+  count_loop_defs(lo, loop, -1);
+}
+
+void optimize_loops(RegAlloc *ra, BBContainer *bbcon) {
+  LoopOpt lo;
+  lo.ra = ra;
+  lo.bbs = bbcon->bbs;
+  table_init(&lo.index_table);
+  for (int i = 0; i < lo.bbs->len; ++i) {
+    BB *bb = lo.bbs->data[i];
+    table_put(&lo.index_table, bb->label, (void*)(intptr_t)(i + 1));
+  }
+  build_cfg(&lo);
+  lo.loops = new_vector();
+  find_loops(&lo);
+  if (lo.loops->len == 0)
+    return;
+
+  table_init(&lo.preheader_table);
+  lo.vreg_count = ra->vregs->len;
+  count_def_use(&lo, bbcon);
+  for (int i = 0; i < lo.loops->len; ++i)
+    optimize_loop(&lo, lo.loops->data[i]);
+
+  // Explicit jump keeps the header from being chained after the preheader in the layout,
+  // so the loop shape is kept.
+  BB *saved = curbb;
+  for (int i = 0; i < lo.loops->len; ++i) {
+    Loop *loop = lo.loops->data[i];
+    if (loop->preheader != NULL) {
+      curbb = loop->preheader;
+      new_ir_jmp(COND_ANY, loop->header);
+    }
+  }
+  curbb = saved;
+
+  // Insert preheaders, outer one first (inner loops are processed earlier).
+  Vector *bbs = new_vector();
+  for (int i = 0; i < lo.bbs->len; ++i) {
+    BB *bb = lo.bbs->data[i];
+    Vector *preheaders = table_get(&lo.preheader_table, bb->label);
+    if (preheaders != NULL) {
+      for (int j = preheaders->len; --j >= 0; )
+        vec_push(bbs, preheaders->data[j]);
+    }
+    vec_push(bbs, bb);
+  }
+  bbcon->bbs = bbs;
+
+  free(lo.def_counts);
+  free(lo.use_counts);
+  free(lo.def_irs);
+  free(lo.use_irs);
+  free(lo.loop_defs);
+}
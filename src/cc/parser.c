@@ -912,7 +912,7 @@ static bool parse_vardecl(Stmt **pstmt) {
     consume(TK_SEMICOL, "`;' expected");
     if (decls != NULL) {
       Vector *inits = !is_global_scope(curscope) ? construct_initializing_stmts(decls) : NULL;
-      *pstmt = new_stmt_vardecl(decls, inits);
+      *pstmt = new_stmt_vardecl(ident, decls, inits);
     }
   }
   return true;
@@ -1062,7 +1062,7 @@ static Stmt *parse_for(const Token *tok) {
   Vector *stmts = new_vector();
   if (decls != NULL) {
     Vector *inits = construct_initializing_stmts(decls);
-    vec_push(stmts, new_stmt_vardecl(decls, inits));
+    vec_push(stmts, new_stmt_vardecl(tok, decls, inits));
   }
 
   curloopflag = save_flag;
@@ -1243,7 +1243,7 @@ static Declaration *parse_defun(Type *functype, int storage, Token *ident) {
     functype->func.vaargs = false;
   }
 
-  Function *func = new_func(functype, ident->ident);
+  Function *func = new_func(functype, ident);
   VarInfo *varinfo = scope_find(global_scope, func->name, NULL);
   bool err = false;
   if (varinfo == NULL) {
@@ -0,0 +1,163 @@
+// Profile-guided optimization
+//
+// Counters are assigned to the blocks just after the code generation (before any optimization),
+// so the instrumented build and the optimized build agree on the block numbering.
+
+#include "../config.h"
+#include "codegen.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>  // malloc, strtol
+#include <string.h>
+
+#include "ast.h"
+#include "ir.h"
+#include "table.h"
+#include "type.h"
+#include "util.h"
+
+#define PROFILE_REGISTER_FUNC  "__xcc_profile_register"
+
+const char *profile_generate_path;
+const char *profile_use_path;
+
+typedef struct {
+  int count;
+  long *counters;
+} ProfileEntry;
+
+static Table *profile_table;  // <Function name, ProfileEntry*>
+static bool profile_loaded;
+
+static long read_number(char **pp) {
+  char *p = *pp;
+  while (*p == ' ')
+    ++p;
+  return strtol(p, pp, 10);
+}
+
+// Format: a line for each function: `name count counter0 counter1 ...`
+static void load_profile(const char *path) {
+  profile_table = malloc(sizeof(*profile_table));
+  table_init(profile_table);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot open profile: %s\n", path);
+    return;
+  }
+  char *line = NULL;
+  size_t capa = 0;
+  while (getline(&line, &capa, fp) > 0) {
+    char *p = strchr(line, ' ');
+    if (p == NULL)
+      continue;
+    const Name *name = alloc_name(line, p, true);
+    int count = read_number(&p);
+    if (count <= 0)
+      continue;
+    long *counters = calloc(count, sizeof(*counters));
+    for (int i = 0; i < count; ++i)
+      counters[i] = read_number(&p);
+
+    // Static functions in different sources might have the same name: sum them up.
+    ProfileEntry *entry = table_get(profile_table, name);
+    if (entry == NULL) {
+      entry = malloc(sizeof(*entry));
+      entry->count = count;
+      entry->counters = counters;
+      table_put(profile_table, name, entry);
+    } else if (entry->count == count) {
+      for (int i = 0; i < count; ++i)
+        entry->counters[i] += counters[i];
+      free(counters);
+    } else {
+      free(counters);
+    }
+  }
+  free(line);
+  fclose(fp);
+  profile_loaded = true;
+}
+
+static void prepend_irs(BB *bb, Vector *irs) {
+  IrRewriter rw;
+  begin_rewrite(&rw, bb);
+  for (int i = 0; i < irs->len; ++i)
+    rewrite_put(&rw, irs->data[i]);
+  for (int i = 0; i < bb->irs->len; ++i)
+    rewrite_put(&rw, bb->irs->data[i]);
+  end_rewrite(&rw);
+}
+
+// Increment the counter at the top of each block, and register the counter record
+// to the runtime at the first call.
+void instrument_blocks(Function *func) {
+  FuncBackend *fnbe = func->extra;
+  Vector *bbs = fnbe->bbcon->bbs;
+  fnbe->prof_counters = alloc_label();
+  fnbe->prof_record = alloc_label();
+  fnbe->prof_count = bbs->len;
+
+  BB *saved = curbb;
+  const VRegType *ptr_vtype = to_vtype(&tyVoidPtr);
+  const VRegType *counter_vtype = to_vtype(&tySSize);
+  for (int i = 0; i < bbs->len; ++i) {
+    BB tmp = {.irs = new_vector()};
+    curbb = &tmp;
+    VReg *ptr = new_ir_bop(IR_ADD, new_ir_iofs(fnbe->prof_counters, false),
+                           new_const_vreg(i * counter_vtype->size, ptr_vtype), ptr_vtype);
+    VReg *counter = new_ir_unary(IR_LOAD, ptr, counter_vtype);
+    new_ir_store(ptr, new_ir_bop(IR_ADD, counter, new_const_vreg(1, counter_vtype), counter_vtype));
+    prepend_irs(bbs->data[i], tmp.irs);
+  }
+
+  // Registered record has non-NULL link.
+  BB *entry = bbs->data[0];
+  BB *check_bb = new_bb();
+  BB *register_bb = new_bb();
+  curbb = check_bb;
+  VReg *record = new_ir_iofs(fnbe->prof_record, false);
+  new_ir_cmp(new_ir_unary(IR_LOAD, record, ptr_vtype), new_const_vreg(0, ptr_vtype));
+  new_ir_jmp(COND_NE, entry);
+
+  curbb = register_bb;
+  VRegType **arg_vtypes = malloc(sizeof(*arg_vtypes));
+  arg_vtypes[0] = to_vtype(&tyVoidPtr);
+  IR *precall = new_ir_precall(1, 0);
+  new_ir_pusharg(record, arg_vtypes[0], 0);
+  new_ir_call(alloc_name(PROFILE_REGISTER_FUNC, NULL, false), true, NULL, 1, 1, to_vtype(&tyVoid),
+              precall, arg_vtypes, false);
+  curbb = saved;
+
+  check_bb->next = register_bb;
+  register_bb->next = entry;
+  vec_insert(bbs, 0, register_bb);
+  vec_insert(bbs, 0, check_bb);
+}
+
+// Set execution counts to the blocks.
+bool apply_profile(Function *func) {
+  if (profile_table == NULL)
+    load_profile(profile_use_path);
+
+  Vector *bbs = ((FuncBackend*)func->extra)->bbcon->bbs;
+  ProfileEntry *entry = table_get(profile_table, func->name);
+  if (entry == NULL) {
+    // Only executed functions are recorded.
+    if (profile_loaded)
+      func->flag |= FUNCF_COLD;
+    return false;
+  }
+  if (entry->count != bbs->len)  // Source is changed.
+    return false;
+
+  for (int i = 0; i < bbs->len; ++i) {
+    BB *bb = bbs->data[i];
+    bb->count = entry->counters[i];
+  }
+  if (entry->counters[0] == 0)
+    func->flag |= FUNCF_COLD;
+  return true;
+}
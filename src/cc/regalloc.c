@@ -9,6 +9,7 @@
 #include "ast.h"
 #include "codegen.h"  // WORD_SIZE
 #include "ir.h"
+#include "table.h"
 #include "type.h"
 #include "util.h"
 #include "var.h"
@@ -156,8 +157,118 @@ static void check_live_interval(BBContainer *bbcon, int vreg_count, LiveInterval
   }
 }
 
+// Calls which save and restore living caller-save registers, with estimated frequencies.
+typedef struct {
+  int *nips;      // Instruction positions, in ascending order.
+  long *weights;  // Accumulated: weights[i] is the sum of the frequencies of calls before i.
+  int count;
+  long entry_weight;  // Frequency of the function entry.
+} CallSites;
+
+#define LOOP_WEIGHT_SHIFT  (3)  // A loop is assumed to iterate 8 times.
+#define LOOP_DEPTH_MAX     (5)
+
+// Block frequencies are taken from the profile if any, otherwise estimated from the loop depth,
+// which is counted with the backward jumps in the laid out order.
+static long *estimate_bb_weights(BBContainer *bbcon, long *pentry_weight) {
+  Vector *bbs = bbcon->bbs;
+  long *weights = calloc(bbs->len + 1, sizeof(*weights));
+  BB *entry = bbs->data[0];
+  if (entry->count > 0) {
+    for (int i = 0; i < bbs->len; ++i) {
+      BB *bb = bbs->data[i];
+      weights[i] = bb->count >= 0 ? bb->count : entry->count;
+    }
+    *pentry_weight = entry->count;
+    return weights;
+  }
+
+  Table index_table;  // <BB label, index + 1>
+  table_init(&index_table);
+  for (int i = 0; i < bbs->len; ++i) {
+    BB *bb = bbs->data[i];
+    table_put(&index_table, bb->label, (void*)(intptr_t)(i + 1));
+  }
+  // Accumulate depth differences first.
+  for (int i = 0; i < bbs->len; ++i) {
+    BB *bb = bbs->data[i];
+    if (bb->irs->len <= 0)
+      continue;
+    IR *ir = bb->irs->data[bb->irs->len - 1];
+    if (ir->kind != IR_JMP)
+      continue;
+    intptr_t target = (intptr_t)table_get(&index_table, ir->jmp.bb->label) - 1;
+    if (target >= 0 && target <= i) {
+      ++weights[target];
+      --weights[i + 1];
+    }
+  }
+  int depth = 0;
+  for (int i = 0; i < bbs->len; ++i) {
+    depth += weights[i];
+    weights[i] = 1L << (MIN(depth, LOOP_DEPTH_MAX) * LOOP_WEIGHT_SHIFT);
+  }
+  *pentry_weight = 1;
+  return weights;
+}
+
+static void collect_call_sites(BBContainer *bbcon, CallSites *sites) {
+  long *bb_weights = estimate_bb_weights(bbcon, &sites->entry_weight);
+  int count = 0;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind == IR_CALL && !ir->call.tail)
+        ++count;
+    }
+  }
+
+  int *nips = malloc(sizeof(*nips) * count);
+  long *weights = malloc(sizeof(*weights) * (count + 1));
+  int n = 0;
+  weights[0] = 0;
+  for (int i = 0, nip = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j, ++nip) {
+      IR *ir = bb->irs->data[j];
+      if (ir->kind == IR_CALL && !ir->call.tail) {
+        nips[n] = nip;
+        weights[n + 1] = weights[n] + bb_weights[i];
+        ++n;
+      }
+    }
+  }
+  free(bb_weights);
+  sites->nips = nips;
+  sites->weights = weights;
+  sites->count = count;
+}
+
+// Sum of the frequencies of calls which the interval lives across.
+static long calc_call_weight(const CallSites *sites, LiveInterval *li) {
+  int lo = 0, hi = sites->count;
+  while (lo < hi) {
+    int m = (lo + hi) / 2;
+    if (sites->nips[m] <= li->start)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+  int first = lo;
+  hi = sites->count;
+  while (lo < hi) {
+    int m = (lo + hi) / 2;
+    if (sites->nips[m] < li->end)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+  return sites->weights[lo] - sites->weights[first];
+}
+
 static void linear_scan_register_allocation(RegAlloc *ra, LiveInterval **sorted_intervals,
-                                            int vreg_count) {
+                                            int vreg_count, const CallSites *sites) {
   typedef struct {
     LiveInterval **active;
     int phys_max;
@@ -201,11 +312,23 @@ static void linear_scan_register_allocation(RegAlloc *ra, LiveInterval **sorted_
     if (info->active_count >= info->phys_max) {
       split_at_interval(ra, info->active, info->active_count, li);
     } else {
+      // Callee-save register costs push and pop in the prologue and epilogue at the first use,
+      // and caller-save one costs save and restore around each call which it lives across.
+      // Costs are doubled to break a tie: callee-save register is preferred only across calls.
+      unsigned short callee_bits = info == &ireg_info ? callee_save_reg_bits() : 0;
+      long call_weight = calc_call_weight(sites, li);
       int regno = -1;
+      long best = 0;
       for (int j = 0; j < info->phys_max; ++j) {
-        if (!(info->using_bits & (1 << j))) {
+        unsigned short bit = 1 << j;
+        if (info->using_bits & bit)
+          continue;
+        bool callee = (callee_bits & bit) != 0;
+        long cost = callee ? ((info->used_bits & bit) ? 0 : sites->entry_weight) : call_weight;
+        cost = cost * 2 + (callee != (call_weight > 0));
+        if (regno < 0 || cost < best) {
           regno = j;
-          break;
+          best = cost;
         }
       }
       assert(regno >= 0);
@@ -223,13 +346,20 @@ static void linear_scan_register_allocation(RegAlloc *ra, LiveInterval **sorted_
 #endif
 }
 
-static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon) {
+// Spill code is put around each IR, and new positions of the original IRs are stored:
+// `start_map` is the first IR put for it (loads come first), and `end_map` is the IR itself.
+static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon, int *start_map,
+                                         int *end_map) {
   int inserted = 0;
+  int nip = 0, base = 0;
   for (int i = 0; i < bbcon->bbs->len; ++i) {
     BB *bb = bbcon->bbs->data[i];
     Vector *irs = bb->irs;
-    for (int j = 0; j < irs->len; ++j) {
+    IrRewriter rw;
+    begin_rewrite(&rw, bb);
+    for (int j = 0; j < irs->len; ++j, ++nip) {
       IR *ir = irs->data[j];
+      start_map[nip] = base + rw.irs->len;
 
       int flag = 7;
       int load_size = ir->size;
@@ -252,6 +382,7 @@ static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon) {
       case IR_NEG:  // unary ops
       case IR_BITNOT:
       case IR_COND:
+      case IR_CMOV:
       case IR_JMP:
       case IR_TJMP:
       case IR_PUSHARG:
@@ -269,6 +400,7 @@ static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon) {
       case IR_CALL:
       case IR_LOAD:
       case IR_STORE:
+      case IR_LEA:
       case IR_MEMCPY:
       case IR_CLEAR:
         flag = 7;
@@ -283,13 +415,16 @@ static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon) {
 
       case IR_LOAD_SPILLED:
       case IR_STORE_SPILLED:
-        continue;
+        flag = 0;
+        break;
       }
 
+      VReg *spilled_opr1 = NULL;
       if (ir->opr1 != NULL && (flag & 1) != 0 &&
           !(ir->opr1->flag & VRF_CONST) && (ir->opr1->flag & VRF_SPILLED)) {
         VReg *tmp = reg_alloc_spawn(ra, ir->opr1->vtype, VRF_NO_SPILL);
-        vec_insert(irs, j++, new_ir_load_spilled(tmp, ir->opr1, load_size));
+        rewrite_put(&rw, new_ir_load_spilled(tmp, ir->opr1, load_size));
+        spilled_opr1 = ir->opr1;
         ir->opr1 = tmp;
         ++inserted;
       }
@@ -297,20 +432,30 @@ static int insert_load_store_spilled_irs(RegAlloc *ra, BBContainer *bbcon) {
       if (ir->opr2 != NULL && (flag & 2) != 0 &&
           !(ir->opr2->flag & VRF_CONST) && (ir->opr2->flag & VRF_SPILLED)) {
         VReg *tmp = reg_alloc_spawn(ra, ir->opr2->vtype, VRF_NO_SPILL);
-        vec_insert(irs, j++, new_ir_load_spilled(tmp, ir->opr2, load_size));
+        rewrite_put(&rw, new_ir_load_spilled(tmp, ir->opr2, load_size));
         ir->opr2 = tmp;
         ++inserted;
       }
 
+      end_map[nip] = base + rw.irs->len;
+      rewrite_put(&rw, ir);
+
       if (ir->dst != NULL && (flag & 4) != 0 &&
           !(ir->dst->flag & VRF_CONST) && (ir->dst->flag & VRF_SPILLED)) {
-        VReg *tmp = reg_alloc_spawn(ra, ir->dst->vtype, VRF_NO_SPILL);
-        vec_insert(irs, ++j, new_ir_store_spilled(ir->dst, tmp, load_size));
+        // Two-address operation (`x = x op y`) has to use the same register for both.
+        VReg *tmp = ir->dst == spilled_opr1 ? ir->opr1 :
+            reg_alloc_spawn(ra, ir->dst->vtype, VRF_NO_SPILL);
+        // `load_size` might be the size of the source (pointer for LOAD, or CAST),
+        // so store with the size of the destination not to clobber adjacent slots.
+        rewrite_put(&rw, new_ir_store_spilled(ir->dst, tmp, ir->dst->vtype->size));
         ir->dst = tmp;
         ++inserted;
       }
     }
+    base += rw.irs->len;
+    end_rewrite(&rw);
   }
+  start_map[nip] = end_map[nip] = base;
   return inserted;
 }
 
@@ -390,42 +535,81 @@ static void analyze_reg_flow(BBContainer *bbcon) {
   } while (cont);
 }
 
-// Detect living registers for each instruction.
+static int count_irs(BBContainer *bbcon) {
+  int count = 0;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    count += bb->irs->len;
+  }
+  return count;
+}
+
+// Bit position in `living_pregs`: floating-point registers follow integer ones.
+static int physical_bit(RegAlloc *ra, LiveInterval *li) {
+  int phys = li->phys;
+#ifndef __NO_FLONUM
+  if (((VReg*)ra->vregs->data[li->virt])->vtype->flag & VRTF_FLONUM)
+    phys += ra->phys_max;
+#else
+  UNUSED(ra);
+#endif
+  return phys;
+}
+
+// Detect living registers for each instruction, with a linear sweep:
+// intervals are sorted by their start, and bucketed by their end.
 static void detect_living_registers(
   RegAlloc *ra, BBContainer *bbcon, LiveInterval **sorted_intervals, int vreg_count
 ) {
+  int ir_count = count_irs(bbcon);
+  int *end_heads = malloc(sizeof(*end_heads) * (ir_count + 1));
+  int *end_nexts = malloc(sizeof(*end_nexts) * vreg_count);
+  for (int i = 0; i <= ir_count; ++i)
+    end_heads[i] = -1;
+  for (int k = 0; k < vreg_count; ++k) {
+    LiveInterval *li = sorted_intervals[k];
+    if (li->state != LI_NORMAL || li->start >= li->end)
+      continue;
+    end_nexts[k] = end_heads[li->end];
+    end_heads[li->end] = k;
+  }
+
   unsigned int living_pregs = 0;
   int nip = 0;
+  int k = 0;
   for (int i = 0; i < bbcon->bbs->len; ++i) {
     BB *bb = bbcon->bbs->data[i];
     for (int j = 0; j < bb->irs->len; ++j, ++nip) {
-      for (int k = 0; k < vreg_count; ++k) {
+      // Ended intervals first, because the register might be reused from this instruction.
+      for (int e = end_heads[nip]; e >= 0; e = end_nexts[e])
+        living_pregs &= ~(1U << physical_bit(ra, sorted_intervals[e]));
+
+      unsigned int born_pregs = 0;
+      for (; k < vreg_count; ++k) {
         LiveInterval *li = sorted_intervals[k];
-        if (li->state != LI_NORMAL)
-          continue;
         if (nip < li->start)
           break;
-        int phys = li->phys;
-#ifndef __NO_FLONUM
-        if (((VReg*)ra->vregs->data[li->virt])->vtype->flag & VRTF_FLONUM)
-          phys += ra->phys_max;
-#endif
-        if (nip == li->start)
-          living_pregs |= 1U << phys;
-        if (nip == li->end)
-          living_pregs &= ~(1U << phys);
+        if (li->state != LI_NORMAL || li->start >= li->end)
+          continue;
+        born_pregs |= 1U << physical_bit(ra, li);
       }
+      living_pregs |= born_pregs;
 
       // Store living regs to IR.
       IR *ir = bb->irs->data[j];
-      if (ir->kind == IR_CALL) {
-        ir->call.precall->precall.living_pregs = living_pregs;
+      if (ir->kind == IR_CALL && !ir->call.tail) {
+        // The result is not living across the call.
+        unsigned int living = living_pregs & ~born_pregs;
+        ir->call.precall->precall.living_pregs = living;
         // Store it into corresponding precall, too.
         IR *ir_precall = ir->call.precall;
-        ir_precall->precall.living_pregs = living_pregs;
+        ir_precall->precall.living_pregs = living;
       }
     }
   }
+
+  free(end_heads);
+  free(end_nexts);
 }
 
 void prepare_register_allocation(Function *func) {
@@ -433,49 +617,30 @@ void prepare_register_allocation(Function *func) {
   if (func->type->func.params != NULL) {
     const int DEFAULT_OFFSET = WORD_SIZE * 2;  // Return address, saved base pointer.
     assert((Scope*)func->scopes->data[0] != NULL);
-    int ireg_index = is_stack_param(func->type->func.ret) ? 1 : 0;
-#ifndef __NO_FLONUM
-    int freg_index = 0;
-#endif
-    int reg_param_index = ireg_index;
-    int offset = DEFAULT_OFFSET;
+    ArgClassifier classifier = {.ireg_index = is_stack_param(func->type->func.ret) ? 1 : 0};
     for (int j = 0; j < func->type->func.params->len; ++j) {
       VarInfo *varinfo = func->type->func.params->data[j];
       VReg *vreg = varinfo->local.reg;
       // Currently, all parameters are force spilled.
       spill_vreg(((FuncBackend*)func->extra)->ra, vreg);
-      // stack parameters
-      if (is_stack_param(varinfo->type)) {
-        vreg->offset = offset = ALIGN(offset, align_size(varinfo->type));
-        offset += type_size(varinfo->type);
+      ArgInfo info;
+      classify_arg(&classifier, varinfo->type, &info);
+      if (info.offset >= 0) {
+        // Function argument passed through the stack.
+        vreg->offset = DEFAULT_OFFSET + info.offset;
         continue;
       }
+      // Struct passed in registers is stored into its own frame slot.
+      if (info.sregs.count > 0)
+        continue;
 
       if (func->type->func.vaargs) {  // Variadic function parameters.
 #ifndef __NO_FLONUM
-        if (is_flonum(varinfo->type))
-          vreg->offset = (freg_index - MAX_FREG_ARGS) * WORD_SIZE;
+        if (info.is_flonum)
+          vreg->offset = (info.reg_index - MAX_FREG_ARGS) * WORD_SIZE;
         else
 #endif
-          vreg->offset = (ireg_index - MAX_REG_ARGS - MAX_FREG_ARGS) * WORD_SIZE;
-      }
-      ++reg_param_index;
-      bool through_stack;
-#ifndef __NO_FLONUM
-      if (is_flonum(varinfo->type)) {
-        through_stack = freg_index >= MAX_FREG_ARGS;
-        ++freg_index;
-      } else
-#endif
-      {
-        through_stack = ireg_index >= MAX_REG_ARGS;
-        ++ireg_index;
-      }
-
-      if (through_stack) {
-        // Function argument passed through the stack.
-        vreg->offset = offset;
-        offset += WORD_SIZE;
+          vreg->offset = (info.reg_index - MAX_REG_ARGS - MAX_FREG_ARGS) * WORD_SIZE;
       }
     }
   }
@@ -513,51 +678,168 @@ void prepare_register_allocation(Function *func) {
   }
 }
 
-void alloc_physical_registers(RegAlloc *ra, BBContainer *bbcon, int reserved_size) {
-#ifndef __NO_FLONUM
-  assert(ra->phys_max + ra->fphys_max < (int)(sizeof(ra->used_reg_bits) * CHAR_BIT));
-#endif
-  analyze_reg_flow(bbcon);
+static void classify_intervals(RegAlloc *ra, LiveInterval *intervals, int vreg_count) {
+  for (int i = 0; i < vreg_count; ++i) {
+    LiveInterval *li = &intervals[i];
+    VReg *vreg = ra->vregs->data[i];
+    li->phys = -1;
+    li->state = LI_NORMAL;
 
-  LiveInterval *intervals = NULL;
-  LiveInterval **sorted_intervals = NULL;
+    if (vreg->flag & VRF_CONST) {
+      li->state = LI_CONST;
+      continue;
+    }
 
-  int vreg_count = ra->vregs->len;
+    // Force function parameter spilled.
+    if (vreg->param_index >= 0) {
+      spill_vreg(ra, vreg);
+      li->start = 0;
+      li->state = LI_SPILL;
+    }
+    if (vreg->flag & VRF_SPILLED) {
+      li->state = LI_SPILL;
+      li->phys = vreg->phys;
+    }
+  }
+}
 
-// int iter_count = 0;
-  for (;;) {
-    intervals = realloc(intervals, sizeof(LiveInterval) * vreg_count);
-    check_live_interval(bbcon, vreg_count, intervals);
+enum {
+  LIVE_IN = 1 << 0,   // Starts at the head of a BB, flowing in.
+  LIVE_OUT = 1 << 1,  // Ends at the tail of a BB, flowing out.
+};
 
-    for (int i = 0; i < vreg_count; ++i) {
-      LiveInterval *li = &intervals[i];
-      VReg *vreg = ra->vregs->data[i];
+// Intervals which start or end at a boundary of BBs extend to the spill code there.
+static unsigned char *mark_inout_intervals(BBContainer *bbcon, LiveInterval *intervals,
+                                           int vreg_count) {
+  unsigned char *inout = calloc(vreg_count, sizeof(*inout));
+  int nip = 0;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->in_regs->len; ++j) {
+      VReg *reg = bb->in_regs->data[j];
+      if (intervals[reg->virt].start == nip)
+        inout[reg->virt] |= LIVE_IN;
+    }
+    nip += bb->irs->len;
+    for (int j = 0; j < bb->out_regs->len; ++j) {
+      VReg *reg = bb->out_regs->data[j];
+      if (intervals[reg->virt].end == nip)
+        inout[reg->virt] |= LIVE_OUT;
+    }
+  }
 
-      if (vreg->flag & VRF_CONST) {
-        li->state = LI_CONST;
-        continue;
+  // Used by the instruction at the boundary: it ends there.
+  nip = 0;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j, ++nip) {
+      IR *ir = bb->irs->data[j];
+      VReg *regs[] = {ir->dst, ir->opr1, ir->opr2};
+      for (int k = 0; k < 3; ++k) {
+        VReg *reg = regs[k];
+        if (reg != NULL && reg->virt < vreg_count && intervals[reg->virt].end == nip)
+          inout[reg->virt] &= ~LIVE_OUT;
       }
+    }
+  }
+  return inout;
+}
 
-      // Force function parameter spilled.
-      if (vreg->param_index >= 0) {
-        spill_vreg(ra, vreg);
-        li->start = 0;
-        li->state = LI_SPILL;
-      }
-      if (vreg->flag & VRF_SPILLED) {
-        li->state = LI_SPILL;
-        li->phys = vreg->phys;
+// Update live intervals after spill code is inserted, instead of calculating and sorting all again:
+// existing intervals are moved to the new positions, which keeps the order,
+// and intervals for the new temporary registers are merged.
+static LiveInterval **update_live_intervals(
+  BBContainer *bbcon, LiveInterval **pintervals, LiveInterval **sorted_intervals, int old_count,
+  int vreg_count, const unsigned char *inout, const int *start_map, const int *end_map
+) {
+  // Intervals are reallocated, so keep the order by index.
+  int *order = malloc(sizeof(*order) * old_count);
+  for (int i = 0; i < old_count; ++i)
+    order[i] = sorted_intervals[i]->virt;
+  free(sorted_intervals);
+
+  LiveInterval *intervals = realloc(*pintervals, sizeof(LiveInterval) * vreg_count);
+  *pintervals = intervals;
+
+  for (int i = 0; i < old_count; ++i) {
+    LiveInterval *li = &intervals[i];
+    if (li->start >= 0) {
+      li->start = (inout[i] & LIVE_IN) ? start_map[li->start] : end_map[li->start];
+      li->end = (inout[i] & LIVE_OUT) ? start_map[li->end] : end_map[li->end];
+    }
+  }
+  for (int i = old_count; i < vreg_count; ++i) {
+    LiveInterval *li = &intervals[i];
+    li->virt = i;
+    li->start = li->end = -1;
+  }
+
+  // Temporary registers live only around an instruction.
+  int nip = 0;
+  for (int i = 0; i < bbcon->bbs->len; ++i) {
+    BB *bb = bbcon->bbs->data[i];
+    for (int j = 0; j < bb->irs->len; ++j, ++nip) {
+      IR *ir = bb->irs->data[j];
+      VReg *regs[] = {ir->dst, ir->opr1, ir->opr2};
+      for (int k = 0; k < 3; ++k) {
+        VReg *reg = regs[k];
+        if (reg == NULL || reg->virt < old_count)
+          continue;
+        LiveInterval *li = &intervals[reg->virt];
+        if (li->start < 0)
+          li->start = nip;
+        if (li->end < nip)
+          li->end = nip;
       }
     }
+  }
+
+  int new_count = vreg_count - old_count;
+  LiveInterval **added = malloc(sizeof(*added) * new_count);
+  for (int i = 0; i < new_count; ++i)
+    added[i] = &intervals[old_count + i];
+  myqsort(added, new_count, sizeof(LiveInterval *), sort_live_interval);
+
+  sorted_intervals = malloc(sizeof(LiveInterval*) * vreg_count);
+  for (int i = 0, j = 0, n = 0; n < vreg_count; ++n) {
+    LiveInterval *li = i < old_count ? &intervals[order[i]] : NULL;
+    if (li == NULL || (j < new_count && sort_live_interval(&added[j], &li) < 0)) {
+      sorted_intervals[n] = added[j++];
+    } else {
+      sorted_intervals[n] = li;
+      ++i;
+    }
+  }
+  free(added);
+  free(order);
+  return sorted_intervals;
+}
+
+void alloc_physical_registers(RegAlloc *ra, BBContainer *bbcon, int reserved_size) {
+#ifndef __NO_FLONUM
+  assert(ra->phys_max + ra->fphys_max < (int)(sizeof(ra->used_reg_bits) * CHAR_BIT));
+#endif
+  analyze_reg_flow(bbcon);
 
-    // Sort by start, end
-    sorted_intervals = realloc(sorted_intervals, sizeof(LiveInterval*) * vreg_count);
-    for (int i = 0; i < vreg_count; ++i)
-      sorted_intervals[i] = &intervals[i];
-    myqsort(sorted_intervals, vreg_count, sizeof(LiveInterval *), sort_live_interval);
+  int vreg_count = ra->vregs->len;
+  LiveInterval *intervals = malloc(sizeof(LiveInterval) * vreg_count);
+  check_live_interval(bbcon, vreg_count, intervals);
+  classify_intervals(ra, intervals, vreg_count);
+
+  // Sort by start, end
+  LiveInterval **sorted_intervals = malloc(sizeof(LiveInterval*) * vreg_count);
+  for (int i = 0; i < vreg_count; ++i)
+    sorted_intervals[i] = &intervals[i];
+  myqsort(sorted_intervals, vreg_count, sizeof(LiveInterval *), sort_live_interval);
+
+  for (;;) {
     ra->sorted_intervals = sorted_intervals;
 
-    linear_scan_register_allocation(ra, sorted_intervals, vreg_count);
+    CallSites sites;
+    collect_call_sites(bbcon, &sites);
+    linear_scan_register_allocation(ra, sorted_intervals, vreg_count, &sites);
+    free(sites.nips);
+    free(sites.weights);
 
     // Spill vregs.
     for (int i = 0; i < vreg_count; ++i) {
@@ -568,9 +850,23 @@ void alloc_physical_registers(RegAlloc *ra, BBContainer *bbcon, int reserved_siz
       }
     }
 
-    if (insert_load_store_spilled_irs(ra, bbcon) <= 0)
+    int ir_count = count_irs(bbcon);
+    unsigned char *inout = mark_inout_intervals(bbcon, intervals, vreg_count);
+    int *start_map = malloc(sizeof(*start_map) * (ir_count + 1));
+    int *end_map = malloc(sizeof(*end_map) * (ir_count + 1));
+    int inserted = insert_load_store_spilled_irs(ra, bbcon, start_map, end_map);
+    if (inserted > 0) {
+      int old_count = vreg_count;
+      vreg_count = ra->vregs->len;
+      sorted_intervals = update_live_intervals(bbcon, &intervals, sorted_intervals, old_count,
+                                               vreg_count, inout, start_map, end_map);
+      classify_intervals(ra, intervals, vreg_count);
+    }
+    free(inout);
+    free(start_map);
+    free(end_map);
+    if (inserted <= 0)
       break;
-    vreg_count = ra->vregs->len;
   }
 
   // Map vreg to preg.
@@ -644,7 +644,7 @@ int preprocess(FILE *fp, const char *filename_) {
     } else if (enable) {
       if ((next = keyword(directive, "include")) != NULL) {
         handle_include(&next, &stream);
-        fprintf(pp_ofp, "# %d \"%s\" 1\n", stream.lineno + 1, stream.filename);
+        fprintf(pp_ofp, "# %d \"%s\" 1\n", stream.lineno, stream.filename);
       } else if ((next = keyword(directive, "define")) != NULL) {
         handle_define(next, &stream);
         next = NULL;  // `#define' consumes the line all.
@@ -89,8 +89,7 @@ static bool load_symtab(ElfObj *elfobj) {
     size_t count = shdr->sh_size / sizeof(Elf64_Sym);
     for (uint32_t i = 0; i < count; ++i) {
       Elf64_Sym *sym = &p->symtab.symtabs[i];
-      unsigned char type = sym->st_info & 0x0f;
-      if (type == STT_NOTYPE && str[sym->st_name] != '\0') {
+      if (ELF64_ST_BIND(sym->st_info) != STB_LOCAL && str[sym->st_name] != '\0') {
         const Name *name = alloc_name(&str[sym->st_name], NULL, false);
         table_put(names, name, sym);
       }
@@ -28,6 +28,7 @@ typedef struct {
     struct {
       uintptr_t address;
       unsigned char *content;
+      int secno;  // Output section.
     } progbits;
     struct {
       const char *buf;
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stddef.h>  // offsetof
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -46,6 +47,31 @@ static void put_padding(FILE *fp, uintptr_t start) {
   }
 }
 
+// Debug sections are not loaded: contents are concatenated,
+// and relocations to them are resolved with the offsets in the output.
+
+#define DEBUG_SECTION_COUNT  (3)
+
+static const char *kDebugSectionNames[DEBUG_SECTION_COUNT] = {
+  ".debug_info",
+  ".debug_abbrev",
+  ".debug_line",
+};
+
+static Vector *debug_inputs[DEBUG_SECTION_COUNT];  // <ElfSectionInfo*>
+static Buffer debug_sections[DEBUG_SECTION_COUNT];
+
+static int find_debug_section(ElfObj *elfobj, const Elf64_Shdr *shdr) {
+  if (shdr->sh_flags & SHF_ALLOC)
+    return -1;
+  const char *name = &elfobj->shstrtab[shdr->sh_name];
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    if (strcmp(name, kDebugSectionNames[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
 //
 
 typedef struct {
@@ -101,6 +127,10 @@ static void resolve_rela_elfobj(ElfObj *elfobj, File *files, int nfiles) {
     Elf64_Shdr *shdr = &elfobj->shdrs[sec];
     if (shdr->sh_type != SHT_RELA || shdr->sh_size <= 0)
       continue;
+    assert(elfobj->shdrs[shdr->sh_info].sh_type == SHT_PROGBITS);
+    const ElfSectionInfo *dst_info = &elfobj->section_infos[shdr->sh_info];
+    if (dst_info->progbits.content == NULL)  // Not linked.
+      continue;
     const Elf64_Rela *relas = read_from(elfobj->fp, shdr->sh_offset + elfobj->start_offset, shdr->sh_size);
     if (relas == NULL) {
       perror("read error");
@@ -108,8 +138,6 @@ static void resolve_rela_elfobj(ElfObj *elfobj, File *files, int nfiles) {
     const Elf64_Shdr *symhdr = &elfobj->shdrs[shdr->sh_link];
     const ElfSectionInfo *symhdrinfo = &elfobj->section_infos[shdr->sh_link];
     const ElfSectionInfo *strinfo = &elfobj->section_infos[symhdr->sh_link];
-    assert(elfobj->shdrs[shdr->sh_info].sh_type == SHT_PROGBITS);
-    const ElfSectionInfo *dst_info = &elfobj->section_infos[shdr->sh_info];
     for (size_t j = 0, n = shdr->sh_size / sizeof(Elf64_Rela); j < n; ++j) {
       const Elf64_Rela *rela = &relas[j];
       const Elf64_Sym *sym = &symhdrinfo->symtab.symtabs[ELF64_R_SYM(rela->r_info)];
@@ -118,9 +146,9 @@ static void resolve_rela_elfobj(ElfObj *elfobj, File *files, int nfiles) {
       switch (ELF64_ST_BIND(sym->st_info)) {
       case STB_LOCAL:
         {
-          assert(ELF64_R_SYM(rela->r_info) < elfobj->ehdr.e_shnum);
-          const ElfSectionInfo *s = &elfobj->section_infos[ELF64_R_SYM(rela->r_info)];
-          address = s->progbits.address;
+          assert(sym->st_shndx < elfobj->ehdr.e_shnum);
+          const ElfSectionInfo *s = &elfobj->section_infos[sym->st_shndx];
+          address = s->progbits.address + sym->st_value;
         }
         break;
       case STB_GLOBAL:
@@ -144,6 +172,9 @@ static void resolve_rela_elfobj(ElfObj *elfobj, File *files, int nfiles) {
       case R_X86_64_64:
         *(uint64_t*)p = address;
         break;
+      case R_X86_64_32:
+        *(uint32_t*)p = address;
+        break;
       case R_X86_64_PC32:
       case R_X86_64_PLT32:
         *(uint32_t*)p = address - pc;
@@ -154,53 +185,56 @@ static void resolve_rela_elfobj(ElfObj *elfobj, File *files, int nfiles) {
   }
 }
 
-static void link_elfobj(ElfObj *elfobj, File *files, int nfiles, uintptr_t *offsets, Vector **progbit_sections, Table *unresolved) {
+// Input sections are put into the output section of the same name, except that
+// `.text.*', `.rodata.*', `.data.*' and `.bss.*' are merged into the predefined ones.
+static int map_output_section(ElfObj *elfobj, const Elf64_Shdr *shdr) {
+  const char *name = &elfobj->shstrtab[shdr->sh_name];
+  for (int secno = SEC_CODE; secno <= SEC_BSS; ++secno) {
+    const Name *prefix = get_section(secno)->name;
+    if (strncmp(name, prefix->chars, prefix->bytes) == 0 &&
+        (name[prefix->bytes] == '\0' || name[prefix->bytes] == '.'))
+      return secno;
+  }
+
+  const Name *secname = alloc_name(name, NULL, false);
+  int secno = find_section(secname);
+  if (secno < 0)
+    secno = add_section(secname, shdr->sh_type,
+                        shdr->sh_flags & (SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR));
+  return secno;
+}
+
+static void link_elfobj(ElfObj *elfobj, File *files, int nfiles, Vector *section_inputs, Table *unresolved) {
   for (Elf64_Half sec = 0; sec < elfobj->ehdr.e_shnum; ++sec) {
     Elf64_Shdr *shdr = &elfobj->shdrs[sec];
     switch (shdr->sh_type) {
     case SHT_PROGBITS:
-      {
-        Elf64_Xword size = shdr->sh_size;
-        if (size <= 0)
-          break;
-        void *buf = read_from(elfobj->fp, shdr->sh_offset + elfobj->start_offset, size);
-        if (buf == NULL) {
-          perror("read error");
-        }
-        enum SectionType secno;
-        if (shdr->sh_flags & SHF_EXECINSTR) {
-          secno = SEC_CODE;
-        } else if (shdr->sh_flags & SHF_WRITE) {
-          secno = SEC_DATA;
-        } else {
-          secno = SEC_RODATA;
-        }
-        Elf64_Xword align = shdr->sh_addralign;
-        align_section_size(secno, align);
-
-        uintptr_t address = ALIGN(offsets[secno], align);
-        ElfSectionInfo *p = &elfobj->section_infos[sec];
-        p->progbits.address = address;
-        p->progbits.content = buf;
-        vec_push(progbit_sections[secno], p);
-        offsets[secno] = address + size;
-      }
-      break;
     case SHT_NOBITS:
       {
         Elf64_Xword size = shdr->sh_size;
         if (size <= 0)
           break;
-        Elf64_Xword align = shdr->sh_addralign;
-        align_section_size(SEC_BSS, align);
-        add_bss(size);
-
-        uintptr_t address = ALIGN(offsets[SEC_BSS], align);
+        int debug = shdr->sh_type == SHT_PROGBITS ? find_debug_section(elfobj, shdr) : -1;
+        if (!(shdr->sh_flags & SHF_ALLOC) && debug < 0)
+          break;
         ElfSectionInfo *p = &elfobj->section_infos[sec];
-        p->progbits.address = address;
         p->progbits.content = NULL;
-        vec_push(progbit_sections[SEC_BSS], p);
-        offsets[SEC_BSS] = address + size;
+        if (shdr->sh_type == SHT_PROGBITS) {
+          p->progbits.content = read_from(elfobj->fp, shdr->sh_offset + elfobj->start_offset, size);
+          if (p->progbits.content == NULL) {
+            perror("read error");
+          }
+        }
+        if (debug >= 0) {
+          vec_push(debug_inputs[debug], p);
+          break;
+        }
+
+        int secno = map_output_section(elfobj, shdr);
+        while (section_inputs->len < section_count())
+          vec_push(section_inputs, new_vector());
+        p->progbits.secno = secno;
+        vec_push(section_inputs->data[secno], p);
       }
       break;
     case SHT_SYMTAB:
@@ -212,8 +246,7 @@ static void link_elfobj(ElfObj *elfobj, File *files, int nfiles, uintptr_t *offs
         const Name *name;
         Elf64_Sym *sym;
         for (int it = 0; (it = table_iterate(names, it, &name, (void**)&sym)) != -1; ) {
-          unsigned char type = ELF64_ST_TYPE(sym->st_info);
-          if (type != STT_NOTYPE || str[sym->st_name] == '\0')
+          if (str[sym->st_name] == '\0')
             continue;
           const Name *name = alloc_name(&str[sym->st_name], NULL, false);
           if (sym->st_shndx == 0) {
@@ -230,7 +263,7 @@ static void link_elfobj(ElfObj *elfobj, File *files, int nfiles, uintptr_t *offs
   }
 }
 
-static void link_archive(Archive *ar, File *files, int nfiles, uintptr_t *offsets, Vector **progbit_sections, Table *unresolved) {
+static void link_archive(Archive *ar, File *files, int nfiles, Vector *section_inputs, Table *unresolved) {
   Table *table = &ar->symbol_table;
   const Name *name;
   void *dummy;
@@ -244,7 +277,7 @@ static void link_archive(Archive *ar, File *files, int nfiles, uintptr_t *offset
 
       ElfObj *elfobj = load_archive_elfobj(ar, symbol->offset);
       if (elfobj != NULL) {
-        link_elfobj(elfobj, files, nfiles, offsets, progbit_sections, unresolved);
+        link_elfobj(elfobj, files, nfiles, section_inputs, unresolved);
         retry = true;
         break;
       }
@@ -276,29 +309,73 @@ static void resolve_relas(File *files, int nfiles) {
   }
 }
 
-static void add_elfobj_sections(ElfObj *elfobj) {
-  for (Elf64_Half sec = 0; sec < elfobj->ehdr.e_shnum; ++sec) {
-    Elf64_Shdr *shdr = &elfobj->shdrs[sec];
-    switch (shdr->sh_type) {
-    case SHT_PROGBITS:
-      {
-        const ElfSectionInfo *p = &elfobj->section_infos[sec];
-        void *content = p->progbits.content;
-        if (content == NULL)
-          continue;
-        enum SectionType secno;
-        if (shdr->sh_flags & SHF_EXECINSTR) {
-          secno = SEC_CODE;
-        } else if (shdr->sh_flags & SHF_WRITE) {
-          secno = SEC_DATA;
-        } else {
-          secno = SEC_RODATA;
-        }
-        align_section_size(secno, shdr->sh_addralign);
-        add_section_data(secno, content, shdr->sh_size);
+// Hot code is placed at the top of the section and unlikely executed code at the bottom.
+static int input_priority(const ElfSectionInfo *p) {
+  const char *name = &p->elfobj->shstrtab[p->shdr->sh_name];
+  if (strncmp(name, ".text.hot", 9) == 0 && (name[9] == '\0' || name[9] == '.'))
+    return 0;
+  if (strncmp(name, ".text.unlikely", 14) == 0 && (name[14] == '\0' || name[14] == '.'))
+    return 2;
+  return 1;
+}
+
+// Concatenate input sections into the output sections, and assign addresses.
+static void layout_sections(Vector *section_inputs, uintptr_t start_address) {
+  for (int secno = 0; secno < section_inputs->len; ++secno) {
+    Vector *inputs = section_inputs->data[secno];
+    Vector *sorted = new_vector();
+    for (int priority = 0; priority < 3; ++priority) {
+      for (int i = 0; i < inputs->len; ++i) {
+        ElfSectionInfo *p = inputs->data[i];
+        if (input_priority(p) == priority)
+          vec_push(sorted, p);
+      }
+    }
+    section_inputs->data[secno] = sorted;
+
+    for (int i = 0; i < sorted->len; ++i) {
+      ElfSectionInfo *p = sorted->data[i];
+      const Elf64_Shdr *shdr = p->shdr;
+      align_section_size(secno, shdr->sh_addralign);
+      size_t offset;
+      get_section_size(secno, &offset, NULL);
+      p->progbits.address = offset;
+      if (shdr->sh_type == SHT_NOBITS) {
+        add_bss(secno, shdr->sh_size);
+      } else {
+        add_section_data(secno, p->progbits.content, shdr->sh_size);
+        free(p->progbits.content);
       }
-      break;
-    default: break;
+    }
+  }
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    Vector *inputs = debug_inputs[i];
+    for (int j = 0; j < inputs->len; ++j) {
+      ElfSectionInfo *p = inputs->data[j];
+      p->progbits.address = debug_sections[i].size;
+      buf_put(&debug_sections[i], p->progbits.content, p->shdr->sh_size);
+      free(p->progbits.content);
+    }
+  }
+
+  fix_section_size(start_address);
+
+  // Relocations are applied to the contents in the output sections.
+  for (int secno = 0; secno < section_inputs->len; ++secno) {
+    Section *section = get_section(secno);
+    Vector *inputs = section_inputs->data[secno];
+    for (int i = 0; i < inputs->len; ++i) {
+      ElfSectionInfo *p = inputs->data[i];
+      if (section->type != SHT_NOBITS)
+        p->progbits.content = section->buf.data + p->progbits.address;
+      p->progbits.address += section->start_address;
+    }
+  }
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    Vector *inputs = debug_inputs[i];
+    for (int j = 0; j < inputs->len; ++j) {
+      ElfSectionInfo *p = inputs->data[j];
+      p->progbits.content = debug_sections[i].data + p->progbits.address;
     }
   }
 }
@@ -308,21 +385,18 @@ static bool link_files(File *files, int nfiles, const Name *entry, uintptr_t sta
   table_init(&unresolved);
   table_put(&unresolved, entry, (void*)entry);
 
-  uintptr_t offsets[SEC_BSS + 1];
-  Vector *progbit_sections[SEC_BSS + 1];
-  for (int secno = 0; secno < SEC_BSS + 1; ++secno) {
-    offsets[secno] = 0;
-    progbit_sections[secno] = new_vector();
-  }
+  Vector *section_inputs = new_vector();  // <Vector<ElfSectionInfo*>*>, for each output section.
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i)
+    debug_inputs[i] = new_vector();
 
   for (int i = 0; i < nfiles; ++i) {
     File *file = &files[i];
     switch (file->kind) {
     case FK_ELFOBJ:
-      link_elfobj(file->elfobj, files, nfiles, offsets, progbit_sections, &unresolved);
+      link_elfobj(file->elfobj, files, nfiles, section_inputs, &unresolved);
       break;
     case FK_ARCHIVE:
-      link_archive(file->archive, files, nfiles, offsets, progbit_sections, &unresolved);
+      link_archive(file->archive, files, nfiles, section_inputs, &unresolved);
       break;
     default: assert(false); break;
     }
@@ -338,54 +412,209 @@ static bool link_files(File *files, int nfiles, const Name *entry, uintptr_t sta
     return false;
   }
 
-  // Calculate address.
-  {
-    uintptr_t address = start_address;
-    for (int secno = 0; secno < SEC_BSS + 1; ++secno) {
-      address = ALIGN(address, section_aligns[secno]);
-      Vector *v = progbit_sections[secno];
-      if (v->len > 0) {
-        for (int i = 0; i < v->len; ++i) {
-          ElfSectionInfo *p = v->data[i];
-          p->progbits.address += address;
-        }
-        ElfSectionInfo *last = v->data[v->len - 1];
-        address = last->progbits.address + last->shdr->sh_size;
-      }
+  layout_sections(section_inputs, start_address);
+  resolve_relas(files, nfiles);
+  return true;
+}
+
+// Symbols for the executable, locals come first.
+typedef struct {
+  Buffer syms[2];  // Local, global.
+  Strtab strtab;
+} ExeSymtab;
+
+static void collect_elfobj_symbols(ElfObj *elfobj, const int *shndxs, ExeSymtab *exesym) {
+  for (Elf64_Half sec = 0; sec < elfobj->ehdr.e_shnum; ++sec) {
+    Elf64_Shdr *shdr = &elfobj->shdrs[sec];
+    if (shdr->sh_type != SHT_SYMTAB)
+      continue;
+
+    ElfSectionInfo *p = &elfobj->section_infos[sec];
+    const char *str = elfobj->section_infos[shdr->sh_link].strtab.buf;
+    size_t count = shdr->sh_size / sizeof(Elf64_Sym);
+    for (uint32_t i = 0; i < count; ++i) {
+      const Elf64_Sym *sym = &p->symtab.symtabs[i];
+      int type = ELF64_ST_TYPE(sym->st_info);
+      if (str[sym->st_name] == '\0' || type == STT_SECTION || type == STT_FILE ||
+          sym->st_shndx == SHN_UNDEF || sym->st_shndx >= elfobj->ehdr.e_shnum)
+        continue;
+      const Elf64_Shdr *target = &elfobj->shdrs[sym->st_shndx];
+      if (target->sh_size <= 0 || !(target->sh_flags & SHF_ALLOC) ||
+          (target->sh_type != SHT_PROGBITS && target->sh_type != SHT_NOBITS))  // Not linked.
+        continue;
+
+      const ElfSectionInfo *target_info = &elfobj->section_infos[sym->st_shndx];
+      int bind = ELF64_ST_BIND(sym->st_info);
+      Elf64_Sym out = {
+        .st_name = strtab_add(&exesym->strtab, alloc_name(&str[sym->st_name], NULL, false)),
+        .st_info = sym->st_info,
+        .st_shndx = shndxs[target_info->progbits.secno],
+        .st_value = target_info->progbits.address + sym->st_value,
+        .st_size = sym->st_size,
+      };
+      buf_put(&exesym->syms[bind != STB_LOCAL], &out, sizeof(out));
     }
   }
+}
 
-  resolve_relas(files, nfiles);
+static void collect_symbols(File *files, int nfiles, const int *shndxs, ExeSymtab *exesym) {
+  Elf64_Sym nulsym = {0};
+  buf_put(&exesym->syms[0], &nulsym, sizeof(nulsym));
+  strtab_add(&exesym->strtab, alloc_name("", NULL, false));
 
   for (int i = 0; i < nfiles; ++i) {
     File *file = &files[i];
     switch (file->kind) {
     case FK_ELFOBJ:
-      add_elfobj_sections(file->elfobj);
+      collect_elfobj_symbols(file->elfobj, shndxs, exesym);
       break;
     case FK_ARCHIVE:
       {
         Archive *ar = file->archive;
         for (int i = 0; i < ar->contents->len; i += 2) {
           ArContent *content = ar->contents->data[i + 1];
-          add_elfobj_sections(content->elfobj);
+          collect_elfobj_symbols(content->elfobj, shndxs, exesym);
         }
       }
       break;
     default: assert(false); break;
     }
   }
+}
 
-  return true;
+static int count_debug_sections(void) {
+  int count = 0;
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    if (debug_sections[i].size > 0)
+      ++count;
+  }
+  return count;
 }
 
-static bool output_exe(const char *ofn, File *files, int nfiles, const Name *entry) {
-  size_t codesz, rodatasz, datasz, bsssz;
-  uintptr_t codeloadadr, dataloadadr;
-  get_section_size(SEC_CODE, &codesz, &codeloadadr);
-  get_section_size(SEC_RODATA, &rodatasz, NULL);
-  get_section_size(SEC_DATA, &datasz, &dataloadadr);
-  get_section_size(SEC_BSS, &bsssz, NULL);
+// Sections are output in the layout order: `order' has the section numbers.
+static void out_section_headers(FILE *fp, File *files, int nfiles, const int *order,
+                                const uintptr_t *offsets) {
+  int nsec = section_count();
+  uintptr_t debug_ofss[DEBUG_SECTION_COUNT];
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    debug_ofss[i] = ftell(fp);
+    if (debug_sections[i].size > 0)
+      fwrite(debug_sections[i].data, debug_sections[i].size, 1, fp);
+  }
+
+  int *shndxs = malloc(sizeof(*shndxs) * nsec);  // Section number to section header index.
+  for (int i = 0; i < nsec; ++i)
+    shndxs[order[i]] = i + 1;
+
+  ExeSymtab exesym;
+  memset(&exesym, 0, sizeof(exesym));
+  strtab_init(&exesym.strtab);
+  collect_symbols(files, nfiles, shndxs, &exesym);
+  size_t local_count = exesym.syms[0].size / sizeof(Elf64_Sym);
+
+  long symtab_ofs = ALIGN(ftell(fp), 8);
+  put_padding(fp, symtab_ofs);
+  fwrite(exesym.syms[0].data, exesym.syms[0].size, 1, fp);
+  if (exesym.syms[1].size > 0)
+    fwrite(exesym.syms[1].data, exesym.syms[1].size, 1, fp);
+  size_t symtab_size = exesym.syms[0].size + exesym.syms[1].size;
+
+  long strtab_ofs = ftell(fp);
+  fwrite(strtab_dump(&exesym.strtab), exesym.strtab.size, 1, fp);
+
+  Strtab shstrtab;
+  strtab_init(&shstrtab);
+
+  Elf64_Shdr *shdrs = calloc(nsec + DEBUG_SECTION_COUNT + 4, sizeof(*shdrs));
+  shdrs[0].sh_name = strtab_add(&shstrtab, alloc_name("", NULL, false));
+  for (int i = 0; i < nsec; ++i) {
+    int secno = order[i];
+    const Section *section = get_section(secno);
+    size_t size;
+    uintptr_t loadadr;
+    get_section_size(secno, &size, &loadadr);
+    Elf64_Shdr *shdr = &shdrs[i + 1];
+    shdr->sh_name = strtab_add(&shstrtab, section->name);
+    shdr->sh_type = section->type;
+    shdr->sh_flags = section->flag;
+    shdr->sh_addr = loadadr;
+    shdr->sh_offset = offsets[secno];
+    shdr->sh_size = size;
+    shdr->sh_addralign = MAX(section->align, 1);
+  }
+
+  int shnum = nsec + 1;
+  for (int i = 0; i < DEBUG_SECTION_COUNT; ++i) {
+    if (debug_sections[i].size <= 0)
+      continue;
+    Elf64_Shdr *shdr = &shdrs[shnum++];
+    shdr->sh_name = strtab_add(&shstrtab, alloc_name(kDebugSectionNames[i], NULL, false));
+    shdr->sh_type = SHT_PROGBITS;
+    shdr->sh_offset = debug_ofss[i];
+    shdr->sh_size = debug_sections[i].size;
+    shdr->sh_addralign = 1;
+  }
+
+  const int symtab_index = shnum, strtab_index = shnum + 1;
+  Elf64_Shdr *symtabsec = &shdrs[symtab_index];
+  symtabsec->sh_name = strtab_add(&shstrtab, alloc_name(".symtab", NULL, false));
+  symtabsec->sh_type = SHT_SYMTAB;
+  symtabsec->sh_offset = symtab_ofs;
+  symtabsec->sh_size = symtab_size;
+  symtabsec->sh_link = strtab_index;
+  symtabsec->sh_info = local_count;  // Number of local symbols
+  symtabsec->sh_addralign = 8;
+  symtabsec->sh_entsize = sizeof(Elf64_Sym);
+
+  Elf64_Shdr *strtabsec = &shdrs[strtab_index];
+  strtabsec->sh_name = strtab_add(&shstrtab, alloc_name(".strtab", NULL, false));
+  strtabsec->sh_type = SHT_STRTAB;
+  strtabsec->sh_offset = strtab_ofs;
+  strtabsec->sh_size = exesym.strtab.size;
+  strtabsec->sh_addralign = 1;
+
+  Elf64_Shdr *shstrtabsec = &shdrs[shnum + 2];
+  shstrtabsec->sh_name = strtab_add(&shstrtab, alloc_name(".shstrtab", NULL, false));
+  shstrtabsec->sh_type = SHT_STRTAB;
+  shstrtabsec->sh_offset = ftell(fp);
+  shstrtabsec->sh_size = shstrtab.size;
+  shstrtabsec->sh_addralign = 1;
+  fwrite(strtab_dump(&shstrtab), shstrtab.size, 1, fp);
+
+  Elf64_Off sh_ofs = ALIGN(ftell(fp), 0x10);
+  put_padding(fp, sh_ofs);
+  fwrite(shdrs, sizeof(*shdrs), shnum + 3, fp);
+
+  // Write section table offset.
+  fseek(fp, offsetof(Elf64_Ehdr, e_shoff), SEEK_SET);
+  fwrite(&sh_ofs, sizeof(Elf64_Off), 1, fp);
+}
+
+// Sections are laid out in two segments: code and read-only data, and writable data and bss.
+// File offset and address differ by the same amount in both segments.
+static bool output_exe(const char *ofn, File *files, int nfiles, const Name *entry, bool strip) {
+  int nsec = section_count();
+  int *order = malloc(sizeof(*order) * nsec);
+  get_section_layout(order);
+
+  uintptr_t text_end = 0, data_start = 0, data_file_end = 0, data_end = 0;
+  for (int i = 0; i < nsec; ++i) {
+    const Section *section = get_section(order[i]);
+    size_t size;
+    uintptr_t loadadr;
+    get_section_size(order[i], &size, &loadadr);
+    if (!(section->flag & SHF_WRITE)) {
+      text_end = loadadr + size;
+      continue;
+    }
+    if (data_start == 0)
+      data_start = loadadr;
+    if (section->type != SHT_NOBITS)
+      data_file_end = loadadr + size;
+    data_end = loadadr + size;
+  }
+  if (data_file_end < data_start)
+    data_file_end = data_start;
 
   ElfObj *telfobj;
   const Elf64_Sym *tsym = find_symbol_from_all(files, nfiles, entry, &telfobj);
@@ -393,7 +622,7 @@ static bool output_exe(const char *ofn, File *files, int nfiles, const Name *ent
     error("Cannot find label: `%.*s'", entry->bytes, entry->chars);
   uintptr_t entry_address = telfobj->section_infos[tsym->st_shndx].progbits.address + tsym->st_value;
 
-  int phnum = datasz > 0 || bsssz > 0 ? 2 : 1;
+  int phnum = data_end > data_start ? 2 : 1;
 
   FILE *fp;
   if (ofn == NULL) {
@@ -406,34 +635,37 @@ static bool output_exe(const char *ofn, File *files, int nfiles, const Name *ent
     }
   }
 
-  size_t rodata_align = MAX(section_aligns[SEC_RODATA], 1);
-  size_t code_rodata_sz = ALIGN(codesz, rodata_align) + rodatasz;
-  out_elf_header(fp, entry_address, phnum, 0);
+  uintptr_t codeloadadr = get_section(SEC_CODE)->start_address;
+  size_t code_rodata_sz = text_end - codeloadadr;
+  out_elf_header(fp, entry_address, phnum, strip ? 0 : nsec + count_debug_sections() + 4);
   out_program_header(fp, 0, PROG_START, codeloadadr, code_rodata_sz, code_rodata_sz);
   if (phnum > 1) {
-    size_t bss_align = MAX(section_aligns[SEC_BSS], 1);
-    size_t datamemsz = ALIGN(datasz, bss_align) + bsssz;
-    out_program_header(fp, 1, ALIGN(PROG_START + code_rodata_sz, DATA_ALIGN), dataloadadr, datasz,
-                       datamemsz);
+    out_program_header(fp, 1, data_start - codeloadadr + PROG_START, data_start,
+                       data_file_end - data_start, data_end - data_start);
   }
 
+  uintptr_t *offsets = malloc(sizeof(*offsets) * nsec);
   uintptr_t addr = PROG_START;
   put_padding(fp, addr);
-  output_section(fp, SEC_CODE);
-  addr += codesz;
-  if (rodatasz > 0) {
-    size_t rodata_align = MAX(section_aligns[SEC_RODATA], 1);
-    addr = ALIGN(addr, rodata_align);
-    put_padding(fp, addr);
-    output_section(fp, SEC_RODATA);
-    addr += rodatasz;
-  }
-  if (datasz > 0) {
-    addr = ALIGN(addr, DATA_ALIGN);
-    put_padding(fp, addr);
-    output_section(fp, SEC_DATA);
-    addr += datasz;
+  for (int i = 0; i < nsec; ++i) {
+    int secno = order[i];
+    const Section *section = get_section(secno);
+    size_t size;
+    uintptr_t loadadr;
+    get_section_size(secno, &size, &loadadr);
+    offsets[secno] = loadadr - codeloadadr + PROG_START;
+    if (section->type == SHT_NOBITS || size <= 0) {
+      if (offsets[secno] > addr)
+        offsets[secno] = addr;
+      continue;
+    }
+    put_padding(fp, offsets[secno]);
+    output_section(fp, secno);
+    addr = offsets[secno] + size;
   }
+
+  if (!strip)
+    out_section_headers(fp, files, nfiles, order, offsets);
   fclose(fp);
 
 #if !defined(__XV6)
@@ -448,6 +680,7 @@ static bool output_exe(const char *ofn, File *files, int nfiles, const Name *ent
 int main(int argc, char *argv[]) {
   const char *ofn = NULL;
   const char *entry = kDefaultEntryName;
+  bool strip = false;
 
   struct option longopts[] = {
     {"version", no_argument, NULL, 'V'},
@@ -455,7 +688,7 @@ int main(int argc, char *argv[]) {
   };
   int opt;
   int longindex;
-  while ((opt = getopt_long(argc, argv, "Vo:e:", longopts, &longindex)) != -1) {
+  while ((opt = getopt_long(argc, argv, "Vo:e:s", longopts, &longindex)) != -1) {
     switch (opt) {
     case 'V':
       show_version("ld");
@@ -466,6 +699,9 @@ int main(int argc, char *argv[]) {
     case 'e':
       entry = optarg;
       break;
+    case 's':
+      strip = true;
+      break;
     default:
       fprintf(stderr, "Unknown option: %s\n", argv[optind]);
       return 1;
@@ -479,7 +715,8 @@ int main(int argc, char *argv[]) {
   if (ofn == NULL)
     ofn = "a.out";
 
-  section_aligns[SEC_DATA] = DATA_ALIGN;
+  init_sections();
+  align_section_size(SEC_DATA, DATA_ALIGN);
 
   int nfiles = 0;
   File *files = malloc_or_die(sizeof(*files) * (argc - iarg));
@@ -510,10 +747,8 @@ int main(int argc, char *argv[]) {
 
   const Name *entry_name = alloc_name(entry, NULL, false);
   bool result = link_files(files, nfiles, entry_name, LOAD_ADDRESS);
-  if (result) {
-    fix_section_size(LOAD_ADDRESS);
-    result = output_exe(ofn, files, nfiles, entry_name);
-  }
+  if (result)
+    result = output_exe(ofn, files, nfiles, entry_name, strip);
 
   for (int i = 0; i < nfiles; ++i) {
     File *file = &files[i];
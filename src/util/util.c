@@ -349,6 +349,38 @@ void buf_align(Buffer *buf, int align) {
   assert(buf->size == aligned_size);
 }
 
+// Arena
+
+#define ARENA_BLOCK_SIZE  (64 * 1024)
+#define ARENA_ALIGN  (16)
+
+static struct {
+  unsigned char *p;
+  size_t left;
+} arena;
+
+void *arena_alloc(size_t size) {
+  size = ALIGN(size, ARENA_ALIGN);
+  if (size > arena.left) {
+    if (size > ARENA_BLOCK_SIZE / 4) {  // Large chunk: allocate separately.
+      void *p = malloc(size);
+      if (p == NULL)
+        error("not enough memory");
+      return p;
+    }
+    arena.p = malloc(ARENA_BLOCK_SIZE);
+    if (arena.p == NULL)
+      error("not enough memory");
+    arena.left = ARENA_BLOCK_SIZE;
+  }
+  void *p = arena.p;
+  arena.p += size;
+  arena.left -= size;
+  return p;
+}
+
+// Container
+
 Vector *new_vector(void) {
   Vector *vec = malloc(sizeof(Vector));
   vec->data = NULL;
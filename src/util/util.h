@@ -41,6 +41,10 @@ const char *skip_whitespaces(const char *s);
 
 void myqsort(void *base, size_t nmemb, size_t size, int (*compare)(const void *, const void *));
 
+// Arena: allocated memory is never freed.
+
+void *arena_alloc(size_t size);
+
 // Container
 
 typedef struct Buffer {
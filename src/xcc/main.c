@@ -149,6 +149,14 @@ static void usage(FILE *fp) {
       "  -c                  Output object file\n"
       "  -S                  Output assembly code\n"
       "  -E                  Output preprocess result\n"
+      "  -s                  Strip symbol table from executable\n"
+      "  -g                  Output line number information\n"
+      "  -fno-omit-frame-pointer  Keep frame pointer in every function\n"
+      "  -ffunction-sections  Put each function into its own section\n"
+      "  -falign-functions=<n>  Align function entries to n bytes (Default: 16)\n"
+      "  -falign-loops=<n>   Align loop heads to n bytes (Default: 16)\n"
+      "  -fprofile-generate[=<file>]  Count block executions into the profile (Default: xcc.prof)\n"
+      "  -fprofile-use[=<file>]  Optimize with the profile\n"
   );
 }
 
@@ -281,7 +289,7 @@ int main(int argc, char *argv[]) {
   };
   int opt;
   int longindex;
-  while ((opt = getopt_long(argc, argv, "hVcESI:D:o:n:", longopts, &longindex)) != -1) {
+  while ((opt = getopt_long(argc, argv, "hVcESsgI:D:o:n:f:", longopts, &longindex)) != -1) {
     switch (opt) {
     case 'h':
       usage(stdout);
@@ -310,6 +318,12 @@ int main(int argc, char *argv[]) {
     case 'S':
       out_type = OutAssembly;
       break;
+    case 's':
+      vec_push(ld_cmd, "-s");
+      break;
+    case 'g':
+      vec_push(cc1_cmd, "-g");
+      break;
     case 'n':
       if (strcmp(optarg, "odefaultlibs") == 0) {
         nodefaultlibs = true;
@@ -319,6 +333,11 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "unknown option: n%s\n", optarg);
       }
       break;
+    case 'f':
+      // Code generation options are passed to the compiler.
+      vec_push(cc1_cmd, "-f");
+      vec_push(cc1_cmd, optarg);
+      break;
     }
   }
 
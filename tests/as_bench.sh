@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Measure the assembler throughput (lines per second) on a large cc1-generated source.
+
+XCC=${XCC:-../xcc}
+AS=${AS:-../as}
+STATEMENTS=${STATEMENTS:-100000}
+
+gen_source() {
+  awk -v n="$1" 'BEGIN {
+    vars = 20
+    print "unsigned g(unsigned x) { return x >> 1; }"
+    print "unsigned f(unsigned *a) {"
+    for (v = 0; v < vars; ++v)
+      printf("  unsigned v%d = a[%d];\n", v, v % 16)
+    for (i = 0; i < n; ++i) {
+      d = i % vars
+      s = (i * 7 + 3) % vars
+      if (i % 50 == 49)
+        printf("  if (v%d & 1) v%d = g(v%d);\n", d, s, d)
+      else
+        printf("  v%d += v%d * %d ^ a[%d];\n", d, s, i % 97 + 1, i % 16)
+    }
+    printf("  return v0")
+    for (v = 1; v < vars; ++v)
+      printf(" + v%d", v)
+    print ";"
+    print "}"
+  }'
+}
+
+tmpfile=$(mktemp)
+gen_source "$STATEMENTS" > "$tmpfile.c"
+$XCC -S -o "$tmpfile.s" "$tmpfile.c" || {
+  echo "NG: compile failed"
+  exit 1
+}
+lines=$(wc -l < "$tmpfile.s")
+
+echo -n "$lines lines => "
+
+TIMEFORMAT='%R'
+elapsed=$( { time $AS -o "$tmpfile.o" "$tmpfile.s" > /dev/null 2>&1; } 2>&1 ) || {
+  echo "NG: assemble failed"
+  exit 1
+}
+rm -f "$tmpfile" "$tmpfile.c" "$tmpfile.s" "$tmpfile.o"
+awk -v lines="$lines" -v t="$elapsed" 'BEGIN {
+  if (t <= 0) t = 0.001
+  printf("OK (%ss, %d lines/s)\n", t, lines / t)
+}'
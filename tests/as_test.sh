@@ -0,0 +1,305 @@
+#!/bin/bash
+
+# Compare the machine code from the assembler with the host GNU assembler, byte for byte.
+
+AS=${AS:-../as}
+HOST_AS=${HOST_AS:-as}
+OBJCOPY=${OBJCOPY:-objcopy}
+
+if ! command -v "$HOST_AS" > /dev/null || ! command -v "$OBJCOPY" > /dev/null; then
+  echo "SKIP: host assembler not found"
+  exit 0
+fi
+
+tmpfile=$(mktemp)
+trap 'rm -f "$tmpfile" "$tmpfile".*' EXIT
+
+text_bytes() {
+  "$OBJCOPY" -O binary -j .text "$1" "$tmpfile.bin" && od -An -tx1 -v "$tmpfile.bin" | tr -s ' \n' ' '
+}
+
+try() {
+  local inst="$1"
+
+  echo -n "$inst => "
+
+  echo "$inst" > "$tmpfile.s"
+  "$HOST_AS" -o "$tmpfile.o" "$tmpfile.s" || exit 1
+  local expected
+  expected=$(text_bytes "$tmpfile.o")
+
+  $AS -o "$tmpfile.o" "$tmpfile.s" || {
+    echo "NG: assemble failed"
+    exit 1
+  }
+  local actual
+  actual=$(text_bytes "$tmpfile.o")
+
+  if [ "$actual" = "$expected" ]; then
+    echo "OK"
+  else
+    echo "NG:$expected expected, but got$actual"
+    exit 1
+  fi
+}
+
+test_memory_operand() {
+  try 'mov (%rax), %rcx'
+  try 'mov %ecx, (%rax)'
+  try 'movsd (%rax), %xmm1'
+  try 'movdqu (%rsp), %xmm0'
+  try 'movdqu 0(%rbp), %xmm0'
+  try 'movdqu (%r12), %xmm0'
+  try 'movdqu (%r13), %xmm0'
+  try 'movdqu 127(%rdi), %xmm0'
+  try 'movdqu -129(%rdi), %xmm0'
+  try 'movdqu (0x1234), %xmm0'
+  try 'movdqu 8(%rip), %xmm0'
+  try 'movdqu (%rax,%rcx), %xmm0'
+  try 'movdqu 16(%rbp,%r9,8), %xmm10'
+  try 'movdqu -4(%r13,%rax,2), %xmm0'
+}
+
+test_sse() {
+  try 'movdqu %xmm1, %xmm0'
+  try 'movdqu %xmm8, %xmm15'
+  try 'movdqu %xmm3, 16(%rdi)'
+  try 'movdqa (%rsi), %xmm2'
+  try 'movdqa %xmm9, -32(%rsp)'
+  try 'pxor %xmm0, %xmm0'
+  try 'pxor (%rdi), %xmm11'
+  try 'paddd %xmm1, %xmm2'
+  try 'pcmpeqb %xmm9, %xmm1'
+  try 'pcmpeqb (%rdi,%rcx), %xmm0'
+  try 'pmovmskb %xmm1, %eax'
+  try 'pmovmskb %xmm1, %rax'
+  try 'pmovmskb %xmm10, %r9d'
+  try 'pshufb %xmm1, %xmm0'
+  try 'pshufb (%r8), %xmm12'
+}
+
+test_avx() {
+  try 'vmovdqu %ymm1, %ymm0'
+  try 'vmovdqu %ymm8, %ymm0'
+  try 'vmovdqu %ymm0, %ymm8'
+  try 'vmovdqu %ymm9, %ymm10'
+  try 'vmovdqu %xmm1, %xmm2'
+  try 'vmovdqu (%rdi), %ymm1'
+  try 'vmovdqu (%r8), %ymm1'
+  try 'vmovdqu %ymm2, 32(%rax,%r9,2)'
+  try 'vmovdqu %ymm12, -64(%rsp)'
+  try 'vmovdqa 32(%rdi), %ymm3'
+  try 'vmovdqa %ymm8, %ymm0'
+  try 'vzeroupper'
+}
+
+test_bit_count() {
+  try 'popcnt %edi, %eax'
+  try 'popcnt %rdi, %rax'
+  try 'popcnt %ax, %cx'
+  try 'popcnt (%rsi), %r10'
+  try 'tzcnt %r8, %rdx'
+  try 'tzcnt (%rdi), %ecx'
+  try 'bsf %edi, %eax'
+  try 'bsf 8(%rbx), %r15'
+}
+
+test_misc() {
+  try 'prefetcht0 (%rdi)'
+  try 'prefetcht1 64(%rsi)'
+  try 'prefetcht2 (%r8,%rcx,4)'
+  try 'prefetchnta 64(%rsp)'
+  try 'rep'
+  try 'rep movsb'
+  try 'rep stosb'
+  try 'cmove %ecx, %eax'
+  try 'cmovg %r9, %r10'
+  try 'cmovne (%rdi), %eax'
+  try 'cmovl 8(%rsp), %r12w'
+}
+
+test_mov() {
+  try 'mov %al, %cl'
+  try 'mov %sil, (%rdi)'
+  try 'mov %r9w, %ax'
+  try 'mov %rax, 8(%rsp)'
+  try 'mov (%rbx), %dil'
+  try 'mov -8(%rbp), %r10d'
+  try 'mov $200, %al'
+  try 'mov $0x1234, %r11w'
+  try 'mov $5, %eax'
+  try 'mov $-1, %rax'
+  try 'mov $0xffffffff, %rax'
+  try 'mov $0x123456789, %r15'
+  try 'movb $-1, (%rax)'
+  try 'movw $0xffff, (%rax)'
+  try 'movl $1, 4(%rcx,%rdx,4)'
+  try 'movq $-2, (%rsp)'
+  try $'movl $5, g(%rip)\ng:\n.long 0'
+  try $'movq $1, g+4(%rip)\ng:\n.quad 0'
+  try $'g:\n.byte 0\nmovb $1, g(%rip)'
+  try $'movw $0x1234, g(%rip)\ng:\n.word 0'
+  try $'addq $0x1000, g(%rip)\ng:\n.quad 0'
+  try $'subq $8, g(%rip)\ng:\n.quad 0'
+  try 'movsx %al, %ecx'
+  try 'movsx %sil, %r8'
+  try 'movsx %ax, %ecx'
+  try 'movsx %eax, %rdx'
+  try 'movzx %dil, %eax'
+  try 'movzx %al, %cx'
+  try 'movzx %r9w, %r9d'
+  try 'lea 16(%rsp), %rdi'
+  try 'lea (%rax,%rcx,2), %eax'
+}
+
+test_alu() {
+  # One line for each encoding of the arithmetic and logical operations.
+  local op
+  for op in add or and sub xor cmp; do
+    try "$op %cl, (%rdi)"
+    try "$op %r9, 8(%rdi)"
+    try "$op (%rsi), %bl"
+    try "$op (%rax,%rcx,8), %r12d"
+    try "$op \$1, %ecx"
+    try "$op \$200, %al"
+    try "$op \$0x1000, %eax"
+    try "$op \$3, %bl"
+    try "$op \$0x1000, %r9w"
+  done
+
+  try 'add %cl, %al'
+  try 'addq $-128, (%rax)'
+  try 'add $0x1000, %rax'
+  try 'addq $0x1000, 8(%rax)'
+  try 'add $0x1000, %r9d'
+  try 'subq $8, %rsp'
+  try 'sub $0x80, %esp'
+  try 'and $0xffffffff, %eax'
+  try 'and $-16, %rsp'
+  try 'and $0x7f, %cl'
+  try 'or %dx, (%rsi)'
+  try 'or $0x100, %ax'
+  try 'xor %eax, %eax'
+  try 'xor $0x55, %sil'
+  try 'cmp $-1, %ax'
+  try 'cmp %r11, %r10'
+  try 'cmp $1000, %rdi'
+  try 'test %eax, %eax'
+  try 'test %cl, (%rdi)'
+  try 'test (%rdi), %al'
+  try 'test 8(%rsp), %r10d'
+  try 'test $1, %al'
+  try 'test $0x100, %eax'
+  try 'test $1, %dil'
+  try 'test $0x100, %r8'
+}
+
+test_unary() {
+  local op
+  for op in not neg mul div idiv imul; do
+    try "$op %cl"
+    try "$op %r9"
+  done
+
+  try 'neg %bpl'
+  try 'not %eax'
+  try 'div %esi'
+  try 'imul %ecx, %eax'
+  try 'imul (%rsi), %r9'
+  try 'imul $3, %eax'
+  try 'imul $1000, %r12'
+  try 'inc %al'
+  try 'inc %r8d'
+  try 'incl (%rax)'
+  try 'incq 8(%rsp)'
+  try 'incb (%rdi)'
+  try 'incw (%rdi)'
+  try 'dec %rcx'
+  try 'decb (%rax)'
+  try 'decw %ax'
+  try 'decl (%rdx)'
+  try 'decq (%rdx)'
+}
+
+test_shift() {
+  local op
+  for op in shl shr sar; do
+    try "$op \$1, %al"
+    try "$op \$1, %eax"
+    try "$op %cl, %dl"
+    try "$op %cl, %rdi"
+    try "$op \$7, %bl"
+    try "$op \$4, %r9"
+  done
+
+  try 'shr $1, %r11w'
+  try 'shr $63, %rax'
+  try 'sar %cl, %sil'
+}
+
+test_control() {
+  try 'cwtl'
+  try 'cltd'
+  try 'cqto'
+  try 'sete %al'
+  try 'setne %sil'
+  try 'setg %r9b'
+  try 'seta (%rdi)'
+  try 'jmp *%rax'
+  try 'jmp *%r11'
+  try 'jmp *8(%rip)'
+  try 'jmp *(%rax,%rcx,8)'
+  try 'call *%rax'
+  try 'call *%r12'
+  try 'call *16(%rdi)'
+  try 'ret'
+  try 'push %rbp'
+  try 'push %r15'
+  try 'push (%rax)'
+  try 'push $1'
+  try 'push $0x1000'
+  try 'pop %rbx'
+  try 'pop %r12'
+  try 'pop 8(%rsp)'
+  try 'int $0x80'
+  try 'syscall'
+}
+
+test_float() {
+  try 'movsd %xmm1, %xmm0'
+  try 'movsd %xmm9, 8(%rsp)'
+  try 'addsd %xmm1, %xmm0'
+  try 'subsd (%rax), %xmm10'
+  try 'mulsd %xmm8, %xmm1'
+  try 'divsd 8(%rip), %xmm0'
+  try 'ucomisd %xmm1, %xmm0'
+  try 'cvtsi2sd %eax, %xmm0'
+  try 'cvtsi2sd %r9, %xmm12'
+  try 'cvttsd2si %xmm0, %eax'
+  try 'cvttsd2si %xmm8, %r10'
+  try 'sqrtsd %xmm1, %xmm2'
+  try 'movss (%rdi), %xmm0'
+  try 'movss %xmm1, (%rdi)'
+  try 'addss %xmm1, %xmm0'
+  try 'subss %xmm1, %xmm0'
+  try 'mulss %xmm1, %xmm0'
+  try 'divss %xmm1, %xmm0'
+  try 'ucomiss %xmm9, %xmm0'
+  try 'cvtsi2ss %ecx, %xmm1'
+  try 'cvtsi2ss %rcx, %xmm1'
+  try 'cvttss2si %xmm1, %rcx'
+  try 'cvtsd2ss %xmm1, %xmm0'
+  try 'cvtss2sd %xmm1, %xmm0'
+}
+
+test_memory_operand
+test_sse
+test_avx
+test_bit_count
+test_misc
+test_mov
+test_alu
+test_unary
+test_shift
+test_control
+test_float
@@ -1,5 +1,6 @@
 // Compiled on XCC
 
+#include "stdarg.h"
 #include "stdio.h"
 #include "stdlib.h"  // exit
 
@@ -11,8 +12,50 @@ extern int ref_export(void);
 extern double many_fargs(double a, double b, double c, double d, double e, double f, double g, double h, double i);
 #endif
 
+typedef struct { int x, y; } Point;
+typedef struct { char s[3]; } Chars;
+typedef struct { long a, b, c; } Large;
+extern Point make_point(int x, int y);
+extern int point_dot(Point a, Point b);
+extern Chars chars_rev(Chars c);
+extern Large large_add(Large a, Large b);
+extern long sum_points(int n, ...);
+extern long call_xcc_points(void);
+#ifndef __NO_FLONUM
+typedef struct { double re, im; } Complex;
+typedef struct { double d; long l; } Mixed;
+extern Complex cmul(Complex a, Complex b);
+extern Mixed mixed_twice(Mixed m);
+extern double call_xcc_mixed(void);
+#endif
+
 int export = 9876;
 
+// Called from gcc.
+Point xcc_point_swap(Point p) {
+  Point r = {p.y, p.x};
+  return r;
+}
+
+long xcc_sum_points(int n, ...) {
+  va_list ap;
+  va_start(ap, n);
+  long sum = 0;
+  for (int i = 0; i < n; ++i) {
+    Point p = va_arg(ap, Point);
+    sum = sum * 100 + p.x * 10 + p.y;
+  }
+  va_end(ap);
+  return sum;
+}
+
+#ifndef __NO_FLONUM
+Mixed xcc_mixed(long l, Mixed m, double d) {
+  Mixed r = {m.d + d, m.l + l};
+  return r;
+}
+#endif
+
 void expect(char *title, long expected, long actual) {
   printf("%s => ", title);
   if (expected == actual) {
@@ -44,5 +87,26 @@ int main(void) {
   expectf("many_dargs", 17.0, many_fargs(1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0));
 #endif
 
+  {
+    Point p = make_point(3, 4);
+    expect("struct return", 34, p.x * 10 + p.y);
+    expect("struct args", 39, point_dot(p, make_point(5, 6)));
+    Chars c = chars_rev((Chars){{'a', 'b', 'c'}});
+    expect("odd sized struct", 'c' * 10000 + 'b' * 100 + 'a', c.s[0] * 10000 + c.s[1] * 100 + c.s[2]);
+    Large l = large_add((Large){1, 2, 3}, (Large){10, 20, 30});
+    expect("large struct", 112233, l.a * 10000 + l.b * 100 + l.c);
+    expect("struct vaargs", 123456, sum_points(3, make_point(1, 2), make_point(3, 4), make_point(5, 6)));
+    expect("struct from gcc", 12345621, call_xcc_points());
+  }
+#ifndef __NO_FLONUM
+  {
+    Complex c = cmul((Complex){1, 2}, (Complex){3, 4});
+    expectf("sse struct", -5.0 * 100 + 10.0, c.re * 100 + c.im);
+    Mixed m = mixed_twice((Mixed){1.25, 21});
+    expectf("mixed struct", 44.5, m.d + m.l);
+    expectf("mixed struct from gcc", 111.75, call_xcc_mixed());
+  }
+#endif
+
   return 0;
 }
@@ -18,3 +18,73 @@ double many_fargs(double a, double b, double c, double d, double e, double f, do
   return h + i;
 }
 #endif
+
+// Structs passed and returned in registers.
+#include <stdarg.h>
+
+typedef struct { int x, y; } Point;
+typedef struct { char s[3]; } Chars;
+typedef struct { long a, b, c; } Large;
+
+Point make_point(int x, int y) {
+  Point p = {x, y};
+  return p;
+}
+
+int point_dot(Point a, Point b) {
+  return a.x * b.x + a.y * b.y;
+}
+
+Chars chars_rev(Chars c) {
+  Chars r = {{c.s[2], c.s[1], c.s[0]}};
+  return r;
+}
+
+Large large_add(Large a, Large b) {
+  Large r = {a.a + b.a, a.b + b.b, a.c + b.c};
+  return r;
+}
+
+long sum_points(int n, ...) {
+  va_list ap;
+  va_start(ap, n);
+  long sum = 0;
+  for (int i = 0; i < n; ++i) {
+    Point p = va_arg(ap, Point);
+    sum = sum * 100 + p.x * 10 + p.y;
+  }
+  va_end(ap);
+  return sum;
+}
+
+extern Point xcc_point_swap(Point p);
+extern long xcc_sum_points(int n, ...);
+
+long call_xcc_points(void) {
+  Point p = xcc_point_swap(make_point(1, 2));
+  return p.x * 10 + p.y + xcc_sum_points(3, make_point(1, 2), make_point(3, 4), make_point(5, 6)) * 100;
+}
+
+#ifndef __NO_FLONUM
+typedef struct { double re, im; } Complex;
+typedef struct { double d; long l; } Mixed;
+
+Complex cmul(Complex a, Complex b) {
+  Complex r = {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+  return r;
+}
+
+Mixed mixed_twice(Mixed m) {
+  m.d *= 2;
+  m.l *= 2;
+  return m;
+}
+
+extern Mixed xcc_mixed(long l, Mixed m, double d);
+
+double call_xcc_mixed(void) {
+  Mixed m = {1.5, 10};
+  Mixed r = xcc_mixed(100, m, 0.25);
+  return r.d + r.l;
+}
+#endif
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Compile a huge function to check the compile time does not go quadratic.
+
+XCC=${XCC:-../xcc}
+STATEMENTS=${STATEMENTS:-50000}
+
+gen_source() {
+  awk -v n="$1" 'BEGIN {
+    vars = 20
+    print "unsigned g(unsigned x) { return x >> 1; }"
+    print "unsigned f(unsigned *a) {"
+    for (v = 0; v < vars; ++v)
+      printf("  unsigned v%d = a[%d];\n", v, v % 16)
+    for (i = 0; i < n; ++i) {
+      d = i % vars
+      s = (i * 7 + 3) % vars
+      if (i % 50 == 49)
+        printf("  if (v%d & 1) v%d = g(v%d);\n", d, s, d)
+      else
+        printf("  v%d += v%d * %d ^ a[%d];\n", d, s, i % 97 + 1, i % 16)
+    }
+    printf("  return v0")
+    for (v = 1; v < vars; ++v)
+      printf(" + v%d", v)
+    print ";"
+    print "}"
+    print "int main(void) {"
+    print "  unsigned a[16];"
+    print "  for (int i = 0; i < 16; ++i) a[i] = i * 12345 + 1;"
+    print "  return f(a) == 0;"
+    print "}"
+  }'
+}
+
+echo -n "$STATEMENTS statements => "
+
+tmpfile=$(mktemp).c
+gen_source "$STATEMENTS" > "$tmpfile"
+
+TIMEFORMAT='%R'
+elapsed=$( { time $XCC "$tmpfile" > /dev/null 2>&1; } 2>&1 ) || {
+  echo "NG: compile failed"
+  exit 1
+}
+./a.out || {
+  echo "NG: run failed"
+  exit 1
+}
+rm -f "$tmpfile"
+echo "OK (${elapsed}s)"
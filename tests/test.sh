@@ -80,6 +80,210 @@ try_output() {
   try_output_direct "$1" "$2" "int main(){ $3\n return 0; }"
 }
 
+try_profile() {
+  local title="$1"
+  local expected="$2"
+  local input="$PROLOGUE\n$3"
+
+  echo -n "$title => "
+
+  local tmpfile
+  tmpfile=$(mktemp).c
+  local profile
+  profile=$(mktemp)
+  rm -f "$profile"
+  echo -e "$input" > "$tmpfile"
+  $XCC -fprofile-generate="$profile" "$tmpfile" || exit 1
+  $RUN_AOUT
+  $RUN_AOUT  # Counts are accumulated.
+  grep -q '^main [0-9]* 2 ' "$profile" || {
+    echo "NG: profile not generated"
+    exit 1
+  }
+  $XCC -fprofile-use="$profile" "$tmpfile" || exit 1
+  rm -f "$profile"
+
+  $RUN_AOUT
+  local actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "OK"
+  else
+    echo "NG: $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+# Assembly for a chain of jumps just on the limit of the short offset:
+# the last jump is long, and it makes all the preceding jumps long one by one.
+jump_chain() {
+  local n="$1"
+  local asm="chain:\\\\n xor %eax, %eax\\\\n"
+  for ((k = 0; k <= n; ++k)); do
+    asm+="J$k:\\\\n"
+    if [ "$k" = "$n" ]; then asm+=" jmp END\\\\n"; else asm+=" jmp T$k\\\\n"; fi
+    if [ "$k" -gt 0 ]; then asm+="T$((k - 1)):\\\\n add \$1, %eax\\\\n jmp J$k\\\\n"; fi
+    if [ "$k" = "$n" ]; then asm+=" .fill 200, 1, 0xcc\\\\n"; else asm+=" .fill 120, 1, 0xcc\\\\n"; fi
+  done
+  echo -n "${asm}END:\\\\n ret"
+}
+
+# Check the symbols in the executable: `expected` is a list of `type name` pairs as `nm` shows.
+try_symbols() {
+  local title="$1"
+  local expected="$2"
+  local input="$PROLOGUE\n$3"
+
+  echo -n "$title => "
+
+  if ! command -v nm > /dev/null; then
+    echo "SKIP"
+    return
+  fi
+
+  local tmpfile
+  tmpfile=$(mktemp).c
+  echo -e "$input" > "$tmpfile"
+  $XCC "$tmpfile" || exit 1
+
+  local symbols
+  symbols=$(nm a.out)
+  set -- $expected
+  while [ $# -ge 2 ]; do
+    echo "$symbols" | grep -q " $1 $2\$" || {
+      echo "NG: \`$1 $2' expected"
+      exit 1
+    }
+    shift 2
+  done
+
+  $XCC -s "$tmpfile" || exit 1
+  [ -n "$(nm a.out 2> /dev/null)" ] && {
+    echo "NG: not stripped"
+    exit 1
+  }
+  echo "OK"
+}
+
+# Compile each source into its own object, and link them.
+try_link() {
+  local title="$1"
+  local expected="$2"
+  shift 2
+
+  echo -n "$title => "
+
+  local objs=()
+  local src
+  for src in "$@"; do
+    local tmpfile
+    tmpfile=$(mktemp).c
+    echo -e "$PROLOGUE\n$src" > "$tmpfile"
+    $XCC -c -o "$tmpfile.o" "$tmpfile" || exit 1
+    objs+=("$tmpfile.o")
+  done
+  $XCC "${objs[@]}" || exit 1
+
+  $RUN_AOUT
+  local actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "OK"
+  else
+    echo "NG: $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+# Check the relocation sections in the object: `relocs` is a list of `section count` pairs.
+try_relocs() {
+  local title="$1"
+  local expected="$2"
+  local relocs="$3"
+  local input="$PROLOGUE\n$4"
+
+  echo -n "$title => "
+
+  if ! command -v readelf > /dev/null; then
+    echo "SKIP"
+    return
+  fi
+
+  local tmpfile
+  tmpfile=$(mktemp).c
+  echo -e "$input" > "$tmpfile"
+  $XCC -c -o "$tmpfile.o" "$tmpfile" || exit 1
+
+  local sections
+  sections=$(readelf -rW "$tmpfile.o")
+  set -- $relocs
+  while [ $# -ge 2 ]; do
+    echo "$sections" | grep -q "^Relocation section '$1' at offset 0x[0-9a-f]* contains $2 entr" || {
+      echo "NG: $2 relocations in \`$1' expected"
+      exit 1
+    }
+    shift 2
+  done
+
+  $XCC "$tmpfile.o" || exit 1
+  $RUN_AOUT
+  local actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "OK"
+  else
+    echo "NG: $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+# Check the source line of `main' in the line number information.
+try_debug_line() {
+  local title="$1"
+  local expected="$2"
+  local input="$3"
+
+  echo -n "$title => "
+
+  if ! command -v addr2line > /dev/null || ! command -v nm > /dev/null; then
+    echo "SKIP"
+    return
+  fi
+
+  local tmpfile
+  tmpfile=$(mktemp).c
+  echo -e "$input" > "$tmpfile"
+  $XCC -g "$tmpfile" || exit 1
+
+  local actual
+  actual=$(addr2line -e a.out "$(nm a.out | awk '$3 == "main" {print $1}')")
+  [ "$actual" = "$tmpfile:$expected" ] || {
+    echo "NG: $expected expected, but got $actual"
+    exit 1
+  }
+  echo "OK"
+}
+
+# Check that the generated assembly does not contain `pattern`.
+try_no_asm() {
+  local title="$1"
+  local pattern="$2"
+  local input="$3"
+
+  echo -n "$title => "
+
+  local tmpfile
+  tmpfile=$(mktemp).c
+  echo -e "$input" > "$tmpfile"
+  $XCC -S -o "$tmpfile.s" "$tmpfile" || exit 1
+
+  grep -q "$pattern" "$tmpfile.s" && {
+    echo "NG: \`$pattern' unexpected"
+    exit 1
+  }
+  echo "OK"
+}
+
 compile_error() {
   local title="$1"
   local input="$PROLOGUE\n$2"
@@ -210,6 +414,9 @@ try 'post-dec ()' 44 'int x = 44; return (x)--;'
 try_direct 'return struct' 46 'typedef struct { int x; int y; } S; S func(void) { S s = {.x = 12, .y = 34}; return s; } int main(){ S s = func(); return s.x + s.y; }'
 try_direct 'return struct not broken' 222 'typedef struct {long x; long y;} S; S sub(){S s={111, 222}; return s;} int main(){int dummy[1]; S s; s = sub(); return s.y;}'
 try_direct 'return struct member' 57 'typedef struct {int x;} S; S func() {return (S){57};} int main(){return func().x;}'
+try_direct 'return odd sized struct' 238 'typedef struct {unsigned char c[7];} S; S func(unsigned char x) {S s = {{1, 2, 3, 4, 5, 6, x}}; return s;} int main(){S s = func(225); return s.c[0] + s.c[5] + s.c[6] + s.c[6 - s.c[0]];}'
+try_direct 'return mixed struct' 23 'typedef struct {double d; int i;} S; S func(S s) {s.d *= 2; s.i += 3; return s;} int main(){S s = func((S){5.5, 9}); return s.d + s.i;}'
+try_direct 'struct args exceed regs' 123 'typedef struct {long a, b;} S; long f(long x, long y, S s, S t, S u) {return x + y + s.a * 10 + s.b + t.a + t.b + u.a + u.b;} int main(){S s = {9, 8}, t = {7, 6}, u = {5, 4}; return f(1, 2, s, t, u);}'
 try_direct 'modify arg' 32 'int sub(int x, int y) {return x+y;} int main() {int w=0, x=0, y=5; int z=sub(++x, y+=10); return x+y+z+w;}'
 try_direct 'long immediate' 240 'int sub(unsigned long x){return x;} int main(){ return sub(0x123456789abcdef0); }'
 try 'can assign const ptr' 97 'const char *p = "foo"; p = "bar"; return p[1];'
@@ -219,7 +426,26 @@ try 'condition with comma expr' 0 'int x = 1; x != 0 && (x = 0, 1); return x;'
 try_direct 'return str' 111 'const char *foo(){ return "foo"; } int main(){ return foo()[2]; }'
 try 'deref str' 48 'return *"0";'
 try_direct 'inline' 93 'inline int f(){return 93;} int main(){return f();}'
+try_direct 'jump relaxation' 100 "int chain(void); void dummy(void) { __asm(\"$(jump_chain 100)\"); } int main(){ return chain(); }"
 try 'data-bss alignment' 0 'static char data = 123; static int bss; return (long)&bss & 3;'
+try_direct 'sparse data' 13 'struct S {char c; long l; short s[3];}; struct S a[] = {[2] = {1, 2, {3}}, [1000] = {.s = {0, 0, 4}}}; char s[8] = "ab\\0"; double d[3] = {[1] = 5.0}; int main(){ return a[2].c + a[2].l + a[2].s[0] + a[1000].s[2] + sizeof(a) / sizeof(*a) - 1001 + s[1] - s[2] - s[7] - (int)(d[0] + d[2]) + (int)d[1] - 100; }'
+try_direct 'data directives' 27 'extern unsigned char tbl[]; int main(){ __asm(".data\\ntbl:\\n .byte 1, 2, 3\\n .fill 2, 2, 0x104\\n .zero 2\\n .skip 1, 9\\n .quad 7, tbl\\n .text"); unsigned char *p = tbl; return p[0] + p[2] + p[3] + p[4] + p[6] + p[7] + p[8] + p[9] + p[10] + p[11] + (*(unsigned char**)(p + 18) == p); }'
+incbin=$(mktemp)
+echo -n '0123456789' > "$incbin"
+try_direct 'incbin' 29 "extern unsigned char bin_a[], bin_b[], bin_c[], bin_d[]; int main(){ __asm(\".data\\\\nbin_a:\\\\n .incbin \\\\\"$incbin\\\\\"\\\\nbin_b:\\\\n .incbin \\\\\"$incbin\\\\\", 3\\\\nbin_c:\\\\n .incbin \\\\\"$incbin\\\\\", 2, 4\\\\nbin_d:\\\\n .text\"); return (bin_b - bin_a) + (bin_c - bin_b) + (bin_d - bin_c) + (bin_b[0] - '0') + (bin_c[3] - '0'); }"
+rm -f "$incbin"
+try_symbols 'symbols' 't helper b counter D table T main' 'static int counter; static int helper(int x){return x*2;} int table[4]={1,2,3,4}; int main(){counter=helper(3); return counter+table[1]-8;}'
+try_debug_line 'debug line' 3 '#include <stdio.h>\nstatic int sq(int x) {return x * x;}\nint main(void) {\n  printf("%d\\n", sq(3));\n  return 0;\n}'
+try_debug_line 'debug line with decl' 2 '#include <stdio.h>\nint main(void)\n{\n  int x = 3;\n  printf("%d\\n", x);\n  return 0;\n}'
+try_no_asm 'no speculative volatile read' 'cmov' 'volatile int vv; int f(int a, int b){int x = 0; if (a < b) x = vv; return x;} int g(int a, int b){return a < b ? vv : 0;}'
+XCC="$XCC -ffunction-sections" try_direct 'function sections' 16 'static int sq(int x){return x*x;} int sw(int x){switch(x){case 0:return 1;case 1:return 5;case 2:return 7;case 3:return 9;case 4:return 2;default:return 0;}} int main(){return sq(3)+sw(2);}'
+try_link 'merge named section' 16 \
+  'extern int sec_a[], sec_b[]; void dummy_a(void) { __asm(".section mysec,\\"aw\\"\\n .p2align 2\\nsec_a:\\n .long 1, 2\\n .text"); } int main(){ return (sec_b == sec_a + 2) * 10 + sec_a[0] + sec_a[1] + sec_b[0]; }' \
+  'void dummy_b(void) { __asm(".section mysec,\\"aw\\"\\n .p2align 2\\n .globl sec_b\\nsec_b:\\n .long 3\\n .text"); }'
+try_direct 'pushsection' 42 'int pushed(void); void dummy(void) { __asm(".globl pushed\\npushed:\\n .pushsection mysec,\\"aw\\"\\nval:\\n .long 42\\n .popsection\\n mov val(%rip), %eax\\n ret"); } int main(){ return pushed(); }'
+try_relocs 'named section relocations' 79 '.rela.text 3 .relamysec 2' 'extern int *ptrs[]; int get(void); void dummy(void) { __asm(".section mysec,\\"aw\\"\\n .p2align 3\\n .globl ptrs\\nptrs:\\n .quad target, target + 4\\n .section other,\\"a\\"\\n .p2align 2\\ntarget:\\n .long 5, 37\\n .text\\n .globl get\\nget:\\n mov target+4(%rip), %eax\\n ret"); } int main(){ return *ptrs[0] + *ptrs[1] + get(); }'
+XCC="$XCC -falign-functions=64" try_direct 'align functions' 0 'int sub(void){return 1;} int main(){return (long)sub % 64;}'
+XCC="$XCC -falign-loops=32" try_direct 'align loops' 30 'int main(){int s=0; for(int i=0;i<10;++i){int j=i; while(j-->0) s+=j&1;} for(int i=0;i<20;++i) s+=i&1; return s;}'
 
 try_direct 'stdarg' 55 "#include <stdarg.h>
 int f(int n, ...) {int a[14*2]; for (int i=0; i<14*2; ++i) a[i]=100+i; va_list ap; va_start(ap, n); int sum=0; for (int i=0; i<n; ++i) sum+=va_arg(ap, int); va_end(ap); return sum;}
@@ -227,6 +453,8 @@ int main(){return f(10, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10);}"
 
 try_direct 'unicode' 121 "int 漢字(int χ) {return χ * χ;} int main(void){return 漢字(11);}"
 
+try_profile 'profile-guided' 123 'int f(int c){switch(c){case 0:return 1;case 1:return 2;case 2:return 3;case 5:return 4;default:return 0;}} int cold(int x){return x*2;} int main(){int s=0; for(int i=0;i<100;++i) s+=f(i%10==0?i%3:5); if(s<0) s=cold(s); return s&255;}'
+
 # error cases
 echo ''
 echo '### Error cases'
@@ -32,6 +32,7 @@ int g_init = (8 * 7 + 100 / 4 - 50 % 3) & 0x5a | 0x100;
 void *null = (void*)0;
 
 struct {int x; int *p;} g_struct = { 42, &g_zero };
+short g_shorts[] = {1, 2, 3, 4, 5};
 
 static int s_val = 456;
 
@@ -56,6 +57,20 @@ int apply(int (*f)(int, int), int x, int y) {
   return f(x, y);
 }
 
+long mix8(long a, long b, long c, long d, long e, long f, long g, long h) {
+  return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+long tail_sum(long n, long acc) {
+  if (n <= 0)
+    return acc;
+  return tail_sum(n - 1, acc + n);
+}
+
+long tail_swap(long a, long b, long c, long d, long e, long f, long g, long h) {
+  return mix8(b, a, c, d, e, f, h, g);
+}
+
 int array_from_ptr1(int a[]) {
   return a[0];
 }
@@ -89,6 +104,73 @@ int static_local(void) {
   return ++x;
 }
 
+int loop_scale = 3;
+void inc_loop_scale(void) {
+  ++loop_scale;
+}
+
+int jump_chain(int x) {
+  if (x < 0) {
+  cycle1:
+    goto cycle2;
+  cycle2:
+    goto cycle1;
+  }
+  goto chain1;
+chain1:
+  goto chain2;
+chain2:
+  if (x > 100)
+    goto chain1;
+  {}
+  goto chain3;
+chain3:
+  return x + 1;
+}
+
+int cold_div(int x, int y) {
+  if (y == 0)
+    exit(1);
+  return x / y;
+}
+
+// Leaf functions keep their frame below the stack pointer, in the red zone.
+int redzone_small(int n) {
+  int a[4];
+  a[0] = n;
+  a[1] = n * 2;
+  a[2] = a[0] + a[1];
+  a[3] = a[2] * 2;
+  return a[0] + a[1] + a[2] + a[3];
+}
+
+int redzone_index(int n, int k) {
+  char buf[16];
+  for (int i = 0; i < 16; ++i)
+    buf[i] = n + i;
+  return buf[k & 15];
+}
+
+// Frame is larger than the red zone.
+long redzone_large(int n) {
+  long a[32];
+  for (int i = 0; i < 32; ++i)
+    a[i] = n + i;
+  long s = 0;
+  for (int i = 31; i >= 0; --i)
+    s = s * 3 + a[i];
+  return s;
+}
+
+// Call needs the frame pointer.
+int redzone_call(int n) {
+  int a[4];
+  for (int i = 0; i < 4; ++i)
+    a[i] = n + i;
+  int r = sqsub(a[1], a[0]);
+  return r + a[2] + a[3];
+}
+
 int main(void) {
   int x, y;
   expect("zero", 0, 0);
@@ -132,6 +214,22 @@ int main(void) {
     unsigned int x = 0x80000000U;
     expect("unsigned modulo", 80, x % 123);
   }
+  {
+    int x = -1234567;
+    unsigned int u = 3000000000U;
+    long l = -98765432109L;
+    expect("mul by const", -12345670, x * 10);
+    expect("mul by negative const", 8641969, x * -7);
+    expect("div by power of 2", -154320, x / 8);
+    expect("mod by power of 2", -7, x % 8);
+    expect("div by const", -176366, x / 7);
+    expect("mod by const", -5, x % 7);
+    expect("div by negative const", 123456, x / -10);
+    expect("unsigned div by const", 428571428, u / 7);
+    expect("unsigned mod by const", 4, u % 7);
+    expect("long div by const", -3292181070L, l / 30);
+    expect("long mod by const", -9, l % 30);
+  }
   {
     int a = 3;
     int b = 5 * 6 - 8;
@@ -264,6 +362,9 @@ int main(void) {
 
   expect("funcall", 23, foo() - 100);
   expect("func var", 9, sqsub(5, 4));
+  expect("self tail call", 500000500000L, tail_sum(1000000, 0));
+  expect("sibling tail call", 202, tail_swap(1, 2, 3, 4, 5, 6, 7, 8));
+  expect("nested funcall args", 28 + 36 * 8, mix8(1, 1, 1, 1, 1, 1, 1, mix8(sub(2, 1), 1, 1, 1, 1, 1, 1, 1)));
   {
     int x = 0;
     if (1)
@@ -292,6 +393,33 @@ int main(void) {
       x = 3;
     expect("if else-false", 3, x);
   }
+  {
+    int x = 0, y = 5, c;
+    c = x < y;
+    if (c)
+      x = y;
+    expect("if with condition value", 6, x + c);
+  }
+  {
+    int x = 3, y = 8;
+    long l = -1;
+    unsigned u = 1;
+    expect("select min", 3, x < y ? x : y);
+    expect("select max", 8, x < y ? y : x);
+    expect("select with cast", -1, x > y ? x : l);
+    expect("select unsigned", 0, u > -1 ? 1 : 0);
+    expect("select const", 22, x == 3 ? 22 : 33);
+    if (x > y)
+      x = y;
+    else
+      x = y + 1;
+    expect("if select", 9, x);
+    if (x != 9)
+      x = 0;
+    expect("if select no else", 9, x);
+    expect("&& value", 1, x == 9 && y == 8);
+    expect("|| value", 0, x != 9 || y < 8);
+  }
   {
     int a = 0, b = 0;
     if (1) {
@@ -322,6 +450,41 @@ int main(void) {
       acc += i;
     expect("for", 55, acc);
   }
+  {
+    int i = 0, acc = 0;
+    while (i < 10) {
+      if (i == 3) {
+        ++i;
+        continue;
+      }
+      acc += i++;
+    }
+    expect("rotated loop", 42, acc);
+  }
+  {
+    int n = 0;
+    for (int i = 0; i < 5; ++i) {
+      for (int j = i; j < 5; ++j) {
+        if (j == 4)
+          break;
+        ++n;
+      }
+    }
+    for (int i = 10; i < 5; ++i)
+      n += 100;
+    expect("rotated nested loop", 10, n);
+  }
+  {
+    int acc = 0;
+    for (int i = 1; i <= 4; ++i)
+      acc += cold_div(100, i);
+    expect("cold block", 208, acc);
+  }
+  expect("jump chain", 78, jump_chain(77));
+  expect("red zone", 60, redzone_small(5));
+  expect("red zone index", 13, redzone_index(10, 35));
+  expect("red zone large", 30111578068842416L, redzone_large(2));
+  expect("red zone call", 30, redzone_call(6));
   {
     int x = 0;
     switch (1) {
@@ -366,6 +529,63 @@ int main(void) {
     }
     expect("switch fallthrough", 11, x);
   }
+  {
+    static const char s[] = "a1 +(_\tz9\"-]x";
+    int x = 0;
+    for (const char *p = s; *p != '\0'; ++p) {
+      switch (*p) {
+      case ' ': case '\t': case '\n': x += 1; break;
+      case '0': case '1': case '2': case '3': case '4':
+      case '5': case '6': case '7': case '8': case '9': x += 10; break;
+      case '+': case '-': case '*': case '/': case '%': x += 100; break;
+      case '(': case ')': case '[': case ']': x += 1000; break;
+      case '"': x += 10000; break;
+      case '_': x += 100000; break;
+      case -1: x = -1; break;
+      default: x += 1000000; break;
+      }
+    }
+    expect("switch clusters", 3112222, x);
+  }
+  {
+    static const int xs[] = {0, 1, 5, 0xfffffff0, 7, 100, 1000, 0x80000000, 0x90000000};
+    int x = 0;
+    for (int i = 0; i < 9; ++i) {
+      int r;
+      switch ((unsigned)xs[i]) {
+      case 1: r = 1; break;
+      case 5: r = 2; break;
+      case 7: r = 3; break;
+      case 100: r = 4; break;
+      case 1000: r = 5; break;
+      case 0x80000000u: r = 6; break;
+      case 0x90000000u: r = 7; break;
+      case 0xfffffff0u: r = 8; break;
+      default: r = 0; break;
+      }
+      x = x * 10 + r;
+    }
+    expect("switch unsigned", 12834567, x);
+  }
+  {
+    static const unsigned long xs[] = {3, 0xfffffffffffffff0UL, 2, 0x8000000000000000UL, 4, 1, 100};
+    int x = 0;
+    for (int i = 0; i < 7; ++i) {
+      int r;
+      switch (xs[i]) {
+      case 1: r = 1; break;
+      case 2: r = 2; break;
+      case 3: r = 3; break;
+      case 100: r = 4; break;
+      case 0x8000000000000000UL: r = 5; break;
+      case 0xfffffffffffffff0UL: r = 6; break;
+      case 0xfffffffffffffff8UL: r = 7; break;
+      default: r = 0; break;
+      }
+      x = x * 10 + r;
+    }
+    expect("switch unsigned long", 3625014, x);
+  }
   {
     int x = 10, *p = &x;
     ++(*p);
@@ -587,6 +807,75 @@ int main(void) {
     a[1] = 55;
     expect("ptr <- array", 55, ptr_from_array(a));
   }
+  {
+    struct {char c; long l; short s;} a[4];
+    for (int i = 0; i < 4; ++i) {
+      a[i].c = i;
+      a[i].l = i * 100;
+      a[i].s = -i;
+    }
+    long i = 2;
+    expect("struct array member", 198, a[i].l + a[i + 1].c + a[i - 1].s * 5);
+  }
+  {
+    long a[8];
+    for (int i = 0; i < 8; ++i)
+      a[i] = i * i;
+    long *p = a;
+    long i = 3;
+    expect("scaled index with offset", 25, p[i + 2]);
+    expect("scaled index with neg offset", 4, *(p + i - 1));
+  }
+  {
+    int a[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    int acc = 0;
+    for (int i = 0; i < 10; ++i)
+      acc += a[i] * loop_scale;
+    expect("loop invariant global", 165, acc);
+    acc = 0;
+    for (int i = 0; i < 10; ++i) {
+      acc += a[i] * loop_scale;
+      if (i == 4)
+        inc_loop_scale();
+    }
+    loop_scale = 3;
+    expect("loop global modified by call", 205, acc);
+    long j = 0;
+    acc = 0;
+    while (j < 10) {
+      acc += a[j];
+      j += 2;
+    }
+    expect("induction step 2", 25, acc);
+    acc = 0;
+    for (int i = 9; i >= 0; --i)
+      acc = acc * 2 + a[i] % 2;
+    expect("induction countdown", 341, acc);
+    int m[3][4];
+    for (int i = 0; i < 3; ++i)
+      for (unsigned int k = 0; k < 4; ++k)
+        m[i][k] = i * 4 + k;
+    acc = 0;
+    for (int i = 0; i < 3; ++i)
+      for (int k = 0; k < 4; ++k)
+        acc += m[i][k] * (k + 1);
+    expect("nested loop", 180, acc);
+    int p = 1, q = 2, r = 3, s = 4, t = 5;
+    for (int i = 0; i < 4; ++i) {
+      inc_loop_scale();
+      p += q; q += r; r += s; s += t; t += i;
+    }
+    expect("values across calls", 488, p + q * 2 + r * 3 + s * 4 + t * 5 + loop_scale);
+    loop_scale = 3;
+  }
+  {
+    int i = 1;
+    g_shorts[i + 2] = 44;
+    expect("global array with index", 47, g_shorts[3] + g_shorts[2]);
+    g_struct.x = 43;
+    expect("global struct member", 43, g_struct.x);
+    g_struct.x = 42;
+  }
   expect("sizeof(int)", 4, sizeof(int));
   expect("sizeof(long)", LONG_SIZE, sizeof(long));
   expect("sizeof(array)", 3, sizeof(char [3]));
@@ -632,6 +921,32 @@ int main(void) {
     struct {int x; int y;} s = {.y = 9};
     expect("struct initializer with member", 9, s.x + s.y);
   }
+  {
+    struct {char a[13];} s = {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13}}, t;
+    t = s;
+    expect("struct copy odd size", 13 + 9 + 5, t.a[12] + t.a[8] + t.a[4]);
+  }
+  {
+    struct {long a[5];} s = {{1, 2, 3, 4, 5}}, t;
+    t = s;
+    expect("struct copy medium size", 5 + 4 + 1, t.a[4] + t.a[3] + t.a[0]);
+  }
+  {
+    struct {char a[300];} s, t;
+    for (int i = 0; i < 300; ++i)
+      s.a[i] = i;
+    t = s;
+    expect("struct copy large size", 299 % 256 + 150 % 256 + 1, (unsigned char)t.a[299] + (unsigned char)t.a[150] + t.a[1]);
+  }
+  {
+    char a[40] = {1}, b[300] = {2};
+    int sum = 0;
+    for (int i = 1; i < 40; ++i)
+      sum += a[i];
+    for (int i = 1; i < 300; ++i)
+      sum += b[i];
+    expect("array clear", 3, sum + a[0] + b[0]);
+  }
   {
     union {char x; int y;} u = {0x1234};
     expect("union initializer", 0x34, u.x);